@@ -29,7 +29,7 @@ DokanOpenRequestorToken(PDOKAN_FILE_INFO FileInfo)
 	PDOKAN_INSTANCE		instance;
 	PDOKAN_OPEN_INFO	openInfo;
 	PEVENT_CONTEXT		eventContext;
-	PEVENT_INFORMATION	eventInfo;
+	EVENT_INFORMATION	eventInfo;
 	HANDLE				handle = INVALID_HANDLE_VALUE;
 	ULONG				eventInfoSize;
 	
@@ -53,24 +53,22 @@ DokanOpenRequestorToken(PDOKAN_FILE_INFO FileInfo)
 	}
 
 	eventInfoSize = sizeof(EVENT_INFORMATION);
-	eventInfo = (PEVENT_INFORMATION)malloc(eventInfoSize);
-	RtlZeroMemory(eventInfo, eventInfoSize);
+	RtlZeroMemory(&eventInfo, eventInfoSize);
 
-	eventInfo->SerialNumber = eventContext->SerialNumber;
+	eventInfo.SerialNumber = eventContext->SerialNumber;
 
 	status = SendToDevice(
 				GetRawDeviceName(instance->DeviceName),
 				IOCTL_GET_ACCESS_TOKEN,
-				eventInfo,
+				&eventInfo,
 				eventInfoSize,
-				eventInfo,
+				&eventInfo,
 				eventInfoSize,
 				&returnedLength);
 	if (status) {
-		handle = eventInfo->AccessToken.Handle;
+		handle = eventInfo.AccessToken.Handle;
 	} else {
 		DbgPrintW(L"IOCTL_GET_ACCESS_TOKEN failed\n");
 	}
-	free(eventInfo);
 	return handle;
 }
\ No newline at end of file
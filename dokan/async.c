@@ -0,0 +1,192 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2008 Hiroki Asakawa info@dokan-dev.net
+
+  http://dokan-dev.net/en
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "dokani.h"
+#include "fileinfo.h"
+
+
+/*
+
+DOKAN_OPTION_ASYNC
+
+DispatchRead/DispatchWrite
+  BeginIoOperation
+    # copy EVENT_CONTEXT to DOKAN_IO_OPERATION on heap
+  ReadFile/WriteFile
+    # returns ERROR_IO_PENDING, keeps DokanFileInfo
+  # return to DokanLoop without reply
+
+DokanCompleteOperation (any thread)
+  CompleteRead/CompleteWrite
+    # send reply through CompletionChannel
+  EndIoOperation
+
+*/
+
+
+PDOKAN_IO_OPERATION
+BeginIoOperation(
+	PDOKAN_IO_OPERATION	SyncOperation,
+	PEVENT_CONTEXT		EventContext,
+	PDOKAN_INSTANCE		DokanInstance)
+{
+	PDOKAN_IO_OPERATION	operation = SyncOperation;
+
+	if (DokanInstance->DokanOptions->Options & DOKAN_OPTION_ASYNC) {
+		// EventContext is the buffer of DokanLoop, which is reused
+		// as soon as the dispatch routine returns
+		operation = (PDOKAN_IO_OPERATION)malloc(sizeof(DOKAN_IO_OPERATION));
+		if (operation != NULL) {
+			ZeroMemory(operation, sizeof(DOKAN_IO_OPERATION));
+			operation->EventContext = (PEVENT_CONTEXT)malloc(EventContext->Length);
+			if (operation->EventContext == NULL) {
+				free(operation);
+				operation = NULL;
+			}
+		}
+		if (operation != NULL) {
+			CopyMemory(operation->EventContext, EventContext, EventContext->Length);
+			operation->ContextAllocated = TRUE;
+			operation->Asynchronous = TRUE;
+			operation->DokanInstance = DokanInstance;
+			InterlockedIncrement(&DokanInstance->PendingOperationCount);
+			return operation;
+		}
+		DbgPrint("Dokan Error: can't allocate operation, run synchronously\n");
+		operation = SyncOperation;
+	}
+
+	ZeroMemory(operation, sizeof(DOKAN_IO_OPERATION));
+	operation->EventContext = EventContext;
+	operation->DokanInstance = DokanInstance;
+	return operation;
+}
+
+
+static VOID
+ReleaseIoOperations(
+	PDOKAN_INSTANCE	DokanInstance)
+{
+	if (InterlockedDecrement(&DokanInstance->PendingOperationCount) == 0) {
+		SetEvent(DokanInstance->OperationsDone);
+	}
+}
+
+
+VOID
+EndIoOperation(
+	PDOKAN_IO_OPERATION	Operation)
+{
+	PDOKAN_INSTANCE	instance = Operation->DokanInstance;
+
+	if (Operation->ContextAllocated) {
+		// DokanResetTimeout must not see the freed EVENT_CONTEXT
+		if (Operation->OpenInfo != NULL) {
+			InterlockedCompareExchangePointer(
+				(PVOID*)&Operation->OpenInfo->EventContext, NULL, Operation->EventContext);
+		}
+		free(Operation->EventContext);
+	}
+	FreeEventInformation(Operation->EventInfo);
+	if (Operation->Asynchronous) {
+		free(Operation);
+		ReleaseIoOperations(instance);
+	}
+}
+
+
+static HANDLE
+GetCompletionChannel(
+	PDOKAN_INSTANCE	DokanInstance)
+{
+	HANDLE	channel = DokanInstance->CompletionChannel;
+
+	if (channel == NULL) {
+		channel = DokanInstance->Transport->OpenChannel(DokanInstance);
+		if (channel == INVALID_HANDLE_VALUE) {
+			return INVALID_HANDLE_VALUE;
+		}
+		if (InterlockedCompareExchangePointer(
+				&DokanInstance->CompletionChannel, channel, NULL) != NULL) {
+			// another thread opened it first
+			DokanInstance->Transport->CloseChannel(channel);
+			channel = DokanInstance->CompletionChannel;
+		}
+	}
+	return channel;
+}
+
+
+VOID
+WaitIoOperations(
+	PDOKAN_INSTANCE	DokanInstance)
+{
+	// drop the count held by the instance, DokanLoop threads have stopped
+	// and no operation begins any more
+	if (DokanInstance->PendingOperationCount > 1) {
+		DbgPrint("waiting for %d pending operations\n",
+			DokanInstance->PendingOperationCount - 1);
+	}
+	ReleaseIoOperations(DokanInstance);
+	WaitForSingleObject(DokanInstance->OperationsDone, INFINITE);
+
+	if (DokanInstance->CompletionChannel != NULL) {
+		DokanInstance->Transport->CloseChannel(DokanInstance->CompletionChannel);
+		DokanInstance->CompletionChannel = NULL;
+	}
+}
+
+
+VOID DOKANAPI
+DokanCompleteOperation(
+	PDOKAN_FILE_INFO	DokanFileInfo,
+	int					Status,
+	DWORD				Length)
+{
+	PDOKAN_IO_OPERATION	operation;
+	HANDLE				channel;
+
+	operation = CONTAINING_RECORD(DokanFileInfo, DOKAN_IO_OPERATION, FileInfo);
+	operation->Length = Length;
+
+	channel = GetCompletionChannel(operation->DokanInstance);
+	if (channel == INVALID_HANDLE_VALUE) {
+		// the IRP is released by the timeout of the driver
+		DbgPrint("Dokan Error: no channel to complete the operation\n");
+		EndIoOperation(operation);
+		return;
+	}
+
+	switch (operation->EventContext->MajorFunction) {
+	case IRP_MJ_READ:
+		CompleteRead(channel, operation, Status);
+		break;
+	case IRP_MJ_WRITE:
+		CompleteWrite(channel, operation, Status);
+		break;
+	default:
+		DbgPrint("Dokan Error: unexpected operation %d\n",
+			operation->EventContext->MajorFunction);
+		break;
+	}
+
+	EndIoOperation(operation);
+}
@@ -0,0 +1,179 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2008 Hiroki Asakawa info@dokan-dev.net
+
+  http://dokan-dev.net/en
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "dokani.h"
+
+
+// EVENT_INFORMATION buffers are rounded up to a power of two from
+// 512 bytes to 1MB and each thread keeps one free buffer of each size.
+// Bigger buffers are not cached.
+#define EVENT_INFO_MIN_SHIFT	9
+#define EVENT_INFO_CLASS_COUNT	12
+
+
+typedef struct _EVENT_INFO_BUFFER {
+	// EVENT_INFO_CLASS_COUNT when the buffer is not cached
+	ULONG	SizeClass;
+	ULONG	Reserved;
+	// EVENT_INFORMATION has ULONG64 field
+	ULONG64	EventInfo[1];
+} EVENT_INFO_BUFFER, *PEVENT_INFO_BUFFER;
+
+
+typedef struct _EVENT_INFO_CACHE {
+	PEVENT_INFO_BUFFER	Free[EVENT_INFO_CLASS_COUNT];
+} EVENT_INFO_CACHE, *PEVENT_INFO_CACHE;
+
+
+static DWORD	g_EventInfoCacheIndex = TLS_OUT_OF_INDEXES;
+
+
+static ULONG
+GetSizeClass(
+	ULONG	Length)
+{
+	ULONG	sizeClass = 0;
+	ULONG	size = 1 << EVENT_INFO_MIN_SHIFT;
+
+	while (size < Length && sizeClass < EVENT_INFO_CLASS_COUNT) {
+		size <<= 1;
+		sizeClass++;
+	}
+	return sizeClass;
+}
+
+
+PEVENT_INFORMATION
+AllocateEventInformation(
+	ULONG	Length)
+{
+	PEVENT_INFO_BUFFER	buffer = NULL;
+	PEVENT_INFO_CACHE	cache = NULL;
+	ULONG				sizeClass = GetSizeClass(Length);
+
+	if (Length < sizeof(EVENT_INFORMATION)) {
+		Length = sizeof(EVENT_INFORMATION);
+	}
+
+	if (sizeClass < EVENT_INFO_CLASS_COUNT) {
+		if (g_EventInfoCacheIndex != TLS_OUT_OF_INDEXES) {
+			cache = (PEVENT_INFO_CACHE)TlsGetValue(g_EventInfoCacheIndex);
+		}
+		if (cache != NULL && cache->Free[sizeClass] != NULL) {
+			buffer = cache->Free[sizeClass];
+			cache->Free[sizeClass] = NULL;
+		} else {
+			buffer = (PEVENT_INFO_BUFFER)malloc(
+				FIELD_OFFSET(EVENT_INFO_BUFFER, EventInfo) +
+				(1 << (sizeClass + EVENT_INFO_MIN_SHIFT)));
+		}
+	} else {
+		buffer = (PEVENT_INFO_BUFFER)malloc(
+			FIELD_OFFSET(EVENT_INFO_BUFFER, EventInfo) + Length);
+	}
+
+	if (buffer == NULL) {
+		DbgPrint("Dokan Error: can't allocate EVENT_INFORMATION %d\n", Length);
+		return NULL;
+	}
+	buffer->SizeClass = sizeClass;
+
+	// Buffer is not cleared, what is sent back to the driver
+	// must be written by the caller
+	ZeroMemory(buffer->EventInfo, sizeof(EVENT_INFORMATION));
+	return (PEVENT_INFORMATION)buffer->EventInfo;
+}
+
+
+VOID
+FreeEventInformation(
+	PEVENT_INFORMATION	EventInfo)
+{
+	PEVENT_INFO_BUFFER	buffer;
+	PEVENT_INFO_CACHE	cache = NULL;
+
+	if (EventInfo == NULL) {
+		return;
+	}
+	buffer = CONTAINING_RECORD(EventInfo, EVENT_INFO_BUFFER, EventInfo);
+
+	if (buffer->SizeClass < EVENT_INFO_CLASS_COUNT &&
+		g_EventInfoCacheIndex != TLS_OUT_OF_INDEXES) {
+
+		cache = (PEVENT_INFO_CACHE)TlsGetValue(g_EventInfoCacheIndex);
+		if (cache == NULL) {
+			cache = (PEVENT_INFO_CACHE)malloc(sizeof(EVENT_INFO_CACHE));
+			if (cache != NULL) {
+				ZeroMemory(cache, sizeof(EVENT_INFO_CACHE));
+				TlsSetValue(g_EventInfoCacheIndex, cache);
+			}
+		}
+		if (cache != NULL && cache->Free[buffer->SizeClass] == NULL) {
+			cache->Free[buffer->SizeClass] = buffer;
+			return;
+		}
+	}
+	free(buffer);
+}
+
+
+VOID
+InitializeEventInformationCache()
+{
+	g_EventInfoCacheIndex = TlsAlloc();
+}
+
+
+// called when a thread exits
+VOID
+ReleaseEventInformationCache()
+{
+	PEVENT_INFO_CACHE	cache;
+	ULONG				i;
+
+	if (g_EventInfoCacheIndex == TLS_OUT_OF_INDEXES) {
+		return;
+	}
+
+	cache = (PEVENT_INFO_CACHE)TlsGetValue(g_EventInfoCacheIndex);
+	if (cache == NULL) {
+		return;
+	}
+
+	for (i = 0; i < EVENT_INFO_CLASS_COUNT; ++i) {
+		if (cache->Free[i] != NULL) {
+			free(cache->Free[i]);
+		}
+	}
+	free(cache);
+	TlsSetValue(g_EventInfoCacheIndex, NULL);
+}
+
+
+VOID
+DeleteEventInformationCache()
+{
+	if (g_EventInfoCacheIndex != TLS_OUT_OF_INDEXES) {
+		ReleaseEventInformationCache();
+		TlsFree(g_EventInfoCacheIndex);
+		g_EventInfoCacheIndex = TLS_OUT_OF_INDEXES;
+	}
+}
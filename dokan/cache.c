@@ -0,0 +1,703 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2008 Hiroki Asakawa info@dokan-dev.net
+
+  http://dokan-dev.net/en
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "dokani.h"
+
+
+/*
+
+Metadata cache
+
+  Results of GetFileInformation, FindFiles and GetDiskFreeSpace are
+  kept per instance for DOKAN_OPTIONS.MetadataCacheTimeout milliseconds,
+  and the callbacks are not called while they are cached. Attributes
+  given by FindFiles are cached too, since enumerations are usually
+  followed by queries of each entry. Opens are not cached: CreateFile
+  and OpenDirectory decide the access of each caller.
+
+  Entries are hashed by the name ignoring case into DOKAN_CACHE_SHARDS
+  shards, each with its own lock, buckets and LRU list. A shard keeps
+  at most MetadataCacheSize / DOKAN_CACHE_SHARDS bytes and drops the
+  least recently used entries to add a new one.
+
+  Names are looked up in the exact case, while invalidation drops all
+  cases of the name.
+
+  Names CreateFile or OpenDirectory did not find are kept for
+  DOKAN_OPTIONS.NegativeCacheTimeout milliseconds as DOKAN_CACHE_NOT_FOUND,
+  and opens which do not create are failed by DispatchCreate with the
+  same error. Creating the name drops it with the other entries of the
+  name, creating a directory drops the misses under it as well
+  ("\new\desktop.ini" was not found because "\new" was not there),
+  renames drop all.
+
+  DispatchCreate (not FILE_OPENED), CompleteWrite, DispatchSetInformation,
+  DispatchCleanup (DeleteOnClose), DokanInvalidatePath
+    # InvalidateCache
+      # entries of the name
+      # the listing of the parent directory
+      # the disk space
+  DispatchCreate (a directory is created), DokanInvalidatePath
+    # InvalidateCacheTree
+      # misses (any entries for DokanInvalidatePath) under the name,
+        found by scanning the LRU lists
+  DokanInvalidatePath
+    # IOCTL_DIR_CACHE_INVALIDATE of the name and of its parent,
+      when the driver caches listings
+
+*/
+
+
+typedef struct _DOKAN_CACHE_ENTRY {
+	struct _DOKAN_CACHE_ENTRY*	Next;
+	LIST_ENTRY	LruEntry;
+	ULONG		Hash;
+	ULONG		Kind;
+	// GetTickCount
+	DWORD		ExpireTick;
+	// allocated bytes, counted in Shard->Size
+	ULONG		Size;
+	ULONG		DataLength;
+	// in WCHARs, without the terminating null
+	ULONG		NameLength;
+	// the name followed by the data at CacheEntryData
+	WCHAR		Name[1];
+} DOKAN_CACHE_ENTRY, *PDOKAN_CACHE_ENTRY;
+
+
+#define CacheDataOffset(NameLength) \
+	((FIELD_OFFSET(DOKAN_CACHE_ENTRY, Name) + ((NameLength) + 1) * sizeof(WCHAR) + 7) & ~7)
+
+#define CacheEntryData(Entry) \
+	((PCHAR)(Entry) + CacheDataOffset((Entry)->NameLength))
+
+#define CacheShard(Cache, Hash) \
+	(&(Cache)->Shards[(Hash) % DOKAN_CACHE_SHARDS])
+
+#define CacheBucket(Shard, Hash) \
+	(&(Shard)->Buckets[((Hash) / DOKAN_CACHE_SHARDS) % DOKAN_CACHE_BUCKETS])
+
+#define CacheEntryExpired(Entry, Now) \
+	((LONG)((Entry)->ExpireTick - (Now)) <= 0)
+
+
+VOID
+InitializeCache(
+	PDOKAN_CACHE	Cache)
+{
+	ULONG	i;
+
+	ZeroMemory(Cache, sizeof(DOKAN_CACHE));
+
+	for (i = 0; i < DOKAN_CACHE_SHARDS; ++i) {
+		PDOKAN_CACHE_SHARD shard = &Cache->Shards[i];
+#if _MSC_VER < 1300
+		InitializeCriticalSection(&shard->Lock);
+#else
+		InitializeCriticalSectionAndSpinCount(
+			&shard->Lock, 0x80000400);
+#endif
+		InitializeListHead(&shard->LruList);
+	}
+}
+
+
+// frees all entries of the shard, Shard->Lock must be held
+static VOID
+ClearCacheShard(
+	PDOKAN_CACHE_SHARD	Shard)
+{
+	while (!IsListEmpty(&Shard->LruList)) {
+		PLIST_ENTRY listEntry = RemoveHeadList(&Shard->LruList);
+		free(CONTAINING_RECORD(listEntry, DOKAN_CACHE_ENTRY, LruEntry));
+	}
+	ZeroMemory(Shard->Buckets, sizeof(Shard->Buckets));
+	Shard->Count = 0;
+	Shard->NotFoundCount = 0;
+	Shard->Size = 0;
+}
+
+
+VOID
+DeleteCache(
+	PDOKAN_CACHE	Cache)
+{
+	ULONG	i;
+
+	for (i = 0; i < DOKAN_CACHE_SHARDS; ++i) {
+		ClearCacheShard(&Cache->Shards[i]);
+		DeleteCriticalSection(&Cache->Shards[i].Lock);
+	}
+}
+
+
+ULONG
+GetCacheTimeout(
+	PDOKAN_INSTANCE	DokanInstance,
+	ULONG			Kind)
+{
+	PDOKAN_OPTIONS	options = DokanInstance->DokanOptions;
+	ULONG			timeout;
+
+	if (options == NULL || options->Version < DOKAN_METADATA_CACHE_SUPPORTED_VERSION) {
+		return 0;
+	}
+
+	if (Kind == DOKAN_CACHE_NOT_FOUND) {
+		timeout = options->NegativeCacheTimeout;
+	} else if (Kind != 0) {
+		timeout = options->MetadataCacheTimeout;
+	} else {
+		timeout = max(options->MetadataCacheTimeout, options->NegativeCacheTimeout);
+	}
+	return min(timeout, DOKAN_CACHE_MAX_TIMEOUT);
+}
+
+
+static ULONG
+GetCacheShardLimit(
+	PDOKAN_INSTANCE	DokanInstance)
+{
+	ULONG	size = DokanInstance->DokanOptions->MetadataCacheSize;
+
+	if (size == 0) {
+		size = DOKAN_CACHE_DEFAULT_SIZE;
+	}
+	return size / DOKAN_CACHE_SHARDS;
+}
+
+
+// unlinks Entry from its bucket and the LRU list and frees it,
+// Shard->Lock must be held
+static VOID
+RemoveCacheEntry(
+	PDOKAN_CACHE_SHARD	Shard,
+	PDOKAN_CACHE_ENTRY	Entry)
+{
+	PDOKAN_CACHE_ENTRY*	link = CacheBucket(Shard, Entry->Hash);
+
+	while (*link != Entry) {
+		link = &(*link)->Next;
+	}
+	*link = Entry->Next;
+
+	RemoveEntryList(&Entry->LruEntry);
+	Shard->Count--;
+	if (Entry->Kind == DOKAN_CACHE_NOT_FOUND) {
+		Shard->NotFoundCount--;
+	}
+	Shard->Size -= Entry->Size;
+	free(Entry);
+}
+
+
+// returns the entry of Kind and Name in the exact case, expired entries
+// of the bucket are dropped, Shard->Lock must be held
+static PDOKAN_CACHE_ENTRY
+FindCacheEntry(
+	PDOKAN_CACHE_SHARD	Shard,
+	ULONG				Hash,
+	ULONG				Kind,
+	LPCWSTR				Name,
+	ULONG				NameLength)
+{
+	PDOKAN_CACHE_ENTRY*	link = CacheBucket(Shard, Hash);
+	DWORD				now = GetTickCount();
+
+	while (*link != NULL) {
+		PDOKAN_CACHE_ENTRY entry = *link;
+
+		if (CacheEntryExpired(entry, now)) {
+			RemoveCacheEntry(Shard, entry);
+			continue;
+		}
+
+		if (entry->Hash == Hash && entry->Kind == Kind &&
+			entry->NameLength == NameLength &&
+			DokanNameEqual(entry->Name, Name, NameLength)) {
+			return entry;
+		}
+		link = &entry->Next;
+	}
+	return NULL;
+}
+
+
+// the name and the data are filled by the caller
+static PDOKAN_CACHE_ENTRY
+AllocateCacheEntry(
+	ULONG	Kind,
+	ULONG	NameLength,
+	ULONG	DataLength)
+{
+	ULONG				size = CacheDataOffset(NameLength) + DataLength;
+	PDOKAN_CACHE_ENTRY	entry;
+
+	// overflow
+	if (size < DataLength) {
+		return NULL;
+	}
+
+	entry = (PDOKAN_CACHE_ENTRY)malloc(size);
+	if (entry == NULL) {
+		return NULL;
+	}
+
+	entry->Kind			= Kind;
+	entry->Size			= size;
+	entry->DataLength	= DataLength;
+	entry->NameLength	= NameLength;
+	entry->Name[NameLength] = L'\0';
+	return entry;
+}
+
+
+// takes Entry, which is freed when it can not be kept
+static VOID
+InsertCacheEntry(
+	PDOKAN_INSTANCE		DokanInstance,
+	PDOKAN_CACHE_ENTRY	Entry,
+	ULONG				Timeout)
+{
+	PDOKAN_CACHE_SHARD	shard;
+	PDOKAN_CACHE_ENTRY*	bucket;
+	PDOKAN_CACHE_ENTRY	old;
+	ULONG				limit = GetCacheShardLimit(DokanInstance);
+
+	if (Entry->Size > limit) {
+		free(Entry);
+		return;
+	}
+
+	Entry->Hash = DokanNameHash(Entry->Name, Entry->NameLength, TRUE);
+	shard = CacheShard(&DokanInstance->Cache, Entry->Hash);
+	bucket = CacheBucket(shard, Entry->Hash);
+
+	EnterCriticalSection(&shard->Lock);
+
+	Entry->ExpireTick = GetTickCount() + Timeout;
+
+	old = FindCacheEntry(shard, Entry->Hash, Entry->Kind, Entry->Name, Entry->NameLength);
+	if (old != NULL) {
+		RemoveCacheEntry(shard, old);
+	}
+
+	// drop the least recently used
+	while (shard->Size + Entry->Size > limit) {
+		RemoveCacheEntry(shard, CONTAINING_RECORD(
+			shard->LruList.Blink, DOKAN_CACHE_ENTRY, LruEntry));
+		shard->Evictions++;
+	}
+
+	Entry->Next = *bucket;
+	*bucket = Entry;
+	InsertHeadList(&shard->LruList, &Entry->LruEntry);
+	shard->Count++;
+	if (Entry->Kind == DOKAN_CACHE_NOT_FOUND) {
+		shard->NotFoundCount++;
+	}
+	shard->Size += Entry->Size;
+
+	LeaveCriticalSection(&shard->Lock);
+}
+
+
+VOID
+AddCache(
+	PDOKAN_INSTANCE	DokanInstance,
+	ULONG			Kind,
+	LPCWSTR			Name,
+	const VOID*		Data,
+	ULONG			DataLength)
+{
+	PDOKAN_CACHE_ENTRY	entry;
+	ULONG	timeout = GetCacheTimeout(DokanInstance, Kind);
+	ULONG	nameLength;
+
+	if (timeout == 0) {
+		return;
+	}
+
+	nameLength = (ULONG)wcslen(Name);
+	entry = AllocateCacheEntry(Kind, nameLength, DataLength);
+	if (entry == NULL) {
+		return;
+	}
+
+	CopyMemory(entry->Name, Name, nameLength * sizeof(WCHAR));
+	CopyMemory(CacheEntryData(entry), Data, DataLength);
+
+	InsertCacheEntry(DokanInstance, entry, timeout);
+}
+
+
+VOID
+AddAttributeCache(
+	PDOKAN_INSTANCE				DokanInstance,
+	LPCWSTR						DirectoryName,
+	LPCWSTR						FileName,
+	ULONG						NameLength,
+	PBY_HANDLE_FILE_INFORMATION	FileInfo)
+{
+	PDOKAN_CACHE_ENTRY			entry;
+	PDOKAN_CACHED_ATTRIBUTES	attributes;
+	ULONG	timeout = GetCacheTimeout(DokanInstance, DOKAN_CACHE_ATTRIBUTES);
+	ULONG	directoryLength;
+	ULONG	length;
+
+	if (timeout == 0) {
+		return;
+	}
+
+	// "." and ".." are not names in the directory
+	if ((NameLength == 1 && FileName[0] == L'.') ||
+		(NameLength == 2 && FileName[0] == L'.' && FileName[1] == L'.')) {
+		return;
+	}
+
+	// the root is "\"
+	directoryLength = (ULONG)wcslen(DirectoryName);
+	if (directoryLength > 0 && DirectoryName[directoryLength-1] == L'\\') {
+		directoryLength--;
+	}
+	length = directoryLength + 1 + NameLength;
+
+	entry = AllocateCacheEntry(DOKAN_CACHE_ATTRIBUTES, length, sizeof(DOKAN_CACHED_ATTRIBUTES));
+	if (entry == NULL) {
+		return;
+	}
+
+	CopyMemory(entry->Name, DirectoryName, directoryLength * sizeof(WCHAR));
+	entry->Name[directoryLength] = L'\\';
+	CopyMemory(&entry->Name[directoryLength + 1], FileName, NameLength * sizeof(WCHAR));
+
+	attributes = (PDOKAN_CACHED_ATTRIBUTES)CacheEntryData(entry);
+	attributes->Info		= *FileInfo;
+	attributes->FromListing	= TRUE;
+
+	InsertCacheEntry(DokanInstance, entry, timeout);
+}
+
+
+// copies the data to Data when it is *DataLength bytes,
+// or to heap when Data is NULL
+static PVOID
+LookupCacheEntry(
+	PDOKAN_INSTANCE	DokanInstance,
+	ULONG			Kind,
+	LPCWSTR			Name,
+	PVOID			Data,
+	PULONG			DataLength)
+{
+	PDOKAN_CACHE_SHARD	shard;
+	PDOKAN_CACHE_ENTRY	entry;
+	PVOID	result = NULL;
+	ULONG	nameLength;
+	ULONG	hash;
+
+	if (GetCacheTimeout(DokanInstance, Kind) == 0) {
+		return NULL;
+	}
+
+	nameLength = (ULONG)wcslen(Name);
+	hash = DokanNameHash(Name, nameLength, TRUE);
+	shard = CacheShard(&DokanInstance->Cache, hash);
+
+	EnterCriticalSection(&shard->Lock);
+
+	entry = FindCacheEntry(shard, hash, Kind, Name, nameLength);
+
+	if (entry != NULL && Data != NULL) {
+		// fixed size data
+		if (entry->DataLength == *DataLength) {
+			CopyMemory(Data, CacheEntryData(entry), entry->DataLength);
+			result = Data;
+		}
+	} else if (entry != NULL) {
+		// the data is copied to heap, not empty even for 0 bytes
+		result = malloc(entry->DataLength > 0 ? entry->DataLength : 1);
+		if (result != NULL) {
+			CopyMemory(result, CacheEntryData(entry), entry->DataLength);
+			*DataLength = entry->DataLength;
+		}
+	}
+
+	if (result != NULL) {
+		// the most recently used
+		RemoveEntryList(&entry->LruEntry);
+		InsertHeadList(&shard->LruList, &entry->LruEntry);
+		shard->Hits++;
+	} else {
+		shard->Misses++;
+	}
+
+	LeaveCriticalSection(&shard->Lock);
+	return result;
+}
+
+
+BOOL
+LookupCache(
+	PDOKAN_INSTANCE	DokanInstance,
+	ULONG			Kind,
+	LPCWSTR			Name,
+	PVOID			Data,
+	ULONG			DataLength)
+{
+	// some kinds have no data
+	CHAR	none;
+
+	return LookupCacheEntry(DokanInstance, Kind, Name,
+			Data != NULL ? Data : &none, &DataLength) != NULL;
+}
+
+
+PVOID
+LookupCacheCopy(
+	PDOKAN_INSTANCE	DokanInstance,
+	ULONG			Kind,
+	LPCWSTR			Name,
+	PULONG			DataLength)
+{
+	return LookupCacheEntry(DokanInstance, Kind, Name, NULL, DataLength);
+}
+
+
+// drops entries of Name ignoring case, of any kind when Kind is 0
+static VOID
+RemoveCacheEntries(
+	PDOKAN_CACHE	Cache,
+	ULONG			Kind,
+	LPCWSTR			Name,
+	ULONG			NameLength)
+{
+	ULONG				hash = DokanNameHash(Name, NameLength, TRUE);
+	PDOKAN_CACHE_SHARD	shard = CacheShard(Cache, hash);
+	PDOKAN_CACHE_ENTRY*	link;
+
+	EnterCriticalSection(&shard->Lock);
+
+	link = CacheBucket(shard, hash);
+	while (*link != NULL) {
+		PDOKAN_CACHE_ENTRY entry = *link;
+
+		if (entry->Hash == hash && (Kind == 0 || entry->Kind == Kind) &&
+			entry->NameLength == NameLength &&
+			DokanNameEqualIgnoreCase(entry->Name, Name, NameLength)) {
+			RemoveCacheEntry(shard, entry);
+		} else {
+			link = &entry->Next;
+		}
+	}
+
+	LeaveCriticalSection(&shard->Lock);
+}
+
+
+VOID
+InvalidateCache(
+	PDOKAN_INSTANCE	DokanInstance,
+	LPCWSTR			FileName)
+{
+	PDOKAN_CACHE	cache = &DokanInstance->Cache;
+	ULONG	length;
+	ULONG	pos;
+
+	if (GetCacheTimeout(DokanInstance, 0) == 0) {
+		return;
+	}
+
+	if (FileName == NULL) {
+		ULONG i;
+		for (i = 0; i < DOKAN_CACHE_SHARDS; ++i) {
+			EnterCriticalSection(&cache->Shards[i].Lock);
+			ClearCacheShard(&cache->Shards[i]);
+			LeaveCriticalSection(&cache->Shards[i].Lock);
+		}
+		return;
+	}
+
+	length = (ULONG)wcslen(FileName);
+	RemoveCacheEntries(cache, 0, FileName, length);
+
+	// search the last "\", the parent of "\foo" is "\"
+	if (length > 1) {
+		pos = length - 1;
+		while (pos > 0 && FileName[pos] != L'\\')
+			--pos;
+		RemoveCacheEntries(cache, DOKAN_CACHE_FIND_FILES, FileName, pos > 0 ? pos : 1);
+	}
+
+	RemoveCacheEntries(cache, DOKAN_CACHE_DISK_SPACE, L"", 0);
+}
+
+
+// drops entries of Kind (any kind when 0) whose names are under the
+// directory Name ignoring case
+static VOID
+RemoveCacheTree(
+	PDOKAN_CACHE	Cache,
+	ULONG			Kind,
+	LPCWSTR			Name,
+	ULONG			NameLength)
+{
+	ULONG	i;
+
+	// names under "\" are "\" and the name
+	if (NameLength == 1 && Name[0] == L'\\') {
+		NameLength = 0;
+	}
+
+	for (i = 0; i < DOKAN_CACHE_SHARDS; ++i) {
+		PDOKAN_CACHE_SHARD	shard = &Cache->Shards[i];
+		PLIST_ENTRY			listEntry;
+
+		EnterCriticalSection(&shard->Lock);
+
+		if (Kind == DOKAN_CACHE_NOT_FOUND && shard->NotFoundCount == 0) {
+			LeaveCriticalSection(&shard->Lock);
+			continue;
+		}
+
+		listEntry = shard->LruList.Flink;
+		while (listEntry != &shard->LruList) {
+			PDOKAN_CACHE_ENTRY entry = CONTAINING_RECORD(
+				listEntry, DOKAN_CACHE_ENTRY, LruEntry);
+			listEntry = listEntry->Flink;
+
+			if ((Kind == 0 || entry->Kind == Kind) &&
+				entry->NameLength > NameLength + 1 &&
+				entry->Name[NameLength] == L'\\' &&
+				DokanNameEqualIgnoreCase(entry->Name, Name, NameLength)) {
+				RemoveCacheEntry(shard, entry);
+			}
+		}
+
+		LeaveCriticalSection(&shard->Lock);
+	}
+}
+
+
+VOID
+InvalidateCacheTree(
+	PDOKAN_INSTANCE	DokanInstance,
+	LPCWSTR			FileName,
+	ULONG			Kind)
+{
+	InvalidateCache(DokanInstance, FileName);
+
+	if (FileName == NULL || GetCacheTimeout(DokanInstance, Kind) == 0) {
+		return;
+	}
+	RemoveCacheTree(&DokanInstance->Cache, Kind, FileName, (ULONG)wcslen(FileName));
+}
+
+
+BOOL DOKANAPI
+DokanInvalidatePath(
+	LPCWSTR	MountPoint,
+	LPCWSTR	FileName)
+{
+	PDOKAN_INSTANCE	instance;
+	WCHAR	deviceName[64];
+	BOOL	dirCache = FALSE;
+	ULONG	length;
+	ULONG	pos;
+
+	if (MountPoint == NULL) {
+		return FALSE;
+	}
+
+	EnterCriticalSection(&g_InstanceCriticalSection);
+
+	instance = FindDokanInstance(MountPoint);
+	if (instance != NULL) {
+		InvalidateCacheTree(instance, FileName, 0);
+
+		dirCache = instance->DokanOptions != NULL &&
+			DOKAN_DIR_CACHE_SUPPORTED_VERSION <= instance->DokanOptions->Version &&
+			instance->DokanOptions->DirectoryCacheTimeout != 0;
+		wcscpy_s(deviceName, sizeof(deviceName) / sizeof(WCHAR), instance->DeviceName);
+	}
+
+	LeaveCriticalSection(&g_InstanceCriticalSection);
+
+	if (instance == NULL) {
+		return FALSE;
+	}
+
+	// the listings the driver keeps: FileName when it is a directory
+	// and its parent, the device is not called holding the lock
+	if (dirCache) {
+		if (FileName == NULL) {
+			InvalidateDirectoryCache(deviceName, NULL, 0);
+		} else if ((length = (ULONG)wcslen(FileName)) > 0) {
+			InvalidateDirectoryCache(deviceName, FileName, length * sizeof(WCHAR));
+
+			// search the last "\", the parent of "\foo" is "\"
+			if (length > 1) {
+				pos = length - 1;
+				while (pos > 0 && FileName[pos] != L'\\')
+					--pos;
+				InvalidateDirectoryCache(deviceName, FileName, (pos > 0 ? pos : 1) * sizeof(WCHAR));
+			}
+		}
+	}
+
+	return TRUE;
+}
+
+
+BOOL DOKANAPI
+DokanGetCacheInfo(
+	LPCWSTR				MountPoint,
+	PDOKAN_CACHE_INFO	CacheInfo)
+{
+	PDOKAN_INSTANCE	instance;
+	ULONG	i;
+
+	if (MountPoint == NULL || CacheInfo == NULL) {
+		return FALSE;
+	}
+
+	ZeroMemory(CacheInfo, sizeof(DOKAN_CACHE_INFO));
+
+	EnterCriticalSection(&g_InstanceCriticalSection);
+
+	instance = FindDokanInstance(MountPoint);
+	if (instance != NULL) {
+		for (i = 0; i < DOKAN_CACHE_SHARDS; ++i) {
+			PDOKAN_CACHE_SHARD shard = &instance->Cache.Shards[i];
+
+			EnterCriticalSection(&shard->Lock);
+			CacheInfo->Hits			+= shard->Hits;
+			CacheInfo->Misses		+= shard->Misses;
+			CacheInfo->Evictions	+= shard->Evictions;
+			CacheInfo->EntryCount	+= shard->Count;
+			CacheInfo->Size			+= shard->Size;
+			LeaveCriticalSection(&shard->Lock);
+		}
+	}
+
+	LeaveCriticalSection(&g_InstanceCriticalSection);
+
+	return instance != NULL;
+}
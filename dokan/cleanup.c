@@ -37,10 +37,16 @@ DispatchCleanup(
 
 	eventInfo = DispatchCommon(
 		EventContext, sizeOfEventInfo, DokanInstance, &fileInfo, &openInfo);
-	
+
+	if (openInfo == NULL) {
+		SendEventInformation(Handle, eventInfo, sizeof(EVENT_INFORMATION), DokanInstance);
+		FreeEventInformation(eventInfo);
+		return;
+	}
+
 	eventInfo->Status = STATUS_SUCCESS; // return success at any case
 
-	DbgPrint("###Cleanup %04d\n", openInfo != NULL ? openInfo->EventId : -1);
+	DbgPrint("###Cleanup %04d\n", openInfo->EventId);
 
 	if (DokanInstance->DokanOperations->Cleanup) {
 		// ignore return value
@@ -49,11 +55,15 @@ DispatchCleanup(
 			&fileInfo);
 	}
 
+	if (fileInfo.DeleteOnClose) {
+		InvalidateCache(DokanInstance, EventContext->Cleanup.FileName);
+	}
+
 	openInfo->UserContext = fileInfo.Context;
 
 	SendEventInformation(Handle, eventInfo, sizeOfEventInfo, DokanInstance);
 
-	free(eventInfo);
+	FreeEventInformation(eventInfo);
 	return;
 }
 
@@ -39,9 +39,15 @@ DispatchClose(
 	eventInfo = DispatchCommon(
 		EventContext, sizeOfEventInfo, DokanInstance, &fileInfo, &openInfo);
 
+	if (openInfo == NULL) {
+		// nothing is sent back for Close
+		FreeEventInformation(eventInfo);
+		return;
+	}
+
 	eventInfo->Status = STATUS_SUCCESS; // return success at any case
 
-	DbgPrint("###Close %04d\n", openInfo != NULL ? openInfo->EventId : -1);
+	DbgPrint("###Close %04d\n", openInfo->EventId);
 
 	if (DokanInstance->DokanOperations->CloseFile) {
 		// ignore return value
@@ -52,13 +58,11 @@ DispatchClose(
 	// do not send it to the driver
 	//SendEventInformation(Handle, eventInfo, length);
 
-	if (openInfo != NULL) {
-		EnterCriticalSection(&DokanInstance->CriticalSection);
-		openInfo->OpenCount--;
-		LeaveCriticalSection(&DokanInstance->CriticalSection);
-	}
+	// drop the reference of the handle, the one taken by
+	// DispatchCommon is still held so this never frees openInfo
+	InterlockedDecrement(&openInfo->OpenCount);
 	ReleaseDokanOpenInfo(eventInfo, DokanInstance);
-	free(eventInfo);
+	FreeEventInformation(eventInfo);
 
 	return;
 }
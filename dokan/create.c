@@ -23,6 +23,39 @@ with this program. If not, see <http://www.gnu.org/licenses/>.
 #include "fileinfo.h"
 
 
+// returns the error CreateFile or OpenDirectory gave for FileName
+// while it is in the negative cache, otherwise 0
+static int
+LookupNotFoundCache(
+	PDOKAN_INSTANCE	DokanInstance,
+	LPCWSTR			FileName)
+{
+	DWORD	error;
+
+	if (LookupCache(DokanInstance, DOKAN_CACHE_NOT_FOUND,
+			FileName, &error, sizeof(DWORD))) {
+		DbgPrint("  negative cache hit %d\n", error);
+		return -(int)error;
+	}
+	return 0;
+}
+
+
+static VOID
+AddNotFoundCache(
+	PDOKAN_INSTANCE	DokanInstance,
+	LPCWSTR			FileName,
+	int				Status)
+{
+	DWORD	error = (DWORD)(Status * -1);
+
+	if (error == ERROR_FILE_NOT_FOUND || error == ERROR_PATH_NOT_FOUND) {
+		AddCache(DokanInstance, DOKAN_CACHE_NOT_FOUND,
+			FileName, &error, sizeof(DWORD));
+	}
+}
+
+
 VOID
 DispatchCreate(
 	HANDLE				Handle,
@@ -31,7 +64,7 @@ DispatchCreate(
 {
 	static eventId = 0;
 	ULONG					length	  = sizeof(EVENT_INFORMATION);
-	PEVENT_INFORMATION		eventInfo = (PEVENT_INFORMATION)malloc(length);
+	PEVENT_INFORMATION		eventInfo = AllocateEventInformation(length);
 	int						status;
 	DOKAN_FILE_INFO			fileInfo;
 	DWORD					disposition;
@@ -41,7 +74,6 @@ DispatchCreate(
 
 	CheckFileName(EventContext->Create.FileName);
 
-	RtlZeroMemory(eventInfo, length);
 	RtlZeroMemory(&fileInfo, sizeof(DOKAN_FILE_INFO));
 
 	eventInfo->BufferLength = 0;
@@ -52,15 +84,19 @@ DispatchCreate(
 
 	// DOKAN_OPEN_INFO is structure for a opened file
 	// this will be freed by Close
-	openInfo = malloc(sizeof(DOKAN_OPEN_INFO));
-	ZeroMemory(openInfo, sizeof(DOKAN_OPEN_INFO));
+	openInfo = AllocateOpenInfo(DokanInstance);
+	if (openInfo == NULL) {
+		eventInfo->Status = STATUS_INSUFFICIENT_RESOURCES;
+		SendEventInformation(Handle, eventInfo, length, DokanInstance);
+		FreeEventInformation(eventInfo);
+		return;
+	}
 	openInfo->OpenCount = 2;
 	openInfo->EventContext = EventContext;
-	openInfo->DokanInstance = DokanInstance;
 	fileInfo.DokanContext = (ULONG64)openInfo;
 
-	// pass it to driver and when the same handle is used get it back
-	eventInfo->Context = (ULONG64)openInfo;
+	// pass the handle to driver and when the same handle is used get it back
+	eventInfo->Context = DOKAN_OPEN_INFO_HANDLE(openInfo);
 
 	// The high 8 bits of this parameter correspond to the Disposition parameter
 	disposition = (EventContext->Create.CreateOptions >> 24) & 0x000000ff;
@@ -104,9 +140,20 @@ DispatchCreate(
 							EventContext->Create.FileName, &fileInfo);
 			}
 		} else if(disposition == FILE_OPEN) {
-			if (DokanInstance->DokanOperations->OpenDirectory) {
+			// an open which succeeds always reaches OpenDirectory,
+			// the FileSystem checks the access of each caller
+			if ((status = LookupNotFoundCache(DokanInstance,
+							EventContext->Create.FileName)) != 0) {
+				// not found a moment ago
+
+			} else if (DokanInstance->DokanOperations->OpenDirectory) {
 				status = DokanInstance->DokanOperations->OpenDirectory(
 							EventContext->Create.FileName, &fileInfo);
+
+				if (status < 0) {
+					AddNotFoundCache(DokanInstance,
+						EventContext->Create.FileName, status);
+				}
 			}
 		} else {
 			DbgPrint("### Create other disposition : %d\n", disposition);
@@ -138,8 +185,20 @@ DispatchCreate(
 				DbgPrint("### Create other disposition : %d\n", disposition);
 				break;
 		}
-		
-		if(DokanInstance->DokanOperations->CreateFile) {
+
+		// dispositions which fail when the file does not exist
+		// are answered by the negative cache
+		if (creationDisposition == OPEN_EXISTING ||
+			creationDisposition == TRUNCATE_EXISTING) {
+			status = LookupNotFoundCache(DokanInstance, EventContext->Create.FileName);
+		} else {
+			status = 0;
+		}
+
+		if (status != 0) {
+			// not found a moment ago
+
+		} else if(DokanInstance->DokanOperations->CreateFile) {
 			status = DokanInstance->DokanOperations->CreateFile(
 									EventContext->Create.FileName,
 									EventContext->Create.DesiredAccess,
@@ -147,6 +206,13 @@ DispatchCreate(
 									creationDisposition,
 									EventContext->Create.FileAttributes,
 									&fileInfo);
+
+			if (status < 0) {
+				AddNotFoundCache(DokanInstance,
+					EventContext->Create.FileName, status);
+			}
+		} else {
+			status = -1;
 		}
 	}
 
@@ -213,7 +279,7 @@ DispatchCreate(
 
 		if (eventInfo->Status != STATUS_SUCCESS) {
 			// Needs to free openInfo because Close is never called.
-			free(openInfo);
+			FreeOpenInfo(DokanInstance, openInfo);
 			eventInfo->Context = 0;
 		}
 
@@ -241,9 +307,16 @@ DispatchCreate(
 
 		if (fileInfo.IsDirectory)
 			eventInfo->Create.Flags |= DOKAN_FILE_DIRECTORY;
+
+		if (eventInfo->Create.Information == FILE_CREATED && fileInfo.IsDirectory) {
+			InvalidateCacheTree(DokanInstance, EventContext->Create.FileName,
+				DOKAN_CACHE_NOT_FOUND);
+		} else if (eventInfo->Create.Information != FILE_OPENED) {
+			InvalidateCache(DokanInstance, EventContext->Create.FileName);
+		}
 	}
 	
 	SendEventInformation(Handle, eventInfo, length, DokanInstance);
-	free(eventInfo);
+	FreeEventInformation(eventInfo);
 	return;
 }
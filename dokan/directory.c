@@ -27,386 +27,741 @@ with this program. If not, see <http://www.gnu.org/licenses/>.
 typedef ULONG ULONG_PTR;
 #endif
 
-typedef struct _DOKAN_FIND_DATA {
-	WIN32_FIND_DATAW	FindData;
-	LIST_ENTRY			ListEntry;
-} DOKAN_FIND_DATA, *PDOKAN_FIND_DATA;
+/*
 
+Directory listing store
 
-VOID
-DokanFillDirInfo(
-	PFILE_DIRECTORY_INFORMATION	Buffer,
-	PWIN32_FIND_DATAW			FindData,
-	ULONG						Index)
+  Entries given by FindFiles are packed into DOKAN_FIND_ENTRY with
+  names of their own length, and bump allocated from chunks of
+  DOKAN_FIND_CHUNK_SIZE bytes. Chunks are freed at once when
+  the listing is cleared.
+
+*/
+
+typedef struct _DOKAN_FIND_ENTRY {
+	DWORD		FileAttributes;
+	DWORD		FileSizeHigh;
+	DWORD		FileSizeLow;
+	FILETIME	CreationTime;
+	FILETIME	LastAccessTime;
+	FILETIME	LastWriteTime;
+	// in WCHARs, without the terminating null
+	USHORT		FileNameLength;
+	USHORT		AlternateNameLength;
+	// FileName and AlternateFileName, both null terminated
+	WCHAR		Names[1];
+} DOKAN_FIND_ENTRY, *PDOKAN_FIND_ENTRY;
+
+
+#define DOKAN_FIND_CHUNK_SIZE	(64*1024)
+
+typedef struct _DOKAN_FIND_CHUNK {
+	struct _DOKAN_FIND_CHUNK*	Next;
+	// bytes of Data
+	ULONG	Used;
+	ULONG	Size;
+	ULONG64	Data[1];
+} DOKAN_FIND_CHUNK, *PDOKAN_FIND_CHUNK;
+
+
+struct _DOKAN_FIND_STORE {
+	PDOKAN_FIND_CHUNK	Head;
+	PDOKAN_FIND_CHUNK	Tail;
+	ULONG				Count;
+};
+
+
+#define FindEntrySize(NameLength, AlternateNameLength) \
+	((FIELD_OFFSET(DOKAN_FIND_ENTRY, Names) + \
+		((NameLength) + (AlternateNameLength) + 2) * sizeof(WCHAR) + 7) & ~7)
+
+#define FindEntryAt(Chunk, Offset) \
+	((PDOKAN_FIND_ENTRY)((PCHAR)(Chunk)->Data + (Offset)))
+
+#define FindEntryAlternateName(Entry) \
+	(&(Entry)->Names[(Entry)->FileNameLength + 1])
+
+
+// state of one FindFilesWithCursor call, FileInfo is given to the FileSystem
+typedef struct _DOKAN_FIND_CURSOR {
+	DOKAN_FILE_INFO		FileInfo;
+	PEVENT_CONTEXT		EventContext;
+	const struct _DOKAN_DIR_LAYOUT*	Layout;
+	// NULL when search pattern is not specified
+	PDOKAN_NAME_EXPRESSION	Expression;
+	PVOID				CurrentBuffer;
+	PVOID				LastBuffer;
+	ULONG				LengthRemaining;
+	// matched entries to be skipped before filling the buffer
+	ULONG				Skip;
+	// index of the next matched entry
+	ULONG				Index;
+	ULONG				Count;
+	// cursor just after the last entry consumed
+	ULONG64				Cursor;
+	BOOL				Full;
+	// entries are given to the metadata cache unless NULL
+	PDOKAN_INSTANCE		DokanInstance;
+} DOKAN_FIND_CURSOR, *PDOKAN_FIND_CURSOR;
+
+
+// Entries of every class start with FILE_DIRECTORY_INFORMATION fields
+// (only NextEntryOffset, FileIndex and FileNameLength for FileNames),
+// followed by class specific fields which Dokan leaves zero, and FileName.
+typedef struct _DOKAN_DIR_LAYOUT {
+	FILE_INFORMATION_CLASS	InformationClass;
+	// FILE_DIRECTORY_INFORMATION fields are filled
+	BOOL	HasAttributes;
+	// zero cleared fields are from ExtraOffset to NameOffset
+	ULONG	ExtraOffset;
+	ULONG	NameOffset;
+} DOKAN_DIR_LAYOUT, *PDOKAN_DIR_LAYOUT;
+
+
+#define DIR_LAYOUT(Class, Type) \
+	{ Class, TRUE, FIELD_OFFSET(FILE_DIRECTORY_INFORMATION, FileName), \
+		FIELD_OFFSET(Type, FileName) }
+
+static const DOKAN_DIR_LAYOUT DokanDirLayouts[] = {
+	DIR_LAYOUT(FileDirectoryInformation,		FILE_DIRECTORY_INFORMATION),
+	DIR_LAYOUT(FileFullDirectoryInformation,	FILE_FULL_DIR_INFORMATION),
+	DIR_LAYOUT(FileBothDirectoryInformation,	FILE_BOTH_DIR_INFORMATION),
+	DIR_LAYOUT(FileIdBothDirectoryInformation,	FILE_ID_BOTH_DIR_INFORMATION),
+	DIR_LAYOUT(FileIdFullDirectoryInformation,	FILE_ID_FULL_DIR_INFORMATION),
+	{ FileNamesInformation, FALSE,
+		FIELD_OFFSET(FILE_NAMES_INFORMATION, FileName),
+		FIELD_OFFSET(FILE_NAMES_INFORMATION, FileName) },
+};
+
+
+// returns NULL when the class is not supported
+static const DOKAN_DIR_LAYOUT*
+DokanGetDirLayout(
+	ULONG	InformationClass)
+{
+	ULONG i;
+
+	for (i = 0; i < sizeof(DokanDirLayouts) / sizeof(DokanDirLayouts[0]); ++i) {
+		if ((ULONG)DokanDirLayouts[i].InformationClass == InformationClass)
+			return &DokanDirLayouts[i];
+	}
+	return NULL;
+}
+
+
+// writes one entry with NextEntryOffset 0,
+// returns the entry size or 0 when the buffer is full
+static ULONG
+DokanEncodeDirEntry(
+	const DOKAN_DIR_LAYOUT*	Layout,
+	PVOID					Buffer,
+	PULONG					LengthRemaining,
+	PDOKAN_FIND_ENTRY		Entry,
+	LPCWSTR					FileName,
+	ULONG					Index)
 {
-	ULONG nameBytes = wcslen(FindData->cFileName) * sizeof(WCHAR);
+	ULONG	nameBytes = Entry->FileNameLength * sizeof(WCHAR);
+	ULONG	entrySize = Layout->NameOffset + nameBytes;
+	ULONG	thisEntrySize;
+
+	// Must be align on a 8-byte boundary.
+	thisEntrySize = QuadAlign(entrySize);
+
+	// no more memory, don't fill any more
+	if (*LengthRemaining < thisEntrySize) {
+		DbgPrint("  no memory\n");
+		return 0;
+	}
+
+	if (Layout->HasAttributes) {
+		PFILE_DIRECTORY_INFORMATION	info = (PFILE_DIRECTORY_INFORMATION)Buffer;
 
-	Buffer->FileIndex = Index;
-	Buffer->FileAttributes = FindData->dwFileAttributes;
-	Buffer->FileNameLength = nameBytes;
+		info->NextEntryOffset = 0;
+		info->FileIndex = Index;
+
+		info->CreationTime.HighPart = Entry->CreationTime.dwHighDateTime;
+		info->CreationTime.LowPart  = Entry->CreationTime.dwLowDateTime;
+
+		info->LastAccessTime.HighPart = Entry->LastAccessTime.dwHighDateTime;
+		info->LastAccessTime.LowPart  = Entry->LastAccessTime.dwLowDateTime;
+
+		info->LastWriteTime.HighPart = Entry->LastWriteTime.dwHighDateTime;
+		info->LastWriteTime.LowPart  = Entry->LastWriteTime.dwLowDateTime;
+
+		info->ChangeTime.HighPart = Entry->LastWriteTime.dwHighDateTime;
+		info->ChangeTime.LowPart  = Entry->LastWriteTime.dwLowDateTime;
+
+		info->EndOfFile.HighPart = Entry->FileSizeHigh;
+		info->EndOfFile.LowPart  = Entry->FileSizeLow;
+		info->AllocationSize.HighPart = Entry->FileSizeHigh;
+		info->AllocationSize.LowPart  = Entry->FileSizeLow;
+
+		info->FileAttributes = Entry->FileAttributes;
+		info->FileNameLength = nameBytes;
+
+	} else {
+		PFILE_NAMES_INFORMATION	info = (PFILE_NAMES_INFORMATION)Buffer;
 
-	Buffer->EndOfFile.HighPart = FindData->nFileSizeHigh;
-	Buffer->EndOfFile.LowPart   = FindData->nFileSizeLow;
-	Buffer->AllocationSize.HighPart = FindData->nFileSizeHigh;
-	Buffer->AllocationSize.LowPart = FindData->nFileSizeLow;
+		info->NextEntryOffset = 0;
+		info->FileIndex = Index;
+		info->FileNameLength = nameBytes;
+	}
 
-	Buffer->CreationTime.HighPart = FindData->ftCreationTime.dwHighDateTime;
-	Buffer->CreationTime.LowPart  = FindData->ftCreationTime.dwLowDateTime;
+	RtlZeroMemory((PCHAR)Buffer + Layout->ExtraOffset,
+		Layout->NameOffset - Layout->ExtraOffset);
 
-	Buffer->LastAccessTime.HighPart = FindData->ftLastAccessTime.dwHighDateTime;
-	Buffer->LastAccessTime.LowPart  = FindData->ftLastAccessTime.dwLowDateTime;
+	RtlCopyMemory((PCHAR)Buffer + Layout->NameOffset, FileName, nameBytes);
 
-	Buffer->LastWriteTime.HighPart = FindData->ftLastWriteTime.dwHighDateTime;
-	Buffer->LastWriteTime.LowPart  = FindData->ftLastWriteTime.dwLowDateTime;
+	// padding
+	RtlZeroMemory((PCHAR)Buffer + entrySize, thisEntrySize - entrySize);
 
-	Buffer->ChangeTime.HighPart = FindData->ftLastWriteTime.dwHighDateTime;
-	Buffer->ChangeTime.LowPart  = FindData->ftLastWriteTime.dwLowDateTime;
+	*LengthRemaining -= thisEntrySize;
 
-	RtlCopyMemory(Buffer->FileName, FindData->cFileName, nameBytes);
+	return thisEntrySize;
 }
 
 
-VOID
-DokanFillFullDirInfo(
-	PFILE_FULL_DIR_INFORMATION	Buffer,
-	PWIN32_FIND_DATAW			FindData,
-	ULONG						Index)
+
+
+
+// returns NULL when no memory
+static PDOKAN_FIND_ENTRY
+AllocateFindEntry(
+	PDOKAN_FIND_STORE	Store,
+	ULONG				EntrySize)
 {
-	ULONG nameBytes = wcslen(FindData->cFileName) * sizeof(WCHAR);
+	PDOKAN_FIND_CHUNK	chunk = Store->Tail;
+	PDOKAN_FIND_ENTRY	entry;
+
+	if (chunk == NULL || chunk->Size - chunk->Used < EntrySize) {
+		chunk = malloc(DOKAN_FIND_CHUNK_SIZE);
+		if (chunk == NULL) {
+			DbgPrint("Dokan Error: can't allocate directory entries\n");
+			return NULL;
+		}
+		chunk->Next = NULL;
+		chunk->Used = 0;
+		chunk->Size = DOKAN_FIND_CHUNK_SIZE - FIELD_OFFSET(DOKAN_FIND_CHUNK, Data);
 
-	Buffer->FileIndex = Index;
-	Buffer->FileAttributes = FindData->dwFileAttributes;
-	Buffer->FileNameLength = nameBytes;
+		if (Store->Tail == NULL) {
+			Store->Head = chunk;
+		} else {
+			Store->Tail->Next = chunk;
+		}
+		Store->Tail = chunk;
+	}
 
-	Buffer->EndOfFile.HighPart = FindData->nFileSizeHigh;
-	Buffer->EndOfFile.LowPart   = FindData->nFileSizeLow;
-	Buffer->AllocationSize.HighPart = FindData->nFileSizeHigh;
-	Buffer->AllocationSize.LowPart = FindData->nFileSizeLow;
+	entry = FindEntryAt(chunk, chunk->Used);
+	chunk->Used += EntrySize;
+	Store->Count++;
+	return entry;
+}
 
-	Buffer->CreationTime.HighPart = FindData->ftCreationTime.dwHighDateTime;
-	Buffer->CreationTime.LowPart  = FindData->ftCreationTime.dwLowDateTime;
 
-	Buffer->LastAccessTime.HighPart = FindData->ftLastAccessTime.dwHighDateTime;
-	Buffer->LastAccessTime.LowPart  = FindData->ftLastAccessTime.dwLowDateTime;
 
-	Buffer->LastWriteTime.HighPart = FindData->ftLastWriteTime.dwHighDateTime;
-	Buffer->LastWriteTime.LowPart  = FindData->ftLastWriteTime.dwLowDateTime;
+// gives the attributes of Entry to the metadata cache
+static VOID
+CacheFindEntry(
+	PDOKAN_INSTANCE		DokanInstance,
+	LPCWSTR				DirectoryName,
+	PDOKAN_FIND_ENTRY	Entry,
+	LPCWSTR				FileName)
+{
+	BY_HANDLE_FILE_INFORMATION	info;
 
-	Buffer->ChangeTime.HighPart = FindData->ftLastWriteTime.dwHighDateTime;
-	Buffer->ChangeTime.LowPart  = FindData->ftLastWriteTime.dwLowDateTime;
+	ZeroMemory(&info, sizeof(BY_HANDLE_FILE_INFORMATION));
 
-	Buffer->EaSize = 0;
+	info.dwFileAttributes	= Entry->FileAttributes;
+	info.ftCreationTime		= Entry->CreationTime;
+	info.ftLastAccessTime	= Entry->LastAccessTime;
+	info.ftLastWriteTime	= Entry->LastWriteTime;
+	info.nFileSizeHigh		= Entry->FileSizeHigh;
+	info.nFileSizeLow		= Entry->FileSizeLow;
+	info.nNumberOfLinks		= 1;
 
-	RtlCopyMemory(Buffer->FileName, FindData->cFileName, nameBytes);
+	AddAttributeCache(DokanInstance, DirectoryName, FileName,
+		Entry->FileNameLength, &info);
 }
 
 
 
-VOID
-DokanFillIdFullDirInfo(
-	PFILE_ID_FULL_DIR_INFORMATION	Buffer,
-	PWIN32_FIND_DATAW				FindData,
-	ULONG							Index)
+static VOID
+CacheFindData(
+	PDOKAN_INSTANCE		DokanInstance,
+	LPCWSTR				DirectoryName,
+	PDOKAN_FIND_STORE	Store)
 {
-	ULONG nameBytes = wcslen(FindData->cFileName) * sizeof(WCHAR);
+	PDOKAN_FIND_CHUNK	chunk;
 
-	Buffer->FileIndex = Index;
-	Buffer->FileAttributes = FindData->dwFileAttributes;
-	Buffer->FileNameLength = nameBytes;
+	for (chunk = Store->Head; chunk != NULL; chunk = chunk->Next) {
+		ULONG offset = 0;
+
+		while (offset < chunk->Used) {
+			PDOKAN_FIND_ENTRY entry = FindEntryAt(chunk, offset);
+			offset += FindEntrySize(entry->FileNameLength, entry->AlternateNameLength);
+			CacheFindEntry(DokanInstance, DirectoryName, entry, entry->Names);
+		}
+	}
+}
 
-	Buffer->EndOfFile.HighPart = FindData->nFileSizeHigh;
-	Buffer->EndOfFile.LowPart   = FindData->nFileSizeLow;
-	Buffer->AllocationSize.HighPart = FindData->nFileSizeHigh;
-	Buffer->AllocationSize.LowPart = FindData->nFileSizeLow;
 
-	Buffer->CreationTime.HighPart = FindData->ftCreationTime.dwHighDateTime;
-	Buffer->CreationTime.LowPart  = FindData->ftCreationTime.dwLowDateTime;
 
-	Buffer->LastAccessTime.HighPart = FindData->ftLastAccessTime.dwHighDateTime;
-	Buffer->LastAccessTime.LowPart  = FindData->ftLastAccessTime.dwLowDateTime;
+// keeps the entries of FindFiles in the metadata cache,
+// as they are packed in the chunks
+static VOID
+SaveFindData(
+	PDOKAN_INSTANCE		DokanInstance,
+	LPCWSTR				DirectoryName,
+	PDOKAN_FIND_STORE	Store)
+{
+	PDOKAN_FIND_CHUNK	chunk;
+	PCHAR				data;
+	ULONG				length = 0;
 
-	Buffer->LastWriteTime.HighPart = FindData->ftLastWriteTime.dwHighDateTime;
-	Buffer->LastWriteTime.LowPart  = FindData->ftLastWriteTime.dwLowDateTime;
+	for (chunk = Store->Head; chunk != NULL; chunk = chunk->Next) {
+		length += chunk->Used;
+	}
 
-	Buffer->ChangeTime.HighPart = FindData->ftLastWriteTime.dwHighDateTime;
-	Buffer->ChangeTime.LowPart  = FindData->ftLastWriteTime.dwLowDateTime;
+	data = malloc(length > 0 ? length : 1);
+	if (data == NULL) {
+		return;
+	}
 
-	Buffer->EaSize = 0;
-	Buffer->FileId.QuadPart = 0;
+	length = 0;
+	for (chunk = Store->Head; chunk != NULL; chunk = chunk->Next) {
+		CopyMemory(data + length, chunk->Data, chunk->Used);
+		length += chunk->Used;
+	}
 
-	RtlCopyMemory(Buffer->FileName, FindData->cFileName, nameBytes);
+	AddCache(DokanInstance, DOKAN_CACHE_FIND_FILES, DirectoryName, data, length);
+	free(data);
 }
 
 
-VOID
-DokanFillIdBothDirInfo(
-	PFILE_ID_BOTH_DIR_INFORMATION	Buffer,
-	PWIN32_FIND_DATAW				FindData,
-	ULONG							Index)
+
+// fills the empty Store with the entries SaveFindData kept,
+// returns FALSE when they are not cached
+static BOOL
+LoadFindData(
+	PDOKAN_INSTANCE		DokanInstance,
+	LPCWSTR				DirectoryName,
+	PDOKAN_FIND_STORE	Store)
+{
+	PCHAR	data;
+	ULONG	length;
+	ULONG	offset = 0;
+
+	data = LookupCacheCopy(DokanInstance, DOKAN_CACHE_FIND_FILES, DirectoryName, &length);
+	if (data == NULL) {
+		return FALSE;
+	}
+
+	while (offset < length) {
+		PDOKAN_FIND_ENTRY	source = (PDOKAN_FIND_ENTRY)(data + offset);
+		ULONG				entrySize = FindEntrySize(
+								source->FileNameLength, source->AlternateNameLength);
+		PDOKAN_FIND_ENTRY	entry = AllocateFindEntry(Store, entrySize);
+
+		if (entry == NULL) {
+			ClearFindData(Store);
+			free(data);
+			return FALSE;
+		}
+		CopyMemory(entry, source, entrySize);
+		offset += entrySize;
+	}
+
+	free(data);
+	return TRUE;
+}
+
+
+
+int WINAPI
+DokanFillFileData(
+	PWIN32_FIND_DATAW	FindData,
+	PDOKAN_FILE_INFO	FileInfo)
+{
+	PDOKAN_FIND_STORE	store = ((PDOKAN_OPEN_INFO)FileInfo->DokanContext)->DirList;
+	PDOKAN_FIND_ENTRY	entry;
+	USHORT				nameLength = 0;
+	USHORT				alternateLength = 0;
+
+	while (nameLength < MAX_PATH - 1 && FindData->cFileName[nameLength] != L'\0')
+		nameLength++;
+	while (alternateLength < 13 && FindData->cAlternateFileName[alternateLength] != L'\0')
+		alternateLength++;
+
+	entry = AllocateFindEntry(store, FindEntrySize(nameLength, alternateLength));
+	if (entry == NULL) {
+		return 1;
+	}
+
+	entry->FileAttributes	= FindData->dwFileAttributes;
+	entry->FileSizeHigh		= FindData->nFileSizeHigh;
+	entry->FileSizeLow		= FindData->nFileSizeLow;
+	entry->CreationTime		= FindData->ftCreationTime;
+	entry->LastAccessTime	= FindData->ftLastAccessTime;
+	entry->LastWriteTime	= FindData->ftLastWriteTime;
+	entry->FileNameLength	= nameLength;
+	entry->AlternateNameLength = alternateLength;
+
+	CopyMemory(entry->Names, FindData->cFileName, nameLength * sizeof(WCHAR));
+	entry->Names[nameLength] = L'\0';
+	CopyMemory(FindEntryAlternateName(entry), FindData->cAlternateFileName,
+		alternateLength * sizeof(WCHAR));
+	FindEntryAlternateName(entry)[alternateLength] = L'\0';
+
+	return 0;
+}
+
+
+
+/*
+
+Streaming enumeration with FindFilesWithCursor
+
+  Entries are written to the reply buffer while the FileSystem enumerates,
+  nothing is kept between queries except the cursor.
+
+  # DispatchFindWithCursor
+    # FileIndex == openInfo->FindIndex
+      # resume at openInfo->FindCursor
+    # otherwise (restart or index specified)
+      # start from cursor 0 and skip FileIndex matched entries
+    # FindFilesWithCursor
+      # DokanFillFileDataWithCursor
+        # returns 1 when the buffer is full
+    # save Index and Cursor of the last entry consumed in openInfo
+
+*/
+
+int WINAPI
+DokanFillFileDataWithCursor(
+	PWIN32_FIND_DATAW	FindData,
+	ULONG64				NextCursor,
+	PDOKAN_FILE_INFO	FileInfo)
 {
-	ULONG nameBytes = wcslen(FindData->cFileName) * sizeof(WCHAR);
+	PDOKAN_FIND_CURSOR	find = CONTAINING_RECORD(FileInfo, DOKAN_FIND_CURSOR, FileInfo);
+	DOKAN_FIND_ENTRY	entry;
+	ULONG				entrySize;
 
-	Buffer->FileIndex = Index;
-	Buffer->FileAttributes = FindData->dwFileAttributes;
-	Buffer->FileNameLength = nameBytes;
-	Buffer->ShortNameLength = 0;
+	if (find->Full) {
+		return 1;
+	}
 
-	Buffer->EndOfFile.HighPart = FindData->nFileSizeHigh;
-	Buffer->EndOfFile.LowPart   = FindData->nFileSizeLow;
-	Buffer->AllocationSize.HighPart = FindData->nFileSizeHigh;
-	Buffer->AllocationSize.LowPart = FindData->nFileSizeLow;
+	if (find->Expression &&
+		!MatchNameExpression(find->Expression, FindData->cFileName)) {
+		find->Cursor = NextCursor;
+		return 0;
+	}
 
-	Buffer->CreationTime.HighPart = FindData->ftCreationTime.dwHighDateTime;
-	Buffer->CreationTime.LowPart  = FindData->ftCreationTime.dwLowDateTime;
+	if (find->Skip > 0) {
+		find->Skip--;
+		find->Index++;
+		find->Cursor = NextCursor;
+		return 0;
+	}
 
-	Buffer->LastAccessTime.HighPart = FindData->ftLastAccessTime.dwHighDateTime;
-	Buffer->LastAccessTime.LowPart  = FindData->ftLastAccessTime.dwLowDateTime;
+	entry.FileAttributes	= FindData->dwFileAttributes;
+	entry.FileSizeHigh		= FindData->nFileSizeHigh;
+	entry.FileSizeLow		= FindData->nFileSizeLow;
+	entry.CreationTime		= FindData->ftCreationTime;
+	entry.LastAccessTime	= FindData->ftLastAccessTime;
+	entry.LastWriteTime		= FindData->ftLastWriteTime;
+	entry.FileNameLength	= 0;
+	while (entry.FileNameLength < MAX_PATH && FindData->cFileName[entry.FileNameLength] != L'\0')
+		entry.FileNameLength++;
+
+	// index+1 is very important, should use next entry index
+	entrySize = DokanEncodeDirEntry(find->Layout, find->CurrentBuffer,
+					&find->LengthRemaining, &entry, FindData->cFileName, find->Index+1);
+
+	// buffer is full, this entry is returned by the next query
+	if (entrySize == 0) {
+		find->Full = TRUE;
+		return 1;
+	}
 
-	Buffer->LastWriteTime.HighPart = FindData->ftLastWriteTime.dwHighDateTime;
-	Buffer->LastWriteTime.LowPart  = FindData->ftLastWriteTime.dwLowDateTime;
+	find->LastBuffer = find->CurrentBuffer;
+	((PFILE_NAMES_INFORMATION)find->CurrentBuffer)->NextEntryOffset = entrySize;
+	find->CurrentBuffer = (PCHAR)find->CurrentBuffer + entrySize;
 
-	Buffer->ChangeTime.HighPart = FindData->ftLastWriteTime.dwHighDateTime;
-	Buffer->ChangeTime.LowPart  = FindData->ftLastWriteTime.dwLowDateTime;
+	find->Index++;
+	find->Count++;
+	find->Cursor = NextCursor;
 
-	Buffer->EaSize = 0;
-	Buffer->FileId.QuadPart = 0;
+	if (find->DokanInstance != NULL) {
+		CacheFindEntry(find->DokanInstance, find->EventContext->Directory.DirectoryName,
+			&entry, FindData->cFileName);
+	}
 
-	RtlCopyMemory(Buffer->FileName, FindData->cFileName, nameBytes);
+	// end if needs to return single entry
+	if (find->EventContext->Flags & SL_RETURN_SINGLE_ENTRY) {
+		find->Full = TRUE;
+	}
+	return 0;
 }
 
 
-VOID
-DokanFillBothDirInfo(
-	PFILE_BOTH_DIR_INFORMATION		Buffer,
-	PWIN32_FIND_DATAW				FindData,
-	ULONG							Index)
+
+static int
+DispatchFindWithCursor(
+	const DOKAN_DIR_LAYOUT*	Layout,
+	PEVENT_CONTEXT		EventContext,
+	PEVENT_INFORMATION	EventInfo,
+	PDOKAN_FILE_INFO	FileInfo,
+	PDOKAN_OPEN_INFO	OpenInfo,
+	PDOKAN_INSTANCE		DokanInstance)
 {
-	ULONG nameBytes = wcslen(FindData->cFileName) * sizeof(WCHAR);
+	DOKAN_FIND_CURSOR	find;
+	LPCWSTR				pattern = L"*";
+	int					status;
+
+	ZeroMemory(&find, sizeof(DOKAN_FIND_CURSOR));
+	find.FileInfo		 = *FileInfo;
+	find.EventContext	 = EventContext;
+	find.Layout			 = Layout;
+	find.CurrentBuffer	 = EventInfo->Buffer;
+	find.LastBuffer		 = EventInfo->Buffer;
+	find.LengthRemaining = EventInfo->BufferLength;
+	if (GetCacheTimeout(DokanInstance, DOKAN_CACHE_ATTRIBUTES) != 0) {
+		find.DokanInstance = DokanInstance;
+	}
+
+	// search patten is specified
+	if (EventContext->Directory.SearchPatternLength != 0) {
+		pattern = (PWCHAR)((SIZE_T)&EventContext->Directory.SearchPatternBase[0]
+					+ (SIZE_T)EventContext->Directory.SearchPatternOffset);
+		find.Expression = CompileNameExpression(pattern, TRUE);
+		if (find.Expression == NULL) {
+			return -1;
+		}
+	}
 
-	Buffer->FileIndex = Index;
-	Buffer->FileAttributes = FindData->dwFileAttributes;
-	Buffer->FileNameLength = nameBytes;
-	Buffer->ShortNameLength = 0;
+	if (EventContext->Directory.FileIndex != 0 &&
+		EventContext->Directory.FileIndex == OpenInfo->FindIndex) {
+		find.Index	= OpenInfo->FindIndex;
+		find.Cursor	= OpenInfo->FindCursor;
+	} else {
+		find.Skip	= EventContext->Directory.FileIndex;
+	}
 
-	Buffer->EndOfFile.HighPart = FindData->nFileSizeHigh;
-	Buffer->EndOfFile.LowPart   = FindData->nFileSizeLow;
-	Buffer->AllocationSize.HighPart = FindData->nFileSizeHigh;
-	Buffer->AllocationSize.LowPart = FindData->nFileSizeLow;
+	DbgPrint("###FindFilesWithCursor %04d index %d cursor %I64d\n",
+		OpenInfo->EventId, EventContext->Directory.FileIndex, find.Cursor);
 
-	Buffer->CreationTime.HighPart = FindData->ftCreationTime.dwHighDateTime;
-	Buffer->CreationTime.LowPart  = FindData->ftCreationTime.dwLowDateTime;
+	status = DokanInstance->DokanOperations->FindFilesWithCursor(
+				EventContext->Directory.DirectoryName,
+				pattern,
+				find.Cursor,
+				DokanFillFileDataWithCursor,
+				&find.FileInfo);
 
-	Buffer->LastAccessTime.HighPart = FindData->ftLastAccessTime.dwHighDateTime;
-	Buffer->LastAccessTime.LowPart  = FindData->ftLastAccessTime.dwLowDateTime;
+	FileInfo->Context = find.FileInfo.Context;
+
+	if (find.Expression != NULL) {
+		FreeNameExpression(find.Expression);
+	}
 
-	Buffer->LastWriteTime.HighPart = FindData->ftLastWriteTime.dwHighDateTime;
-	Buffer->LastWriteTime.LowPart  = FindData->ftLastWriteTime.dwLowDateTime;
+	// Since next of the last entry doesn't exist, clear next offset
+	((PFILE_NAMES_INFORMATION)find.LastBuffer)->NextEntryOffset = 0;
 
-	Buffer->ChangeTime.HighPart = FindData->ftLastWriteTime.dwHighDateTime;
-	Buffer->ChangeTime.LowPart  = FindData->ftLastWriteTime.dwLowDateTime;
+	// acctualy used length of buffer
+	EventInfo->BufferLength = EventContext->Directory.BufferLength - find.LengthRemaining;
 
-	Buffer->EaSize = 0;
+	if (status < 0 || find.Count == 0) {
+		OpenInfo->FindIndex = 0;
+		OpenInfo->FindCursor = 0;
+		return -1;
+	}
 
-	RtlCopyMemory(Buffer->FileName, FindData->cFileName, nameBytes);
+	OpenInfo->FindIndex	 = find.Index;
+	OpenInfo->FindCursor = find.Cursor;
+	return find.Index;
 }
 
 
+
+// frees all entries, the first chunk is kept for the next listing
 VOID
-DokanFillNamesInfo(
-	PFILE_NAMES_INFORMATION	Buffer,
-	PWIN32_FIND_DATAW		FindData,
-	ULONG					Index)
+ClearFindData(
+	PDOKAN_FIND_STORE	Store)
 {
-	ULONG nameBytes = wcslen(FindData->cFileName) * sizeof(WCHAR);
+	PDOKAN_FIND_CHUNK	chunk;
+
+	if (Store->Head == NULL)
+		return;
 
-	Buffer->FileIndex = Index;
-	Buffer->FileNameLength = nameBytes;
+	chunk = Store->Head->Next;
+	while (chunk != NULL) {
+		PDOKAN_FIND_CHUNK next = chunk->Next;
+		free(chunk);
+		chunk = next;
+	}
 
-	RtlCopyMemory(Buffer->FileName, FindData->cFileName, nameBytes);
+	Store->Head->Next = NULL;
+	Store->Head->Used = 0;
+	Store->Tail = Store->Head;
+	Store->Count = 0;
 }
 
 
-ULONG
-DokanFillDirectoryInformation(
-	FILE_INFORMATION_CLASS	DirectoryInfo,
-	PVOID					Buffer,
-	PULONG					LengthRemaining,
-	PWIN32_FIND_DATAW		FindData,
-	ULONG					Index)
+
+// matched entries of DirList in order, so that
+// a query resumes at FileIndex without walking earlier entries
+typedef struct _DOKAN_FIND_MATCH {
+	// pattern which entries are matched with, NULL when not checked
+	PWCHAR				Pattern;
+	ULONG				Count;
+	PDOKAN_FIND_ENTRY	Entries[1];
+} DOKAN_FIND_MATCH, *PDOKAN_FIND_MATCH;
+
+
+
+static PDOKAN_FIND_MATCH
+BuildFindMatch(
+	PDOKAN_FIND_STORE	Store,
+	LPCWSTR		Pattern)
 {
-	ULONG	nameBytes;
-	ULONG	thisEntrySize;
-	
-	nameBytes = wcslen(FindData->cFileName) * sizeof(WCHAR);
-
-	thisEntrySize = nameBytes;
-
-	switch (DirectoryInfo) {
-	case FileDirectoryInformation:
-		thisEntrySize += sizeof(FILE_DIRECTORY_INFORMATION);
-		break;
-	case FileFullDirectoryInformation:
-		thisEntrySize += sizeof(FILE_FULL_DIR_INFORMATION);
-		break;
-	case FileNamesInformation:
-		thisEntrySize += sizeof(FILE_NAMES_INFORMATION);
-		break;
-	case FileBothDirectoryInformation:
-		thisEntrySize += sizeof(FILE_BOTH_DIR_INFORMATION);
-		break;
-	case FileIdBothDirectoryInformation:
-		thisEntrySize += sizeof(FILE_ID_BOTH_DIR_INFORMATION);
-		break;
-	default:
-		break;
+	PDOKAN_FIND_MATCH	match;
+	PDOKAN_NAME_EXPRESSION	expr = NULL;
+	PDOKAN_FIND_CHUNK	chunk;
+	ULONG				count = Store->Count;
+	ULONG				patternSize = 0;
+	SIZE_T				size;
+
+	if (Pattern) {
+		patternSize = (ULONG)(wcslen(Pattern) + 1) * sizeof(WCHAR);
+		expr = CompileNameExpression(Pattern, TRUE);
+		if (expr == NULL) {
+			return NULL;
+		}
 	}
 
-	// Must be align on a 8-byte boundary.
-	thisEntrySize = QuadAlign(thisEntrySize);
+	size = FIELD_OFFSET(DOKAN_FIND_MATCH, Entries)
+			+ sizeof(PDOKAN_FIND_ENTRY) * (count > 0 ? count : 1) + patternSize;
 
-	// no more memory, don't fill any more
-	if (*LengthRemaining < thisEntrySize) {
-		DbgPrint("  no memory\n");
-		return 0;
+	match = (PDOKAN_FIND_MATCH)malloc(size);
+	if (match == NULL) {
+		if (expr != NULL) {
+			FreeNameExpression(expr);
+		}
+		return NULL;
 	}
+	match->Pattern = NULL;
+	match->Count = 0;
 
-	RtlZeroMemory(Buffer, thisEntrySize);
-
-	switch (DirectoryInfo) {
-	case FileDirectoryInformation:
-		DokanFillDirInfo(Buffer, FindData, Index);
-		break;
-	case FileFullDirectoryInformation:
-		DokanFillFullDirInfo(Buffer, FindData, Index);
-		break;
-	case FileNamesInformation:
-		DokanFillNamesInfo(Buffer, FindData, Index);
-		break;
-	case FileBothDirectoryInformation:
-		DokanFillBothDirInfo(Buffer, FindData, Index);
-		break;
-	case FileIdBothDirectoryInformation:
-		DokanFillIdBothDirInfo(Buffer, FindData, Index);
-		break;
-	default:
-		break;
+	if (Pattern) {
+		match->Pattern = (PWCHAR)&match->Entries[count > 0 ? count : 1];
+		CopyMemory(match->Pattern, Pattern, patternSize);
 	}
 
-	*LengthRemaining -= thisEntrySize;
+	for (chunk = Store->Head; chunk != NULL; chunk = chunk->Next) {
+		ULONG offset = 0;
 
-	return thisEntrySize;
-}
+		while (offset < chunk->Used) {
+			PDOKAN_FIND_ENTRY entry = FindEntryAt(chunk, offset);
+			offset += FindEntrySize(entry->FileNameLength, entry->AlternateNameLength);
 
+			// pattern is not specified or pattern match is ignore cases
+			if (!expr || MatchNameExpression(expr, entry->Names)) {
+				match->Entries[match->Count++] = entry;
+			}
+		}
+	}
 
+	if (expr != NULL) {
+		FreeNameExpression(expr);
+	}
 
+	DbgPrint("  %d of %d entries matched\n", match->Count, count);
+	return match;
+}
 
 
-int WINAPI
-DokanFillFileData(
-	PWIN32_FIND_DATAW	FindData,
-	PDOKAN_FILE_INFO	FileInfo)
+
+static BOOL
+IsSameFindMatch(
+	PDOKAN_FIND_MATCH	Match,
+	LPCWSTR				Pattern)
 {
-	PLIST_ENTRY listHead = ((PDOKAN_OPEN_INFO)FileInfo->DokanContext)->DirListHead;
-	PDOKAN_FIND_DATA	findData;
-	
-	findData = malloc(sizeof(DOKAN_FIND_DATA));
-	ZeroMemory(findData, sizeof(DOKAN_FIND_DATA));
-	InitializeListHead(&findData->ListEntry);
+	if (Match->Pattern == NULL || Pattern == NULL) {
+		return Match->Pattern == Pattern;
+	}
+	return wcscmp(Match->Pattern, Pattern) == 0;
+}
 
-	findData->FindData = *FindData;
 
-	InsertTailList(listHead, &findData->ListEntry);
-	return 0;
+
+static VOID
+ClearFindMatch(
+	PDOKAN_OPEN_INFO	OpenInfo)
+{
+	if (OpenInfo->FindMatch != NULL) {
+		free(OpenInfo->FindMatch);
+		OpenInfo->FindMatch = NULL;
+	}
 }
 
 
 
 VOID
-ClearFindData(
-  PLIST_ENTRY	ListHead)
+ReleaseFindData(
+	PDOKAN_OPEN_INFO	OpenInfo)
 {
-	// free all list entries
-	while(!IsListEmpty(ListHead)) {
-		PLIST_ENTRY entry = RemoveHeadList(ListHead);
-		PDOKAN_FIND_DATA find = CONTAINING_RECORD(entry, DOKAN_FIND_DATA, ListEntry);
-		free(find);
+	ClearFindMatch(OpenInfo);
+
+	if (OpenInfo->DirList != NULL) {
+		ClearFindData(OpenInfo->DirList);
+		free(OpenInfo->DirList->Head);
+		free(OpenInfo->DirList);
+		OpenInfo->DirList = NULL;
 	}
 }
 
 
 
-// add entry which matches the pattern specifed in EventContext
+// add matched entries from FileIndex
 // to the buffer specifed in EventInfo
 //
 LONG
 MatchFiles(
+	const DOKAN_DIR_LAYOUT*	Layout,
 	PEVENT_CONTEXT			EventContext,
 	PEVENT_INFORMATION		EventInfo,
-	PLIST_ENTRY				FindDataList,
-	BOOLEAN					PatternCheck)
+	PDOKAN_FIND_MATCH		Match)
 {
-	PLIST_ENTRY	thisEntry, listHead, nextEntry;
-
 	ULONG	lengthRemaining = EventInfo->BufferLength;
 	PVOID	currentBuffer	= EventInfo->Buffer;
 	PVOID	lastBuffer		= currentBuffer;
-	ULONG	index = 0;
-
-	PWCHAR pattern = NULL;
-	
-	// search patten is specified
-	if (PatternCheck && EventContext->Directory.SearchPatternLength != 0) {
-		pattern = (PWCHAR)((SIZE_T)&EventContext->Directory.SearchPatternBase[0]
-					+ (SIZE_T)EventContext->Directory.SearchPatternOffset);
-	}
+	ULONG	index = EventContext->Directory.FileIndex;
 
-	listHead = FindDataList;
-
-    for(thisEntry = listHead->Flink;
-		thisEntry != listHead;
-		thisEntry = nextEntry) {
-        
-		PDOKAN_FIND_DATA	find;
-		nextEntry = thisEntry->Flink;
-
-		find = CONTAINING_RECORD(thisEntry, DOKAN_FIND_DATA, ListEntry);
-
-		DbgPrintW(L"FileMatch? : %s (%s,%d,%d)\n", find->FindData.cFileName,
-			(pattern ? pattern : L"null"),
-			EventContext->Directory.FileIndex, index);
-
-		// pattern is not specified or pattern match is ignore cases
-		if (!pattern || DokanIsNameInExpression(pattern, find->FindData.cFileName, TRUE)) {
-			
-			if(EventContext->Directory.FileIndex <= index) {
-				// index+1 is very important, should use next entry index
-				ULONG entrySize = DokanFillDirectoryInformation(
-									EventContext->Directory.FileInformationClass,
-									currentBuffer, &lengthRemaining, &find->FindData, index+1);
-				// buffer is full
-				if (entrySize == 0)
-					break;
-			
-				// pointer of the current last entry
-				lastBuffer = currentBuffer;
-
-				// end if needs to return single entry
-				if (EventContext->Flags & SL_RETURN_SINGLE_ENTRY) {
-					DbgPrint("  =>return single entry\n");
-					index++;
-					break;
-				}
+	for (; index < Match->Count; ++index) {
+		PDOKAN_FIND_ENTRY entry = Match->Entries[index];
 
-				DbgPrint("  =>return\n");
+		// index+1 is very important, should use next entry index
+		ULONG entrySize = DokanEncodeDirEntry(
+							Layout, currentBuffer, &lengthRemaining,
+							entry, entry->Names, index+1);
+		// buffer is full
+		if (entrySize == 0)
+			break;
 
-				// the offset of next entry
-				((PFILE_BOTH_DIR_INFORMATION)currentBuffer)->NextEntryOffset = entrySize;
+		// pointer of the current last entry
+		lastBuffer = currentBuffer;
 
-				// next buffer position
-				(PCHAR)currentBuffer += entrySize;
-			}
+		// end if needs to return single entry
+		if (EventContext->Flags & SL_RETURN_SINGLE_ENTRY) {
+			DbgPrint("  =>return single entry\n");
 			index++;
+			break;
 		}
+
+		// the offset of next entry
+		((PFILE_BOTH_DIR_INFORMATION)currentBuffer)->NextEntryOffset = entrySize;
+
+		// next buffer position
+		currentBuffer = (PCHAR)currentBuffer + entrySize;
 	}
 
 	// Since next of the last entry doesn't exist, clear next offset
@@ -435,29 +790,35 @@ DispatchDirectoryInformation(
 	PDOKAN_OPEN_INFO	openInfo;
 	int					status = 0;
 	ULONG				fileInfoClass = EventContext->Directory.FileInformationClass;
+	const DOKAN_DIR_LAYOUT*	layout = DokanGetDirLayout(fileInfoClass);
 	ULONG				sizeOfEventInfo = sizeof(EVENT_INFORMATION) - 8 + EventContext->Directory.BufferLength;
 
-	BOOLEAN				patternCheck = TRUE;
+	LPCWSTR				pattern = NULL;
+	// FindFilesWithPattern returns matched entries only
+	BOOLEAN				patternCheck =
+		DokanInstance->DokanOperations->FindFilesWithPattern == NULL;
 
 	CheckFileName(EventContext->Directory.DirectoryName);
 
 	eventInfo = DispatchCommon(
 		EventContext, sizeOfEventInfo, DokanInstance, &fileInfo, &openInfo);
 
+	if (openInfo == NULL) {
+		SendEventInformation(Handle, eventInfo, sizeof(EVENT_INFORMATION), DokanInstance);
+		FreeEventInformation(eventInfo);
+		return;
+	}
+
 	// check whether this is handled FileInfoClass
-	if (fileInfoClass != FileDirectoryInformation &&
-		fileInfoClass != FileFullDirectoryInformation &&
-		fileInfoClass != FileNamesInformation &&
-		fileInfoClass != FileIdBothDirectoryInformation &&
-		fileInfoClass != FileBothDirectoryInformation) {
-		
+	if (layout == NULL) {
+
 		DbgPrint("not suported type %d\n", fileInfoClass);
 
 		// send directory info to driver
 		eventInfo->BufferLength = 0;
 		eventInfo->Status = STATUS_NOT_IMPLEMENTED;
-		SendEventInformation(Handle, eventInfo, sizeOfEventInfo, DokanInstance);
-		free(eventInfo);
+		SendEventInformation(Handle, eventInfo, EVENT_INFO_REPLY_LENGTH(eventInfo), DokanInstance);
+		FreeEventInformation(eventInfo);
 		return;
 	}
 
@@ -466,49 +827,99 @@ DispatchDirectoryInformation(
 	// this buffer length is fixed in MatchFiles funciton
 	eventInfo->BufferLength		= EventContext->Directory.BufferLength; 
 
-	if (openInfo->DirListHead == NULL) {
-		openInfo->DirListHead = malloc(sizeof(LIST_ENTRY));
-		InitializeListHead(openInfo->DirListHead);
+	if (DOKAN_FIND_CURSOR_SUPPORTED_VERSION <= DokanInstance->DokanOptions->Version &&
+		DokanInstance->DokanOperations->FindFilesWithCursor) {
+		LONG	index = DispatchFindWithCursor(
+						layout, EventContext, eventInfo, &fileInfo, openInfo, DokanInstance);
+
+		if (index < 0) {
+			if (EventContext->Directory.FileIndex == 0) {
+				DbgPrint("  STATUS_NO_SUCH_FILE\n");
+				eventInfo->Status = STATUS_NO_SUCH_FILE;
+			} else {
+				DbgPrint("  STATUS_NO_MORE_FILES\n");
+				eventInfo->Status = STATUS_NO_MORE_FILES;
+			}
+			eventInfo->BufferLength = 0;
+			eventInfo->Directory.Index = EventContext->Directory.FileIndex;
+		} else {
+			DbgPrint("index to %d\n", index);
+			eventInfo->Status = STATUS_SUCCESS;
+			eventInfo->Directory.Index = index;
+		}
+
+		openInfo->UserContext = fileInfo.Context;
+		SendEventInformation(Handle, eventInfo, EVENT_INFO_REPLY_LENGTH(eventInfo), DokanInstance);
+		FreeEventInformation(eventInfo);
+		return;
+	}
+
+	if (openInfo->DirList == NULL) {
+		openInfo->DirList = malloc(sizeof(DOKAN_FIND_STORE));
+		if (openInfo->DirList == NULL) {
+			eventInfo->BufferLength = 0;
+			eventInfo->Status = STATUS_INSUFFICIENT_RESOURCES;
+			SendEventInformation(Handle, eventInfo, EVENT_INFO_REPLY_LENGTH(eventInfo), DokanInstance);
+			FreeEventInformation(eventInfo);
+			return;
+		}
+		ZeroMemory(openInfo->DirList, sizeof(DOKAN_FIND_STORE));
 	}
 
 	if (EventContext->Directory.FileIndex == 0) {
-		ClearFindData(openInfo->DirListHead);
+		ClearFindMatch(openInfo);
+		ClearFindData(openInfo->DirList);
+	}
+
+	// if search pattern is specified
+	if (EventContext->Directory.SearchPatternLength != 0) {
+		pattern = (PWCHAR)((SIZE_T)&EventContext->Directory.SearchPatternBase[0]
+				+ (SIZE_T)EventContext->Directory.SearchPatternOffset);
 	}
 
-	if (IsListEmpty(openInfo->DirListHead)) {
+	if (openInfo->DirList->Count == 0) {
+		BOOL	cached = FALSE;
 
 		DbgPrint("###FindFiles %04d\n", openInfo->EventId);
 
+		ClearFindMatch(openInfo);
+
 		// if user defined FindFilesWithPattern
 		if (DokanInstance->DokanOperations->FindFilesWithPattern) {
-			LPCWSTR	pattern = L"*";
-		
-			// if search pattern is specified
-			if (EventContext->Directory.SearchPatternLength != 0) {
-				pattern = (PWCHAR)((SIZE_T)&EventContext->Directory.SearchPatternBase[0]
-						+ (SIZE_T)EventContext->Directory.SearchPatternOffset);
-			}
-
-			patternCheck = FALSE; // do not recheck pattern later in MatchFiles
 
 			status = DokanInstance->DokanOperations->FindFilesWithPattern(
 						EventContext->Directory.DirectoryName,
-						pattern,
+						pattern ? pattern : L"*",
 						DokanFillFileData,
 						&fileInfo);
 	
 		} else if (DokanInstance->DokanOperations->FindFiles) {
 
-			patternCheck = TRUE; // do pattern check later in MachFiles
+			if (LoadFindData(DokanInstance,
+					EventContext->Directory.DirectoryName, openInfo->DirList)) {
+				DbgPrint("  FindFiles cache hit\n");
+				cached = TRUE;
 
-			// call FileSystem specifeid callback routine
-			status = DokanInstance->DokanOperations->FindFiles(
-						EventContext->Directory.DirectoryName,
-						DokanFillFileData,
-						&fileInfo);
+			} else {
+				// call FileSystem specifeid callback routine
+				status = DokanInstance->DokanOperations->FindFiles(
+							EventContext->Directory.DirectoryName,
+							DokanFillFileData,
+							&fileInfo);
+
+				if (status >= 0 && GetCacheTimeout(DokanInstance, DOKAN_CACHE_FIND_FILES) != 0) {
+					SaveFindData(DokanInstance,
+						EventContext->Directory.DirectoryName, openInfo->DirList);
+				}
+			}
 		} else {
 			status = -1;
 		}
+
+		if (status >= 0 && !cached && GetCacheTimeout(DokanInstance, DOKAN_CACHE_ATTRIBUTES) != 0) {
+			CacheFindData(DokanInstance,
+				EventContext->Directory.DirectoryName, openInfo->DirList);
+		}
 	}
 
 
@@ -526,14 +937,26 @@ DispatchDirectoryInformation(
 		eventInfo->BufferLength = 0;
 		eventInfo->Directory.Index = EventContext->Directory.FileIndex;
 		// free all of list entries
-		ClearFindData(openInfo->DirListHead);
+		ClearFindMatch(openInfo);
+		ClearFindData(openInfo->DirList);
 	} else {
-		LONG	index;
+		LONG	index = -1;
+		LPCWSTR	matchPattern = patternCheck ? pattern : NULL;
 		eventInfo->Status = STATUS_SUCCESS;
 
-		DbgPrint("index from %d\n", EventContext->Directory.FileIndex);
 		// extract entries that match search pattern from FindFiles result
-		index = MatchFiles(EventContext, eventInfo, openInfo->DirListHead, patternCheck);
+		if (openInfo->FindMatch != NULL &&
+			!IsSameFindMatch(openInfo->FindMatch, matchPattern)) {
+			ClearFindMatch(openInfo);
+		}
+		if (openInfo->FindMatch == NULL) {
+			openInfo->FindMatch = BuildFindMatch(openInfo->DirList, matchPattern);
+		}
+
+		DbgPrint("index from %d\n", EventContext->Directory.FileIndex);
+		if (openInfo->FindMatch != NULL) {
+			index = MatchFiles(layout, EventContext, eventInfo, openInfo->FindMatch);
+		}
 
 		// there is no matched file
 		if (index <0) {
@@ -547,7 +970,8 @@ DispatchDirectoryInformation(
 			eventInfo->BufferLength = 0;
 			eventInfo->Directory.Index = EventContext->Directory.FileIndex;
 
-			ClearFindData(openInfo->DirListHead);
+			ClearFindMatch(openInfo);
+			ClearFindData(openInfo->DirList);
 
 		} else {
 			DbgPrint("index to %d\n", index);
@@ -560,116 +984,7 @@ DispatchDirectoryInformation(
 	openInfo->UserContext = fileInfo.Context;
 
 	// send directory information to driver
-	SendEventInformation(Handle, eventInfo, sizeOfEventInfo, DokanInstance);
-	free(eventInfo);
+	SendEventInformation(Handle, eventInfo, EVENT_INFO_REPLY_LENGTH(eventInfo), DokanInstance);
+	FreeEventInformation(eventInfo);
 	return;
 }
-
-
-
-#define DOS_STAR                        (L'<')
-#define DOS_QM                          (L'>')
-#define DOS_DOT                         (L'"')
-
-// check whether Name matches Expression
-// Expression can contain "?"(any one character) and "*" (any string)
-// when IgnoreCase is TRUE, do case insenstive matching
-//
-// http://msdn.microsoft.com/en-us/library/ff546850(v=VS.85).aspx
-// * (asterisk) Matches zero or more characters.
-// ? (question mark) Matches a single character.
-// DOS_DOT Matches either a period or zero characters beyond the name string.
-// DOS_QM Matches any single character or, upon encountering a period or end
-//        of name string, advances the expression to the end of the set of
-//        contiguous DOS_QMs.
-// DOS_STAR Matches zero or more characters until encountering and matching
-//          the final . in the name.
-BOOL DOKANAPI
-DokanIsNameInExpression(
-	LPCWSTR		Expression, // matching pattern
-	LPCWSTR		Name, // file name
-	BOOL		IgnoreCase)
-{
-	ULONG ei = 0;
-	ULONG ni = 0;
-
-	while (Expression[ei] != '\0') {
-
-		if (Expression[ei] == L'*') {
-			ei++;
-			if (Expression[ei] == '\0')
-				return TRUE;
-
-			while (Name[ni] != '\0') {
-				if (DokanIsNameInExpression(&Expression[ei], &Name[ni], IgnoreCase))
-					return TRUE;
-				ni++;
-			}
-
-		} else if (Expression[ei] == DOS_STAR) {
-
-			ULONG p = ni;
-			ULONG lastDot = 0;
-			ei++;
-			
-			while (Name[p] != '\0') {
-				if (Name[p] == L'.')
-					lastDot = p;
-				p++;
-			}
-			
-
-			while (TRUE) {
-				if (Name[ni] == '\0' || ni == lastDot)
-					break;
-
-				if (DokanIsNameInExpression(&Expression[ei], &Name[ni], IgnoreCase))
-					return TRUE;
-				ni++;
-			}
-			
-		} else if (Expression[ei] == DOS_QM)  {
-			
-			ei++;
-			if (Name[ni] != L'.') {
-				ni++;
-			} else {
-
-				ULONG p = ni + 1;
-				while (Name[p] != '\0') {
-					if (Name[p] == L'.')
-						break;
-					p++;
-				}
-
-				if (Name[p] == L'.')
-					ni++;
-			}
-
-		} else if (Expression[ei] == DOS_DOT) {
-			ei++;
-
-			if (Name[ni] == L'.')
-				ni++;
-
-		} else {
-			if (Expression[ei] == L'?') {
-				ei++; ni++;
-			} else if(IgnoreCase && towupper(Expression[ei]) == towupper(Name[ni])) {
-				ei++; ni++;
-			} else if(!IgnoreCase && Expression[ei] == Name[ni]) {
-				ei++; ni++;
-			} else {
-				return FALSE;
-			}
-		}
-	}
-
-	if (ei == wcslen(Expression) && ni == wcslen(Name))
-		return TRUE;
-	
-
-	return FALSE;
-}
-
-
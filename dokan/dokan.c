@@ -57,6 +57,12 @@ NewDokanInstance()
 		&instance->CriticalSection, 0x80000400);
 #endif
 
+	InitializeHandleTable(&instance->HandleTable);
+	InitializeCache(&instance->Cache);
+	instance->EventBufferSize = EVENT_CONTEXT_MAX_SIZE;
+	instance->PendingOperationCount = 1;
+	instance->OperationsDone = CreateEvent(NULL, TRUE, FALSE, NULL);
+
 	InitializeListHead(&instance->ListEntry);
 
 	EnterCriticalSection(&g_InstanceCriticalSection);
@@ -75,9 +81,28 @@ DeleteDokanInstance(PDOKAN_INSTANCE Instance)
 	RemoveEntryList(&Instance->ListEntry);
 	LeaveCriticalSection(&g_InstanceCriticalSection);
 
+	DeleteHandleTable(Instance);
+	DeleteCache(&Instance->Cache);
+	if (Instance->OperationsDone != NULL) {
+		CloseHandle(Instance->OperationsDone);
+	}
+
 	free(Instance);
 }
 
+ULONG
+GetEventBufferSize(
+	PDOKAN_OPTIONS	DokanOptions)
+{
+	ULONG	size = EVENT_CONTEXT_MAX_SIZE;
+
+	if (DOKAN_EVENT_BUFFER_SUPPORTED_VERSION <= DokanOptions->Version &&
+		DokanOptions->EventBufferSize > EVENT_CONTEXT_MAX_SIZE) {
+		size = min(DokanOptions->EventBufferSize, EVENT_CONTEXT_MAX_BUFFER_SIZE) & ~7;
+	}
+	return size;
+}
+
 BOOL
 IsValidDriveLetter(WCHAR DriveLetter)
 {
@@ -118,12 +143,10 @@ CheckMountPoint(LPCWSTR	MountPoint)
 int DOKANAPI
 DokanMain(PDOKAN_OPTIONS DokanOptions, PDOKAN_OPERATIONS DokanOperations)
 {
-	ULONG	threadNum = 0;
-	ULONG	i;
 	BOOL	status;
 	int		error;
 	HANDLE	device;
-	HANDLE	threadIds[DOKAN_MAX_THREAD];
+	HANDLE	keepAliveThread = NULL;
 	ULONG   returnedLength;
 	char	buffer[1024];
 	BOOL	useMountPoint = FALSE;
@@ -141,17 +164,6 @@ DokanMain(PDOKAN_OPTIONS DokanOptions, PDOKAN_OPERATIONS DokanOperations)
 		g_DebugMode = TRUE;
 	}
 
-	if (DokanOptions->ThreadCount == 0) {
-		DokanOptions->ThreadCount = 5;
-
-	} else if (DOKAN_MAX_THREAD-1 < DokanOptions->ThreadCount) {
-		// DOKAN_MAX_THREAD includes DokanKeepAlive thread, so 
-		// available thread is DOKAN_MAX_THREAD -1
-		DokanDbgPrintW(L"Dokan Error: too many thread count %d\n",
-			DokanOptions->ThreadCount);
-		DokanOptions->ThreadCount = DOKAN_MAX_THREAD-1;
-	}
-
 	if (DOKAN_MOUNT_POINT_SUPPORTED_VERSION <= DokanOptions->Version &&
 		DokanOptions->MountPoint) {
 		error = CheckMountPoint(DokanOptions->MountPoint);
@@ -186,6 +198,7 @@ DokanMain(PDOKAN_OPTIONS DokanOptions, PDOKAN_OPERATIONS DokanOperations)
 	instance = NewDokanInstance();
 	instance->DokanOptions = DokanOptions;
 	instance->DokanOperations = DokanOperations;
+	instance->Transport = &DokanDeviceTransport;
 	if (useMountPoint) {
 		wcscpy_s(instance->MountPoint, sizeof(instance->MountPoint) / sizeof(WCHAR),
 				DokanOptions->MountPoint);
@@ -209,7 +222,7 @@ DokanMain(PDOKAN_OPTIONS DokanOptions, PDOKAN_OPERATIONS DokanOperations)
 	DbgPrintW(L"mounted: %s -> %s\n", instance->MountPoint, instance->DeviceName);
 
 	if (DokanOptions->Options & DOKAN_OPTION_KEEP_ALIVE) {
-		threadIds[threadNum++] = (HANDLE)_beginthreadex(
+		keepAliveThread = (HANDLE)_beginthreadex(
 			NULL, // Security Atributes
 			0, //stack size
 			DokanKeepAlive,
@@ -218,24 +231,36 @@ DokanMain(PDOKAN_OPTIONS DokanOptions, PDOKAN_OPERATIONS DokanOperations)
 			NULL);
 	}
 
-	for (i = 0; i < DokanOptions->ThreadCount; ++i) {
-		threadIds[threadNum++] = (HANDLE)_beginthreadex(
-			NULL, // Security Atributes
-			0, //stack size
-			DokanLoop,
-			(PVOID)instance, // param
-			0, // create flag
-			NULL);
+	if (DokanOptions->Options & DOKAN_OPTION_RING &&
+		!DokanRingStart(instance)) {
+		DbgPrint("Dokan Error: can't start the ring, use ioctls\n");
 	}
 
+	if (!StartDokanLoop(instance)) {
+		DokanDbgPrint("Dokan Error: can't start threads\n");
+		DokanRemoveMountPoint(instance->MountPoint);
+		if (keepAliveThread) {
+			WaitForSingleObject(keepAliveThread, INFINITE);
+			CloseHandle(keepAliveThread);
+		}
+		DokanRingStop(instance);
+		CloseHandle(device);
+		DeleteDokanInstance(instance);
+		return DOKAN_START_ERROR;
+	}
 
 	// wait for thread terminations
-	WaitForMultipleObjects(threadNum, threadIds, TRUE, INFINITE);
+	WaitDokanLoop(instance);
 
-	for (i = 0; i < threadNum; ++i) {
-		CloseHandle(threadIds[i]);
+	if (keepAliveThread) {
+		WaitForSingleObject(keepAliveThread, INFINITE);
+		CloseHandle(keepAliveThread);
 	}
 
+	WaitIoOperations(instance);
+
+	DokanRingStop(instance);
+
     CloseHandle(device);
 
 	Sleep(1000);
@@ -256,121 +281,178 @@ GetRawDeviceName(LPCWSTR	DeviceName)
 	return rawDeviceName;
 }
 
+static VOID
+DispatchEvent(
+	HANDLE				Handle,
+	PEVENT_CONTEXT		EventContext,
+	PDOKAN_INSTANCE		DokanInstance)
+{
+	switch (EventContext->MajorFunction) {
+	case IRP_MJ_CREATE:
+		DispatchCreate(Handle, EventContext, DokanInstance);
+		break;
+	case IRP_MJ_CLEANUP:
+		DispatchCleanup(Handle, EventContext, DokanInstance);
+		break;
+	case IRP_MJ_CLOSE:
+		DispatchClose(Handle, EventContext, DokanInstance);
+		break;
+	case IRP_MJ_DIRECTORY_CONTROL:
+		DispatchDirectoryInformation(Handle, EventContext, DokanInstance);
+		break;
+	case IRP_MJ_READ:
+		DispatchRead(Handle, EventContext, DokanInstance);
+		break;
+	case IRP_MJ_WRITE:
+		DispatchWrite(Handle, EventContext, DokanInstance);
+		break;
+	case IRP_MJ_QUERY_INFORMATION:
+		DispatchQueryInformation(Handle, EventContext, DokanInstance);
+		break;
+	case IRP_MJ_QUERY_VOLUME_INFORMATION:
+		DispatchQueryVolumeInformation(Handle, EventContext, DokanInstance);
+		break;
+	case IRP_MJ_LOCK_CONTROL:
+		DispatchLock(Handle, EventContext, DokanInstance);
+		break;
+	case IRP_MJ_SET_INFORMATION:
+		DispatchSetInformation(Handle, EventContext, DokanInstance);
+		break;
+	case IRP_MJ_FLUSH_BUFFERS:
+		DispatchFlush(Handle, EventContext, DokanInstance);
+		break;
+	case IRP_MJ_QUERY_SECURITY:
+		DispatchQuerySecurity(Handle, EventContext, DokanInstance);
+		break;
+	case IRP_MJ_SET_SECURITY:
+		DispatchSetSecurity(Handle, EventContext, DokanInstance);
+		break;
+	case IRP_MJ_SHUTDOWN:
+		// this cass is used before unmount not shutdown
+		DispatchUnmount(Handle, EventContext, DokanInstance);
+		break;
+	default:
+		break;
+	}
+}
+
+
+static ULONG
+CountEvents(
+	PVOID	Buffer,
+	ULONG	Length)
+{
+	ULONG	count = 0;
+	ULONG	offset;
+
+	for (offset = 0; offset < Length; ++count) {
+		PEVENT_CONTEXT context = (PEVENT_CONTEXT)((PCHAR)Buffer + offset);
+		if (context->Length == 0) {
+			break;
+		}
+		offset = EVENT_CONTEXT_ALIGN(offset + context->Length);
+	}
+	return count;
+}
+
+
 DWORD WINAPI
 DokanLoop(
    PDOKAN_INSTANCE DokanInstance
 	)
 {
 	HANDLE	device;
-	char	buffer[EVENT_CONTEXT_MAX_SIZE];
-	ULONG	count = 0;
+	PVOID	buffer;
 	BOOL	status;
 	ULONG	returnedLength;
+	ULONG	offset;
+	ULONG	eventCount;
 	DWORD	result = 0;
+	PDOKAN_TRANSPORT transport = DokanInstance->Transport;
 
-	RtlZeroMemory(buffer, sizeof(buffer));
+	// EVENT_CONTEXT has ULONG64 field, malloc aligns it
+	buffer = malloc(DokanInstance->EventBufferSize);
+	if (buffer == NULL) {
+		DbgPrint("Dokan Error: can't allocate event buffer %d\n",
+			DokanInstance->EventBufferSize);
+		result = -1;
+		LeaveDokanLoop(DokanInstance);
+		_endthreadex(result);
+		return result;
+	}
 
-	device = CreateFile(
-				GetRawDeviceName(DokanInstance->DeviceName), // lpFileName
-				GENERIC_READ | GENERIC_WRITE,       // dwDesiredAccess
-				FILE_SHARE_READ | FILE_SHARE_WRITE, // dwShareMode
-				NULL,                               // lpSecurityAttributes
-				OPEN_EXISTING,                      // dwCreationDistribution
-				0,                                  // dwFlagsAndAttributes
-				NULL                                // hTemplateFile
-			);
+	device = transport->OpenChannel(DokanInstance);
 
 	if (device == INVALID_HANDLE_VALUE) {
-		DbgPrint("Dokan Error: CreateFile failed %ws: %d\n",
-			GetRawDeviceName(DokanInstance->DeviceName), GetLastError());
 		result = -1;
+		free(buffer);
+		LeaveDokanLoop(DokanInstance);
 		_endthreadex(result);
 		return result;
 	}
 
 	while(1) {
 
-		status = DeviceIoControl(
-					device,				// Handle to device
-					IOCTL_EVENT_WAIT,	// IO Control code
-					NULL,				// Input Buffer to driver.
-					0,					// Length of input buffer in bytes.
-					buffer,             // Output Buffer from driver.
-					sizeof(buffer),		// Length of output buffer in bytes.
-					&returnedLength,	// Bytes placed in buffer.
-					NULL                // synchronous call
-					);
+		if (!EnterIdleState(DokanInstance)) {
+			// the pool shrinks, ThreadCount is already decremented
+			transport->CloseChannel(device);
+			free(buffer);
+			_endthreadex(result);
+			return result;
+		}
+
+		status = transport->WaitEvent(
+					device,
+					buffer,
+					DokanInstance->EventBufferSize,
+					&returnedLength);
+
+		eventCount = status ? CountEvents(buffer, returnedLength) : 0;
+		LeaveIdleState(DokanInstance, eventCount);
 
 		if (!status) {
-			DbgPrint("Ioctl failed with code %d\n", GetLastError());
 			result = -1;
 			break;
 		}
 
 		//printf("#%d got notification %d\n", (ULONG)Param, count++);
 
-		if(returnedLength > 0) {
-			PEVENT_CONTEXT context = (PEVENT_CONTEXT)buffer;
+		if (returnedLength == 0) {
+			DbgPrint("ReturnedLength %d\n", returnedLength);
+			continue;
+		}
+
+		// the buffer may contain several EVENT_CONTEXTs,
+		// dispatch all of them before waiting again
+		for (offset = 0; offset < returnedLength;) {
+			PEVENT_CONTEXT context = (PEVENT_CONTEXT)((PCHAR)buffer + offset);
+
+			if (context->Length < sizeof(EVENT_CONTEXT) - sizeof(context->Length) ||
+				returnedLength - offset < context->Length) {
+				DbgPrint("Dokan Error: Invalid event length %d\n", context->Length);
+				break;
+			}
+			offset = EVENT_CONTEXT_ALIGN(offset + context->Length);
+
+			InterlockedDecrement(&DokanInstance->QueueDepth);
+			eventCount--;
+
 			if (context->MountId != DokanInstance->MountId) {
 				DbgPrint("Dokan Error: Invalid MountId (expected:%d, acctual:%d)\n",
 						DokanInstance->MountId, context->MountId);
 				continue;
 			}
 
-			switch (context->MajorFunction) {
-			case IRP_MJ_CREATE:
-				DispatchCreate(device, context, DokanInstance);
-				break;
-			case IRP_MJ_CLEANUP:
-				DispatchCleanup(device, context, DokanInstance);
-				break;
-			case IRP_MJ_CLOSE:
-				DispatchClose(device, context, DokanInstance);
-				break;
-			case IRP_MJ_DIRECTORY_CONTROL:
-				DispatchDirectoryInformation(device, context, DokanInstance);
-				break;
-			case IRP_MJ_READ:
-				DispatchRead(device, context, DokanInstance);
-				break;
-			case IRP_MJ_WRITE:
-				DispatchWrite(device, context, DokanInstance);
-				break;
-			case IRP_MJ_QUERY_INFORMATION:
-				DispatchQueryInformation(device, context, DokanInstance);
-				break;
-			case IRP_MJ_QUERY_VOLUME_INFORMATION:
-				DispatchQueryVolumeInformation(device ,context, DokanInstance);
-				break;
-			case IRP_MJ_LOCK_CONTROL:
-				DispatchLock(device, context, DokanInstance);
-				break;
-			case IRP_MJ_SET_INFORMATION:
-				DispatchSetInformation(device, context, DokanInstance);
-				break;
-			case IRP_MJ_FLUSH_BUFFERS:
-				DispatchFlush(device, context, DokanInstance);
-				break;
-			case IRP_MJ_QUERY_SECURITY:
-				DispatchQuerySecurity(device, context, DokanInstance);
-				break;
-			case IRP_MJ_SET_SECURITY:
-				DispatchSetSecurity(device, context, DokanInstance);
-				break;
-			case IRP_MJ_SHUTDOWN:
-				// this cass is used before unmount not shutdown
-				DispatchUnmount(device, context, DokanInstance);
-				break;
-			default:
-				break;
-			}
-
-		} else {
-			DbgPrint("ReturnedLength %d\n", returnedLength);
+			DispatchEvent(device, context, DokanInstance);
 		}
+
+		// events skipped by an invalid length
+		InterlockedExchangeAdd(&DokanInstance->QueueDepth, -(LONG)eventCount);
 	}
 
-	CloseHandle(device);
+	transport->CloseChannel(device);
+	free(buffer);
+	LeaveDokanLoop(DokanInstance);
 	_endthreadex(result);
 	return result;
 }
@@ -384,30 +466,28 @@ SendEventInformation(
 	ULONG				EventLength,
 	PDOKAN_INSTANCE		DokanInstance)
 {
-	BOOL	status;
-	ULONG	returnedLength;
-
 	//DbgPrint("###EventInfo->Context %X\n", EventInfo->Context);
-	if (DokanInstance != NULL) {
-		ReleaseDokanOpenInfo(EventInfo, DokanInstance);
-	}
+	ReleaseDokanOpenInfo(EventInfo, DokanInstance);
 
 	// send event info to driver
-	status = DeviceIoControl(
-					Handle,				// Handle to device
-					IOCTL_EVENT_INFO,	// IO Control code
-					EventInfo,			// Input Buffer to driver.
-					EventLength,		// Length of input buffer in bytes.
-					NULL,				// Output Buffer from driver.
-					0,					// Length of output buffer in bytes.
-					&returnedLength,	// Bytes placed in buffer.
-					NULL				// synchronous call
-					);
+	DokanInstance->Transport->SendEventInformation(
+		Handle, EventInfo, EventLength);
+}
 
-	if (!status) {
-		DWORD errorCode = GetLastError();
-		DbgPrint("Dokan Error: Ioctl failed with code %d\n", errorCode );
-	}
+
+BOOL
+SendWriteRequest(
+	HANDLE				Handle,
+	PEVENT_INFORMATION	EventInfo,
+	ULONG				EventLength,
+	PVOID				Buffer,
+	ULONG				BufferLength,
+	PDOKAN_INSTANCE		DokanInstance)
+{
+	DbgPrint("SendWriteRequest\n");
+
+	return DokanInstance->Transport->SendWriteRequest(
+				Handle, EventInfo, EventLength, Buffer, BufferLength);
 }
 
 
@@ -436,9 +516,9 @@ DispatchCommon(
 	PDOKAN_FILE_INFO	DokanFileInfo,
 	PDOKAN_OPEN_INFO*	DokanOpenInfo)
 {
-	PEVENT_INFORMATION	eventInfo = (PEVENT_INFORMATION)malloc(SizeOfEventInfo);
+	// only the header of eventInfo is cleared
+	PEVENT_INFORMATION	eventInfo = AllocateEventInformation(SizeOfEventInfo);
 
-	RtlZeroMemory(eventInfo, SizeOfEventInfo);
 	RtlZeroMemory(DokanFileInfo, sizeof(DOKAN_FILE_INFO));
 
 	eventInfo->BufferLength = 0;
@@ -464,7 +544,10 @@ DispatchCommon(
 
 	*DokanOpenInfo = GetDokanOpenInfo(EventContext, DokanInstance);
 	if (*DokanOpenInfo == NULL) {
+		// the dispatch routine sends this back without calling
+		// the callback of the file system
 		DbgPrint("error openInfo is NULL\n");
+		eventInfo->Status = STATUS_INVALID_HANDLE;
 		return eventInfo;
 	}
 
@@ -472,7 +555,7 @@ DispatchCommon(
 	DokanFileInfo->IsDirectory	= (UCHAR)(*DokanOpenInfo)->IsDirectory;
 	DokanFileInfo->DokanContext = (ULONG64)(*DokanOpenInfo);
 
-	eventInfo->Context = (ULONG64)(*DokanOpenInfo);
+	eventInfo->Context = DOKAN_OPEN_INFO_HANDLE(*DokanOpenInfo);
 
 	return eventInfo;
 }
@@ -484,15 +567,16 @@ GetDokanOpenInfo(
 	PDOKAN_INSTANCE		DokanInstance)
 {
 	PDOKAN_OPEN_INFO openInfo;
-	EnterCriticalSection(&DokanInstance->CriticalSection);
 
-	openInfo = (PDOKAN_OPEN_INFO)EventContext->Context;
+	// The driver sends events of a file only between its Create and Close,
+	// and the reference of the handle keeps openInfo alive until Close.
+	// So no lock is needed to take one more reference here.
+	openInfo = LookupOpenInfo(DokanInstance, EventContext->Context);
 	if (openInfo != NULL) {
-		openInfo->OpenCount++;
+		InterlockedIncrement(&openInfo->OpenCount);
 		openInfo->EventContext = EventContext;
 		openInfo->DokanInstance = DokanInstance;
 	}
-	LeaveCriticalSection(&DokanInstance->CriticalSection);
 	return openInfo;
 }
 
@@ -503,22 +587,16 @@ ReleaseDokanOpenInfo(
 	PDOKAN_INSTANCE		DokanInstance)
 {
 	PDOKAN_OPEN_INFO openInfo;
-	EnterCriticalSection(&DokanInstance->CriticalSection);
 
-	openInfo = (PDOKAN_OPEN_INFO)EventInformation->Context;
+	openInfo = LookupOpenInfo(DokanInstance, EventInformation->Context);
 	if (openInfo != NULL) {
-		openInfo->OpenCount--;
-		if (openInfo->OpenCount < 1) {
-			if (openInfo->DirListHead != NULL) {
-				ClearFindData(openInfo->DirListHead);
-				free(openInfo->DirListHead);
-				openInfo->DirListHead = NULL;
-			}
-			free(openInfo);
+		// the thread which drops the last reference frees it
+		if (InterlockedDecrement(&openInfo->OpenCount) == 0) {
+			ReleaseFindData(openInfo);
+			FreeOpenInfo(DokanInstance, openInfo);
 			EventInformation->Context = 0;
 		}
 	}
-	LeaveCriticalSection(&DokanInstance->CriticalSection);
 }
 
 
@@ -593,6 +671,10 @@ DokanStart(PDOKAN_INSTANCE Instance)
 	ZeroMemory(&driverInfo, sizeof(EVENT_DRIVER_INFO));
 
 	eventStart.UserVersion = DOKAN_DRIVER_VERSION;
+	eventStart.EventBufferSize = GetEventBufferSize(Instance->DokanOptions);
+	if (DOKAN_DIR_CACHE_SUPPORTED_VERSION <= Instance->DokanOptions->Version) {
+		eventStart.DirCacheTimeout = Instance->DokanOptions->DirectoryCacheTimeout;
+	}
 	if (Instance->DokanOptions->Options & DOKAN_OPTION_ALT_STREAM) {
 		eventStart.Flags |= DOKAN_EVENT_ALTERNATIVE_STREAM_ON;
 	}
@@ -627,6 +709,10 @@ DokanStart(PDOKAN_INSTANCE Instance)
 	} else if (driverInfo.Status == DOKAN_MOUNTED) {
 		Instance->MountId = driverInfo.MountId;
 		Instance->DeviceNumber = driverInfo.DeviceNumber;
+		if (driverInfo.EventBufferSize > EVENT_CONTEXT_MAX_SIZE) {
+			Instance->EventBufferSize = driverInfo.EventBufferSize;
+		}
+		DbgPrint("event buffer size %d\n", Instance->EventBufferSize);
 		wcscpy_s(Instance->DeviceName,
 				sizeof(Instance->DeviceName) / sizeof(WCHAR),
 				driverInfo.DeviceName);
@@ -713,6 +799,8 @@ BOOL WINAPI DllMain(
 	switch(Reason) {
 		case DLL_PROCESS_ATTACH:
 			{
+				InitializeEventInformationCache();
+
 #if _MSC_VER < 1300
 				InitializeCriticalSection(&g_InstanceCriticalSection);
 #else
@@ -738,8 +826,13 @@ BOOL WINAPI DllMain(
 
 				LeaveCriticalSection(&g_InstanceCriticalSection);
 				DeleteCriticalSection(&g_InstanceCriticalSection);
+
+				DeleteEventInformationCache();
 			}
 			break;
+		case DLL_THREAD_DETACH:
+			ReleaseEventInformationCache();
+			break;
 	}
 	return TRUE;
 }
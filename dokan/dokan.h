@@ -40,8 +40,8 @@ with this program. If not, see <http://www.gnu.org/licenses/>.
 extern "C" {
 #endif
 
-// The current Dokan version (ver 0.6.0). Please set this constant on DokanOptions->Version.
-#define DOKAN_VERSION		600
+// The current Dokan version (ver 0.6.1). Please set this constant on DokanOptions->Version.
+#define DOKAN_VERSION		610
 
 #define DOKAN_OPTION_DEBUG		1 // ouput debug message
 #define DOKAN_OPTION_STDERR		2 // ouput debug message to stderr
@@ -49,6 +49,8 @@ extern "C" {
 #define DOKAN_OPTION_KEEP_ALIVE	8 // use auto unmount
 #define DOKAN_OPTION_NETWORK	16 // use network drive, you need to install Dokan network provider.
 #define DOKAN_OPTION_REMOVABLE	32 // use removable drive
+#define DOKAN_OPTION_ASYNC		64 // ReadFile and WriteFile may complete later, see DokanCompleteOperation
+#define DOKAN_OPTION_RING		128 // pass requests through memory shared with the driver
 
 typedef struct _DOKAN_OPTIONS {
 	USHORT	Version; // Supported Dokan Version, ex. "530" (Dokan ver 0.5.3)
@@ -56,6 +58,19 @@ typedef struct _DOKAN_OPTIONS {
 	ULONG	Options;	 // combination of DOKAN_OPTIONS_*
 	ULONG64	GlobalContext; // FileSystem can use this variable
 	LPCWSTR	MountPoint; //  mount point "M:\" (drive letter) or "C:\mount\dokan" (path in NTFS)
+	ULONG	MaxThreadCount; // Suported since 0.6.1. threads are added up to this number
+							// when all threads are busy, 0 keeps ThreadCount threads
+	ULONG	EventBufferSize; // Supported since 0.6.1. size of the buffer to receive requests,
+							// WriteFile of about this size is passed at once (32KB - 2MB, 0 is 32KB)
+	ULONG	DirectoryCacheTimeout; // Supported since 0.6.1. milliseconds the driver answers a repeated
+							// directory listing without FindFiles (up to 60 seconds, 0 disables)
+	ULONG	MetadataCacheTimeout; // Supported since 0.6.1. milliseconds results of GetFileInformation,
+							// FindFiles and GetDiskFreeSpace are reused (up to 60 seconds, 0 disables).
+							// The callbacks are not called while the results are cached.
+	ULONG	MetadataCacheSize; // Supported since 0.6.1. bytes the cache may use, 0 is 16MB
+	ULONG	NegativeCacheTimeout; // Supported since 0.6.1. milliseconds a name CreateFile or
+							// OpenDirectory did not find is answered as not found again without
+							// calling them (up to 60 seconds, 0 disables), until it is created
 } DOKAN_OPTIONS, *PDOKAN_OPTIONS;
 
 typedef struct _DOKAN_FILE_INFO {
@@ -79,6 +94,12 @@ typedef struct _DOKAN_FILE_INFO {
 //   (currently never return 1)
 typedef int (WINAPI *PFillFindData) (PWIN32_FIND_DATAW, PDOKAN_FILE_INFO);
 
+// FillFindDataWithCursor
+//   add an entry in FindFilesWithCursor
+//   NextCursor is the cursor to resume enumeration just after this entry
+//   return 1 if buffer is full and the entry was not added, otherwise 0
+typedef int (WINAPI *PFillFindDataWithCursor) (PWIN32_FIND_DATAW, ULONG64, PDOKAN_FILE_INFO);
+
 typedef struct _DOKAN_OPERATIONS {
 
 	// When an error occurs, return negative value.
@@ -116,6 +137,8 @@ typedef struct _DOKAN_OPERATIONS {
 		LPCWSTR,      // FileName
 		PDOKAN_FILE_INFO);
 
+	// With DOKAN_OPTION_ASYNC, ReadFile and WriteFile may return ERROR_IO_PENDING
+	// (not negative value) and call DokanCompleteOperation later.
 	int (DOKAN_CALLBACK *ReadFile) (
 		LPCWSTR,  // FileName
 		LPVOID,   // Buffer
@@ -269,6 +292,19 @@ typedef struct _DOKAN_OPERATIONS {
 		PDOKAN_FILE_INFO);
 
 
+	// Suported since 0.6.1. You must specify the version at DOKAN_OPTIONS.Version.
+	// Used instead of FindFiles and FindFilesWithPattern when implemented.
+	// Enumerate entries from Cursor (0 means the first entry) and stop
+	// when PFillFindDataWithCursor returns 1. Entries may be filtered by
+	// SearchPattern, Dokan checks the pattern anyway.
+	int (DOKAN_CALLBACK *FindFilesWithCursor) (
+		LPCWSTR,			// PathName
+		LPCWSTR,			// SearchPattern
+		ULONG64,			// Cursor
+		PFillFindDataWithCursor,	// call this function with PWIN32_FIND_DATAW
+		PDOKAN_FILE_INFO);	//  (see PFillFindDataWithCursor definition)
+
+
 } DOKAN_OPERATIONS, *PDOKAN_OPERATIONS;
 
 
@@ -320,6 +356,42 @@ DokanResetTimeout(
 	ULONG				Timeout,	// timeout in millisecond
 	PDOKAN_FILE_INFO	DokanFileInfo);
 
+// DokanInvalidateDirectoryCache
+//   drops the listings of DirectoryName ("\dir") the driver keeps for
+//   DirectoryCacheTimeout, when the directory is changed other than
+//   through the mount. NULL drops all directories of the mount.
+BOOL DOKANAPI
+DokanInvalidateDirectoryCache(
+	LPCWSTR	MountPoint,
+	LPCWSTR	DirectoryName);
+
+typedef struct _DOKAN_CACHE_INFO {
+	ULONG64	Hits;
+	ULONG64	Misses;
+	ULONG64	Evictions;	// entries dropped to keep MetadataCacheSize
+	ULONG	EntryCount;
+	ULONG	Size;		// bytes used by entries
+} DOKAN_CACHE_INFO, *PDOKAN_CACHE_INFO;
+
+// DokanInvalidatePath
+//   drops what the metadata cache of the mount keeps for FileName
+//   ("\dir\file"), the names under it and the listing of its directory,
+//   when the file is changed other than through the mount. NULL drops
+//   all. The listings
+//   the driver keeps for DirectoryCacheTimeout are dropped as well, see
+//   DokanInvalidateDirectoryCache.
+BOOL DOKANAPI
+DokanInvalidatePath(
+	LPCWSTR	MountPoint,
+	LPCWSTR	FileName);
+
+// DokanGetCacheInfo
+//   returns the counters of the metadata cache of the mount
+BOOL DOKANAPI
+DokanGetCacheInfo(
+	LPCWSTR				MountPoint,
+	PDOKAN_CACHE_INFO	CacheInfo);
+
 // Get the handle to Access Token
 // This method needs be called in CreateFile, OpenDirectory or CreateDirectly callback.
 // The caller must call CloseHandle for the returned handle.
@@ -327,6 +399,33 @@ HANDLE DOKANAPI
 DokanOpenRequestorToken(
 	PDOKAN_FILE_INFO	DokanFileInfo);
 
+typedef struct _DOKAN_THREAD_POOL_INFO {
+	ULONG	ThreadCount;		// number of threads
+	ULONG	IdleThreadCount;	// threads waiting for events
+	ULONG	MinThreadCount;
+	ULONG	MaxThreadCount;
+	ULONG	QueueDepth;			// events fetched by threads and not dispatched yet
+} DOKAN_THREAD_POOL_INFO, *PDOKAN_THREAD_POOL_INFO;
+
+// DokanGetThreadPoolInfo
+//   returns the current state of threads of the mount
+BOOL DOKANAPI
+DokanGetThreadPoolInfo(
+	LPCWSTR					MountPoint,
+	PDOKAN_THREAD_POOL_INFO	ThreadPoolInfo);
+
+// DokanCompleteOperation
+//   completes ReadFile or WriteFile which returned ERROR_IO_PENDING.
+//   It can be called from any thread. Until then DokanFileInfo, the buffer
+//   and the file name passed to the callback stay valid.
+//   Status is what the callback would have returned and Length is
+//   NumberOfBytesRead or NumberOfBytesWritten.
+VOID DOKANAPI
+DokanCompleteOperation(
+	PDOKAN_FILE_INFO	DokanFileInfo,
+	int					Status,
+	DWORD				Length);
+
 #ifdef __cplusplus
 }
 #endif
@@ -30,6 +30,11 @@ extern "C" {
 
 #define DOKAN_MOUNT_POINT_SUPPORTED_VERSION 600
 #define DOKAN_SECURITY_SUPPORTED_VERSION	600
+#define DOKAN_THREAD_POOL_SUPPORTED_VERSION	610
+#define DOKAN_EVENT_BUFFER_SUPPORTED_VERSION	610
+#define DOKAN_FIND_CURSOR_SUPPORTED_VERSION	610
+#define DOKAN_DIR_CACHE_SUPPORTED_VERSION	610
+#define DOKAN_METADATA_CACHE_SUPPORTED_VERSION	610
 
 #define DOKAN_GLOBAL_DEVICE_NAME	L"\\\\.\\Dokan"
 #define DOKAN_CONTROL_PIPE			L"\\\\.\\pipe\\DokanMounter"
@@ -54,7 +59,9 @@ extern "C" {
 
 #define DOKAN_KEEPALIVE_TIME	3000 // in miliseconds
 
-#define DOKAN_MAX_THREAD		15
+#define DOKAN_POOL_IDLE_TIMEOUT	10000 // in miliseconds
+
+#define DOKAN_MAX_THREAD		256
 
 // DokanOptions->DebugMode is ON?
 extern	BOOL	g_DebugMode;
@@ -103,17 +110,17 @@ DokanDbgPrintW(LPCWSTR format, ...)
 }
 
 
-#define DbgPrint(format, ... ) \
+#define DbgPrint(... ) \
 	do {\
 		if (g_DebugMode) {\
-			DokanDbgPrint(format, __VA_ARGS__);\
+			DokanDbgPrint(__VA_ARGS__);\
 		}\
 	} while(0)
 
-#define DbgPrintW(format, ... ) \
+#define DbgPrintW(... ) \
 	do {\
 		if (g_DebugMode) {\
-			DokanDbgPrintW(format, __VA_ARGS__);\
+			DokanDbgPrintW(__VA_ARGS__);\
 		}\
 	} while(0)
 
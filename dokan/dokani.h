@@ -27,6 +27,7 @@ with this program. If not, see <http://www.gnu.org/licenses/>.
 #include <stdlib.h>
 
 #include "public.h"
+#include "namecmp.h"
 #include "dokan.h"
 #include "dokanc.h"
 #include "list.h"
@@ -36,9 +37,111 @@ extern "C" {
 #endif
 
 
+struct _DOKAN_INSTANCE;
+
+// Transport between DokanLoop and whoever produces EVENT_CONTEXTs.
+// DokanDeviceTransport (transport.c) talks to dokan.sys, and
+// DokanLoopbackTransport (loopback.c) generates events in process.
+typedef struct _DOKAN_TRANSPORT {
+	// opens a channel used by one DokanLoop thread,
+	// returns INVALID_HANDLE_VALUE on failure
+	HANDLE	(*OpenChannel)(struct _DOKAN_INSTANCE* DokanInstance);
+
+	VOID	(*CloseChannel)(HANDLE Channel);
+
+	// blocks until at least one EVENT_CONTEXT is available,
+	// returns FALSE when the channel is shut down.
+	// Several EVENT_CONTEXTs may be packed into Buffer: each one starts at
+	// EVENT_CONTEXT_ALIGN of the end of the previous one and
+	// *ReturnedLength is the end of the last one.
+	BOOL	(*WaitEvent)(
+				HANDLE	Channel,
+				PVOID	Buffer,
+				ULONG	BufferLength,
+				PULONG	ReturnedLength);
+
+	// the reply may be held back until the next WaitEvent on Channel
+	BOOL	(*SendEventInformation)(
+				HANDLE				Channel,
+				PEVENT_INFORMATION	EventInfo,
+				ULONG				EventLength);
+
+	// fetches the whole EVENT_CONTEXT of a write whose
+	// Write.RequestLength is bigger than the wait buffer
+	BOOL	(*SendWriteRequest)(
+				HANDLE				Channel,
+				PEVENT_INFORMATION	EventInfo,
+				ULONG				EventLength,
+				PVOID				Buffer,
+				ULONG				BufferLength);
+
+} DOKAN_TRANSPORT, *PDOKAN_TRANSPORT;
+
+
+// DOKAN_OPEN_INFO slabs, see handle.c
+#define DOKAN_HANDLE_SLAB_SHIFT	8
+#define DOKAN_HANDLE_SLAB_SIZE	(1 << DOKAN_HANDLE_SLAB_SHIFT)
+#define DOKAN_HANDLE_SLAB_COUNT	4096
+
+typedef struct _DOKAN_HANDLE_TABLE {
+	CRITICAL_SECTION	Lock;
+	struct _DOKAN_OPEN_INFO*	Slabs[DOKAN_HANDLE_SLAB_COUNT];
+	ULONG				SlabCount;
+	// head of the free list
+	ULONG				FreeIndex;
+	ULONG				OpenCount;
+} DOKAN_HANDLE_TABLE, *PDOKAN_HANDLE_TABLE;
+
+
+// metadata cache, see cache.c
+#define DOKAN_CACHE_SHARDS			16
+// buckets of a shard
+#define DOKAN_CACHE_BUCKETS			256
+#define DOKAN_CACHE_MAX_TIMEOUT		(60*1000)
+#define DOKAN_CACHE_DEFAULT_SIZE	(16*1024*1024)
+
+// kinds of entries, an entry is identified by its kind and name
+#define DOKAN_CACHE_ATTRIBUTES		1 // DOKAN_CACHED_ATTRIBUTES
+#define DOKAN_CACHE_FIND_FILES		2 // entries given by FindFiles, see directory.c
+#define DOKAN_CACHE_DISK_SPACE		3 // DOKAN_CACHED_DISK_SPACE, the name is ""
+#define DOKAN_CACHE_NOT_FOUND		4 // DWORD error CreateFile or OpenDirectory returned
+
+typedef struct _DOKAN_CACHED_ATTRIBUTES {
+	BY_HANDLE_FILE_INFORMATION	Info;
+	// given by FindFiles, file index and volume serial number are not set
+	BOOL	FromListing;
+} DOKAN_CACHED_ATTRIBUTES, *PDOKAN_CACHED_ATTRIBUTES;
+
+typedef struct _DOKAN_CACHED_DISK_SPACE {
+	ULONGLONG	FreeBytesAvailable;
+	ULONGLONG	TotalNumberOfBytes;
+	ULONGLONG	TotalNumberOfFreeBytes;
+} DOKAN_CACHED_DISK_SPACE, *PDOKAN_CACHED_DISK_SPACE;
+
+typedef struct _DOKAN_CACHE_SHARD {
+	CRITICAL_SECTION	Lock;
+	// most recently used first
+	LIST_ENTRY			LruList;
+	ULONG				Count;
+	// DOKAN_CACHE_NOT_FOUND entries, shards without them are not scanned
+	// for the misses under a new directory
+	ULONG				NotFoundCount;
+	// bytes allocated for the entries
+	ULONG				Size;
+	ULONG64				Hits;
+	ULONG64				Misses;
+	ULONG64				Evictions;
+	struct _DOKAN_CACHE_ENTRY*	Buckets[DOKAN_CACHE_BUCKETS];
+} DOKAN_CACHE_SHARD, *PDOKAN_CACHE_SHARD;
+
+typedef struct _DOKAN_CACHE {
+	DOKAN_CACHE_SHARD	Shards[DOKAN_CACHE_SHARDS];
+} DOKAN_CACHE, *PDOKAN_CACHE;
+
 
 typedef struct _DOKAN_INSTANCE {
-	// to ensure that unmount dispatch is called at once
+	// to ensure that unmount dispatch is called at once,
+	// DOKAN_OPEN_INFO does not use this
 	CRITICAL_SECTION	CriticalSection;
 
 	// store CurrentDeviceName
@@ -49,25 +152,120 @@ typedef struct _DOKAN_INSTANCE {
 
 	ULONG	DeviceNumber;
 	ULONG	MountId;
+	// size of the buffer DokanLoop receives events with
+	ULONG	EventBufferSize;
 
 	PDOKAN_OPTIONS		DokanOptions;
 	PDOKAN_OPERATIONS	DokanOperations;
 
+	PDOKAN_TRANSPORT	Transport;
+	// private data of Transport
+	PVOID				TransportContext;
+
+	// channel used by DokanCompleteOperation, opened on demand
+	HANDLE				CompletionChannel;
+	// number of DOKAN_OPTION_ASYNC operations not completed yet,
+	// plus one held by the instance until WaitIoOperations
+	LONG				PendingOperationCount;
+	// set when PendingOperationCount drops to 0
+	HANDLE				OperationsDone;
+
+	// DokanLoop thread pool, see pool.c
+	LONG				ThreadCount;
+	LONG				IdleThreadCount;
+	ULONG				MinThreadCount;
+	ULONG				MaxThreadCount;
+	LONG				QueueDepth;
+	DWORD				LastSaturatedTick;
+	// set when ThreadCount drops to 0
+	HANDLE				ThreadsDrained;
+
+	DOKAN_HANDLE_TABLE	HandleTable;
+
+	DOKAN_CACHE			Cache;
+
 	LIST_ENTRY	ListEntry;
 } DOKAN_INSTANCE, *PDOKAN_INSTANCE;
 
 
+extern DOKAN_TRANSPORT	DokanDeviceTransport;
+extern DOKAN_TRANSPORT	DokanLoopbackTransport;
+extern DOKAN_TRANSPORT	DokanRingTransport;
+
+extern CRITICAL_SECTION	g_InstanceCriticalSection;
+extern LIST_ENTRY		g_InstanceList;
+
+
 typedef struct _DOKAN_OPEN_INFO {
 	BOOL			IsDirectory;
-	ULONG			OpenCount;
+	// references of the handle and of events in progress,
+	// changed by Interlocked functions only
+	LONG			OpenCount;
 	PEVENT_CONTEXT	EventContext;
 	PDOKAN_INSTANCE	DokanInstance;
 	ULONG64			UserContext;
 	ULONG			EventId;
-	PLIST_ENTRY		DirListHead;
+	// entries given by FindFiles, see directory.c
+	struct _DOKAN_FIND_STORE*	DirList;
+	// entries of DirList which match the search pattern
+	struct _DOKAN_FIND_MATCH*	FindMatch;
+	// FindFilesWithCursor resumes at FindCursor when
+	// the driver asks for FindIndex
+	ULONG			FindIndex;
+	ULONG64			FindCursor;
+
+	// owned by HandleTable
+	ULONG			Index;
+	// odd while the entry is in use
+	LONG			Generation;
+	ULONG			NextFree;
 } DOKAN_OPEN_INFO, *PDOKAN_OPEN_INFO;
 
 
+// EVENT_INFORMATION.Context given to the driver
+#define DOKAN_OPEN_INFO_HANDLE(OpenInfo) \
+	(((ULONG64)(ULONG)(OpenInfo)->Generation << 32) | (OpenInfo)->Index)
+
+typedef struct _DOKAN_FIND_STORE DOKAN_FIND_STORE, *PDOKAN_FIND_STORE;
+
+// compiled search pattern, see match.c
+typedef struct _DOKAN_NAME_EXPRESSION *PDOKAN_NAME_EXPRESSION;
+
+typedef BOOL (*PDOKAN_OPEN_INFO_CALLBACK)(
+	PDOKAN_OPEN_INFO	OpenInfo,
+	PVOID				Context);
+
+
+// ReadFile/WriteFile request. With DOKAN_OPTION_ASYNC this is allocated
+// on heap and FileInfo is the token of DokanCompleteOperation,
+// otherwise it is on the stack of the dispatch routine.
+typedef struct _DOKAN_IO_OPERATION {
+	DOKAN_FILE_INFO		FileInfo;
+	PDOKAN_INSTANCE		DokanInstance;
+	PDOKAN_OPEN_INFO	OpenInfo;
+	PEVENT_INFORMATION	EventInfo;
+	ULONG				SizeOfEventInfo;
+	PEVENT_CONTEXT		EventContext;
+	// NumberOfBytesRead or NumberOfBytesWritten
+	DWORD				Length;
+	// EventContext is freed by EndIoOperation
+	BOOL				ContextAllocated;
+	BOOL				Asynchronous;
+} DOKAN_IO_OPERATION, *PDOKAN_IO_OPERATION;
+
+
+PDOKAN_INSTANCE
+NewDokanInstance();
+
+// EventBufferSize of DokanOptions in the range the driver accepts
+ULONG
+GetEventBufferSize(
+	PDOKAN_OPTIONS	DokanOptions);
+
+VOID
+DeleteDokanInstance(
+	PDOKAN_INSTANCE	Instance);
+
 BOOL
 DokanStart(
 	PDOKAN_INSTANCE	Instance);
@@ -85,9 +283,46 @@ SendToDevice(
 LPCWSTR
 GetRawDeviceName(LPCWSTR	DeviceName);
 
+BOOL
+InvalidateDirectoryCache(
+	LPCWSTR	DeviceName,
+	LPCWSTR	DirectoryName,
+	ULONG	Length);
+
 DWORD __stdcall
 DokanLoop(
-	PVOID Param);
+	PDOKAN_INSTANCE DokanInstance);
+
+// starts MinThreadCount DokanLoop threads
+BOOL
+StartDokanLoop(
+	PDOKAN_INSTANCE	Instance);
+
+// waits until all DokanLoop threads exit
+VOID
+WaitDokanLoop(
+	PDOKAN_INSTANCE	Instance);
+
+// called by a DokanLoop thread on exit
+VOID
+LeaveDokanLoop(
+	PDOKAN_INSTANCE	Instance);
+
+// called before WaitEvent,
+// returns FALSE when the thread should exit to shrink the pool
+BOOL
+EnterIdleState(
+	PDOKAN_INSTANCE	Instance);
+
+// called after WaitEvent with the number of events received
+VOID
+LeaveIdleState(
+	PDOKAN_INSTANCE	Instance,
+	ULONG			EventCount);
+
+PDOKAN_INSTANCE
+FindDokanInstance(
+	LPCWSTR	MountPoint);
 
 
 BOOL
@@ -102,7 +337,159 @@ SendEventInformation(
 	ULONG				EventLength,
 	PDOKAN_INSTANCE		DokanInstance);
 
+BOOL
+SendWriteRequest(
+	HANDLE				Handle,
+	PEVENT_INFORMATION	EventInfo,
+	ULONG				EventLength,
+	PVOID				Buffer,
+	ULONG				BufferLength,
+	PDOKAN_INSTANCE		DokanInstance);
 
+
+// EVENT_INFORMATION cached per thread, see buffer.c.
+// Only the header is cleared.
+PEVENT_INFORMATION
+AllocateEventInformation(
+	ULONG	Length);
+
+VOID
+FreeEventInformation(
+	PEVENT_INFORMATION	EventInfo);
+
+// length of a reply holding BufferLength bytes, the rest of a cached
+// buffer may hold an earlier reply and must not go to the driver
+#define EVENT_INFO_REPLY_LENGTH(EventInfo) \
+	max((ULONG)sizeof(EVENT_INFORMATION), \
+		(ULONG)FIELD_OFFSET(EVENT_INFORMATION, Buffer) + (EventInfo)->BufferLength)
+
+VOID
+InitializeEventInformationCache();
+
+VOID
+ReleaseEventInformationCache();
+
+VOID
+DeleteEventInformationCache();
+
+
+// DOKAN_OPTION_RING, see ring.c.
+// Switches Transport to DokanRingTransport, returns FALSE when the driver
+// does not accept the ring and DokanDeviceTransport should be kept.
+BOOL
+DokanRingStart(
+	PDOKAN_INSTANCE	DokanInstance);
+
+VOID
+DokanRingStop(
+	PDOKAN_INSTANCE	DokanInstance);
+
+
+// DOKAN_OPEN_INFO handle table, see handle.c
+VOID
+InitializeHandleTable(
+	PDOKAN_HANDLE_TABLE	Table);
+
+// frees all DOKAN_OPEN_INFOs of the instance
+VOID
+DeleteHandleTable(
+	PDOKAN_INSTANCE	DokanInstance);
+
+PDOKAN_OPEN_INFO
+AllocateOpenInfo(
+	PDOKAN_INSTANCE	DokanInstance);
+
+VOID
+FreeOpenInfo(
+	PDOKAN_INSTANCE		DokanInstance,
+	PDOKAN_OPEN_INFO	OpenInfo);
+
+// returns NULL when Handle is 0 or stale, no reference is taken
+PDOKAN_OPEN_INFO
+LookupOpenInfo(
+	PDOKAN_INSTANCE	DokanInstance,
+	ULONG64			Handle);
+
+// calls Callback for each open file until it returns FALSE,
+// returns the number of entries visited
+ULONG
+EnumerateOpenInfo(
+	PDOKAN_INSTANCE				DokanInstance,
+	PDOKAN_OPEN_INFO_CALLBACK	Callback,
+	PVOID						Context);
+
+
+// metadata cache, see cache.c
+VOID
+InitializeCache(
+	PDOKAN_CACHE	Cache);
+
+VOID
+DeleteCache(
+	PDOKAN_CACHE	Cache);
+
+// milliseconds entries of Kind are kept, 0 when they are not cached,
+// Kind 0 is any kind
+ULONG
+GetCacheTimeout(
+	PDOKAN_INSTANCE	DokanInstance,
+	ULONG			Kind);
+
+// Data is copied, an entry of the same kind and name is replaced
+VOID
+AddCache(
+	PDOKAN_INSTANCE	DokanInstance,
+	ULONG			Kind,
+	LPCWSTR			Name,
+	const VOID*		Data,
+	ULONG			DataLength);
+
+// attributes given by FindFiles for FileName in the directory,
+// NameLength in WCHARs
+VOID
+AddAttributeCache(
+	PDOKAN_INSTANCE				DokanInstance,
+	LPCWSTR						DirectoryName,
+	LPCWSTR						FileName,
+	ULONG						NameLength,
+	PBY_HANDLE_FILE_INFORMATION	FileInfo);
+
+// copies the data of an entry of DataLength bytes,
+// returns FALSE when Name is not cached or expired
+BOOL
+LookupCache(
+	PDOKAN_INSTANCE	DokanInstance,
+	ULONG			Kind,
+	LPCWSTR			Name,
+	PVOID			Data,
+	ULONG			DataLength);
+
+// returns a copy of the data which the caller frees, or NULL
+PVOID
+LookupCacheCopy(
+	PDOKAN_INSTANCE	DokanInstance,
+	ULONG			Kind,
+	LPCWSTR			Name,
+	PULONG			DataLength);
+
+// drops entries of FileName ignoring case, the listing of its parent and
+// the disk space, NULL drops all
+VOID
+InvalidateCache(
+	PDOKAN_INSTANCE	DokanInstance,
+	LPCWSTR			FileName);
+
+// InvalidateCache and the entries of Kind (0 is any kind) under the
+// directory FileName, which scans all shards
+VOID
+InvalidateCacheTree(
+	PDOKAN_INSTANCE	DokanInstance,
+	LPCWSTR			FileName,
+	ULONG			Kind);
+
+
+// *DokanOpenInfo is NULL and the Status of the returned EVENT_INFORMATION
+// is STATUS_INVALID_HANDLE when the Context of EventContext is 0 or stale
 PEVENT_INFORMATION
 DispatchCommon(
 	PEVENT_CONTEXT		EventContext,
@@ -154,6 +541,35 @@ DispatchWrite(
 	PDOKAN_INSTANCE		DokanInstance);
 
 
+// returns SyncOperation unless DOKAN_OPTION_ASYNC is on
+PDOKAN_IO_OPERATION
+BeginIoOperation(
+	PDOKAN_IO_OPERATION	SyncOperation,
+	PEVENT_CONTEXT		EventContext,
+	PDOKAN_INSTANCE		DokanInstance);
+
+VOID
+EndIoOperation(
+	PDOKAN_IO_OPERATION	Operation);
+
+// waits for DokanCompleteOperation of all pending operations
+VOID
+WaitIoOperations(
+	PDOKAN_INSTANCE		DokanInstance);
+
+VOID
+CompleteRead(
+	HANDLE				Handle,
+	PDOKAN_IO_OPERATION	Operation,
+	int					Status);
+
+VOID
+CompleteWrite(
+	HANDLE				Handle,
+	PDOKAN_IO_OPERATION	Operation,
+	int					Status);
+
+
 VOID
 DispatchCreate(
 	HANDLE				Handle,
@@ -252,11 +668,29 @@ CheckFileName(
 
 VOID
 ClearFindData(
-  PLIST_ENTRY	ListHead);
+	PDOKAN_FIND_STORE	Store);
+
+VOID
+ReleaseFindData(
+	PDOKAN_OPEN_INFO	OpenInfo);
+
+PDOKAN_NAME_EXPRESSION
+CompileNameExpression(
+	LPCWSTR	Expression,
+	BOOL	IgnoreCase);
+
+BOOL
+MatchNameExpression(
+	PDOKAN_NAME_EXPRESSION	Expression,
+	LPCWSTR					Name);
+
+VOID
+FreeNameExpression(
+	PDOKAN_NAME_EXPRESSION	Expression);
 
 DWORD WINAPI
 DokanKeepAlive(
-	PVOID	Param);
+	PDOKAN_INSTANCE DokanInstance);
 
 
 ULONG
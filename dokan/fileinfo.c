@@ -242,6 +242,16 @@ DokanFillInternalInfo(
 }
 
 
+// classes filled only from what FindFiles gives,
+// file index and volume serial number are not in the listing
+#define UseListingAttributes(InfoClass) \
+	((InfoClass) == FileBasicInformation || \
+	(InfoClass) == FileStandardInformation || \
+	(InfoClass) == FileAllInformation || \
+	(InfoClass) == FileAttributeTagInformation || \
+	(InfoClass) == FileNetworkOpenInformation)
+
+
 VOID
 DispatchQueryInformation(
 	HANDLE				Handle,
@@ -256,6 +266,7 @@ DispatchQueryInformation(
 	int					result;
 	PDOKAN_OPEN_INFO	openInfo;
 	ULONG				sizeOfEventInfo;
+	DOKAN_CACHED_ATTRIBUTES	cached;
 
 	sizeOfEventInfo = sizeof(EVENT_INFORMATION) - 8 + EventContext->File.BufferLength;
 
@@ -265,16 +276,39 @@ DispatchQueryInformation(
 
 	eventInfo = DispatchCommon(
 		EventContext, sizeOfEventInfo, DokanInstance, &fileInfo, &openInfo);
+
+	if (openInfo == NULL) {
+		SendEventInformation(Handle, eventInfo, sizeof(EVENT_INFORMATION), DokanInstance);
+		FreeEventInformation(eventInfo);
+		return;
+	}
+
+	// returned structures rely on zero cleared fields
+	RtlZeroMemory(eventInfo->Buffer, EventContext->File.BufferLength);
 	
 	eventInfo->BufferLength = EventContext->File.BufferLength;
 
-	DbgPrint("###GetFileInfo %04d\n", openInfo != NULL ? openInfo->EventId : -1);
+	DbgPrint("###GetFileInfo %04d\n", openInfo->EventId);
+
+	if (LookupCache(DokanInstance, DOKAN_CACHE_ATTRIBUTES, EventContext->File.FileName,
+			&cached, sizeof(DOKAN_CACHED_ATTRIBUTES)) &&
+		(!cached.FromListing || UseListingAttributes(EventContext->File.FileInformationClass))) {
+		DbgPrint("  attribute cache hit\n");
+		byHandleFileInfo = cached.Info;
+		result = 0;
 
-	if (DokanInstance->DokanOperations->GetFileInformation) {
+	} else if (DokanInstance->DokanOperations->GetFileInformation) {
 		result = DokanInstance->DokanOperations->GetFileInformation(
 										EventContext->File.FileName,
 										&byHandleFileInfo,
 										&fileInfo);
+
+		if (result >= 0 && GetCacheTimeout(DokanInstance, DOKAN_CACHE_ATTRIBUTES) != 0) {
+			cached.Info = byHandleFileInfo;
+			cached.FromListing = FALSE;
+			AddCache(DokanInstance, DOKAN_CACHE_ATTRIBUTES, EventContext->File.FileName,
+				&cached, sizeof(DOKAN_CACHED_ATTRIBUTES));
+		}
 	} else {
 		result = -1;
 	}
@@ -370,8 +404,8 @@ DispatchQueryInformation(
 	// information for FileSystem
 	openInfo->UserContext = fileInfo.Context;
 
-	SendEventInformation(Handle, eventInfo, sizeOfEventInfo, DokanInstance);
-	free(eventInfo);
+	SendEventInformation(Handle, eventInfo, EVENT_INFO_REPLY_LENGTH(eventInfo), DokanInstance);
+	FreeEventInformation(eventInfo);
 	return;
 
 }
@@ -475,6 +475,9 @@ typedef struct _FILE_NETWORK_OPEN_INFORMATION {
 #ifndef STATUS_INVALID_PARAMETER
 	#define STATUS_INVALID_PARAMETER        ((ULONG)0xC000000DL)
 #endif
+#ifndef STATUS_INVALID_HANDLE
+	#define STATUS_INVALID_HANDLE           ((ULONG)0xC0000008L)
+#endif
 #define STATUS_NOT_IMPLEMENTED          ((ULONG)0xC0000002L)
 #define STATUS_BUFFER_OVERFLOW          ((ULONG)0x80000005L)
 #define STATUS_FILE_IS_A_DIRECTORY      ((ULONG)0xC00000BAL)
@@ -495,6 +498,7 @@ typedef struct _FILE_NETWORK_OPEN_INFORMATION {
 #define STATUS_PRIVILEGE_NOT_HELD		((ULONG)0xC0000061L)
 #define STATUS_DISK_FULL				((ULONG)0xC000007FL)
 #define STATUS_DEVICE_NOT_READY			((ULONG)0xC00000A3L)
+#define STATUS_INSUFFICIENT_RESOURCES	((ULONG)0xC000009AL)
 
 #define FILE_SUPERSEDE                  0x00000000
 #define FILE_OPEN                       0x00000001
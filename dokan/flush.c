@@ -40,7 +40,13 @@ DispatchFlush(
 	eventInfo = DispatchCommon(
 		EventContext, sizeOfEventInfo, DokanInstance, &fileInfo, &openInfo);
 
-	DbgPrint("###Flush %04d\n", openInfo != NULL ? openInfo->EventId : -1);
+	if (openInfo == NULL) {
+		SendEventInformation(Handle, eventInfo, sizeof(EVENT_INFORMATION), DokanInstance);
+		FreeEventInformation(eventInfo);
+		return;
+	}
+
+	DbgPrint("###Flush %04d\n", openInfo->EventId);
 
 	eventInfo->Status = STATUS_SUCCESS;
 
@@ -58,7 +64,7 @@ DispatchFlush(
 
 	SendEventInformation(Handle, eventInfo, sizeOfEventInfo, DokanInstance);
 
-	free(eventInfo);
+	FreeEventInformation(eventInfo);
 	return;
 }
 
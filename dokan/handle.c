@@ -0,0 +1,245 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2008 Hiroki Asakawa info@dokan-dev.net
+
+  http://dokan-dev.net/en
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "dokani.h"
+
+
+/*
+
+Handle table of DOKAN_OPEN_INFO
+
+  DOKAN_OPEN_INFOs live in slabs of DOKAN_HANDLE_SLAB_SIZE entries.
+  Slabs are never moved or freed until the instance is deleted, so
+  LookupOpenInfo needs no lock.
+
+  The driver sees (Generation << 32) | Index as EVENT_INFORMATION.Context.
+  Generation is odd while the entry is in use and incremented again when
+  it is freed, so a stale or broken Context never matches an entry.
+
+  Table->Lock protects the free list and the slab array.
+
+*/
+
+
+#define DOKAN_HANDLE_NONE	((ULONG)-1)
+
+
+#define OpenInfoEntry(Table, Index) \
+	(&(Table)->Slabs[(Index) >> DOKAN_HANDLE_SLAB_SHIFT] \
+		[(Index) & (DOKAN_HANDLE_SLAB_SIZE - 1)])
+
+
+VOID
+InitializeHandleTable(
+	PDOKAN_HANDLE_TABLE	Table)
+{
+	ZeroMemory(Table, sizeof(DOKAN_HANDLE_TABLE));
+
+#if _MSC_VER < 1300
+	InitializeCriticalSection(&Table->Lock);
+#else
+	InitializeCriticalSectionAndSpinCount(
+		&Table->Lock, 0x80000400);
+#endif
+
+	Table->FreeIndex = DOKAN_HANDLE_NONE;
+}
+
+
+static BOOL
+AddHandleSlab(
+	PDOKAN_HANDLE_TABLE	Table)
+{
+	PDOKAN_OPEN_INFO	slab;
+	ULONG				base;
+	LONG				i;
+
+	if (Table->SlabCount == DOKAN_HANDLE_SLAB_COUNT) {
+		DbgPrint("Dokan Error: too many open files\n");
+		return FALSE;
+	}
+
+	slab = (PDOKAN_OPEN_INFO)malloc(sizeof(DOKAN_OPEN_INFO) * DOKAN_HANDLE_SLAB_SIZE);
+	if (slab == NULL) {
+		return FALSE;
+	}
+	ZeroMemory(slab, sizeof(DOKAN_OPEN_INFO) * DOKAN_HANDLE_SLAB_SIZE);
+
+	base = Table->SlabCount << DOKAN_HANDLE_SLAB_SHIFT;
+
+	// lower indexes are used first
+	for (i = DOKAN_HANDLE_SLAB_SIZE - 1; i >= 0; --i) {
+		slab[i].Index = base + i;
+		slab[i].NextFree = Table->FreeIndex;
+		Table->FreeIndex = base + i;
+	}
+
+	Table->Slabs[Table->SlabCount] = slab;
+	Table->SlabCount++;
+	return TRUE;
+}
+
+
+PDOKAN_OPEN_INFO
+AllocateOpenInfo(
+	PDOKAN_INSTANCE	DokanInstance)
+{
+	PDOKAN_HANDLE_TABLE	table = &DokanInstance->HandleTable;
+	PDOKAN_OPEN_INFO	openInfo = NULL;
+	ULONG				index;
+	LONG				generation;
+
+	EnterCriticalSection(&table->Lock);
+
+	if (table->FreeIndex != DOKAN_HANDLE_NONE || AddHandleSlab(table)) {
+		openInfo = OpenInfoEntry(table, table->FreeIndex);
+		table->FreeIndex = openInfo->NextFree;
+
+		index = openInfo->Index;
+		generation = openInfo->Generation + 1;
+
+		ZeroMemory(openInfo, sizeof(DOKAN_OPEN_INFO));
+		openInfo->Index = index;
+		openInfo->NextFree = DOKAN_HANDLE_NONE;
+		openInfo->DokanInstance = DokanInstance;
+		// becomes valid for LookupOpenInfo
+		InterlockedExchange(&openInfo->Generation, generation);
+
+		table->OpenCount++;
+	}
+
+	LeaveCriticalSection(&table->Lock);
+	return openInfo;
+}
+
+
+VOID
+FreeOpenInfo(
+	PDOKAN_INSTANCE		DokanInstance,
+	PDOKAN_OPEN_INFO	OpenInfo)
+{
+	PDOKAN_HANDLE_TABLE	table = &DokanInstance->HandleTable;
+
+	EnterCriticalSection(&table->Lock);
+
+	InterlockedIncrement(&OpenInfo->Generation);
+
+	OpenInfo->NextFree = table->FreeIndex;
+	table->FreeIndex = OpenInfo->Index;
+	table->OpenCount--;
+
+	LeaveCriticalSection(&table->Lock);
+}
+
+
+PDOKAN_OPEN_INFO
+LookupOpenInfo(
+	PDOKAN_INSTANCE	DokanInstance,
+	ULONG64			Handle)
+{
+	PDOKAN_HANDLE_TABLE	table = &DokanInstance->HandleTable;
+	PDOKAN_OPEN_INFO	openInfo;
+	ULONG				index = (ULONG)Handle;
+	LONG				generation = (LONG)(Handle >> 32);
+
+	if (Handle == 0) {
+		return NULL;
+	}
+
+	if ((index >> DOKAN_HANDLE_SLAB_SHIFT) >= table->SlabCount ||
+		!(generation & 1)) {
+		DbgPrint("Dokan Error: invalid handle %I64X\n", Handle);
+		return NULL;
+	}
+
+	openInfo = OpenInfoEntry(table, index);
+	if (openInfo->Generation != generation) {
+		DbgPrint("Dokan Error: stale handle %I64X\n", Handle);
+		return NULL;
+	}
+	return openInfo;
+}
+
+
+ULONG
+EnumerateOpenInfo(
+	PDOKAN_INSTANCE		DokanInstance,
+	PDOKAN_OPEN_INFO_CALLBACK	Callback,
+	PVOID				Context)
+{
+	PDOKAN_HANDLE_TABLE	table = &DokanInstance->HandleTable;
+	ULONG				count = 0;
+	ULONG				i, j;
+
+	EnterCriticalSection(&table->Lock);
+
+	for (i = 0; i < table->SlabCount; ++i) {
+		PDOKAN_OPEN_INFO slab = table->Slabs[i];
+		for (j = 0; j < DOKAN_HANDLE_SLAB_SIZE; ++j) {
+			if (slab[j].Generation & 1) {
+				count++;
+				if (Callback != NULL && !Callback(&slab[j], Context)) {
+					LeaveCriticalSection(&table->Lock);
+					return count;
+				}
+			}
+		}
+	}
+
+	LeaveCriticalSection(&table->Lock);
+	return count;
+}
+
+
+static BOOL
+ReleaseDirList(
+	PDOKAN_OPEN_INFO	OpenInfo,
+	PVOID				Context)
+{
+	UNREFERENCED_PARAMETER(Context);
+
+	ReleaseFindData(OpenInfo);
+	return TRUE;
+}
+
+
+// frees all entries at once, including files which are not closed
+VOID
+DeleteHandleTable(
+	PDOKAN_INSTANCE	DokanInstance)
+{
+	PDOKAN_HANDLE_TABLE	table = &DokanInstance->HandleTable;
+	ULONG				openCount;
+	ULONG				i;
+
+	openCount = EnumerateOpenInfo(DokanInstance, ReleaseDirList, NULL);
+	if (openCount > 0) {
+		DbgPrint("%d files are not closed\n", openCount);
+	}
+
+	for (i = 0; i < table->SlabCount; ++i) {
+		free(table->Slabs[i]);
+		table->Slabs[i] = NULL;
+	}
+	table->SlabCount = 0;
+
+	DeleteCriticalSection(&table->Lock);
+}
@@ -39,7 +39,13 @@ DispatchLock(
 	eventInfo = DispatchCommon(
 		EventContext, sizeOfEventInfo, DokanInstance, &fileInfo, &openInfo);
 
-	DbgPrint("###Lock %04d\n", openInfo != NULL ? openInfo->EventId : -1);
+	if (openInfo == NULL) {
+		SendEventInformation(Handle, eventInfo, sizeof(EVENT_INFORMATION), DokanInstance);
+		FreeEventInformation(eventInfo);
+		return;
+	}
+
+	DbgPrint("###Lock %04d\n", openInfo->EventId);
 
 	eventInfo->Status = STATUS_NOT_IMPLEMENTED;
 
@@ -83,6 +89,6 @@ DispatchLock(
 
 	SendEventInformation(Handle, eventInfo, sizeOfEventInfo, DokanInstance);
 
-	free(eventInfo);
+	FreeEventInformation(eventInfo);
 	return;
 }
@@ -0,0 +1,672 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2008 Hiroki Asakawa info@dokan-dev.net
+
+  http://dokan-dev.net/en
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <windows.h>
+#include "dokani.h"
+#include "fileinfo.h"
+#include "loopback.h"
+
+
+/*
+
+DokanLoopbackSubmit
+  # put the request into NotifyList (as DokanEventNotification)
+  # and wait for Completed
+
+DokanLoop
+  LoopbackWaitEvent
+    # move the request from NotifyList to PendingList
+	# and copy its EVENT_CONTEXT (as NotificationLoop),
+	# more requests are packed when no other thread is waiting
+  Dispatch*
+    LoopbackSendEventInformation
+	  # remove the request from PendingList, copy the reply
+	  # and set Completed (as DokanCompleteIrp)
+
+*/
+
+
+#define DOKAN_LOOPBACK_MOUNT_ID		1
+
+// number of completion events kept for reuse
+#define DOKAN_LOOPBACK_EVENT_CACHE	64
+
+
+typedef struct _LOOPBACK_REQUEST {
+	LIST_ENTRY			ListEntry;
+	PEVENT_CONTEXT		EventContext;
+	PEVENT_INFORMATION	EventInfo;
+	ULONG				EventInfoLength;
+	ULONG				ReturnedLength;
+	// NULL when no reply is expected (IRP_MJ_CLOSE and IRP_MJ_SHUTDOWN),
+	// the request and its EventContext are freed by the worker then
+	HANDLE				Completed;
+} LOOPBACK_REQUEST, *PLOOPBACK_REQUEST;
+
+
+// PDOKAN_LOOPBACK is declared in loopback.h
+typedef struct _DOKAN_LOOPBACK {
+	CRITICAL_SECTION	Lock;
+
+	// requests which are not handed to DokanLoop yet
+	LIST_ENTRY			NotifyList;
+	// requests which are waiting for EVENT_INFORMATION
+	LIST_ENTRY			PendingList;
+	// counts entries in NotifyList
+	HANDLE				NotEmpty;
+
+	LONG				SerialNumber;
+	BOOL				Stopped;
+
+	// threads in DokanLoopbackSubmit waiting for a reply, DokanLoopbackStop
+	// frees the loopback after SubmitsDone is set
+	LONG				SubmitCount;
+	HANDLE				SubmitsDone;
+
+	// number of threads blocked in LoopbackWaitEvent
+	LONG				WaitingCount;
+
+	HANDLE				FreeEvents[DOKAN_LOOPBACK_EVENT_CACHE];
+	ULONG				FreeEventCount;
+
+	PDOKAN_INSTANCE		DokanInstance;
+} DOKAN_LOOPBACK;
+
+
+static PLOOPBACK_REQUEST
+FindPendingRequest(
+	PDOKAN_LOOPBACK	Loopback,
+	ULONG			SerialNumber)
+{
+	PLIST_ENTRY listHead = &Loopback->PendingList;
+	PLIST_ENTRY entry;
+
+	for (entry = listHead->Flink; entry != listHead; entry = entry->Flink) {
+		PLOOPBACK_REQUEST request = CONTAINING_RECORD(entry, LOOPBACK_REQUEST, ListEntry);
+		if (request->EventContext->SerialNumber == SerialNumber) {
+			return request;
+		}
+	}
+	return NULL;
+}
+
+
+static HANDLE
+AllocateCompletedEvent(
+	PDOKAN_LOOPBACK	Loopback)
+{
+	HANDLE event = NULL;
+
+	EnterCriticalSection(&Loopback->Lock);
+	if (Loopback->FreeEventCount > 0) {
+		event = Loopback->FreeEvents[--Loopback->FreeEventCount];
+	}
+	LeaveCriticalSection(&Loopback->Lock);
+
+	if (event == NULL) {
+		event = CreateEvent(NULL, FALSE, FALSE, NULL);
+	}
+	return event;
+}
+
+
+static VOID
+FreeCompletedEvent(
+	PDOKAN_LOOPBACK	Loopback,
+	HANDLE			Event)
+{
+	EnterCriticalSection(&Loopback->Lock);
+	if (Loopback->FreeEventCount < DOKAN_LOOPBACK_EVENT_CACHE) {
+		Loopback->FreeEvents[Loopback->FreeEventCount++] = Event;
+		Event = NULL;
+	}
+	LeaveCriticalSection(&Loopback->Lock);
+
+	if (Event != NULL) {
+		CloseHandle(Event);
+	}
+}
+
+
+static HANDLE
+LoopbackOpenChannel(
+	PDOKAN_INSTANCE	DokanInstance)
+{
+	// all threads share the loopback
+	return (HANDLE)DokanInstance->TransportContext;
+}
+
+
+static VOID
+LoopbackCloseChannel(
+	HANDLE	Channel)
+{
+	UNREFERENCED_PARAMETER(Channel);
+}
+
+
+// Copies the EVENT_CONTEXT of Request to Buffer and moves Request to
+// PendingList. Returns the copied length, 0 when it does not fit.
+// Called with Lock held.
+static ULONG
+TakeRequest(
+	PDOKAN_LOOPBACK		Loopback,
+	PLOOPBACK_REQUEST	Request,
+	PVOID				Buffer,
+	ULONG				BufferLength)
+{
+	PEVENT_CONTEXT	eventContext = Request->EventContext;
+	ULONG			length = 0;
+
+	if (eventContext->Length <= BufferLength) {
+		CopyMemory(Buffer, eventContext, eventContext->Length);
+		length = eventContext->Length;
+
+	} else if (eventContext->MajorFunction == IRP_MJ_WRITE) {
+		// same as DokanDispatchWrite, hand the head of the event and
+		// let DispatchWrite fetch the whole of it with SendWriteRequest
+		PEVENT_CONTEXT requestContext = (PEVENT_CONTEXT)Buffer;
+		ULONG requestLength = max(sizeof(EVENT_CONTEXT), eventContext->Write.BufferOffset);
+
+		CopyMemory(requestContext, eventContext, requestLength);
+		requestContext->Length = requestLength;
+		requestContext->Write.RequestLength = eventContext->Length;
+		length = requestLength;
+
+	} else {
+		DbgPrint("Dokan Error: loopback event too big %d\n", eventContext->Length);
+	}
+
+	if (Request->Completed == NULL) {
+		free(Request->EventContext);
+		free(Request);
+
+	} else if (length == 0) {
+		// nobody will reply to this
+		SetEvent(Request->Completed);
+
+	} else {
+		InsertTailList(&Loopback->PendingList, &Request->ListEntry);
+	}
+	return length;
+}
+
+
+static BOOL
+LoopbackWaitEvent(
+	HANDLE	Channel,
+	PVOID	Buffer,
+	ULONG	BufferLength,
+	PULONG	ReturnedLength)
+{
+	PDOKAN_LOOPBACK		loopback = (PDOKAN_LOOPBACK)Channel;
+	PLOOPBACK_REQUEST	request;
+	ULONG				offset;
+
+	*ReturnedLength = 0;
+
+	InterlockedIncrement(&loopback->WaitingCount);
+	for (;;) {
+		WaitForSingleObject(loopback->NotEmpty, INFINITE);
+
+		EnterCriticalSection(&loopback->Lock);
+		if (!IsListEmpty(&loopback->NotifyList)) {
+			break;
+		}
+		if (loopback->Stopped) {
+			LeaveCriticalSection(&loopback->Lock);
+			InterlockedDecrement(&loopback->WaitingCount);
+			// wake up the next thread, the number of threads changes
+			ReleaseSemaphore(loopback->NotEmpty, 1, NULL);
+			return FALSE;
+		}
+		LeaveCriticalSection(&loopback->Lock);
+	}
+	InterlockedDecrement(&loopback->WaitingCount);
+
+	request = CONTAINING_RECORD(
+				RemoveHeadList(&loopback->NotifyList), LOOPBACK_REQUEST, ListEntry);
+	*ReturnedLength = TakeRequest(loopback, request, Buffer, BufferLength);
+
+	// as IOCTL_EVENT_WAIT_BATCH, pack more events only when no other
+	// thread is waiting, otherwise they are better run in parallel
+	offset = EVENT_CONTEXT_ALIGN(*ReturnedLength);
+	while (*ReturnedLength > 0 &&
+			loopback->WaitingCount == 0 &&
+			!IsListEmpty(&loopback->NotifyList)) {
+
+		ULONG length;
+
+		request = CONTAINING_RECORD(
+					loopback->NotifyList.Flink, LOOPBACK_REQUEST, ListEntry);
+
+		if (offset >= BufferLength ||
+			BufferLength - offset < request->EventContext->Length) {
+			break;
+		}
+		// take the count of this entry, DokanLoopbackSubmit may
+		// not have released it yet
+		if (WaitForSingleObject(loopback->NotEmpty, 0) != WAIT_OBJECT_0) {
+			break;
+		}
+		RemoveHeadList(&loopback->NotifyList);
+
+		length = TakeRequest(loopback, request, (PCHAR)Buffer + offset, BufferLength - offset);
+		*ReturnedLength = offset + length;
+		offset = EVENT_CONTEXT_ALIGN(offset + length);
+	}
+
+	LeaveCriticalSection(&loopback->Lock);
+	return TRUE;
+}
+
+
+static BOOL
+LoopbackSendEventInformation(
+	HANDLE				Channel,
+	PEVENT_INFORMATION	EventInfo,
+	ULONG				EventLength)
+{
+	PDOKAN_LOOPBACK		loopback = (PDOKAN_LOOPBACK)Channel;
+	PLOOPBACK_REQUEST	request;
+
+	EnterCriticalSection(&loopback->Lock);
+
+	request = FindPendingRequest(loopback, EventInfo->SerialNumber);
+	if (request == NULL) {
+		LeaveCriticalSection(&loopback->Lock);
+		DbgPrint("Dokan Error: loopback reply %d has no request\n", EventInfo->SerialNumber);
+		return FALSE;
+	}
+	RemoveEntryList(&request->ListEntry);
+
+	request->ReturnedLength = min(EventLength, request->EventInfoLength);
+	CopyMemory(request->EventInfo, EventInfo, request->ReturnedLength);
+
+	LeaveCriticalSection(&loopback->Lock);
+
+	SetEvent(request->Completed);
+	return TRUE;
+}
+
+
+static BOOL
+LoopbackSendWriteRequest(
+	HANDLE				Channel,
+	PEVENT_INFORMATION	EventInfo,
+	ULONG				EventLength,
+	PVOID				Buffer,
+	ULONG				BufferLength)
+{
+	PDOKAN_LOOPBACK		loopback = (PDOKAN_LOOPBACK)Channel;
+	PLOOPBACK_REQUEST	request;
+
+	UNREFERENCED_PARAMETER(EventLength);
+
+	EnterCriticalSection(&loopback->Lock);
+
+	// the request stays pending until the reply of the write
+	request = FindPendingRequest(loopback, EventInfo->SerialNumber);
+	if (request == NULL || BufferLength < request->EventContext->Length) {
+		LeaveCriticalSection(&loopback->Lock);
+		DbgPrint("Dokan Error: loopback write request %d failed\n", EventInfo->SerialNumber);
+		return FALSE;
+	}
+	CopyMemory(Buffer, request->EventContext, request->EventContext->Length);
+
+	LeaveCriticalSection(&loopback->Lock);
+	return TRUE;
+}
+
+
+DOKAN_TRANSPORT DokanLoopbackTransport = {
+	LoopbackOpenChannel,
+	LoopbackCloseChannel,
+	LoopbackWaitEvent,
+	LoopbackSendEventInformation,
+	LoopbackSendWriteRequest
+};
+
+
+PEVENT_CONTEXT DOKANAPI
+DokanLoopbackAllocateEvent(
+	UCHAR	MajorFunction,
+	LPCWSTR	FileName,
+	LPCWSTR	SearchPattern,
+	ULONG	DataLength)
+{
+	PEVENT_CONTEXT	eventContext;
+	ULONG	fileNameLength = FileName ? (ULONG)wcslen(FileName) * sizeof(WCHAR) : 0;
+	ULONG	searchPatternLength = 0;
+	ULONG	eventLength;
+	PWCHAR	fileNameBuffer = NULL;
+	PULONG	fileNameLengthField = NULL;
+
+	if (MajorFunction == IRP_MJ_DIRECTORY_CONTROL && SearchPattern) {
+		searchPatternLength = (ULONG)wcslen(SearchPattern) * sizeof(WCHAR);
+	}
+
+	// sizeof(EVENT_CONTEXT) is enough for the last null chars
+	eventLength = sizeof(EVENT_CONTEXT) + fileNameLength + searchPatternLength + DataLength;
+
+	eventContext = (PEVENT_CONTEXT)malloc(eventLength);
+	if (eventContext == NULL) {
+		return NULL;
+	}
+	ZeroMemory(eventContext, eventLength);
+
+	eventContext->Length = eventLength;
+	eventContext->MajorFunction = MajorFunction;
+	eventContext->ProcessId = GetCurrentProcessId();
+
+	switch (MajorFunction) {
+	case IRP_MJ_CREATE:
+		fileNameLengthField = &eventContext->Create.FileNameLength;
+		fileNameBuffer = eventContext->Create.FileName;
+		break;
+	case IRP_MJ_CLEANUP:
+		fileNameLengthField = &eventContext->Cleanup.FileNameLength;
+		fileNameBuffer = eventContext->Cleanup.FileName;
+		break;
+	case IRP_MJ_CLOSE:
+		fileNameLengthField = &eventContext->Close.FileNameLength;
+		fileNameBuffer = eventContext->Close.FileName;
+		break;
+	case IRP_MJ_DIRECTORY_CONTROL:
+		fileNameLengthField = &eventContext->Directory.DirectoryNameLength;
+		fileNameBuffer = eventContext->Directory.DirectoryName;
+		if (searchPatternLength) {
+			eventContext->Directory.SearchPatternLength = searchPatternLength;
+			eventContext->Directory.SearchPatternOffset = fileNameLength;
+			CopyMemory((PCHAR)&eventContext->Directory.SearchPatternBase[0] + fileNameLength,
+				SearchPattern, searchPatternLength);
+		}
+		break;
+	case IRP_MJ_READ:
+		fileNameLengthField = &eventContext->Read.FileNameLength;
+		fileNameBuffer = eventContext->Read.FileName;
+		break;
+	case IRP_MJ_WRITE:
+		fileNameLengthField = &eventContext->Write.FileNameLength;
+		fileNameBuffer = eventContext->Write.FileName;
+		eventContext->Write.BufferLength = DataLength;
+		eventContext->Write.BufferOffset = FIELD_OFFSET(EVENT_CONTEXT, Write.FileName[0]) +
+											fileNameLength + sizeof(WCHAR);
+		break;
+	case IRP_MJ_QUERY_INFORMATION:
+		fileNameLengthField = &eventContext->File.FileNameLength;
+		fileNameBuffer = eventContext->File.FileName;
+		break;
+	case IRP_MJ_SET_INFORMATION:
+		fileNameLengthField = &eventContext->SetFile.FileNameLength;
+		fileNameBuffer = eventContext->SetFile.FileName;
+		eventContext->SetFile.BufferLength = DataLength;
+		eventContext->SetFile.BufferOffset = FIELD_OFFSET(EVENT_CONTEXT, SetFile.FileName[0]) +
+											fileNameLength + sizeof(WCHAR);
+		break;
+	case IRP_MJ_LOCK_CONTROL:
+		fileNameLengthField = &eventContext->Lock.FileNameLength;
+		fileNameBuffer = eventContext->Lock.FileName;
+		break;
+	case IRP_MJ_FLUSH_BUFFERS:
+		fileNameLengthField = &eventContext->Flush.FileNameLength;
+		fileNameBuffer = eventContext->Flush.FileName;
+		break;
+	case IRP_MJ_QUERY_SECURITY:
+		fileNameLengthField = &eventContext->Security.FileNameLength;
+		fileNameBuffer = eventContext->Security.FileName;
+		break;
+	case IRP_MJ_SET_SECURITY:
+		fileNameLengthField = &eventContext->SetSecurity.FileNameLength;
+		fileNameBuffer = eventContext->SetSecurity.FileName;
+		eventContext->SetSecurity.BufferLength = DataLength;
+		eventContext->SetSecurity.BufferOffset = FIELD_OFFSET(EVENT_CONTEXT, SetSecurity.FileName[0]) +
+											fileNameLength + sizeof(WCHAR);
+		break;
+	default:
+		// IRP_MJ_QUERY_VOLUME_INFORMATION and IRP_MJ_SHUTDOWN have no file name
+		break;
+	}
+
+	if (fileNameBuffer != NULL) {
+		*fileNameLengthField = fileNameLength;
+		CopyMemory(fileNameBuffer, FileName, fileNameLength);
+	}
+
+	return eventContext;
+}
+
+
+VOID DOKANAPI
+DokanLoopbackFreeEvent(
+	PEVENT_CONTEXT	EventContext)
+{
+	free(EventContext);
+}
+
+
+BOOL DOKANAPI
+DokanLoopbackSubmit(
+	PDOKAN_LOOPBACK		Loopback,
+	PEVENT_CONTEXT		EventContext,
+	PEVENT_INFORMATION	EventInfo,
+	ULONG				EventInfoLength,
+	PULONG				ReturnedLength)
+{
+	LOOPBACK_REQUEST	request;
+	PLOOPBACK_REQUEST	noReplyRequest;
+
+	if (ReturnedLength) {
+		*ReturnedLength = 0;
+	}
+
+	EventContext->MountId = Loopback->DokanInstance->MountId;
+	EventContext->SerialNumber = (ULONG)InterlockedIncrement(&Loopback->SerialNumber);
+
+	if (EventContext->MajorFunction == IRP_MJ_CLOSE ||
+		EventContext->MajorFunction == IRP_MJ_SHUTDOWN) {
+		// DispatchClose and DispatchUnmount never reply
+		noReplyRequest = (PLOOPBACK_REQUEST)malloc(sizeof(LOOPBACK_REQUEST));
+		if (noReplyRequest == NULL) {
+			return FALSE;
+		}
+		ZeroMemory(noReplyRequest, sizeof(LOOPBACK_REQUEST));
+		noReplyRequest->EventContext = (PEVENT_CONTEXT)malloc(EventContext->Length);
+		if (noReplyRequest->EventContext == NULL) {
+			free(noReplyRequest);
+			return FALSE;
+		}
+		CopyMemory(noReplyRequest->EventContext, EventContext, EventContext->Length);
+
+		EnterCriticalSection(&Loopback->Lock);
+		if (Loopback->Stopped) {
+			LeaveCriticalSection(&Loopback->Lock);
+			free(noReplyRequest->EventContext);
+			free(noReplyRequest);
+			return FALSE;
+		}
+		InsertTailList(&Loopback->NotifyList, &noReplyRequest->ListEntry);
+		LeaveCriticalSection(&Loopback->Lock);
+
+		ReleaseSemaphore(Loopback->NotEmpty, 1, NULL);
+		return TRUE;
+	}
+
+	ZeroMemory(&request, sizeof(LOOPBACK_REQUEST));
+	request.EventContext = EventContext;
+	request.EventInfo = EventInfo;
+	request.EventInfoLength = EventInfoLength;
+	request.Completed = AllocateCompletedEvent(Loopback);
+	if (request.Completed == NULL) {
+		return FALSE;
+	}
+
+	EnterCriticalSection(&Loopback->Lock);
+	if (Loopback->Stopped) {
+		LeaveCriticalSection(&Loopback->Lock);
+		FreeCompletedEvent(Loopback, request.Completed);
+		return FALSE;
+	}
+	InsertTailList(&Loopback->NotifyList, &request.ListEntry);
+	Loopback->SubmitCount++;
+	LeaveCriticalSection(&Loopback->Lock);
+
+	ReleaseSemaphore(Loopback->NotEmpty, 1, NULL);
+
+	WaitForSingleObject(request.Completed, INFINITE);
+	FreeCompletedEvent(Loopback, request.Completed);
+
+	// Loopback may be freed as soon as this is left
+	EnterCriticalSection(&Loopback->Lock);
+	if (--Loopback->SubmitCount == 0 && Loopback->Stopped) {
+		SetEvent(Loopback->SubmitsDone);
+	}
+	LeaveCriticalSection(&Loopback->Lock);
+
+	if (ReturnedLength) {
+		*ReturnedLength = request.ReturnedLength;
+	}
+	return request.ReturnedLength > 0;
+}
+
+
+PDOKAN_LOOPBACK DOKANAPI
+DokanLoopbackStart(
+	PDOKAN_OPTIONS		DokanOptions,
+	PDOKAN_OPERATIONS	DokanOperations)
+{
+	PDOKAN_LOOPBACK	loopback;
+	PDOKAN_INSTANCE	instance;
+
+	g_DebugMode = DokanOptions->Options & DOKAN_OPTION_DEBUG;
+	g_UseStdErr = DokanOptions->Options & DOKAN_OPTION_STDERR;
+	if (g_UseStdErr) {
+		g_DebugMode = TRUE;
+	}
+
+	loopback = (PDOKAN_LOOPBACK)malloc(sizeof(DOKAN_LOOPBACK));
+	if (loopback == NULL) {
+		return NULL;
+	}
+	ZeroMemory(loopback, sizeof(DOKAN_LOOPBACK));
+
+#if _MSC_VER < 1300
+	InitializeCriticalSection(&loopback->Lock);
+#else
+	InitializeCriticalSectionAndSpinCount(
+		&loopback->Lock, 0x80000400);
+#endif
+
+	InitializeListHead(&loopback->NotifyList);
+	InitializeListHead(&loopback->PendingList);
+	loopback->NotEmpty = CreateSemaphore(NULL, 0, MAXLONG, NULL);
+	loopback->SubmitsDone = CreateEvent(NULL, TRUE, FALSE, NULL);
+
+	if (loopback->NotEmpty == NULL || loopback->SubmitsDone == NULL) {
+		if (loopback->NotEmpty != NULL) {
+			CloseHandle(loopback->NotEmpty);
+		}
+		if (loopback->SubmitsDone != NULL) {
+			CloseHandle(loopback->SubmitsDone);
+		}
+		DeleteCriticalSection(&loopback->Lock);
+		free(loopback);
+		return NULL;
+	}
+
+	instance = NewDokanInstance();
+	instance->DokanOptions = DokanOptions;
+	instance->DokanOperations = DokanOperations;
+	instance->Transport = &DokanLoopbackTransport;
+	instance->TransportContext = loopback;
+	instance->MountId = DOKAN_LOOPBACK_MOUNT_ID;
+	instance->EventBufferSize = GetEventBufferSize(DokanOptions);
+	if (DOKAN_MOUNT_POINT_SUPPORTED_VERSION <= DokanOptions->Version &&
+		DokanOptions->MountPoint) {
+		wcscpy_s(instance->MountPoint, sizeof(instance->MountPoint) / sizeof(WCHAR),
+				DokanOptions->MountPoint);
+	}
+	loopback->DokanInstance = instance;
+
+	if (!StartDokanLoop(instance)) {
+		DeleteDokanInstance(instance);
+		CloseHandle(loopback->NotEmpty);
+		CloseHandle(loopback->SubmitsDone);
+		DeleteCriticalSection(&loopback->Lock);
+		free(loopback);
+		return NULL;
+	}
+
+	return loopback;
+}
+
+
+VOID DOKANAPI
+DokanLoopbackStop(
+	PDOKAN_LOOPBACK		Loopback)
+{
+	PEVENT_CONTEXT	eventContext;
+	ULONG			i;
+	LONG			submitCount;
+
+	// same as the driver, notify Unmount before threads stop
+	eventContext = DokanLoopbackAllocateEvent(IRP_MJ_SHUTDOWN, NULL, NULL, 0);
+	if (eventContext != NULL) {
+		DokanLoopbackSubmit(Loopback, eventContext, NULL, 0, NULL);
+		DokanLoopbackFreeEvent(eventContext);
+	}
+
+	EnterCriticalSection(&Loopback->Lock);
+	Loopback->Stopped = TRUE;
+	LeaveCriticalSection(&Loopback->Lock);
+
+	// wake up threads, each of them wakes up the next one
+	ReleaseSemaphore(Loopback->NotEmpty, 1, NULL);
+
+	WaitDokanLoop(Loopback->DokanInstance);
+
+	WaitIoOperations(Loopback->DokanInstance);
+
+	// nobody replies to the requests left
+	while (!IsListEmpty(&Loopback->PendingList)) {
+		PLOOPBACK_REQUEST request = CONTAINING_RECORD(
+			RemoveHeadList(&Loopback->PendingList), LOOPBACK_REQUEST, ListEntry);
+		SetEvent(request->Completed);
+	}
+
+	EnterCriticalSection(&Loopback->Lock);
+	submitCount = Loopback->SubmitCount;
+	LeaveCriticalSection(&Loopback->Lock);
+	if (submitCount > 0) {
+		WaitForSingleObject(Loopback->SubmitsDone, INFINITE);
+	}
+
+	for (i = 0; i < Loopback->FreeEventCount; ++i) {
+		CloseHandle(Loopback->FreeEvents[i]);
+	}
+
+	DeleteDokanInstance(Loopback->DokanInstance);
+
+	CloseHandle(Loopback->NotEmpty);
+	CloseHandle(Loopback->SubmitsDone);
+	DeleteCriticalSection(&Loopback->Lock);
+	free(Loopback);
+}
@@ -0,0 +1,95 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2008 Hiroki Asakawa info@dokan-dev.net
+
+  http://dokan-dev.net/en
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef _LOOPBACK_H_
+#define _LOOPBACK_H_
+
+#include "public.h"
+#include "dokan.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Loopback mount
+//
+// Runs DOKAN_OPERATIONS on the DokanLoop threads without dokan.sys.
+// The caller plays the role of the driver: it builds EVENT_CONTEXTs
+// with DokanLoopbackAllocateEvent, submits them and gets the
+// EVENT_INFORMATION replies back. As in the driver, the caller has to
+// keep EVENT_INFORMATION.Context of IRP_MJ_CREATE and pass it in
+// EVENT_CONTEXT.Context of the following requests on that file.
+
+typedef struct _DOKAN_LOOPBACK *PDOKAN_LOOPBACK;
+
+
+// starts DokanOptions->ThreadCount DokanLoop threads,
+// returns NULL on failure
+PDOKAN_LOOPBACK DOKANAPI
+DokanLoopbackStart(
+	PDOKAN_OPTIONS		DokanOptions,
+	PDOKAN_OPERATIONS	DokanOperations);
+
+
+// sends IRP_MJ_SHUTDOWN and waits for all threads and DOKAN_OPTION_ASYNC
+// operations, DokanLoopbackSubmit of other threads returns before this does
+VOID DOKANAPI
+DokanLoopbackStop(
+	PDOKAN_LOOPBACK		Loopback);
+
+
+// Allocates a zero filled EVENT_CONTEXT laid out as dokan.sys does.
+// FileName is copied to the file name field of MajorFunction.
+// SearchPattern is used by IRP_MJ_DIRECTORY_CONTROL only.
+// DataLength bytes are reserved after the file name for
+// IRP_MJ_WRITE, IRP_MJ_SET_INFORMATION and IRP_MJ_SET_SECURITY and
+// BufferOffset/BufferLength are set.
+PEVENT_CONTEXT DOKANAPI
+DokanLoopbackAllocateEvent(
+	UCHAR	MajorFunction,
+	LPCWSTR	FileName,
+	LPCWSTR	SearchPattern,
+	ULONG	DataLength);
+
+
+VOID DOKANAPI
+DokanLoopbackFreeEvent(
+	PEVENT_CONTEXT	EventContext);
+
+
+// Submits EventContext and waits until a DokanLoop thread replies.
+// MountId and SerialNumber are filled in. At most EventInfoLength bytes
+// of the reply are copied to EventInfo. IRP_MJ_CLOSE and IRP_MJ_SHUTDOWN
+// have no reply and return as soon as they are queued.
+BOOL DOKANAPI
+DokanLoopbackSubmit(
+	PDOKAN_LOOPBACK		Loopback,
+	PEVENT_CONTEXT		EventContext,
+	PEVENT_INFORMATION	EventInfo,
+	ULONG				EventInfoLength,
+	PULONG				ReturnedLength);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _LOOPBACK_H_
@@ -0,0 +1,390 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2008 Hiroki Asakawa info@dokan-dev.net
+
+  http://dokan-dev.net/en
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "dokani.h"
+
+
+/*
+
+Compiled name expression
+
+  An expression is compiled once per enumeration and matched against
+  each name without recursion.
+
+  # CompileNameExpression
+    # upcase the expression when IgnoreCase
+    # find literal prefix and suffix around the wildcards
+
+  # MatchNameExpression
+    # no wildcard: compare whole names
+    # reject names whose prefix or suffix differ
+    # "prefix*suffix": done
+    # otherwise run the automaton
+      # states are positions in the expression, one set per
+        position in the name, so the cost is O(name * expression)
+
+  A compiled expression keeps its state sets and is used by one
+  thread at a time. DokanIsNameInExpression compiles expressions of up
+  to MAX_PATH characters on the stack.
+
+  Differences from the recursive matcher this replaced:
+    # '?' does not match the end of the name, it stepped over the null
+      ("a?*" matched "a")
+    # DOS_QM matches zero characters at the end of the name (">>>"
+      matches "ab", it stepped over the null and matched nothing shorter
+      than the expression)
+    # DOS_STAR at the start of a name without a period matches ("<"
+      matches "abc", it stopped at once as if a period were there)
+
+*/
+
+
+#define DOS_STAR                        (L'<')
+#define DOS_QM                          (L'>')
+#define DOS_DOT                         (L'"')
+
+#define IsWildcard(c) \
+	((c) == L'*' || (c) == L'?' || (c) == DOS_STAR || (c) == DOS_QM || (c) == DOS_DOT)
+
+
+struct _DOKAN_NAME_EXPRESSION {
+	BOOL	IgnoreCase;
+	BOOL	HasWildcard;
+	// wildcards between prefix and suffix are a single '*'
+	BOOL	StarOnly;
+	ULONG	Length;
+	// literal characters before the first and after the last wildcard
+	ULONG	PrefixLength;
+	ULONG	SuffixLength;
+
+	// state sets of the automaton, Length + 1 entries each
+	PULONG	Current;
+	PULONG	Next;
+	// a state is in the set being built when Mark[state] == Stamp
+	PULONG	Mark;
+	ULONG	Stamp;
+
+	// upcased when IgnoreCase
+	WCHAR	Expression[1];
+};
+
+
+// bytes before the state sets of an expression of Length characters
+#define NameExpressionHeaderSize(Length) \
+	((FIELD_OFFSET(struct _DOKAN_NAME_EXPRESSION, Expression) \
+		+ ((Length) + 1) * sizeof(WCHAR) + sizeof(ULONG) - 1) & ~(sizeof(ULONG) - 1))
+
+#define NameExpressionSize(Length) \
+	(NameExpressionHeaderSize(Length) + ((Length) + 1) * sizeof(ULONG) * 3)
+
+
+// compiles Expression of Length characters into Memory,
+// which has NameExpressionSize(Length) bytes
+static PDOKAN_NAME_EXPRESSION
+InitNameExpression(
+	PVOID	Memory,
+	LPCWSTR	Expression,
+	ULONG	Length,
+	BOOL	IgnoreCase)
+{
+	PDOKAN_NAME_EXPRESSION	expr = (PDOKAN_NAME_EXPRESSION)Memory;
+	ULONG	length = Length;
+	ULONG	first = length;
+	ULONG	last = length;
+	SIZE_T	size = NameExpressionHeaderSize(length);
+	SIZE_T	stateSize = (length + 1) * sizeof(ULONG);
+	ULONG	i;
+
+	for (i = 0; i < length; ++i) {
+		WCHAR c = Expression[i];
+		if (IsWildcard(c)) {
+			if (first == length)
+				first = i;
+			last = i;
+		}
+	}
+
+	if (IgnoreCase) {
+		DokanNameUpcase(expr->Expression, Expression, length);
+	} else {
+		CopyMemory(expr->Expression, Expression, length * sizeof(WCHAR));
+	}
+	expr->Expression[length] = L'\0';
+
+	expr->IgnoreCase	= IgnoreCase;
+	expr->Length		= length;
+	expr->HasWildcard	= first < length;
+	expr->PrefixLength	= first;
+	expr->SuffixLength	= expr->HasWildcard ? length - last - 1 : length;
+	expr->StarOnly		= expr->HasWildcard && first == last && Expression[first] == L'*';
+
+	expr->Current	= (PULONG)((PCHAR)expr + size);
+	expr->Next		= expr->Current + length + 1;
+	expr->Mark		= expr->Next + length + 1;
+	expr->Stamp		= 0;
+	ZeroMemory(expr->Mark, stateSize);
+
+	return expr;
+}
+
+
+PDOKAN_NAME_EXPRESSION
+CompileNameExpression(
+	LPCWSTR	Expression,
+	BOOL	IgnoreCase)
+{
+	ULONG	length = (ULONG)wcslen(Expression);
+	PVOID	memory = malloc(NameExpressionSize(length));
+
+	if (memory == NULL) {
+		return NULL;
+	}
+	return InitNameExpression(memory, Expression, length, IgnoreCase);
+}
+
+
+VOID
+FreeNameExpression(
+	PDOKAN_NAME_EXPRESSION	Expression)
+{
+	free(Expression);
+}
+
+
+static BOOL
+CompareLiteral(
+	PDOKAN_NAME_EXPRESSION	Expression,
+	LPCWSTR					Literal,
+	LPCWSTR					Name,
+	ULONG					Length)
+{
+	if (Expression->IgnoreCase) {
+		return DokanNameEqualIgnoreCase(Literal, Name, Length);
+	}
+	return DokanNameEqual(Literal, Name, Length);
+}
+
+
+static VOID
+NextStamp(
+	PDOKAN_NAME_EXPRESSION	Expression)
+{
+	if (++Expression->Stamp == 0) {
+		ZeroMemory(Expression->Mark, (Expression->Length + 1) * sizeof(ULONG));
+		Expression->Stamp = 1;
+	}
+}
+
+
+// adds State at Position of the name, and the states which
+// follow it without consuming a character
+static VOID
+AddState(
+	PDOKAN_NAME_EXPRESSION	Expression,
+	PULONG		List,
+	PULONG		Count,
+	ULONG		State,
+	ULONG		Position,
+	LPCWSTR		Name,
+	ULONG		NameLength,
+	LONG		LastDot)
+{
+	while (Expression->Mark[State] != Expression->Stamp) {
+		WCHAR c;
+
+		Expression->Mark[State] = Expression->Stamp;
+		List[(*Count)++] = State;
+
+		if (State == Expression->Length)
+			return;
+
+		c = Expression->Expression[State];
+
+		if (c == L'*' || c == DOS_STAR) {
+			// zero characters
+			State++;
+
+		} else if (c == DOS_DOT) {
+			// a period here must be consumed
+			if (Position < NameLength && Name[Position] == L'.')
+				return;
+			State++;
+
+		} else if (c == DOS_QM) {
+			// zero characters at the last period or at the end of the name
+			if (Position == NameLength || (LONG)Position == LastDot) {
+				State++;
+			} else {
+				return;
+			}
+
+		} else {
+			return;
+		}
+	}
+}
+
+
+static BOOL
+RunNameExpression(
+	PDOKAN_NAME_EXPRESSION	Expression,
+	LPCWSTR		Name,
+	ULONG		NameLength,
+	LONG		LastDot)
+{
+	PULONG	list;
+	ULONG	count = 0;
+	ULONG	n;
+
+	NextStamp(Expression);
+	AddState(Expression, Expression->Current, &count, 0, 0, Name, NameLength, LastDot);
+
+	for (n = 0; n < NameLength && count > 0; ++n) {
+		WCHAR	ch = Expression->IgnoreCase ? DOKAN_UPCASE_CHAR(Name[n]) : Name[n];
+		// DOS_STAR does not consume the last period
+		ULONG	stop = LastDot >= (LONG)n ? (ULONG)LastDot : NameLength;
+		ULONG	nextCount = 0;
+		ULONG	i;
+
+		NextStamp(Expression);
+
+		for (i = 0; i < count; ++i) {
+			ULONG	state = Expression->Current[i];
+			ULONG	next = Expression->Length + 1;
+			WCHAR	c;
+
+			if (state == Expression->Length)
+				continue;
+
+			c = Expression->Expression[state];
+
+			if (c == L'*') {
+				next = state;
+			} else if (c == DOS_STAR) {
+				if (n < stop)
+					next = state;
+			} else if (c == L'?') {
+				next = state + 1;
+			} else if (c == DOS_QM) {
+				// a period is consumed when another one follows
+				if ((LONG)n != LastDot)
+					next = state + 1;
+			} else if (c == DOS_DOT) {
+				if (ch == L'.')
+					next = state + 1;
+			} else if (c == ch) {
+				next = state + 1;
+			}
+
+			if (next <= Expression->Length) {
+				AddState(Expression, Expression->Next, &nextCount,
+					next, n + 1, Name, NameLength, LastDot);
+			}
+		}
+
+		list = Expression->Current;
+		Expression->Current = Expression->Next;
+		Expression->Next = list;
+		count = nextCount;
+	}
+
+	// the end of the expression is in the last set
+	return Expression->Mark[Expression->Length] == Expression->Stamp;
+}
+
+
+BOOL
+MatchNameExpression(
+	PDOKAN_NAME_EXPRESSION	Expression,
+	LPCWSTR					Name)
+{
+	ULONG	nameLength;
+	LONG	lastDot = -1;
+	ULONG	prefix = Expression->PrefixLength;
+	ULONG	suffix = Expression->SuffixLength;
+
+	for (nameLength = 0; Name[nameLength] != L'\0'; ++nameLength) {
+		if (Name[nameLength] == L'.')
+			lastDot = nameLength;
+	}
+
+	if (!Expression->HasWildcard) {
+		return nameLength == Expression->Length &&
+			CompareLiteral(Expression, Expression->Expression, Name, nameLength);
+	}
+
+	if (nameLength < prefix + suffix ||
+		!CompareLiteral(Expression, Expression->Expression, Name, prefix) ||
+		!CompareLiteral(Expression, &Expression->Expression[Expression->Length - suffix],
+			&Name[nameLength - suffix], suffix)) {
+		return FALSE;
+	}
+
+	if (Expression->StarOnly)
+		return TRUE;
+
+	return RunNameExpression(Expression, Name, nameLength, lastDot);
+}
+
+
+
+// check whether Name matches Expression
+// Expression can contain "?"(any one character) and "*" (any string)
+// when IgnoreCase is TRUE, do case insenstive matching
+//
+// http://msdn.microsoft.com/en-us/library/ff546850(v=VS.85).aspx
+// * (asterisk) Matches zero or more characters.
+// ? (question mark) Matches a single character.
+// DOS_DOT Matches either a period or zero characters beyond the name string.
+// DOS_QM Matches any single character or, upon encountering a period or end
+//        of name string, advances the expression to the end of the set of
+//        contiguous DOS_QMs.
+// DOS_STAR Matches zero or more characters until encountering and matching
+//          the final . in the name.
+BOOL DOKANAPI
+DokanIsNameInExpression(
+	LPCWSTR		Expression, // matching pattern
+	LPCWSTR		Name, // file name
+	BOOL		IgnoreCase)
+{
+	// ULONGLONG for the alignment of the expression
+	ULONGLONG	stack[(NameExpressionSize(MAX_PATH) + sizeof(ULONGLONG) - 1) / sizeof(ULONGLONG)];
+	ULONG		length = (ULONG)wcslen(Expression);
+	PVOID		memory = stack;
+	BOOL		match;
+
+	// called for each name by FindFiles of the file systems,
+	// a longer expression than a path is rare
+	if (length > MAX_PATH) {
+		memory = malloc(NameExpressionSize(length));
+		if (memory == NULL) {
+			return FALSE;
+		}
+	}
+
+	match = MatchNameExpression(
+				InitNameExpression(memory, Expression, length, IgnoreCase), Name);
+
+	if (memory != stack) {
+		free(memory);
+	}
+	return match;
+}
@@ -0,0 +1,264 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2008 Hiroki Asakawa info@dokan-dev.net
+
+  http://dokan-dev.net/en
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <process.h>
+#include "dokani.h"
+
+
+/*
+
+Pool of DokanLoop threads
+
+  starts with DokanOptions->ThreadCount threads and
+  grows up to DokanOptions->MaxThreadCount threads
+
+DokanLoop
+  EnterIdleState
+    # exits when another thread is waiting, the pool is bigger than
+    # MinThreadCount and it has not been saturated for DOKAN_POOL_IDLE_TIMEOUT
+  WaitEvent
+  LeaveIdleState
+    # when no thread is left waiting for the driver or events are
+    # backed up (a batch has more than one event), add a thread
+  Dispatch*
+
+Threads blocked in WaitEvent do not notice that they are idle,
+so the pool shrinks only while events are still coming.
+
+*/
+
+
+// ThreadCount must be incremented for the thread in advance
+static BOOL
+StartDokanLoopThread(
+	PDOKAN_INSTANCE	Instance)
+{
+	HANDLE	thread;
+
+	thread = (HANDLE)_beginthreadex(
+		NULL, // Security Atributes
+		0, //stack size
+		DokanLoop,
+		(PVOID)Instance, // param
+		0, // create flag
+		NULL);
+
+	if (thread == NULL) {
+		DbgPrint("Dokan Error: can't start DokanLoop thread %d\n", GetLastError());
+		LeaveDokanLoop(Instance);
+		return FALSE;
+	}
+
+	// threads are counted, not joined
+	CloseHandle(thread);
+	return TRUE;
+}
+
+
+static BOOL
+AddDokanLoopThread(
+	PDOKAN_INSTANCE	Instance)
+{
+	LONG	threadCount = Instance->ThreadCount;
+	LONG	prev;
+
+	// reserve a slot first so that the pool never exceeds MaxThreadCount
+	for (;;) {
+		if (threadCount >= (LONG)Instance->MaxThreadCount) {
+			return FALSE;
+		}
+		prev = InterlockedCompareExchange(
+				&Instance->ThreadCount, threadCount + 1, threadCount);
+		if (prev == threadCount) {
+			break;
+		}
+		threadCount = prev;
+	}
+
+	return StartDokanLoopThread(Instance);
+}
+
+
+BOOL
+StartDokanLoop(
+	PDOKAN_INSTANCE	Instance)
+{
+	PDOKAN_OPTIONS	options = Instance->DokanOptions;
+	ULONG			i;
+
+	if (options->ThreadCount == 0) {
+		options->ThreadCount = 5;
+
+	} else if (DOKAN_MAX_THREAD < options->ThreadCount) {
+		DokanDbgPrintW(L"Dokan Error: too many thread count %d\n",
+			options->ThreadCount);
+		options->ThreadCount = DOKAN_MAX_THREAD;
+	}
+
+	Instance->MinThreadCount = options->ThreadCount;
+	Instance->MaxThreadCount = options->ThreadCount;
+
+	if (DOKAN_THREAD_POOL_SUPPORTED_VERSION <= options->Version &&
+		Instance->MinThreadCount < options->MaxThreadCount) {
+		Instance->MaxThreadCount = min(options->MaxThreadCount, DOKAN_MAX_THREAD);
+	}
+
+	Instance->ThreadsDrained = CreateEvent(NULL, TRUE, FALSE, NULL);
+	if (Instance->ThreadsDrained == NULL) {
+		return FALSE;
+	}
+	Instance->LastSaturatedTick = GetTickCount();
+
+	// count this function as a thread too, so that ThreadsDrained is not
+	// set before all threads are started
+	InterlockedExchangeAdd(&Instance->ThreadCount, Instance->MinThreadCount + 1);
+
+	for (i = 0; i < Instance->MinThreadCount; ++i) {
+		StartDokanLoopThread(Instance);
+	}
+
+	LeaveDokanLoop(Instance);
+
+	return TRUE;
+}
+
+
+VOID
+WaitDokanLoop(
+	PDOKAN_INSTANCE	Instance)
+{
+	WaitForSingleObject(Instance->ThreadsDrained, INFINITE);
+	CloseHandle(Instance->ThreadsDrained);
+	Instance->ThreadsDrained = NULL;
+}
+
+
+VOID
+LeaveDokanLoop(
+	PDOKAN_INSTANCE	Instance)
+{
+	if (InterlockedDecrement(&Instance->ThreadCount) == 0) {
+		SetEvent(Instance->ThreadsDrained);
+	}
+}
+
+
+BOOL
+EnterIdleState(
+	PDOKAN_INSTANCE	Instance)
+{
+	LONG	threadCount;
+	LONG	prev;
+
+	if (Instance->IdleThreadCount > 0 &&
+		GetTickCount() - Instance->LastSaturatedTick > DOKAN_POOL_IDLE_TIMEOUT) {
+
+		threadCount = Instance->ThreadCount;
+		while (threadCount > (LONG)Instance->MinThreadCount) {
+			prev = InterlockedCompareExchange(
+					&Instance->ThreadCount, threadCount - 1, threadCount);
+			if (prev == threadCount) {
+				DbgPrint("DokanLoop thread exits, %d threads left\n", threadCount - 1);
+				return FALSE;
+			}
+			threadCount = prev;
+		}
+	}
+
+	InterlockedIncrement(&Instance->IdleThreadCount);
+	return TRUE;
+}
+
+
+VOID
+LeaveIdleState(
+	PDOKAN_INSTANCE	Instance,
+	ULONG			EventCount)
+{
+	LONG idleThreadCount = InterlockedDecrement(&Instance->IdleThreadCount);
+
+	if (EventCount == 0) {
+		return;
+	}
+
+	InterlockedExchangeAdd(&Instance->QueueDepth, EventCount);
+
+	if (idleThreadCount == 0 || EventCount > 1) {
+		Instance->LastSaturatedTick = GetTickCount();
+		if (AddDokanLoopThread(Instance)) {
+			DbgPrint("DokanLoop thread added, %d threads\n", Instance->ThreadCount);
+		}
+	}
+}
+
+
+// g_InstanceCriticalSection must be held
+PDOKAN_INSTANCE
+FindDokanInstance(
+	LPCWSTR	MountPoint)
+{
+	PLIST_ENTRY	entry;
+	size_t		length = wcslen(MountPoint);
+
+	for (entry = g_InstanceList.Flink; entry != &g_InstanceList; entry = entry->Flink) {
+		PDOKAN_INSTANCE instance = CONTAINING_RECORD(entry, DOKAN_INSTANCE, ListEntry);
+		LPCWSTR mountPoint = instance->MountPoint;
+
+		if (length <= 3 && wcslen(mountPoint) <= 3) {
+			// drive letter, "M", "M:" or "M:\"
+			if (towupper(MountPoint[0]) == towupper(mountPoint[0])) {
+				return instance;
+			}
+		} else if (wcslen(mountPoint) == length &&
+			DokanNameEqualIgnoreCase(MountPoint, mountPoint, (ULONG)length)) {
+			return instance;
+		}
+	}
+	return NULL;
+}
+
+
+BOOL DOKANAPI
+DokanGetThreadPoolInfo(
+	LPCWSTR					MountPoint,
+	PDOKAN_THREAD_POOL_INFO	ThreadPoolInfo)
+{
+	PDOKAN_INSTANCE	instance;
+
+	if (MountPoint == NULL || ThreadPoolInfo == NULL) {
+		return FALSE;
+	}
+
+	EnterCriticalSection(&g_InstanceCriticalSection);
+
+	instance = FindDokanInstance(MountPoint);
+	if (instance != NULL) {
+		ThreadPoolInfo->ThreadCount		= instance->ThreadCount;
+		ThreadPoolInfo->IdleThreadCount	= instance->IdleThreadCount;
+		ThreadPoolInfo->MinThreadCount	= instance->MinThreadCount;
+		ThreadPoolInfo->MaxThreadCount	= instance->MaxThreadCount;
+		ThreadPoolInfo->QueueDepth		= instance->QueueDepth;
+	}
+
+	LeaveCriticalSection(&g_InstanceCriticalSection);
+
+	return instance != NULL;
+}
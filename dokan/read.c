@@ -23,55 +23,85 @@ with this program. If not, see <http://www.gnu.org/licenses/>.
 #include "fileinfo.h"
 
 
+VOID
+CompleteRead(
+	HANDLE				Handle,
+	PDOKAN_IO_OPERATION	Operation,
+	int					Status)
+{
+	PEVENT_INFORMATION	eventInfo = Operation->EventInfo;
+	PEVENT_CONTEXT		eventContext = Operation->EventContext;
+	ULONG				readLength = Operation->Length;
+
+	Operation->OpenInfo->UserContext = Operation->FileInfo.Context;
+	eventInfo->BufferLength = 0;
+
+	if (Status < 0) {
+		eventInfo->Status = STATUS_INVALID_PARAMETER;
+	} else if(readLength == 0) {
+		eventInfo->Status = STATUS_END_OF_FILE;
+	} else {
+		eventInfo->Status = STATUS_SUCCESS;
+		eventInfo->BufferLength = readLength;
+		eventInfo->Read.CurrentByteOffset.QuadPart =
+			eventContext->Read.ByteOffset.QuadPart + readLength;
+	}
+
+	SendEventInformation(Handle, eventInfo, EVENT_INFO_REPLY_LENGTH(eventInfo),
+		Operation->DokanInstance);
+}
+
+
 VOID
 DispatchRead(
 	HANDLE				Handle,
 	PEVENT_CONTEXT		EventContext,
 	PDOKAN_INSTANCE		DokanInstance)
 {
-	PEVENT_INFORMATION		eventInfo;
-	PDOKAN_OPEN_INFO		openInfo;
-	ULONG					readLength = 0;
+	DOKAN_IO_OPERATION		syncOperation;
+	PDOKAN_IO_OPERATION		operation;
 	int						status;
-	DOKAN_FILE_INFO			fileInfo;
-	ULONG					sizeOfEventInfo;
-	
-	sizeOfEventInfo = sizeof(EVENT_INFORMATION) - 8 + EventContext->Read.BufferLength;
+
+	operation = BeginIoOperation(&syncOperation, EventContext, DokanInstance);
+	EventContext = operation->EventContext;
+
+	operation->SizeOfEventInfo =
+		sizeof(EVENT_INFORMATION) - 8 + EventContext->Read.BufferLength;
 
 	CheckFileName(EventContext->Read.FileName);
 
-	eventInfo = DispatchCommon(
-		EventContext, sizeOfEventInfo, DokanInstance, &fileInfo, &openInfo);
+	operation->EventInfo = DispatchCommon(
+		EventContext, operation->SizeOfEventInfo, DokanInstance,
+		&operation->FileInfo, &operation->OpenInfo);
 
-	DbgPrint("###Read %04d\n", openInfo != NULL ? openInfo->EventId : -1);
+	if (operation->OpenInfo == NULL) {
+		SendEventInformation(Handle, operation->EventInfo, sizeof(EVENT_INFORMATION),
+			DokanInstance);
+		EndIoOperation(operation);
+		return;
+	}
+
+	DbgPrint("###Read %04d\n", operation->OpenInfo->EventId);
 
 	if (DokanInstance->DokanOperations->ReadFile) {
 		status = DokanInstance->DokanOperations->ReadFile(
 						EventContext->Read.FileName,
-						eventInfo->Buffer,
+						operation->EventInfo->Buffer,
 						EventContext->Read.BufferLength,
-						&readLength,
+						&operation->Length,
 						EventContext->Read.ByteOffset.QuadPart,
-						&fileInfo);
+						&operation->FileInfo);
 	} else {
 		status = -1;
 	}
 
-	openInfo->UserContext = fileInfo.Context;
-	eventInfo->BufferLength = 0;
-
-	if (status < 0) {
-		eventInfo->Status = STATUS_INVALID_PARAMETER;
-	} else if(readLength == 0) {
-		eventInfo->Status = STATUS_END_OF_FILE;
-	} else {
-		eventInfo->Status = STATUS_SUCCESS;
-		eventInfo->BufferLength = readLength;
-		eventInfo->Read.CurrentByteOffset.QuadPart =
-			EventContext->Read.ByteOffset.QuadPart + readLength;
+	if (status == ERROR_IO_PENDING && operation->Asynchronous) {
+		// DokanCompleteOperation replies, operation may be gone already
+		return;
 	}
 
-	SendEventInformation(Handle, eventInfo, sizeOfEventInfo, DokanInstance);
-	free(eventInfo);
+	CompleteRead(Handle, operation, status);
+	EndIoOperation(operation);
 	return;
 }
+
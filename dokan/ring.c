@@ -0,0 +1,446 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2008 Hiroki Asakawa info@dokan-dev.net
+
+  http://dokan-dev.net/en
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "dokani.h"
+
+
+/*
+
+DOKAN_OPTION_RING
+
+DokanMain
+  DokanRingStart
+    # IOCTL_RING_REGISTER stays pending on an overlapped handle
+    # until unmount, the slots are shared with the driver
+  StartDokanLoop
+
+DokanLoop
+  RingWaitEvent
+    # take a REQUEST slot, wait for RequestEvent when there is none
+  Dispatch*
+    RingSendEventInformation
+      # write the reply into the slot and set ReplyEvent
+
+Replies which do not fit into the slot, replies to events which came by
+IOCTL_EVENT_WAIT and IOCTL_EVENT_WRITE use the device channel as before.
+
+A reply finds its BUSY slot through BusySlot, indexed by SerialNumber.
+An event whose entry is taken by another BUSY event is counted in
+Unindexed and its reply scans the slots.
+
+*/
+
+
+// each slot holds EventBufferSize, the ring is at most DOKAN_RING_MAX_LENGTH
+#define DOKAN_RING_MIN_SLOT_COUNT	2
+#define DOKAN_RING_SLOT_COUNT		64
+#define DOKAN_RING_BUSY_HASH		(DOKAN_RING_SLOT_COUNT * 4)
+
+
+typedef struct _DOKAN_RING_CONTEXT {
+	// opened with FILE_FLAG_OVERLAPPED for IOCTL_RING_REGISTER
+	HANDLE				Device;
+	// signaled when the driver releases the ring
+	OVERLAPPED			Overlapped;
+
+	// set by the driver when it fills slots
+	HANDLE				RequestEvent;
+	// set when replies are written or slots are freed
+	HANDLE				ReplyEvent;
+
+	PDOKAN_RING_HEADER	Base;
+	SIZE_T				Length;
+	ULONG				SlotCount;
+	ULONG				SlotSize;
+
+	// where to look for a request first
+	LONG				NextSlot;
+
+	// slot index + 1 of a BUSY event by SerialNumber, 0 when empty
+	LONG				BusySlot[DOKAN_RING_BUSY_HASH];
+	// BUSY events which are not in BusySlot
+	LONG				Unindexed;
+} DOKAN_RING_CONTEXT, *PDOKAN_RING_CONTEXT;
+
+
+typedef struct _RING_CHANNEL {
+	PDOKAN_RING_CONTEXT	Ring;
+	HANDLE				DeviceChannel;
+} RING_CHANNEL, *PRING_CHANNEL;
+
+
+#define RingSlot(Ring, Index) \
+	DOKAN_RING_SLOT_AT((Ring)->Base, (Ring)->SlotSize, (Index))
+
+
+static VOID
+DeleteRing(
+	PDOKAN_RING_CONTEXT	Ring)
+{
+	if (Ring->Device != INVALID_HANDLE_VALUE) {
+		CloseHandle(Ring->Device);
+	}
+	if (Ring->Overlapped.hEvent) {
+		CloseHandle(Ring->Overlapped.hEvent);
+	}
+	if (Ring->RequestEvent) {
+		CloseHandle(Ring->RequestEvent);
+	}
+	if (Ring->ReplyEvent) {
+		CloseHandle(Ring->ReplyEvent);
+	}
+	if (Ring->Base) {
+		VirtualFree(Ring->Base, 0, MEM_RELEASE);
+	}
+	free(Ring);
+}
+
+
+BOOL
+DokanRingStart(
+	PDOKAN_INSTANCE	DokanInstance)
+{
+	PDOKAN_RING_CONTEXT	ring;
+	DOKAN_RING_REGISTER	ringRegister;
+
+	ring = (PDOKAN_RING_CONTEXT)malloc(sizeof(DOKAN_RING_CONTEXT));
+	if (ring == NULL) {
+		return FALSE;
+	}
+	ZeroMemory(ring, sizeof(DOKAN_RING_CONTEXT));
+	ring->Device = INVALID_HANDLE_VALUE;
+
+	// any event the driver passes fits into a slot
+	ring->SlotSize = FIELD_OFFSET(DOKAN_RING_SLOT, Data) + DokanInstance->EventBufferSize;
+	ring->SlotCount = (DOKAN_RING_MAX_LENGTH - sizeof(DOKAN_RING_HEADER)) / ring->SlotSize;
+	ring->SlotCount = min(ring->SlotCount, DOKAN_RING_SLOT_COUNT);
+	if (ring->SlotCount < DOKAN_RING_MIN_SLOT_COUNT) {
+		DbgPrint("Dokan: EventBufferSize %d is too big for the ring\n",
+			DokanInstance->EventBufferSize);
+		DeleteRing(ring);
+		return FALSE;
+	}
+	ring->Length = DOKAN_RING_LENGTH(ring->SlotSize, ring->SlotCount);
+
+	ring->Base = (PDOKAN_RING_HEADER)VirtualAlloc(
+					NULL, ring->Length, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+	ring->RequestEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+	ring->ReplyEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+	ring->Overlapped.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+
+	if (ring->Base == NULL || ring->RequestEvent == NULL ||
+		ring->ReplyEvent == NULL || ring->Overlapped.hEvent == NULL) {
+		DbgPrint("Dokan Error: can't allocate ring %d\n", GetLastError());
+		DeleteRing(ring);
+		return FALSE;
+	}
+
+	ring->Device = CreateFile(
+				GetRawDeviceName(DokanInstance->DeviceName), // lpFileName
+				GENERIC_READ | GENERIC_WRITE,       // dwDesiredAccess
+				FILE_SHARE_READ | FILE_SHARE_WRITE, // dwShareMode
+				NULL,                               // lpSecurityAttributes
+				OPEN_EXISTING,                      // dwCreationDistribution
+				FILE_FLAG_OVERLAPPED,               // dwFlagsAndAttributes
+				NULL                                // hTemplateFile
+			);
+
+	if (ring->Device == INVALID_HANDLE_VALUE) {
+		DbgPrint("Dokan Error: CreateFile failed %ws: %d\n",
+			GetRawDeviceName(DokanInstance->DeviceName), GetLastError());
+		DeleteRing(ring);
+		return FALSE;
+	}
+
+	ZeroMemory(&ringRegister, sizeof(DOKAN_RING_REGISTER));
+	ringRegister.RequestEvent = ring->RequestEvent;
+	ringRegister.ReplyEvent = ring->ReplyEvent;
+	ringRegister.SlotCount = ring->SlotCount;
+	ringRegister.SlotSize = ring->SlotSize;
+
+	// IRPs are cancelled when the issuing thread exits,
+	// so this must be called by a thread which lives until unmount
+	if (DeviceIoControl(
+			ring->Device,
+			IOCTL_RING_REGISTER,
+			&ringRegister,
+			sizeof(DOKAN_RING_REGISTER),
+			ring->Base,
+			(DWORD)ring->Length,
+			NULL,
+			&ring->Overlapped) ||
+		GetLastError() != ERROR_IO_PENDING) {
+
+		DbgPrint("Dokan Error: IOCTL_RING_REGISTER failed %d\n", GetLastError());
+		DeleteRing(ring);
+		return FALSE;
+	}
+
+	DbgPrint("ring started: %d slots of %d bytes\n", ring->SlotCount, ring->SlotSize);
+
+	DokanInstance->TransportContext = ring;
+	DokanInstance->Transport = &DokanRingTransport;
+	return TRUE;
+}
+
+
+// called by the thread which called DokanRingStart after DokanLoop exits
+VOID
+DokanRingStop(
+	PDOKAN_INSTANCE	DokanInstance)
+{
+	PDOKAN_RING_CONTEXT	ring = (PDOKAN_RING_CONTEXT)DokanInstance->TransportContext;
+	DWORD				returnedLength;
+
+	if (DokanInstance->Transport != &DokanRingTransport || ring == NULL) {
+		return;
+	}
+
+	if (!HasOverlappedIoCompleted(&ring->Overlapped)) {
+		CancelIo(ring->Device);
+	}
+	// the driver must not touch the memory any more
+	GetOverlappedResult(ring->Device, &ring->Overlapped, &returnedLength, TRUE);
+
+	DeleteRing(ring);
+	DokanInstance->TransportContext = NULL;
+}
+
+
+static HANDLE
+RingOpenChannel(
+	PDOKAN_INSTANCE	DokanInstance)
+{
+	PRING_CHANNEL	channel;
+
+	channel = (PRING_CHANNEL)malloc(sizeof(RING_CHANNEL));
+	if (channel == NULL) {
+		return INVALID_HANDLE_VALUE;
+	}
+
+	channel->Ring = (PDOKAN_RING_CONTEXT)DokanInstance->TransportContext;
+	channel->DeviceChannel = DokanDeviceTransport.OpenChannel(DokanInstance);
+	if (channel->DeviceChannel == INVALID_HANDLE_VALUE) {
+		free(channel);
+		return INVALID_HANDLE_VALUE;
+	}
+	return (HANDLE)channel;
+}
+
+
+static VOID
+RingCloseChannel(
+	HANDLE	Channel)
+{
+	PRING_CHANNEL	channel = (PRING_CHANNEL)Channel;
+
+	DokanDeviceTransport.CloseChannel(channel->DeviceChannel);
+	free(channel);
+}
+
+
+static ULONG
+TakeRequest(
+	PDOKAN_RING_CONTEXT	Ring,
+	PVOID				Buffer,
+	ULONG				BufferLength)
+{
+	PDOKAN_RING_SLOT	slot;
+	ULONG				start = (ULONG)Ring->NextSlot;
+	ULONG				length;
+	ULONG				i, n;
+
+	for (n = 0; n < Ring->SlotCount; ++n) {
+		i = (start + n) % Ring->SlotCount;
+		slot = RingSlot(Ring, i);
+
+		if (slot->State != DOKAN_RING_SLOT_REQUEST ||
+			InterlockedCompareExchange(&slot->State,
+				DOKAN_RING_SLOT_BUSY, DOKAN_RING_SLOT_REQUEST) != DOKAN_RING_SLOT_REQUEST) {
+			continue;
+		}
+
+		length = slot->Length;
+		if (length > BufferLength) {
+			DbgPrint("Dokan Error: ring event too big %d\n", length);
+			InterlockedExchange(&slot->State, DOKAN_RING_SLOT_FREE);
+			SetEvent(Ring->ReplyEvent);
+			continue;
+		}
+		CopyMemory(Buffer, slot->Data, length);
+		Ring->NextSlot = (LONG)((i + 1) % Ring->SlotCount);
+
+		if (InterlockedCompareExchange(&Ring->BusySlot[
+				((PEVENT_CONTEXT)Buffer)->SerialNumber % DOKAN_RING_BUSY_HASH],
+				(LONG)i + 1, 0) != 0) {
+			InterlockedIncrement(&Ring->Unindexed);
+		}
+
+		// RequestEvent wakes one thread, let it wake the next one
+		for (++n; n < Ring->SlotCount; ++n) {
+			if (RingSlot(Ring, (start + n) % Ring->SlotCount)->State
+					== DOKAN_RING_SLOT_REQUEST) {
+				SetEvent(Ring->RequestEvent);
+				break;
+			}
+		}
+		return length;
+	}
+	return 0;
+}
+
+
+static BOOL
+RingWaitEvent(
+	HANDLE	Channel,
+	PVOID	Buffer,
+	ULONG	BufferLength,
+	PULONG	ReturnedLength)
+{
+	PDOKAN_RING_CONTEXT	ring = ((PRING_CHANNEL)Channel)->Ring;
+	HANDLE				events[2];
+
+	events[0] = ring->RequestEvent;
+	events[1] = ring->Overlapped.hEvent;
+
+	*ReturnedLength = 0;
+
+	for (;;) {
+		// released by unmount
+		if (HasOverlappedIoCompleted(&ring->Overlapped)) {
+			return FALSE;
+		}
+
+		*ReturnedLength = TakeRequest(ring, Buffer, BufferLength);
+		if (*ReturnedLength > 0) {
+			return TRUE;
+		}
+
+		if (WaitForMultipleObjects(2, events, FALSE, INFINITE) != WAIT_OBJECT_0) {
+			return FALSE;
+		}
+	}
+}
+
+
+static BOOL
+IsBusySlotOf(
+	PDOKAN_RING_SLOT	Slot,
+	ULONG				SerialNumber)
+{
+	return Slot->State == DOKAN_RING_SLOT_BUSY &&
+		((PEVENT_CONTEXT)Slot->Data)->SerialNumber == SerialNumber;
+}
+
+
+// returns the BUSY slot of the event and drops it from the index,
+// NULL when it did not come by the ring
+static PDOKAN_RING_SLOT
+FindBusySlot(
+	PDOKAN_RING_CONTEXT	Ring,
+	ULONG				SerialNumber)
+{
+	PLONG				entry = &Ring->BusySlot[SerialNumber % DOKAN_RING_BUSY_HASH];
+	LONG				index = *entry;
+	PDOKAN_RING_SLOT	slot;
+	ULONG				i;
+
+	// only the reply of this event clears the entry
+	if (index != 0 && IsBusySlotOf(RingSlot(Ring, index - 1), SerialNumber)) {
+		InterlockedExchange(entry, 0);
+		return RingSlot(Ring, index - 1);
+	}
+
+	if (Ring->Unindexed == 0) {
+		return NULL;
+	}
+	for (i = 0; i < Ring->SlotCount; ++i) {
+		slot = RingSlot(Ring, i);
+		if (IsBusySlotOf(slot, SerialNumber)) {
+			InterlockedDecrement(&Ring->Unindexed);
+			return slot;
+		}
+	}
+	return NULL;
+}
+
+
+static BOOL
+RingSendEventInformation(
+	HANDLE				Channel,
+	PEVENT_INFORMATION	EventInfo,
+	ULONG				EventLength)
+{
+	PRING_CHANNEL		channel = (PRING_CHANNEL)Channel;
+	PDOKAN_RING_CONTEXT	ring = channel->Ring;
+	PDOKAN_RING_SLOT	slot;
+	BOOL				status = TRUE;
+
+	slot = FindBusySlot(ring, EventInfo->SerialNumber);
+
+	if (slot != NULL && EventLength <= DOKAN_RING_SLOT_DATA_SIZE(ring->SlotSize)) {
+		CopyMemory(slot->Data, EventInfo, EventLength);
+		slot->Length = EventLength;
+		InterlockedExchange(&slot->State, DOKAN_RING_SLOT_REPLY);
+	} else {
+		status = DokanDeviceTransport.SendEventInformation(
+					channel->DeviceChannel, EventInfo, EventLength);
+		if (slot == NULL) {
+			return status;
+		}
+		InterlockedExchange(&slot->State, DOKAN_RING_SLOT_FREE);
+	}
+
+	SetEvent(ring->ReplyEvent);
+	return status;
+}
+
+
+static BOOL
+RingSendWriteRequest(
+	HANDLE				Channel,
+	PEVENT_INFORMATION	EventInfo,
+	ULONG				EventLength,
+	PVOID				Buffer,
+	ULONG				BufferLength)
+{
+	PRING_CHANNEL		channel = (PRING_CHANNEL)Channel;
+	PDOKAN_RING_SLOT	slot;
+
+	// the whole event comes by IOCTL_EVENT_WRITE, the slot is not needed
+	slot = FindBusySlot(channel->Ring, EventInfo->SerialNumber);
+	if (slot != NULL) {
+		InterlockedExchange(&slot->State, DOKAN_RING_SLOT_FREE);
+		SetEvent(channel->Ring->ReplyEvent);
+	}
+
+	return DokanDeviceTransport.SendWriteRequest(
+				channel->DeviceChannel, EventInfo, EventLength, Buffer, BufferLength);
+}
+
+
+DOKAN_TRANSPORT DokanRingTransport = {
+	RingOpenChannel,
+	RingCloseChannel,
+	RingWaitEvent,
+	RingSendEventInformation,
+	RingSendWriteRequest
+};
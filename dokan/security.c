@@ -39,7 +39,14 @@ DispatchQuerySecurity(
 	CheckFileName(EventContext->Security.FileName);
 
 	eventInfo = DispatchCommon(EventContext, eventInfoLength, DokanInstance, &fileInfo, &openInfo);
-	
+
+	if (openInfo == NULL) {
+		SendEventInformation(Handle, eventInfo, sizeof(EVENT_INFORMATION), DokanInstance);
+		FreeEventInformation(eventInfo);
+		return;
+	}
+
+	RtlZeroMemory(eventInfo->Buffer, EventContext->Security.BufferLength);
 
 	if (DOKAN_SECURITY_SUPPORTED_VERSION <= DokanInstance->DokanOptions->Version &&
 		DokanInstance->DokanOperations->GetFileSecurity) {
@@ -79,7 +86,7 @@ DispatchQuerySecurity(
 	}
 
 	SendEventInformation(Handle, eventInfo, eventInfoLength, DokanInstance);
-	free(eventInfo);
+	FreeEventInformation(eventInfo);
 }
 
 
@@ -100,7 +107,13 @@ DispatchSetSecurity(
 	CheckFileName(EventContext->SetSecurity.FileName);
 
 	eventInfo = DispatchCommon(EventContext, eventInfoLength, DokanInstance, &fileInfo, &openInfo);
-	
+
+	if (openInfo == NULL) {
+		SendEventInformation(Handle, eventInfo, sizeof(EVENT_INFORMATION), DokanInstance);
+		FreeEventInformation(eventInfo);
+		return;
+	}
+
 	securityDescriptor = (PCHAR)EventContext + EventContext->SetSecurity.BufferOffset;
 
 	if (DOKAN_SECURITY_SUPPORTED_VERSION <= DokanInstance->DokanOptions->Version &&
@@ -122,7 +135,7 @@ DispatchSetSecurity(
 	}
 
 	SendEventInformation(Handle, eventInfo, eventInfoLength, DokanInstance);
-	free(eventInfo);
+	FreeEventInformation(eventInfo);
 }
 
 
@@ -243,8 +243,14 @@ DispatchSetInformation(
 
 	eventInfo = DispatchCommon(
 		EventContext, sizeOfEventInfo, DokanInstance, &fileInfo, &openInfo);
-	
-	DbgPrint("###SetFileInfo %04d\n", openInfo != NULL ? openInfo->EventId : -1);
+
+	if (openInfo == NULL) {
+		SendEventInformation(Handle, eventInfo, sizeof(EVENT_INFORMATION), DokanInstance);
+		FreeEventInformation(eventInfo);
+		return;
+	}
+
+	DbgPrint("###SetFileInfo %04d\n", openInfo->EventId);
 
 	switch (EventContext->SetFile.FileInformationClass) {
 	case FileAllocationInformation:
@@ -290,6 +296,13 @@ DispatchSetInformation(
 
 	openInfo->UserContext = fileInfo.Context;
 
+	if (EventContext->SetFile.FileInformationClass == FileRenameInformation) {
+		// names under a renamed directory change too
+		InvalidateCache(DokanInstance, NULL);
+	} else {
+		InvalidateCache(DokanInstance, EventContext->SetFile.FileName);
+	}
+
 	eventInfo->BufferLength = 0;
 
 	if (EventContext->SetFile.FileInformationClass == FileDispositionInformation) {
@@ -327,8 +340,8 @@ DispatchSetInformation(
 
 	//DbgPrint("SetInfomation status = %d\n\n", status);
 
-	SendEventInformation(Handle, eventInfo, sizeOfEventInfo, DokanInstance);
-	free(eventInfo);
+	SendEventInformation(Handle, eventInfo, EVENT_INFO_REPLY_LENGTH(eventInfo), DokanInstance);
+	FreeEventInformation(eventInfo);
 	return;
 }
 
@@ -29,7 +29,7 @@ DokanResetTimeout(ULONG Timeout, PDOKAN_FILE_INFO FileInfo)
 	PDOKAN_INSTANCE		instance;
 	PDOKAN_OPEN_INFO	openInfo;
 	PEVENT_CONTEXT		eventContext;
-	PEVENT_INFORMATION	eventInfo;
+	EVENT_INFORMATION	eventInfo;
 	ULONG	eventInfoSize = sizeof(EVENT_INFORMATION);
 
 	openInfo = (PDOKAN_OPEN_INFO)FileInfo->DokanContext;
@@ -47,25 +47,83 @@ DokanResetTimeout(ULONG Timeout, PDOKAN_FILE_INFO FileInfo)
 		return FALSE;
 	}
 
-	eventInfo = (PEVENT_INFORMATION)malloc(eventInfoSize);
-	RtlZeroMemory(eventInfo, eventInfoSize);
+	RtlZeroMemory(&eventInfo, eventInfoSize);
 
-	eventInfo->SerialNumber = eventContext->SerialNumber;
-	eventInfo->ResetTimeout.Timeout = Timeout;
+	eventInfo.SerialNumber = eventContext->SerialNumber;
+	eventInfo.ResetTimeout.Timeout = Timeout;
 
 	status = SendToDevice(
 				GetRawDeviceName(instance->DeviceName),
 				IOCTL_RESET_TIMEOUT,
-				eventInfo,
+				&eventInfo,
 				eventInfoSize,
 				NULL,
 				0,
 				&returnedLength);
-	free(eventInfo);
 	return status;
 }
 
 
+// IOCTL_DIR_CACHE_INVALIDATE of Length bytes of DirectoryName,
+// 0 drops all directories of the mount
+BOOL
+InvalidateDirectoryCache(
+	LPCWSTR	DeviceName,
+	LPCWSTR	DirectoryName,
+	ULONG	Length)
+{
+	ULONG	returnedLength;
+
+	return SendToDevice(
+				GetRawDeviceName(DeviceName),
+				IOCTL_DIR_CACHE_INVALIDATE,
+				(PVOID)DirectoryName,
+				Length,
+				NULL,
+				0,
+				&returnedLength);
+}
+
+
+BOOL DOKANAPI
+DokanInvalidateDirectoryCache(
+	LPCWSTR	MountPoint,
+	LPCWSTR	DirectoryName)
+{
+	ULONG	length = 0;
+	PDOKAN_INSTANCE	instance;
+	WCHAR	deviceName[64];
+
+	if (MountPoint == NULL) {
+		return FALSE;
+	}
+
+	if (DirectoryName != NULL) {
+		length = (ULONG)(wcslen(DirectoryName) * sizeof(WCHAR));
+		// the driver takes an empty name as all directories
+		if (length == 0) {
+			return FALSE;
+		}
+	}
+
+	// the device is not called holding g_InstanceCriticalSection
+	EnterCriticalSection(&g_InstanceCriticalSection);
+
+	instance = FindDokanInstance(MountPoint);
+	if (instance != NULL) {
+		wcscpy_s(deviceName, sizeof(deviceName) / sizeof(WCHAR), instance->DeviceName);
+	}
+
+	LeaveCriticalSection(&g_InstanceCriticalSection);
+
+	if (instance == NULL) {
+		return FALSE;
+	}
+
+	return InvalidateDirectoryCache(deviceName, DirectoryName, length);
+}
+
+
 DWORD WINAPI
 DokanKeepAlive(
 	PDOKAN_INSTANCE DokanInstance)
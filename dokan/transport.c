@@ -0,0 +1,238 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2008 Hiroki Asakawa info@dokan-dev.net
+
+  http://dokan-dev.net/en
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <windows.h>
+#include <winioctl.h>
+#include "dokani.h"
+
+
+// DOKAN_TRANSPORT which talks to dokan.sys using DeviceIoControl.
+// Each channel holds a handle of the raw device of the mount.
+//
+// The reply to the last event of a batch is not sent at once. It is kept
+// in the channel and passed to IOCTL_EVENT_INFO_WAIT by the next
+// DeviceWaitEvent, so that one ioctl both completes the IRP and fetches
+// the next events. Replies to other events and replies which do not fit
+// into the channel go out with IOCTL_EVENT_INFO as before.
+
+typedef struct _DEVICE_CHANNEL {
+	HANDLE	Device;
+
+	// serial number of the last event returned by DeviceWaitEvent
+	ULONG	LastSerialNumber;
+	BOOL	HasLastEvent;
+
+	// deferred reply to the last event, 0 when there is none
+	ULONG	ReplyLength;
+	// EVENT_INFORMATION has ULONG64 field
+	ULONG64	Reply[EVENT_CONTEXT_MAX_SIZE / sizeof(ULONG64)];
+} DEVICE_CHANNEL, *PDEVICE_CHANNEL;
+
+
+static BOOL
+SendEventInformationNow(
+	HANDLE				Device,
+	PEVENT_INFORMATION	EventInfo,
+	ULONG				EventLength)
+{
+	BOOL	status;
+	ULONG	returnedLength;
+
+	// send event info to driver
+	status = DeviceIoControl(
+					Device,				// Handle to device
+					IOCTL_EVENT_INFO,	// IO Control code
+					EventInfo,			// Input Buffer to driver.
+					EventLength,		// Length of input buffer in bytes.
+					NULL,				// Output Buffer from driver.
+					0,					// Length of output buffer in bytes.
+					&returnedLength,	// Bytes placed in buffer.
+					NULL				// synchronous call
+					);
+
+	if (!status) {
+		DWORD errorCode = GetLastError();
+		DbgPrint("Dokan Error: Ioctl failed with code %d\n", errorCode );
+	}
+	return status;
+}
+
+
+static HANDLE
+DeviceOpenChannel(
+	PDOKAN_INSTANCE	DokanInstance)
+{
+	PDEVICE_CHANNEL	channel;
+
+	channel = (PDEVICE_CHANNEL)malloc(sizeof(DEVICE_CHANNEL));
+	if (channel == NULL) {
+		DbgPrint("Dokan Error: can't allocate channel\n");
+		return INVALID_HANDLE_VALUE;
+	}
+	ZeroMemory(channel, FIELD_OFFSET(DEVICE_CHANNEL, Reply));
+
+	channel->Device = CreateFile(
+				GetRawDeviceName(DokanInstance->DeviceName), // lpFileName
+				GENERIC_READ | GENERIC_WRITE,       // dwDesiredAccess
+				FILE_SHARE_READ | FILE_SHARE_WRITE, // dwShareMode
+				NULL,                               // lpSecurityAttributes
+				OPEN_EXISTING,                      // dwCreationDistribution
+				0,                                  // dwFlagsAndAttributes
+				NULL                                // hTemplateFile
+			);
+
+	if (channel->Device == INVALID_HANDLE_VALUE) {
+		DbgPrint("Dokan Error: CreateFile failed %ws: %d\n",
+			GetRawDeviceName(DokanInstance->DeviceName), GetLastError());
+		free(channel);
+		return INVALID_HANDLE_VALUE;
+	}
+	return (HANDLE)channel;
+}
+
+
+static VOID
+DeviceCloseChannel(
+	HANDLE	Channel)
+{
+	PDEVICE_CHANNEL	channel = (PDEVICE_CHANNEL)Channel;
+
+	if (channel->ReplyLength > 0) {
+		SendEventInformationNow(channel->Device,
+			(PEVENT_INFORMATION)channel->Reply, channel->ReplyLength);
+	}
+	CloseHandle(channel->Device);
+	free(channel);
+}
+
+
+static BOOL
+DeviceWaitEvent(
+	HANDLE	Channel,
+	PVOID	Buffer,
+	ULONG	BufferLength,
+	PULONG	ReturnedLength)
+{
+	PDEVICE_CHANNEL	channel = (PDEVICE_CHANNEL)Channel;
+	BOOL	status;
+	PVOID	reply = NULL;
+	ULONG	replyLength = channel->ReplyLength;
+	ULONG	offset;
+
+	if (replyLength > 0) {
+		reply = channel->Reply;
+		channel->ReplyLength = 0;
+	}
+	channel->HasLastEvent = FALSE;
+
+	status = DeviceIoControl(
+				channel->Device,		// Handle to device
+				IOCTL_EVENT_INFO_WAIT,	// IO Control code
+				reply,				// Input Buffer to driver.
+				replyLength,		// Length of input buffer in bytes.
+				Buffer,             // Output Buffer from driver.
+				BufferLength,		// Length of output buffer in bytes.
+				ReturnedLength,		// Bytes placed in buffer.
+				NULL                // synchronous call
+				);
+
+	if (!status) {
+		DbgPrint("Ioctl failed with code %d\n", GetLastError());
+		return status;
+	}
+
+	// remember the last event, its reply can wait for the next call
+	for (offset = 0; offset < *ReturnedLength;) {
+		PEVENT_CONTEXT context = (PEVENT_CONTEXT)((PCHAR)Buffer + offset);
+		if (context->Length == 0) {
+			break;
+		}
+		channel->LastSerialNumber = context->SerialNumber;
+		channel->HasLastEvent = TRUE;
+		offset = EVENT_CONTEXT_ALIGN(offset + context->Length);
+	}
+	return status;
+}
+
+
+static BOOL
+DeviceSendEventInformation(
+	HANDLE				Channel,
+	PEVENT_INFORMATION	EventInfo,
+	ULONG				EventLength)
+{
+	PDEVICE_CHANNEL	channel = (PDEVICE_CHANNEL)Channel;
+
+	if (channel->HasLastEvent &&
+		channel->LastSerialNumber == EventInfo->SerialNumber &&
+		channel->ReplyLength == 0 &&
+		EventLength <= sizeof(channel->Reply)) {
+
+		CopyMemory(channel->Reply, EventInfo, EventLength);
+		channel->ReplyLength = EventLength;
+		channel->HasLastEvent = FALSE;
+		return TRUE;
+	}
+
+	return SendEventInformationNow(channel->Device, EventInfo, EventLength);
+}
+
+
+static BOOL
+DeviceSendWriteRequest(
+	HANDLE				Channel,
+	PEVENT_INFORMATION	EventInfo,
+	ULONG				EventLength,
+	PVOID				Buffer,
+	ULONG				BufferLength)
+{
+	PDEVICE_CHANNEL	channel = (PDEVICE_CHANNEL)Channel;
+	BOOL	status;
+	ULONG	returnedLength = 0;
+
+	status = DeviceIoControl(
+					channel->Device,        // Handle to device
+					IOCTL_EVENT_WRITE,		// IO Control code
+					EventInfo,			    // Input Buffer to driver.
+					EventLength,			// Length of input buffer in bytes.
+					Buffer,	                // Output Buffer from driver.
+					BufferLength,			// Length of output buffer in bytes.
+					&returnedLength,		// Bytes placed in buffer.
+					NULL                    // synchronous call
+                            );
+
+	if ( !status ) {
+		DWORD errorCode = GetLastError();
+		DbgPrint("Ioctl failed with code %d\n", errorCode );
+	}
+
+	DbgPrint("SendWriteRequest got %d bytes\n", returnedLength);
+	return status;
+}
+
+
+DOKAN_TRANSPORT DokanDeviceTransport = {
+	DeviceOpenChannel,
+	DeviceCloseChannel,
+	DeviceWaitEvent,
+	DeviceSendEventInformation,
+	DeviceSendWriteRequest
+};
@@ -134,13 +134,43 @@ DokanFsVolumeInformation(
 }
 
 
+// GetDiskFreeSpace through the metadata cache
+static int
+GetDiskFreeSpaceCached(
+	PDOKAN_INSTANCE				DokanInstance,
+	PDOKAN_CACHED_DISK_SPACE	DiskSpace,
+	PDOKAN_FILE_INFO			FileInfo)
+{
+	int		status;
+
+	if (LookupCache(DokanInstance, DOKAN_CACHE_DISK_SPACE, L"",
+			DiskSpace, sizeof(DOKAN_CACHED_DISK_SPACE))) {
+		return 0;
+	}
+
+	status = DokanInstance->DokanOperations->GetDiskFreeSpace(
+		&DiskSpace->FreeBytesAvailable,
+		&DiskSpace->TotalNumberOfBytes,
+		&DiskSpace->TotalNumberOfFreeBytes,
+		FileInfo);
+
+	if (status >= 0) {
+		AddCache(DokanInstance, DOKAN_CACHE_DISK_SPACE, L"",
+			DiskSpace, sizeof(DOKAN_CACHED_DISK_SPACE));
+	}
+	return status;
+}
+
+
 ULONG
 DokanFsSizeInformation(
 	PEVENT_INFORMATION	EventInfo,
 	PEVENT_CONTEXT		EventContext,
 	PDOKAN_FILE_INFO	FileInfo,
-	PDOKAN_OPERATIONS	DokanOperations)
+	PDOKAN_INSTANCE		DokanInstance)
 {
+	PDOKAN_OPERATIONS	DokanOperations = DokanInstance->DokanOperations;
+	DOKAN_CACHED_DISK_SPACE	diskSpace;
 	ULONGLONG	freeBytesAvailable = 0;
 	ULONGLONG	totalBytes = 0;
 	ULONGLONG	freeBytes = 0;
@@ -159,16 +189,16 @@ DokanFsSizeInformation(
 		return STATUS_BUFFER_OVERFLOW;
 	}
 
-	status = DokanOperations->GetDiskFreeSpace(
-		&freeBytesAvailable, // FreeBytesAvailable
-		&totalBytes, // TotalNumberOfBytes
-		&freeBytes, // TotalNumberOfFreeBytes
-		FileInfo);
+	status = GetDiskFreeSpaceCached(DokanInstance, &diskSpace, FileInfo);
 
 	if (status < 0) {
 		return STATUS_INVALID_PARAMETER;
 	}
 
+	freeBytesAvailable	= diskSpace.FreeBytesAvailable;
+	totalBytes			= diskSpace.TotalNumberOfBytes;
+	freeBytes			= diskSpace.TotalNumberOfFreeBytes;
+
 	sizeInfo->TotalAllocationUnits.QuadPart		= totalBytes / DOKAN_ALLOCATION_UNIT_SIZE;
 	sizeInfo->AvailableAllocationUnits.QuadPart	= freeBytesAvailable / DOKAN_ALLOCATION_UNIT_SIZE;
 	sizeInfo->SectorsPerAllocationUnit			= DOKAN_ALLOCATION_UNIT_SIZE / DOKAN_SECTOR_SIZE;
@@ -255,8 +285,10 @@ DokanFsFullSizeInformation(
 	PEVENT_INFORMATION	EventInfo,
 	PEVENT_CONTEXT		EventContext,
 	PDOKAN_FILE_INFO	FileInfo,
-	PDOKAN_OPERATIONS	DokanOperations)
+	PDOKAN_INSTANCE		DokanInstance)
 {
+	PDOKAN_OPERATIONS	DokanOperations = DokanInstance->DokanOperations;
+	DOKAN_CACHED_DISK_SPACE	diskSpace;
 	ULONGLONG	freeBytesAvailable = 0;
 	ULONGLONG	totalBytes = 0;
 	ULONGLONG	freeBytes = 0;
@@ -275,16 +307,16 @@ DokanFsFullSizeInformation(
 		return STATUS_BUFFER_OVERFLOW;
 	}
 
-	status = DokanOperations->GetDiskFreeSpace(
-		&freeBytesAvailable, // FreeBytesAvailable
-		&totalBytes, // TotalNumberOfBytes
-		&freeBytes, // TotalNumberOfFreeBytes
-		FileInfo);
+	status = GetDiskFreeSpaceCached(DokanInstance, &diskSpace, FileInfo);
 
 	if (status < 0) {
 		return STATUS_INVALID_PARAMETER;
 	}
 
+	freeBytesAvailable	= diskSpace.FreeBytesAvailable;
+	totalBytes			= diskSpace.TotalNumberOfBytes;
+	freeBytes			= diskSpace.TotalNumberOfFreeBytes;
+
 	sizeInfo->TotalAllocationUnits.QuadPart		= totalBytes / DOKAN_ALLOCATION_UNIT_SIZE;
 	sizeInfo->ActualAvailableAllocationUnits.QuadPart = freeBytes / DOKAN_ALLOCATION_UNIT_SIZE;
 	sizeInfo->CallerAvailableAllocationUnits.QuadPart = freeBytesAvailable / DOKAN_ALLOCATION_UNIT_SIZE;
@@ -310,14 +342,15 @@ DispatchQueryVolumeInformation(
 	ULONG					sizeOfEventInfo = sizeof(EVENT_INFORMATION)
 								- 8 + EventContext->Volume.BufferLength;
 
-	eventInfo = (PEVENT_INFORMATION)malloc(sizeOfEventInfo);
+	eventInfo = AllocateEventInformation(sizeOfEventInfo);
 
-	RtlZeroMemory(eventInfo, sizeOfEventInfo);
+	// returned structures rely on zero cleared fields
+	RtlZeroMemory(eventInfo->Buffer, EventContext->Volume.BufferLength);
 	RtlZeroMemory(&fileInfo, sizeof(DOKAN_FILE_INFO));
 
 	// There is no Context because file is not opened
 	// so DispatchCommon is not used here
-	openInfo = (PDOKAN_OPEN_INFO)EventContext->Context;
+	openInfo = LookupOpenInfo(DokanInstance, EventContext->Context);
 	
 	eventInfo->BufferLength = 0;
 	eventInfo->SerialNumber = EventContext->SerialNumber;
@@ -337,7 +370,7 @@ DispatchQueryVolumeInformation(
 		break;
 	case FileFsSizeInformation:
 		eventInfo->Status = DokanFsSizeInformation(
-								eventInfo, EventContext, &fileInfo, DokanInstance->DokanOperations);
+								eventInfo, EventContext, &fileInfo, DokanInstance);
 		break;
 	case FileFsAttributeInformation:
 		eventInfo->Status = DokanFsAttributeInformation(
@@ -345,13 +378,14 @@ DispatchQueryVolumeInformation(
 		break;
 	case FileFsFullSizeInformation:
 		eventInfo->Status = DokanFsFullSizeInformation(
-								eventInfo, EventContext, &fileInfo, DokanInstance->DokanOperations);
+								eventInfo, EventContext, &fileInfo, DokanInstance);
 		break;
 	default:
 		DbgPrint("error unknown volume info %d\n", EventContext->Volume.FsInformationClass);
 	}
 
-	SendEventInformation(Handle, eventInfo, sizeOfEventInfo, NULL);
-	free(eventInfo);
+	// eventInfo->Context is 0, so no DOKAN_OPEN_INFO is released here
+	SendEventInformation(Handle, eventInfo, EVENT_INFO_REPLY_LENGTH(eventInfo), DokanInstance);
+	FreeEventInformation(eventInfo);
 	return;
 }
@@ -24,35 +24,32 @@ with this program. If not, see <http://www.gnu.org/licenses/>.
 #include "fileinfo.h"
 #include <winioctl.h>
 
-SendWriteRequest(
+VOID
+CompleteWrite(
 	HANDLE				Handle,
-	PEVENT_INFORMATION	EventInfo,
-	ULONG				EventLength,
-	PVOID				Buffer,
-	ULONG				BufferLength)
+	PDOKAN_IO_OPERATION	Operation,
+	int					Status)
 {
-	BOOL	status;
-	ULONG	returnedLength;
-
-	DbgPrint("SendWriteRequest\n");
-
-	status = DeviceIoControl(
-					Handle,		            // Handle to device
-					IOCTL_EVENT_WRITE,		// IO Control code
-					EventInfo,			    // Input Buffer to driver.
-					EventLength,			// Length of input buffer in bytes.
-					Buffer,	                // Output Buffer from driver.
-					BufferLength,			// Length of output buffer in bytes.
-					&returnedLength,		// Bytes placed in buffer.
-					NULL                    // synchronous call
-                            );
-
-	if ( !status ) {
-		DWORD errorCode = GetLastError();
-		DbgPrint("Ioctl failed with code %d\n", errorCode );
+	PEVENT_INFORMATION	eventInfo = Operation->EventInfo;
+	PEVENT_CONTEXT		eventContext = Operation->EventContext;
+	ULONG				writtenLength = Operation->Length;
+
+	Operation->OpenInfo->UserContext = Operation->FileInfo.Context;
+	eventInfo->BufferLength = 0;
+
+	if (Status < 0) {
+		eventInfo->Status = STATUS_INVALID_PARAMETER;
+	
+	} else {
+		InvalidateCache(Operation->DokanInstance, eventContext->Write.FileName);
+		eventInfo->Status = STATUS_SUCCESS;
+		eventInfo->BufferLength = writtenLength;
+		eventInfo->Write.CurrentByteOffset.QuadPart =
+			eventContext->Write.ByteOffset.QuadPart + writtenLength;
 	}
 
-	DbgPrint("SendWriteRequest got %d bytes\n", returnedLength);
+	SendEventInformation(Handle, eventInfo, Operation->SizeOfEventInfo,
+		Operation->DokanInstance);
 }
 
 
@@ -62,61 +59,69 @@ DispatchWrite(
 	PEVENT_CONTEXT		EventContext,
 	PDOKAN_INSTANCE		DokanInstance)
 {
-	PEVENT_INFORMATION		eventInfo;
-	PDOKAN_OPEN_INFO		openInfo;
-	ULONG					writtenLength = 0;
+	DOKAN_IO_OPERATION		syncOperation;
+	PDOKAN_IO_OPERATION		operation;
 	int						status;
-	DOKAN_FILE_INFO			fileInfo;
-	BOOL					bufferAllocated = FALSE;
-	ULONG					sizeOfEventInfo = sizeof(EVENT_INFORMATION);
 
-	eventInfo = DispatchCommon(
-		EventContext, sizeOfEventInfo, DokanInstance, &fileInfo, &openInfo);
+	operation = BeginIoOperation(&syncOperation, EventContext, DokanInstance);
+	EventContext = operation->EventContext;
+
+	operation->SizeOfEventInfo = sizeof(EVENT_INFORMATION);
+
+	operation->EventInfo = DispatchCommon(
+		EventContext, operation->SizeOfEventInfo, DokanInstance,
+		&operation->FileInfo, &operation->OpenInfo);
 
 	// Since driver requested bigger memory,
 	// allocate enough memory and send it to driver
 	if (EventContext->Write.RequestLength > 0) {
 		ULONG contextLength = EventContext->Write.RequestLength;
 		PEVENT_CONTEXT	contextBuf = (PEVENT_CONTEXT)malloc(contextLength);
-		SendWriteRequest(Handle, eventInfo, sizeOfEventInfo, contextBuf, contextLength);
+		SendWriteRequest(Handle, operation->EventInfo, operation->SizeOfEventInfo,
+			contextBuf, contextLength, DokanInstance);
+
+		if (operation->ContextAllocated) {
+			if (operation->OpenInfo != NULL) {
+				InterlockedCompareExchangePointer(
+					(PVOID*)&operation->OpenInfo->EventContext, contextBuf, EventContext);
+			}
+			free(EventContext);
+		}
 		EventContext = contextBuf;
-		bufferAllocated = TRUE;
+		operation->EventContext = contextBuf;
+		operation->ContextAllocated = TRUE;
+	}
+
+	// the data of a big write is still fetched, the driver frees it then
+	if (operation->OpenInfo == NULL) {
+		SendEventInformation(Handle, operation->EventInfo, sizeof(EVENT_INFORMATION),
+			DokanInstance);
+		EndIoOperation(operation);
+		return;
 	}
 
 	CheckFileName(EventContext->Write.FileName);
 
-	DbgPrint("###WriteFile %04d\n", openInfo != NULL ? openInfo->EventId : -1);
+	DbgPrint("###WriteFile %04d\n", operation->OpenInfo->EventId);
 
 	if (DokanInstance->DokanOperations->WriteFile) {
 		status = DokanInstance->DokanOperations->WriteFile(
 						EventContext->Write.FileName,
 						(PCHAR)EventContext + EventContext->Write.BufferOffset,
 						EventContext->Write.BufferLength,
-						&writtenLength,
+						&operation->Length,
 						EventContext->Write.ByteOffset.QuadPart,
-						&fileInfo);
+						&operation->FileInfo);
 	} else {
 		status = -1;
 	}
 
-	openInfo->UserContext = fileInfo.Context;
-	eventInfo->BufferLength = 0;
-
-	if (status < 0) {
-		eventInfo->Status = STATUS_INVALID_PARAMETER;
-	
-	} else {
-		eventInfo->Status = STATUS_SUCCESS;
-		eventInfo->BufferLength = writtenLength;
-		eventInfo->Write.CurrentByteOffset.QuadPart =
-			EventContext->Write.ByteOffset.QuadPart + writtenLength;
+	if (status == ERROR_IO_PENDING && operation->Asynchronous) {
+		// DokanCompleteOperation replies, operation may be gone already
+		return;
 	}
 
-	SendEventInformation(Handle, eventInfo, sizeOfEventInfo, DokanInstance);
-	free(eventInfo);
-
-	if (bufferAllocated)
-		free(EventContext);
-
+	CompleteWrite(Handle, operation, status);
+	EndIoOperation(operation);
 	return;
 }
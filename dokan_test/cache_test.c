@@ -0,0 +1,386 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2008 Hiroki Asakawa info@dokan-dev.net
+
+  http://dokan-dev.net/en
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "test.h"
+#include "memfs.h"
+#include "request.h"
+
+
+// Metadata cache of the library (dokan/cache.c)
+//
+// Through the loopback: GetFileInformation and FindFiles are answered
+// from the cache until MetadataCacheTimeout, the entries of a listing
+// answer the information classes they have the fields for, writes and
+// DokanInvalidatePath drop entries, and OpenDirectory is called on every
+// open. A name which was not found is answered from the negative cache
+// until it, or a directory above it, is created or renamed to.
+// Directly: the least recently used entries of a shard are dropped to
+// keep MetadataCacheSize.
+
+#define CACHE_TEST_TIMEOUT	500 // in millisecond
+#define CACHE_TEST_MOUNT	L"C:\\"
+
+
+static LONGLONG
+QuerySize(
+	PDOKAN_LOOPBACK	Loopback,
+	LPCWSTR			FileName,
+	ULONG64			Context)
+{
+	FILE_STANDARD_INFORMATION	standard;
+	ULONG						length;
+
+	if (RequestQueryInformation(Loopback, FileName, Context, FileStandardInformation,
+			&standard, sizeof(standard), &length) != STATUS_SUCCESS) {
+		return -1;
+	}
+	return standard.EndOfFile.QuadPart;
+}
+
+
+// entries of one listing of DirectoryName
+static ULONG
+ListDirectory(
+	PDOKAN_LOOPBACK	Loopback,
+	LPCWSTR			DirectoryName)
+{
+	ULONG64	context;
+	CHAR	buffer[4096];
+	ULONG	length = 0;
+	ULONG	index = 0;
+
+	if (RequestCreate(Loopback, DirectoryName, FILE_OPEN, FILE_DIRECTORY_FILE, &context)
+			!= STATUS_SUCCESS) {
+		return 0;
+	}
+	RequestDirectory(Loopback, DirectoryName, L"*", context, FileNamesInformation,
+		&index, buffer, sizeof(buffer), &length);
+	RequestClose(Loopback, DirectoryName, context);
+	return length;
+}
+
+
+static VOID
+TestAttributes(
+	PDOKAN_LOOPBACK	Loopback)
+{
+	ULONG64	context;
+	LONG	calls;
+
+	CHECK(MemfsAddFile(L"\\attr.txt", 10));
+	CHECK(RequestCreate(Loopback, L"\\attr.txt", FILE_OPEN, 0, &context) == STATUS_SUCCESS);
+
+	calls = g_MemfsCalls[MEMFS_GET_FILE_INFO];
+	CHECK(QuerySize(Loopback, L"\\attr.txt", context) == 10);
+	CHECK(QuerySize(Loopback, L"\\attr.txt", context) == 10);
+	CHECK(g_MemfsCalls[MEMFS_GET_FILE_INFO] == calls + 1);
+
+	// a write through the mount drops the entry
+	CHECK(RequestWrite(Loopback, L"\\attr.txt", context, 10, "abcde", 5) == STATUS_SUCCESS);
+	CHECK(QuerySize(Loopback, L"\\attr.txt", context) == 15);
+	CHECK(g_MemfsCalls[MEMFS_GET_FILE_INFO] == calls + 2);
+
+	// and so does the timeout
+	Sleep(CACHE_TEST_TIMEOUT + 50);
+	CHECK(QuerySize(Loopback, L"\\attr.txt", context) == 15);
+	CHECK(g_MemfsCalls[MEMFS_GET_FILE_INFO] == calls + 3);
+
+	// a change other than through the mount
+	CHECK(DokanInvalidatePath(CACHE_TEST_MOUNT, L"\\ATTR.TXT"));
+	CHECK(QuerySize(Loopback, L"\\attr.txt", context) == 15);
+	CHECK(g_MemfsCalls[MEMFS_GET_FILE_INFO] == calls + 4);
+	CHECK(!DokanInvalidatePath(L"Q:\\", L"\\attr.txt"));
+
+	CHECK(RequestClose(Loopback, L"\\attr.txt", context) == STATUS_SUCCESS);
+}
+
+
+static VOID
+TestListing(
+	PDOKAN_LOOPBACK	Loopback)
+{
+	ULONG64	context;
+	LONG	finds, infos;
+	ULONG	length;
+
+	CHECK(MemfsAddDirectory(L"\\list"));
+	CHECK(MemfsAddFile(L"\\list\\a.txt", 1));
+	CHECK(MemfsAddFile(L"\\list\\b.txt", 2));
+
+	finds = g_MemfsCalls[MEMFS_FIND_FILES];
+	length = ListDirectory(Loopback, L"\\list");
+	CHECK(length > 0);
+	CHECK(ListDirectory(Loopback, L"\\list") == length);
+	CHECK(g_MemfsCalls[MEMFS_FIND_FILES] == finds + 1);
+
+	// the listing gave the attributes of the entries
+	infos = g_MemfsCalls[MEMFS_GET_FILE_INFO];
+	CHECK(RequestCreate(Loopback, L"\\list\\b.txt", FILE_OPEN, 0, &context) == STATUS_SUCCESS);
+	CHECK(QuerySize(Loopback, L"\\list\\b.txt", context) == 2);
+	CHECK(g_MemfsCalls[MEMFS_GET_FILE_INFO] == infos);
+
+	// an entry drops the listing of its directory
+	CHECK(DokanInvalidatePath(CACHE_TEST_MOUNT, L"\\list\\b.txt"));
+	CHECK(QuerySize(Loopback, L"\\list\\b.txt", context) == 2);
+	CHECK(g_MemfsCalls[MEMFS_GET_FILE_INFO] == infos + 1);
+	CHECK(ListDirectory(Loopback, L"\\list") == length);
+	CHECK(g_MemfsCalls[MEMFS_FIND_FILES] == finds + 2);
+	CHECK(RequestClose(Loopback, L"\\list\\b.txt", context) == STATUS_SUCCESS);
+
+	// NULL drops all
+	CHECK(DokanInvalidatePath(CACHE_TEST_MOUNT, NULL));
+	CHECK(ListDirectory(Loopback, L"\\list") == length);
+	CHECK(g_MemfsCalls[MEMFS_FIND_FILES] == finds + 3);
+}
+
+
+static VOID
+TestListingClasses(
+	PDOKAN_LOOPBACK	Loopback)
+{
+	ULONG64							context;
+	LONG							infos;
+	ULONG							length;
+	FILE_BASIC_INFORMATION			basic;
+	FILE_NETWORK_OPEN_INFORMATION	networkOpen;
+	FILE_STANDARD_INFORMATION		standard;
+	FILE_INTERNAL_INFORMATION		internal;
+
+	CHECK(MemfsAddDirectory(L"\\classes"));
+	CHECK(MemfsAddFile(L"\\classes\\c.txt", 7));
+	CHECK(MemfsAddDirectory(L"\\classes\\sub"));
+	CHECK(ListDirectory(Loopback, L"\\classes") > 0);
+
+	// the classes a listing entry has everything for
+	infos = g_MemfsCalls[MEMFS_GET_FILE_INFO];
+	CHECK(RequestCreate(Loopback, L"\\classes\\c.txt", FILE_OPEN, 0, &context) == STATUS_SUCCESS);
+	CHECK(RequestQueryInformation(Loopback, L"\\classes\\c.txt", context, FileBasicInformation,
+			&basic, sizeof(basic), &length) == STATUS_SUCCESS);
+	CHECK(basic.FileAttributes == FILE_ATTRIBUTE_NORMAL);
+	CHECK(RequestQueryInformation(Loopback, L"\\classes\\c.txt", context,
+			FileNetworkOpenInformation, &networkOpen, sizeof(networkOpen), &length)
+			== STATUS_SUCCESS);
+	CHECK(networkOpen.EndOfFile.QuadPart == 7);
+	CHECK(g_MemfsCalls[MEMFS_GET_FILE_INFO] == infos);
+
+	// the file index is not in the listing
+	CHECK(RequestQueryInformation(Loopback, L"\\classes\\c.txt", context,
+			FileInternalInformation, &internal, sizeof(internal), &length) == STATUS_SUCCESS);
+	CHECK(g_MemfsCalls[MEMFS_GET_FILE_INFO] == infos + 1);
+
+	// what GetFileInformation gave answers the following queries of any class
+	CHECK(RequestQueryInformation(Loopback, L"\\classes\\c.txt", context,
+			FileInternalInformation, &internal, sizeof(internal), &length) == STATUS_SUCCESS);
+	CHECK(QuerySize(Loopback, L"\\classes\\c.txt", context) == 7);
+	CHECK(g_MemfsCalls[MEMFS_GET_FILE_INFO] == infos + 1);
+	CHECK(RequestClose(Loopback, L"\\classes\\c.txt", context) == STATUS_SUCCESS);
+
+	// a directory of the listing
+	CHECK(RequestCreate(Loopback, L"\\classes\\sub", FILE_OPEN, FILE_DIRECTORY_FILE, &context)
+			== STATUS_SUCCESS);
+	CHECK(RequestQueryInformation(Loopback, L"\\classes\\sub", context, FileStandardInformation,
+			&standard, sizeof(standard), &length) == STATUS_SUCCESS);
+	CHECK(standard.Directory);
+	CHECK(g_MemfsCalls[MEMFS_GET_FILE_INFO] == infos + 1);
+	CHECK(RequestClose(Loopback, L"\\classes\\sub", context) == STATUS_SUCCESS);
+}
+
+
+static VOID
+TestOpenDirectory(
+	PDOKAN_LOOPBACK	Loopback)
+{
+	LONG	opens = g_MemfsCalls[MEMFS_OPEN_DIRECTORY];
+	ULONG	i;
+
+	// the file system decides the access of each open
+	for (i = 0; i < 3; ++i) {
+		CHECK(ListDirectory(Loopback, L"\\list") > 0);
+	}
+	CHECK(g_MemfsCalls[MEMFS_OPEN_DIRECTORY] == opens + 3);
+}
+
+
+static VOID
+TestNegative(
+	PDOKAN_LOOPBACK	Loopback)
+{
+	ULONG64	context;
+	LONG	creates = g_MemfsCalls[MEMFS_CREATE_FILE];
+	LONG	opens = g_MemfsCalls[MEMFS_OPEN_DIRECTORY];
+
+	CHECK(RequestCreate(Loopback, L"\\none.txt", FILE_OPEN, 0, &context)
+		== STATUS_OBJECT_NAME_NOT_FOUND);
+	CHECK(RequestCreate(Loopback, L"\\none.txt", FILE_OPEN, 0, &context)
+		== STATUS_OBJECT_NAME_NOT_FOUND);
+	CHECK(g_MemfsCalls[MEMFS_CREATE_FILE] == creates + 1);
+
+	// creating the name drops the miss
+	CHECK(RequestCreate(Loopback, L"\\none.txt", FILE_CREATE, 0, &context) == STATUS_SUCCESS);
+	CHECK(RequestClose(Loopback, L"\\none.txt", context) == STATUS_SUCCESS);
+	CHECK(RequestCreate(Loopback, L"\\none.txt", FILE_OPEN, 0, &context) == STATUS_SUCCESS);
+	CHECK(RequestClose(Loopback, L"\\none.txt", context) == STATUS_SUCCESS);
+	CHECK(g_MemfsCalls[MEMFS_CREATE_FILE] == creates + 3);
+
+	CHECK(RequestCreate(Loopback, L"\\nodir", FILE_OPEN, FILE_DIRECTORY_FILE, &context)
+		== STATUS_OBJECT_PATH_NOT_FOUND);
+	CHECK(RequestCreate(Loopback, L"\\nodir", FILE_OPEN, FILE_DIRECTORY_FILE, &context)
+		== STATUS_OBJECT_PATH_NOT_FOUND);
+	CHECK(g_MemfsCalls[MEMFS_OPEN_DIRECTORY] == opens + 1);
+
+	// a new directory drops the misses under it, and only those
+	creates = g_MemfsCalls[MEMFS_CREATE_FILE];
+	CHECK(RequestCreate(Loopback, L"\\new\\desktop.ini", FILE_OPEN, 0, &context)
+		== STATUS_OBJECT_NAME_NOT_FOUND);
+	CHECK(RequestCreate(Loopback, L"\\newer\\desktop.ini", FILE_OPEN, 0, &context)
+		== STATUS_OBJECT_NAME_NOT_FOUND);
+	CHECK(RequestCreate(Loopback, L"\\NEW", FILE_CREATE, FILE_DIRECTORY_FILE, &context)
+		== STATUS_SUCCESS);
+	CHECK(RequestClose(Loopback, L"\\NEW", context) == STATUS_SUCCESS);
+	CHECK(RequestCreate(Loopback, L"\\new\\desktop.ini", FILE_OPEN, 0, &context)
+		== STATUS_OBJECT_NAME_NOT_FOUND);
+	CHECK(RequestCreate(Loopback, L"\\newer\\desktop.ini", FILE_OPEN, 0, &context)
+		== STATUS_OBJECT_NAME_NOT_FOUND);
+	CHECK(g_MemfsCalls[MEMFS_CREATE_FILE] == creates + 3);
+
+	// and so does renaming a directory to a name in the same parent
+	CHECK(MemfsAddDirectory(L"\\old"));
+	CHECK(MemfsAddFile(L"\\old\\desktop.ini", 3));
+	CHECK(RequestCreate(Loopback, L"\\moved\\desktop.ini", FILE_OPEN, 0, &context)
+		== STATUS_OBJECT_NAME_NOT_FOUND);
+	CHECK(RequestCreate(Loopback, L"\\old", FILE_OPEN, FILE_DIRECTORY_FILE, &context)
+		== STATUS_SUCCESS);
+	CHECK(RequestRename(Loopback, L"\\old", context, L"moved") == STATUS_SUCCESS);
+	CHECK(RequestClose(Loopback, L"\\moved", context) == STATUS_SUCCESS);
+	CHECK(RequestCreate(Loopback, L"\\moved\\desktop.ini", FILE_OPEN, 0, &context)
+		== STATUS_SUCCESS);
+	CHECK(QuerySize(Loopback, L"\\moved\\desktop.ini", context) == 3);
+	CHECK(RequestClose(Loopback, L"\\moved\\desktop.ini", context) == STATUS_SUCCESS);
+
+	// a change other than through the mount
+	creates = g_MemfsCalls[MEMFS_CREATE_FILE];
+	CHECK(MemfsAddDirectory(L"\\outside"));
+	CHECK(RequestCreate(Loopback, L"\\outside\\a.txt", FILE_OPEN, 0, &context)
+		== STATUS_OBJECT_NAME_NOT_FOUND);
+	CHECK(MemfsAddFile(L"\\outside\\a.txt", 1));
+	CHECK(DokanInvalidatePath(CACHE_TEST_MOUNT, L"\\Outside"));
+	CHECK(RequestCreate(Loopback, L"\\outside\\a.txt", FILE_OPEN, 0, &context)
+		== STATUS_SUCCESS);
+	CHECK(RequestClose(Loopback, L"\\outside\\a.txt", context) == STATUS_SUCCESS);
+	CHECK(g_MemfsCalls[MEMFS_CREATE_FILE] == creates + 2);
+}
+
+
+static VOID
+TestLru(void)
+{
+	DOKAN_OPTIONS			options;
+	PDOKAN_INSTANCE			instance;
+	PDOKAN_CACHE_SHARD		shard;
+	DOKAN_CACHED_ATTRIBUTES	attributes;
+	WCHAR					names[64][16];
+	WCHAR					upper[16];
+	ULONG					count = 0;
+	ULONG					i;
+
+	ZeroMemory(&options, sizeof(DOKAN_OPTIONS));
+	options.Version = DOKAN_VERSION;
+	options.MetadataCacheTimeout = DOKAN_CACHE_MAX_TIMEOUT;
+	options.MetadataCacheSize = DOKAN_CACHE_SHARDS * 1024;
+
+	instance = NewDokanInstance();
+	instance->DokanOptions = &options;
+	ZeroMemory(&attributes, sizeof(attributes));
+
+	// names of the first shard
+	for (i = 0; count < 64; ++i) {
+		swprintf_s(names[count], 16, L"\\lru%u", i);
+		if (DokanNameHash(names[count], (ULONG)wcslen(names[count]), TRUE)
+				% DOKAN_CACHE_SHARDS == 0) {
+			count++;
+		}
+	}
+	shard = &instance->Cache.Shards[0];
+
+	AddCache(instance, DOKAN_CACHE_ATTRIBUTES, names[0], &attributes, sizeof(attributes));
+	AddCache(instance, DOKAN_CACHE_ATTRIBUTES, names[1], &attributes, sizeof(attributes));
+	for (i = 2; i < count; ++i) {
+		// names[0] is used again before each insertion
+		CHECK(LookupCache(instance, DOKAN_CACHE_ATTRIBUTES, names[0],
+				&attributes, sizeof(attributes)));
+		AddCache(instance, DOKAN_CACHE_ATTRIBUTES, names[i], &attributes, sizeof(attributes));
+		CHECK(shard->Size <= 1024);
+	}
+	CHECK(shard->Evictions > 0);
+	CHECK(shard->Count < count);
+	CHECK(LookupCache(instance, DOKAN_CACHE_ATTRIBUTES, names[0], &attributes, sizeof(attributes)));
+	CHECK(!LookupCache(instance, DOKAN_CACHE_ATTRIBUTES, names[1], &attributes, sizeof(attributes)));
+	CHECK(LookupCache(instance, DOKAN_CACHE_ATTRIBUTES, names[count - 1],
+			&attributes, sizeof(attributes)));
+
+	// names are looked up in the exact case and dropped in any case
+	DokanNameUpcase(upper, names[0], (ULONG)wcslen(names[0]) + 1);
+	CHECK(!LookupCache(instance, DOKAN_CACHE_ATTRIBUTES, upper, &attributes, sizeof(attributes)));
+	InvalidateCache(instance, upper);
+	CHECK(!LookupCache(instance, DOKAN_CACHE_ATTRIBUTES, names[0], &attributes, sizeof(attributes)));
+
+	DeleteDokanInstance(instance);
+}
+
+
+int
+main(void)
+{
+	DOKAN_OPTIONS		options;
+	DOKAN_OPERATIONS	operations;
+	PDOKAN_LOOPBACK		loopback;
+	DOKAN_CACHE_INFO	info;
+
+	TestInitialize();
+	MemfsInitialize(&operations, FALSE);
+
+	ZeroMemory(&options, sizeof(DOKAN_OPTIONS));
+	options.Version = DOKAN_VERSION;
+	options.ThreadCount = 2;
+	options.MountPoint = CACHE_TEST_MOUNT;
+	options.MetadataCacheTimeout = CACHE_TEST_TIMEOUT;
+	options.NegativeCacheTimeout = CACHE_TEST_TIMEOUT;
+
+	loopback = DokanLoopbackStart(&options, &operations);
+	CHECK(loopback != NULL);
+	if (loopback == NULL) {
+		return TestResult("cache_test");
+	}
+
+	TestAttributes(loopback);
+	TestListing(loopback);
+	TestListingClasses(loopback);
+	TestOpenDirectory(loopback);
+	TestNegative(loopback);
+
+	CHECK(DokanGetCacheInfo(CACHE_TEST_MOUNT, &info));
+	CHECK(info.Hits > 0 && info.Misses > 0);
+
+	DokanLoopbackStop(loopback);
+
+	TestLru();
+	return TestResult("cache_test");
+}
@@ -0,0 +1,244 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2008 Hiroki Asakawa info@dokan-dev.net
+
+  http://dokan-dev.net/en
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "test.h"
+#include "memfs.h"
+#include "request.h"
+
+
+// Directory enumeration through the loopback
+//
+// Resume: lists synthetic directories of 10k, 100k and 1M entries in
+// 4KB pages and reports the cost of the first page (FindFiles fills
+// the listing), of an average page and of the last 1% of pages. With
+// the listing cached and the match applied once, the cost of a page
+// does not depend on where it resumes.
+//
+// Classes: lists the 100k directory in 64KB pages, as FindFirstFileEx
+// with FIND_FIRST_EX_LARGE_FETCH does, once per information class and
+// reports entries per second with and without the first page.
+
+#define DIR_BENCH_PAGE			4096
+#define DIR_BENCH_LARGE_PAGE	65536
+#define DIR_BENCH_CLASS_ROUNDS	5
+
+
+// entries in a page, entries of every class start with NextEntryOffset
+static ULONG
+CountEntries(
+	PVOID	Buffer,
+	ULONG	Length)
+{
+	PFILE_NAMES_INFORMATION	info = (PFILE_NAMES_INFORMATION)Buffer;
+	ULONG					count = 0;
+
+	while (Length > 0) {
+		count++;
+		if (info->NextEntryOffset == 0) {
+			break;
+		}
+		info = (PFILE_NAMES_INFORMATION)((PCHAR)info + info->NextEntryOffset);
+	}
+	return count;
+}
+
+
+// lists Directory with Pattern, returns FALSE when the number of
+// entries is not Expected
+static BOOL
+BenchResume(
+	PDOKAN_LOOPBACK	Loopback,
+	LPCWSTR			Directory,
+	LPCWSTR			Pattern,
+	ULONG			Expected)
+{
+	CHAR	buffer[DIR_BENCH_PAGE];
+	ULONG64	context;
+	ULONG	index = 0;
+	ULONG	length;
+	ULONG	status;
+	ULONG	entries = 0;
+	ULONG	pages = 0;
+	ULONG	maxPages = Expected / 8 + 2;
+	double*	cost = (double*)malloc(sizeof(double) * maxPages);
+	double	total = 0, tail = 0;
+	ULONG	tailPages, i;
+
+	if (RequestCreate(Loopback, Directory, FILE_OPEN, FILE_DIRECTORY_FILE, &context) != STATUS_SUCCESS) {
+		free(cost);
+		return FALSE;
+	}
+
+	for (;;) {
+		double start = TestNow();
+		status = RequestDirectory(Loopback, Directory, Pattern, context, FileNamesInformation,
+					&index, buffer, sizeof(buffer), &length);
+		if (status != STATUS_SUCCESS) {
+			break;
+		}
+		if (pages < maxPages) {
+			cost[pages] = TestNow() - start;
+		}
+		pages++;
+		entries += CountEntries(buffer, length);
+	}
+	RequestClose(Loopback, Directory, context);
+
+	if (pages == 0 || pages > maxPages) {
+		free(cost);
+		return FALSE;
+	}
+	for (i = 0; i < pages; ++i) {
+		total += cost[i];
+	}
+	tailPages = pages / 100 > 0 ? pages / 100 : 1;
+	for (i = pages - tailPages; i < pages; ++i) {
+		tail += cost[i];
+	}
+
+	printf("%8u entries %-3s %6u pages  first %9.1f us  avg %6.2f us  last 1%% %6.2f us  total %7.1f ms\n",
+		Expected, Pattern[1] ? "*5" : "*", pages, cost[0] * 1e6,
+		(total - cost[0]) / max(pages - 1, 1) * 1e6,
+		tail / tailPages * 1e6, total * 1e3);
+	free(cost);
+	return entries == Expected;
+}
+
+
+// lists Directory with InformationClass DIR_BENCH_CLASS_ROUNDS times,
+// returns FALSE when the number of entries is not Expected
+static BOOL
+BenchClass(
+	PDOKAN_LOOPBACK	Loopback,
+	LPCWSTR			Directory,
+	ULONG			InformationClass,
+	const char*		ClassName,
+	ULONG			Expected)
+{
+	PCHAR	buffer = (PCHAR)malloc(DIR_BENCH_LARGE_PAGE);
+	double	total = 0, first = 0;
+	ULONG64	bytes = 0;
+	ULONG	round;
+	BOOL	ok = buffer != NULL;
+
+	for (round = 0; ok && round < DIR_BENCH_CLASS_ROUNDS; ++round) {
+		ULONG64	context;
+		ULONG	index = 0;
+		ULONG	entries = 0;
+		ULONG	pages = 0;
+		ULONG	length;
+		double	start;
+
+		if (RequestCreate(Loopback, Directory, FILE_OPEN, FILE_DIRECTORY_FILE, &context) != STATUS_SUCCESS) {
+			ok = FALSE;
+			break;
+		}
+		start = TestNow();
+		while (RequestDirectory(Loopback, Directory, L"*", context, InformationClass,
+					&index, buffer, DIR_BENCH_LARGE_PAGE, &length) == STATUS_SUCCESS) {
+			if (pages++ == 0) {
+				first += TestNow() - start;
+			}
+			entries += CountEntries(buffer, length);
+			bytes += length;
+		}
+		total += TestNow() - start;
+		RequestClose(Loopback, Directory, context);
+
+		ok = entries == Expected;
+	}
+
+	if (ok) {
+		ULONG64	listed = (ULONG64)Expected * DIR_BENCH_CLASS_ROUNDS;
+		printf("%-32s %5.1f bytes/entry  %6.2f M entries/s  after first page %6.2f M entries/s\n",
+			ClassName, (double)bytes / listed, listed / total / 1e6,
+			listed / (total - first) / 1e6);
+	}
+	free(buffer);
+	return ok;
+}
+
+
+int
+main(void)
+{
+	static const ULONG sizes[] = { 10000, 100000, 1000000 };
+	DOKAN_OPTIONS		options;
+	DOKAN_OPERATIONS	operations;
+	PDOKAN_LOOPBACK		loopback;
+	ULONG				failures = 0;
+	ULONG				i;
+	WCHAR				name[32];
+	static const struct {
+		ULONG		InformationClass;
+		const char*	Name;
+	} classes[] = {
+		{ FileNamesInformation,				"FileNamesInformation" },
+		{ FileDirectoryInformation,			"FileDirectoryInformation" },
+		{ FileFullDirectoryInformation,		"FileFullDirectoryInformation" },
+		{ FileBothDirectoryInformation,		"FileBothDirectoryInformation" },
+		{ FileIdFullDirectoryInformation,	"FileIdFullDirectoryInformation" },
+		{ FileIdBothDirectoryInformation,	"FileIdBothDirectoryInformation" },
+	};
+
+	TestInitialize();
+	MemfsInitialize(&operations, FALSE);
+
+	ZeroMemory(&options, sizeof(DOKAN_OPTIONS));
+	options.Version = DOKAN_VERSION;
+	options.ThreadCount = 2;
+	options.MountPoint = L"M:\\";
+
+	loopback = DokanLoopbackStart(&options, &operations);
+	if (loopback == NULL) {
+		fprintf(stderr, "DokanLoopbackStart failed\n");
+		return 1;
+	}
+
+	printf("resume in %u byte pages (FileNamesInformation)\n", DIR_BENCH_PAGE);
+	for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+		ULONG count = (ULONG)(sizes[i] * BenchScale());
+		swprintf_s(name, 32, L"\\d%u", i);
+		MemfsAddSyntheticDirectory(name, count);
+
+		// all entries, then the 10% of names ending with 5
+		if (!BenchResume(loopback, name, L"*", count)) {
+			fprintf(stderr, "%u entries: wrong number of entries\n", count);
+			failures++;
+		}
+		if (!BenchResume(loopback, name, L"*5", count / 10)) {
+			fprintf(stderr, "%u entries *5: wrong number of entries\n", count);
+			failures++;
+		}
+	}
+
+	printf("\nentries per second in %u byte pages, \\d1\n", DIR_BENCH_LARGE_PAGE);
+	for (i = 0; i < sizeof(classes) / sizeof(classes[0]); ++i) {
+		if (!BenchClass(loopback, L"\\d1", classes[i].InformationClass,
+				classes[i].Name, (ULONG)(sizes[1] * BenchScale()))) {
+			fprintf(stderr, "%s: wrong number of entries\n", classes[i].Name);
+			failures++;
+		}
+	}
+
+	DokanLoopbackStop(loopback);
+	return failures ? 1 : 0;
+}
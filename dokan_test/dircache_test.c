@@ -0,0 +1,431 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2008 Hiroki Asakawa info@dokan-dev.net
+
+  http://dokan-dev.net/en
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "test.h"
+#include "hostsys.h"
+
+
+// Directory listing cache of the driver (sys/dircache.c)
+//
+// Keys, expiry, replacement of a query, eviction of the oldest reply
+// beyond DOKAN_DIR_CACHE_MAX_ENTRIES, the replies which are not kept,
+// and invalidation by directory name through the FCB table.
+
+typedef enum _FSD_IDENTIFIER_TYPE {
+	VCB = 1,
+	FCB,
+} FSD_IDENTIFIER_TYPE;
+
+typedef struct _FSD_IDENTIFIER {
+	FSD_IDENTIFIER_TYPE	Type;
+	ULONG				Size;
+} FSD_IDENTIFIER, *PFSD_IDENTIFIER;
+
+#define GetIdentifierType(Obj) (((PFSD_IDENTIFIER)Obj)->Type)
+
+#include "fcbtable.h"
+
+typedef struct _DokanDCB {
+	ULONG		DirCacheTimeout;
+} DokanDCB, *PDokanDCB;
+
+typedef struct _DokanVCB {
+	FSD_IDENTIFIER	Identifier;
+	ERESOURCE		Resource;
+	PDokanDCB		Dcb;
+	LIST_ENTRY		NextFCB;
+	DOKAN_FCB_TABLE	FcbTable;
+} DokanVCB, *PDokanVCB;
+
+typedef struct _DokanFCB {
+	FSD_IDENTIFIER	Identifier;
+	PDokanVCB		Vcb;
+	LIST_ENTRY		NextFCB;
+	LIST_ENTRY		HashEntry;
+	ULONG			NameHash;
+	UNICODE_STRING	FileName;
+	FAST_MUTEX		DirCacheMutex;
+	LIST_ENTRY		DirCache;
+	ULONG			DirCacheCount;
+} DokanFCB, *PDokanFCB;
+
+typedef struct _DokanCCB {
+	PWCHAR		SearchPattern;
+	ULONG		SearchPatternLength;
+} DokanCCB, *PDokanCCB;
+
+#include "dircache.h"
+#include "../sys/fcbtable.c"
+#include "../sys/dircache.c"
+
+
+#define DIR_TEST_TIMEOUT	1000 // in millisecond
+#define DIR_TEST_MS			10000 // KeQueryInterruptTime units
+
+
+static DokanDCB		g_Dcb;
+static DokanVCB		g_Vcb;
+
+
+static VOID
+InitializeVolume(void)
+{
+	g_Dcb.DirCacheTimeout = DIR_TEST_TIMEOUT;
+	g_Vcb.Identifier.Type = VCB;
+	g_Vcb.Dcb = &g_Dcb;
+	ExInitializeResourceLite(&g_Vcb.Resource);
+	InitializeListHead(&g_Vcb.NextFCB);
+	DokanFcbTableInitialize(&g_Vcb.FcbTable);
+}
+
+
+static PDokanFCB
+AddDirectory(
+	LPCWSTR	Name)
+{
+	PDokanFCB fcb = (PDokanFCB)calloc(1, sizeof(DokanFCB));
+
+	fcb->Identifier.Type = FCB;
+	fcb->Vcb = &g_Vcb;
+	fcb->FileName.Length = (USHORT)(wcslen(Name) * sizeof(WCHAR));
+	fcb->FileName.MaximumLength = fcb->FileName.Length;
+	fcb->FileName.Buffer = (PWCHAR)Name;
+	DokanDirCacheInitialize(fcb);
+	InsertTailList(&g_Vcb.NextFCB, &fcb->NextFCB);
+	DokanFcbTableInsert(&g_Vcb.FcbTable, fcb);
+	return fcb;
+}
+
+
+static VOID
+RemoveDirectory(
+	PDokanFCB	Fcb)
+{
+	DokanDirCacheClear(Fcb);
+	RemoveEntryList(&Fcb->NextFCB);
+	DokanFcbTableRemove(&g_Vcb.FcbTable, Fcb);
+	free(Fcb);
+}
+
+
+static VOID
+MakeKey(
+	PDOKAN_DIR_CACHE_KEY	Key,
+	ULONG					FileIndex,
+	LPCWSTR					Pattern)
+{
+	Key->InformationClass = FileBothDirectoryInformation;
+	Key->FileIndex = FileIndex;
+	Key->BufferLength = 4096;
+	Key->Flags = 0;
+	Key->SearchPattern = (PWCHAR)Pattern;
+	Key->SearchPatternLength = Pattern ? (ULONG)(wcslen(Pattern) * sizeof(WCHAR)) : 0;
+}
+
+
+// a reply of DataLength bytes of Fill
+static VOID
+Insert(
+	PDokanFCB				Fcb,
+	PDOKAN_DIR_CACHE_KEY	Key,
+	NTSTATUS				Status,
+	ULONG					DataLength,
+	CHAR					Fill)
+{
+	PCHAR data = (PCHAR)malloc(DataLength + 1);
+	memset(data, Fill, DataLength);
+	DokanDirCacheInsert(Fcb, Key, Status, Key->FileIndex + 1, data, DataLength);
+	free(data);
+}
+
+
+// returns the first byte of the cached reply, or 0 when not found
+static CHAR
+Lookup(
+	PDokanFCB				Fcb,
+	PDOKAN_DIR_CACHE_KEY	Key)
+{
+	PCHAR		buffer = (PCHAR)malloc(Key->BufferLength);
+	NTSTATUS	status;
+	ULONG		nextIndex;
+	ULONG		dataLength = 0;
+	CHAR		first = 0;
+
+	buffer[0] = 0;
+	if (DokanDirCacheLookup(Fcb, Key, buffer, &status, &nextIndex, &dataLength)) {
+		CHECK(nextIndex == Key->FileIndex + 1);
+		first = dataLength > 0 ? buffer[0] : 1;
+	}
+	free(buffer);
+	return first;
+}
+
+
+static VOID
+TestMakeKey(void)
+{
+	IO_STACK_LOCATION	irpSp;
+	DokanCCB			ccb;
+	DOKAN_DIR_CACHE_KEY	key;
+	WCHAR				pattern[] = L"*.txt";
+
+	ZeroMemory(&irpSp, sizeof(irpSp));
+	irpSp.Flags = SL_RETURN_SINGLE_ENTRY | SL_RESTART_SCAN | SL_INDEX_SPECIFIED;
+	irpSp.Parameters.QueryDirectory.FileInformationClass = FileIdBothDirectoryInformation;
+	irpSp.Parameters.QueryDirectory.FileIndex = 7;
+	irpSp.Parameters.QueryDirectory.Length = 512;
+	ccb.SearchPattern = pattern;
+	ccb.SearchPatternLength = sizeof(pattern) - sizeof(WCHAR);
+
+	DokanDirCacheMakeKey(&key, &irpSp, &ccb);
+	CHECK(key.InformationClass == FileIdBothDirectoryInformation);
+	CHECK(key.FileIndex == 7);
+	CHECK(key.BufferLength == 512);
+	// only SL_RETURN_SINGLE_ENTRY changes the reply
+	CHECK(key.Flags == SL_RETURN_SINGLE_ENTRY);
+	CHECK(key.SearchPattern == pattern);
+	CHECK(key.SearchPatternLength == 5 * sizeof(WCHAR));
+
+	ccb.SearchPattern = NULL;
+	ccb.SearchPatternLength = 10;
+	DokanDirCacheMakeKey(&key, &irpSp, &ccb);
+	CHECK(key.SearchPatternLength == 0);
+}
+
+
+static VOID
+TestKeys(void)
+{
+	PDokanFCB			fcb = AddDirectory(L"\\dir");
+	DOKAN_DIR_CACHE_KEY	key, other;
+
+	MakeKey(&key, 0, L"*.txt");
+	Insert(fcb, &key, STATUS_SUCCESS, 100, 'a');
+	CHECK(Lookup(fcb, &key) == 'a');
+	CHECK(fcb->DirCacheCount == 1);
+
+	// each field of the key
+	other = key;
+	other.InformationClass = FileNamesInformation;
+	CHECK(Lookup(fcb, &other) == 0);
+	other = key;
+	other.FileIndex = 1;
+	CHECK(Lookup(fcb, &other) == 0);
+	other = key;
+	other.BufferLength = 8192;
+	CHECK(Lookup(fcb, &other) == 0);
+	other = key;
+	other.Flags = SL_RETURN_SINGLE_ENTRY;
+	CHECK(Lookup(fcb, &other) == 0);
+	MakeKey(&other, 0, L"*.TXT");
+	CHECK(Lookup(fcb, &other) == 0);
+	MakeKey(&other, 0, L"*.tx");
+	CHECK(Lookup(fcb, &other) == 0);
+	MakeKey(&other, 0, NULL);
+	CHECK(Lookup(fcb, &other) == 0);
+
+	// the same query replaces the reply
+	Insert(fcb, &key, STATUS_SUCCESS, 100, 'b');
+	CHECK(Lookup(fcb, &key) == 'b');
+	CHECK(fcb->DirCacheCount == 1);
+
+	// end of the listing is kept, errors are not
+	MakeKey(&other, 5, NULL);
+	Insert(fcb, &other, STATUS_NO_MORE_FILES, 0, 0);
+	CHECK(Lookup(fcb, &other) == 1);
+	MakeKey(&other, 6, NULL);
+	Insert(fcb, &other, STATUS_ACCESS_DENIED, 0, 0);
+	CHECK(Lookup(fcb, &other) == 0);
+
+	// replies bigger than the buffer or than the limit
+	MakeKey(&other, 7, NULL);
+	Insert(fcb, &other, STATUS_SUCCESS, other.BufferLength + 1, 'c');
+	CHECK(Lookup(fcb, &other) == 0);
+	other.BufferLength = DOKAN_DIR_CACHE_MAX_LENGTH + 8;
+	Insert(fcb, &other, STATUS_SUCCESS, DOKAN_DIR_CACHE_MAX_LENGTH + 1, 'c');
+	CHECK(Lookup(fcb, &other) == 0);
+	CHECK(fcb->DirCacheCount == 2);
+
+	RemoveDirectory(fcb);
+}
+
+
+static VOID
+TestExpiry(void)
+{
+	PDokanFCB			fcb = AddDirectory(L"\\dir");
+	DOKAN_DIR_CACHE_KEY	key;
+
+	MakeKey(&key, 0, NULL);
+	Insert(fcb, &key, STATUS_SUCCESS, 10, 'a');
+
+	g_HostInterruptTime += (DIR_TEST_TIMEOUT - 1) * DIR_TEST_MS;
+	CHECK(Lookup(fcb, &key) == 'a');
+
+	// expired replies are dropped by the lookup
+	g_HostInterruptTime += DIR_TEST_MS;
+	CHECK(Lookup(fcb, &key) == 0);
+	CHECK(fcb->DirCacheCount == 0);
+
+	// nothing is kept without DirCacheTimeout
+	g_Dcb.DirCacheTimeout = 0;
+	Insert(fcb, &key, STATUS_SUCCESS, 10, 'a');
+	CHECK(fcb->DirCacheCount == 0);
+	g_Dcb.DirCacheTimeout = DIR_TEST_TIMEOUT;
+
+	RemoveDirectory(fcb);
+}
+
+
+static VOID
+TestEviction(void)
+{
+	PDokanFCB			fcb = AddDirectory(L"\\dir");
+	DOKAN_DIR_CACHE_KEY	key;
+	ULONG				i;
+
+	for (i = 0; i < DOKAN_DIR_CACHE_MAX_ENTRIES + 3; ++i) {
+		MakeKey(&key, i, NULL);
+		Insert(fcb, &key, STATUS_SUCCESS, 10, (CHAR)('A' + i));
+		CHECK(fcb->DirCacheCount == min(i + 1, DOKAN_DIR_CACHE_MAX_ENTRIES));
+	}
+
+	// the 3 oldest replies were dropped
+	for (i = 0; i < DOKAN_DIR_CACHE_MAX_ENTRIES + 3; ++i) {
+		MakeKey(&key, i, NULL);
+		CHECK(Lookup(fcb, &key) == (i < 3 ? 0 : (CHAR)('A' + i)));
+	}
+
+	// a replaced reply becomes the newest
+	MakeKey(&key, 3, NULL);
+	Insert(fcb, &key, STATUS_SUCCESS, 10, 'z');
+	MakeKey(&key, 100, NULL);
+	Insert(fcb, &key, STATUS_SUCCESS, 10, 'y');
+	MakeKey(&key, 3, NULL);
+	CHECK(Lookup(fcb, &key) == 'z');
+	MakeKey(&key, 4, NULL);
+	CHECK(Lookup(fcb, &key) == 0);
+	CHECK(fcb->DirCacheCount == DOKAN_DIR_CACHE_MAX_ENTRIES);
+
+	RemoveDirectory(fcb);
+}
+
+
+static VOID
+TestInvalidate(void)
+{
+	PDokanFCB			root = AddDirectory(L"\\");
+	PDokanFCB			dir = AddDirectory(L"\\Dir");
+	PDokanFCB			sub = AddDirectory(L"\\Dir\\Sub");
+	// FCBs are opened in the exact case
+	PDokanFCB			other = AddDirectory(L"\\dIR");
+	DOKAN_DIR_CACHE_KEY	key;
+	UNICODE_STRING		name;
+	IO_STACK_LOCATION	irpSp;
+	DEVICE_OBJECT		device;
+	IRP					irp;
+	WCHAR				buffer[] = L"\\dir\\sub";
+
+	MakeKey(&key, 0, NULL);
+	Insert(root, &key, STATUS_SUCCESS, 10, 'r');
+	Insert(dir, &key, STATUS_SUCCESS, 10, 'd');
+	Insert(sub, &key, STATUS_SUCCESS, 10, 's');
+	Insert(other, &key, STATUS_SUCCESS, 10, 'o');
+
+	// names are compared ignoring case
+	DokanDirCacheInvalidate(&g_Vcb, L"\\DIR", 4 * sizeof(WCHAR));
+	CHECK(Lookup(dir, &key) == 0);
+	CHECK(Lookup(other, &key) == 0);
+	CHECK(Lookup(root, &key) == 'r');
+	CHECK(Lookup(sub, &key) == 's');
+
+	// parent of "\Dir\Sub\file" is "\Dir\Sub", of "\file" is "\"
+	name.Buffer = L"\\Dir\\Sub\\file";
+	name.Length = name.MaximumLength = (USHORT)(wcslen(name.Buffer) * sizeof(WCHAR));
+	DokanDirCacheInvalidateParent(&g_Vcb, &name);
+	CHECK(Lookup(sub, &key) == 0);
+	CHECK(Lookup(root, &key) == 'r');
+	name.Buffer = L"\\file";
+	name.Length = name.MaximumLength = (USHORT)(wcslen(name.Buffer) * sizeof(WCHAR));
+	DokanDirCacheInvalidateParent(&g_Vcb, &name);
+	CHECK(Lookup(root, &key) == 0);
+
+	// IOCTL_DIR_CACHE_INVALIDATE, an empty name is all directories
+	Insert(root, &key, STATUS_SUCCESS, 10, 'r');
+	Insert(dir, &key, STATUS_SUCCESS, 10, 'd');
+	Insert(sub, &key, STATUS_SUCCESS, 10, 's');
+	ZeroMemory(&irpSp, sizeof(irpSp));
+	device.DeviceExtension = &g_Vcb;
+	irp.CurrentStackLocation = &irpSp;
+	irp.AssociatedIrp.SystemBuffer = buffer;
+
+	irpSp.Parameters.DeviceIoControl.InputBufferLength = 3;
+	CHECK(DokanDirCacheInvalidateIoctl(&device, &irp) == STATUS_INVALID_PARAMETER);
+	irpSp.Parameters.DeviceIoControl.InputBufferLength = sizeof(buffer) - sizeof(WCHAR);
+	CHECK(DokanDirCacheInvalidateIoctl(&device, &irp) == STATUS_SUCCESS);
+	CHECK(Lookup(sub, &key) == 0);
+	CHECK(Lookup(dir, &key) == 'd');
+	irpSp.Parameters.DeviceIoControl.InputBufferLength = 0;
+	CHECK(DokanDirCacheInvalidateIoctl(&device, &irp) == STATUS_SUCCESS);
+	CHECK(Lookup(root, &key) == 0);
+	CHECK(Lookup(dir, &key) == 0);
+
+	RemoveDirectory(other);
+	RemoveDirectory(sub);
+	RemoveDirectory(dir);
+	RemoveDirectory(root);
+
+	// only the FCB of the name is cleared in a grown table
+	{
+		static WCHAR	names[100][8];
+		PDokanFCB		fcbs[100];
+		ULONG			i;
+
+		for (i = 0; i < 100; ++i) {
+			swprintf_s(names[i], 8, L"\\d%03u", i);
+			fcbs[i] = AddDirectory(names[i]);
+			Insert(fcbs[i], &key, STATUS_SUCCESS, 10, 'a');
+		}
+		CHECK(g_Vcb.FcbTable.BucketCount > DOKAN_FCB_TABLE_INITIAL_BUCKETS);
+		DokanDirCacheInvalidate(&g_Vcb, L"\\D050", 5 * sizeof(WCHAR));
+		for (i = 0; i < 100; ++i) {
+			CHECK(Lookup(fcbs[i], &key) == (i == 50 ? 0 : 'a'));
+		}
+		for (i = 0; i < 100; ++i) {
+			RemoveDirectory(fcbs[i]);
+		}
+	}
+}
+
+
+int main(void)
+{
+	InitializeVolume();
+
+	TestMakeKey();
+	TestKeys();
+	TestExpiry();
+	TestEviction();
+	TestInvalidate();
+
+	ExDeleteResourceLite(&g_Vcb.Resource);
+	return TestResult("dircache_test");
+}
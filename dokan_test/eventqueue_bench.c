@@ -0,0 +1,201 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2008 Hiroki Asakawa info@dokan-dev.net
+
+  http://dokan-dev.net/en
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "test.h"
+#include "hostevent.h"
+
+
+// Event queue contention
+//
+// Events per second through the event queue (sys/eventqueue.c) with
+// 1 to 8 dispatch threads queuing events, as many worker threads
+// waiting in IOCTL_EVENT_WAIT_BATCH IRPs, and a notification thread.
+// "one list" runs every thread on processor 0, so all of them take the
+// lock of one shard as they took the one PendingEvent and NotifyEvent
+// before; "sharded" gives each thread its own processor. A dispatch
+// thread has at most EVENTQ_BENCH_WINDOW events in flight, as an
+// application waits for the replies to its requests.
+
+#define EVENTQ_BENCH_EVENTS		400000
+#define EVENTQ_BENCH_WINDOW		16
+#define EVENTQ_BENCH_BATCH		8
+#define EVENTQ_BENCH_MAX_THREADS	8
+#define EVENTQ_BENCH_STOP		0xFFFFFFFF
+
+#define EVENT_LEN	((ULONG)sizeof(EVENT_CONTEXT))
+
+
+typedef struct _EVENTQ_BENCH {
+	DOKAN_EVENT_QUEUE	Queue;
+	BOOLEAN				Sharded;
+	ULONG				EventsPerThread;
+	volatile LONG		InFlight[EVENTQ_BENCH_MAX_THREADS];
+	volatile LONG		Exited;
+	volatile LONG		Stop;
+} EVENTQ_BENCH, *PEVENTQ_BENCH;
+
+static EVENTQ_BENCH	g_Bench;
+
+
+static void*
+Producer(
+	void*	Arg)
+{
+	ULONG	index = (ULONG)(ULONG_PTR)Arg;
+	ULONG	i;
+
+	g_HostProcessorNumber = g_Bench.Sharded ? index : 0;
+	for (i = 0; i < g_Bench.EventsPerThread; ++i) {
+		while (g_Bench.InFlight[index] >= EVENTQ_BENCH_WINDOW) {
+			sched_yield();
+		}
+		InterlockedIncrement(&g_Bench.InFlight[index]);
+		DokanQueueEvent(&g_Bench.Queue, HostAllocateEvent(index, EVENT_LEN));
+	}
+	return NULL;
+}
+
+static void*
+Worker(
+	void*	Arg)
+{
+	HOST_EVENT_IRP	irp;
+	ULONG			offset;
+	BOOLEAN			stop = FALSE;
+
+	g_HostProcessorNumber = g_Bench.Sharded ? (ULONG)(ULONG_PTR)Arg : 0;
+	HostInitEventIrp(&irp, IOCTL_EVENT_WAIT_BATCH,
+		EVENTQ_BENCH_BATCH * EVENT_CONTEXT_ALIGN(EVENT_LEN));
+
+	while (!stop) {
+		HostRegisterEventIrp(&g_Bench.Queue, &irp);
+		KeWaitForSingleObject(&irp.Completed, Executive, KernelMode, FALSE, NULL);
+
+		for (offset = 0; offset < irp.Irp.IoStatus.Information;
+				offset = EVENT_CONTEXT_ALIGN(offset + EVENT_LEN)) {
+			ULONG producer = HostEventAt(&irp, offset)->SerialNumber;
+			if (producer == EVENTQ_BENCH_STOP) {
+				stop = TRUE;
+			} else {
+				InterlockedDecrement(&g_Bench.InFlight[producer]);
+			}
+		}
+	}
+	HostDeleteEventIrp(&irp);
+	InterlockedIncrement(&g_Bench.Exited);
+	return NULL;
+}
+
+// NotificationThread without the ring
+static void*
+Notification(
+	void*	Arg)
+{
+	ULONG	i;
+
+	while (1) {
+		KeWaitForSingleObject(&g_Bench.Queue.EventQueued, Executive, KernelMode, FALSE, NULL);
+		if (g_Bench.Stop) {
+			break;
+		}
+		KeClearEvent(&g_Bench.Queue.EventQueued);
+		for (i = 0; i < DOKAN_EVENT_SHARDS; ++i) {
+			DokanDispatchEvents(&g_Bench.Queue, &g_Bench.Queue.Shards[i]);
+		}
+	}
+	return NULL;
+}
+
+
+// events per second of Threads dispatch and worker threads
+static double
+Run(
+	ULONG	Threads,
+	BOOLEAN	Sharded)
+{
+	pthread_t	producers[EVENTQ_BENCH_MAX_THREADS];
+	pthread_t	workers[EVENTQ_BENCH_MAX_THREADS];
+	pthread_t	notification;
+	double		start, elapsed;
+	ULONG		i;
+
+	ZeroMemory(&g_Bench, sizeof(g_Bench));
+	DokanInitEventQueue(&g_Bench.Queue);
+	g_Bench.Sharded = Sharded;
+	g_Bench.EventsPerThread = (ULONG)(EVENTQ_BENCH_EVENTS * BenchScale()) / Threads + 1;
+
+	pthread_create(&notification, NULL, Notification, NULL);
+	for (i = 0; i < Threads; ++i) {
+		pthread_create(&workers[i], NULL, Worker, (void*)(ULONG_PTR)i);
+	}
+
+	start = TestNow();
+	for (i = 0; i < Threads; ++i) {
+		pthread_create(&producers[i], NULL, Producer, (void*)(ULONG_PTR)i);
+	}
+	for (i = 0; i < Threads; ++i) {
+		pthread_join(producers[i], NULL);
+	}
+	for (i = 0; i < Threads; ++i) {
+		while (g_Bench.InFlight[i] > 0) {
+			sched_yield();
+		}
+	}
+	elapsed = TestNow() - start;
+
+	// one stop event at a time, each stops one worker
+	g_HostProcessorNumber = 0;
+	for (i = 0; i < Threads; ++i) {
+		DokanQueueEvent(&g_Bench.Queue, HostAllocateEvent(EVENTQ_BENCH_STOP, EVENT_LEN));
+		while (g_Bench.Exited == (LONG)i) {
+			sched_yield();
+		}
+	}
+	for (i = 0; i < Threads; ++i) {
+		pthread_join(workers[i], NULL);
+	}
+	g_Bench.Stop = TRUE;
+	KeSetEvent(&g_Bench.Queue.EventQueued, IO_NO_INCREMENT, FALSE);
+	pthread_join(notification, NULL);
+
+	return g_Bench.EventsPerThread * Threads / elapsed;
+}
+
+
+int main(void)
+{
+	ULONG	threads;
+
+	printf("%8s %14s %14s\n", "threads", "one list", "sharded");
+
+	for (threads = 1; threads <= EVENTQ_BENCH_MAX_THREADS; threads *= 2) {
+		double single = Run(threads, FALSE);
+		double sharded = Run(threads, TRUE);
+
+		printf("%8u %10.0f ev/s %10.0f ev/s\n", threads, single, sharded);
+	}
+
+	if (g_HostPoolAllocations != 0) {
+		printf("eventqueue_bench: %d pool blocks left\n", g_HostPoolAllocations);
+		return 1;
+	}
+	return 0;
+}
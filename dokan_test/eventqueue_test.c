@@ -0,0 +1,479 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2008 Hiroki Asakawa info@dokan-dev.net
+
+  http://dokan-dev.net/en
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "test.h"
+#include "hostevent.h"
+
+
+// Event queue of the driver (sys/eventqueue.c)
+//
+// Pairing in a shard in order, stealing from the other shards, the
+// handoff to a waiting IRP and the queued events it must not overtake,
+// batches, short buffers, an IRP being canceled, the events left at
+// release, and producers, workers and a notification thread on several
+// processors.
+
+#define EVENT_LEN			((ULONG)sizeof(EVENT_CONTEXT))
+#define STRESS_PRODUCERS	4
+#define STRESS_WORKERS		3
+#define STRESS_EVENTS		20000 // per producer
+#define STRESS_STOP			0xFFFFFFFF
+
+
+static ULONG
+CountEvents(
+	PDOKAN_EVENT_SHARD	Shard)
+{
+	PLIST_ENTRY	entry;
+	ULONG		count = 0;
+
+	for (entry = Shard->NotifyEvent.Flink; entry != &Shard->NotifyEvent; entry = entry->Flink) {
+		count++;
+	}
+	return count;
+}
+
+static VOID
+QueueOn(
+	PDOKAN_EVENT_QUEUE	Queue,
+	ULONG				Processor,
+	ULONG				SerialNumber)
+{
+	g_HostProcessorNumber = Processor;
+	DokanQueueEvent(Queue, HostAllocateEvent(SerialNumber, EVENT_LEN));
+}
+
+static VOID
+RegisterOn(
+	PDOKAN_EVENT_QUEUE	Queue,
+	ULONG				Processor,
+	PHOST_EVENT_IRP		HostIrp)
+{
+	g_HostProcessorNumber = Processor;
+	HostRegisterEventIrp(Queue, HostIrp);
+}
+
+#define Completed(HostIrp)	(KeReadStateEvent(&(HostIrp)->Completed) != 0)
+
+
+static VOID
+TestPairAndSteal(void)
+{
+	DOKAN_EVENT_QUEUE	queue;
+	HOST_EVENT_IRP		irp;
+	ULONG				i;
+
+	DokanInitEventQueue(&queue);
+	HostInitEventIrp(&irp, IOCTL_EVENT_WAIT, EVENT_LEN);
+
+	// no IRP is waiting
+	for (i = 1; i <= 3; ++i) {
+		QueueOn(&queue, 0, i);
+	}
+	CHECK(queue.QueuedEventCount == 3);
+	CHECK(CountEvents(&queue.Shards[0]) == 3);
+	CHECK(KeReadStateEvent(&queue.EventQueued) != 0);
+	KeClearEvent(&queue.EventQueued);
+
+	// an IRP of the same shard takes the oldest event
+	RegisterOn(&queue, DOKAN_EVENT_SHARDS, &irp);
+	CHECK(Completed(&irp));
+	CHECK(irp.Irp.IoStatus.Status == STATUS_SUCCESS);
+	CHECK(irp.Irp.IoStatus.Information == EVENT_LEN);
+	CHECK(HostEventAt(&irp, 0)->SerialNumber == 1);
+	CHECK(queue.QueuedEventCount == 2);
+
+	// an IRP of an empty shard steals the others, in order
+	RegisterOn(&queue, 3, &irp);
+	CHECK(Completed(&irp));
+	CHECK(HostEventAt(&irp, 0)->SerialNumber == 2);
+	CHECK(queue.QueuedEventCount == 1);
+	CHECK(CountEvents(&queue.Shards[0]) == 0);
+	CHECK(CountEvents(&queue.Shards[3]) == 1);
+	// the event left in shard 3 is offered again by NotificationThread
+	CHECK(KeReadStateEvent(&queue.EventQueued) != 0);
+
+	RegisterOn(&queue, 6, &irp);
+	CHECK(Completed(&irp));
+	CHECK(HostEventAt(&irp, 0)->SerialNumber == 3);
+	CHECK(queue.QueuedEventCount == 0);
+
+	HostDeleteEventIrp(&irp);
+	CHECK(g_HostPoolAllocations == 0);
+}
+
+
+static VOID
+TestHandoff(void)
+{
+	DOKAN_EVENT_QUEUE	queue;
+	HOST_EVENT_IRP		irp;
+	ULONG				i;
+
+	DokanInitEventQueue(&queue);
+	HostInitEventIrp(&irp, IOCTL_EVENT_WAIT, EVENT_LEN);
+
+	// the IRP waits while nothing is queued
+	RegisterOn(&queue, 2, &irp);
+	CHECK(!Completed(&irp));
+	CHECK(!IsListEmpty(&queue.Shards[2].PendingEvent.ListHead));
+
+	// and takes an event of another processor at once
+	QueueOn(&queue, 5, 1);
+	CHECK(Completed(&irp));
+	CHECK(HostEventAt(&irp, 0)->SerialNumber == 1);
+	CHECK(queue.QueuedEventCount == 0);
+	CHECK(KeReadStateEvent(&queue.EventQueued) == 0);
+	CHECK(IsListEmpty(&queue.Shards[2].PendingEvent.ListHead));
+
+	// an event queued before the IRP came is not overtaken: the IRP is
+	// added while event 1 is queued, before it looks for events
+	QueueOn(&queue, 5, 1);
+	g_HostProcessorNumber = 2;
+	HostInsertEventIrp(&queue, &irp);
+	QueueOn(&queue, 5, 2);
+	CHECK(!Completed(&irp));
+	CHECK(queue.QueuedEventCount == 2);
+	CHECK(CountEvents(&queue.Shards[5]) == 2);
+
+	// NotificationThread dispatches every shard
+	for (i = 0; i < DOKAN_EVENT_SHARDS; ++i) {
+		DokanDispatchEvents(&queue, &queue.Shards[i]);
+	}
+	CHECK(Completed(&irp));
+	CHECK(HostEventAt(&irp, 0)->SerialNumber == 1);
+	CHECK(queue.QueuedEventCount == 1);
+
+	RegisterOn(&queue, 0, &irp);
+	CHECK(Completed(&irp));
+	CHECK(HostEventAt(&irp, 0)->SerialNumber == 2);
+	CHECK(queue.QueuedEventCount == 0);
+
+	// an IRP which can not take the event is failed and the event queued
+	HostDeleteEventIrp(&irp);
+	HostInitEventIrp(&irp, IOCTL_EVENT_WAIT, 8);
+	RegisterOn(&queue, 4, &irp);
+	QueueOn(&queue, 4, 3);
+	CHECK(Completed(&irp));
+	CHECK(irp.Irp.IoStatus.Status == STATUS_INSUFFICIENT_RESOURCES);
+	CHECK(queue.QueuedEventCount == 1);
+	CHECK(CountEvents(&queue.Shards[4]) == 1);
+	DokanFreeQueuedEvents(&queue);
+
+	HostDeleteEventIrp(&irp);
+	CHECK(g_HostPoolAllocations == 0);
+}
+
+
+static VOID
+TestBatch(void)
+{
+	DOKAN_EVENT_QUEUE	queue;
+	HOST_EVENT_IRP		batch, single;
+	ULONG				offset = EVENT_CONTEXT_ALIGN(EVENT_LEN);
+
+	DokanInitEventQueue(&queue);
+	// room for two events
+	HostInitEventIrp(&batch, IOCTL_EVENT_WAIT_BATCH, offset + EVENT_LEN);
+	HostInitEventIrp(&single, IOCTL_EVENT_WAIT, EVENT_LEN);
+
+	QueueOn(&queue, 1, 1);
+	QueueOn(&queue, 1, 2);
+	QueueOn(&queue, 1, 3);
+
+	// the only waiting IRP packs the events which fit
+	RegisterOn(&queue, 1, &batch);
+	CHECK(Completed(&batch));
+	CHECK(batch.Irp.IoStatus.Information == offset + EVENT_LEN);
+	CHECK(HostEventAt(&batch, 0)->SerialNumber == 1);
+	CHECK(HostEventAt(&batch, offset)->SerialNumber == 2);
+	CHECK(queue.QueuedEventCount == 1);
+
+	// stolen events are packed too
+	QueueOn(&queue, 1, 4);
+	RegisterOn(&queue, 4, &batch);
+	CHECK(Completed(&batch));
+	CHECK(batch.Irp.IoStatus.Information == offset + EVENT_LEN);
+	CHECK(HostEventAt(&batch, 0)->SerialNumber == 3);
+	CHECK(HostEventAt(&batch, offset)->SerialNumber == 4);
+	CHECK(queue.QueuedEventCount == 0);
+
+	// a batch IRP waiting alone is handed an event when none is
+	// queued, the single worker does not wait for NotificationThread
+	KeClearEvent(&queue.EventQueued);
+	RegisterOn(&queue, 6, &batch);
+	QueueOn(&queue, 2, 5);
+	CHECK(Completed(&batch));
+	CHECK(batch.Irp.IoStatus.Information == EVENT_LEN);
+	CHECK(HostEventAt(&batch, 0)->SerialNumber == 5);
+	CHECK(queue.QueuedEventCount == 0);
+	CHECK(KeReadStateEvent(&queue.EventQueued) == 0);
+
+	// events which pile up meanwhile are packed into the next one
+	QueueOn(&queue, 2, 6);
+	QueueOn(&queue, 2, 7);
+	CHECK(queue.QueuedEventCount == 2);
+	RegisterOn(&queue, 6, &batch);
+	CHECK(Completed(&batch));
+	CHECK(batch.Irp.IoStatus.Information == offset + EVENT_LEN);
+	CHECK(HostEventAt(&batch, 0)->SerialNumber == 6);
+	CHECK(HostEventAt(&batch, offset)->SerialNumber == 7);
+	CHECK(queue.QueuedEventCount == 0);
+
+	// while another IRP waits, events are handed off one by one
+	RegisterOn(&queue, 7, &batch);
+	RegisterOn(&queue, 7, &single);
+	QueueOn(&queue, 7, 8);
+	CHECK(Completed(&batch));
+	CHECK(batch.Irp.IoStatus.Information == EVENT_LEN);
+	CHECK(HostEventAt(&batch, 0)->SerialNumber == 8);
+	// IOCTL_EVENT_WAIT takes one event anyway
+	QueueOn(&queue, 7, 9);
+	CHECK(Completed(&single));
+	CHECK(HostEventAt(&single, 0)->SerialNumber == 9);
+	CHECK(queue.QueuedEventCount == 0);
+
+	HostDeleteEventIrp(&batch);
+	HostDeleteEventIrp(&single);
+	CHECK(g_HostPoolAllocations == 0);
+}
+
+
+static VOID
+TestShortBufferAndCancel(void)
+{
+	DOKAN_EVENT_QUEUE	queue;
+	HOST_EVENT_IRP		irp, shortIrp;
+	PIRP_ENTRY			irpEntry;
+
+	DokanInitEventQueue(&queue);
+	HostInitEventIrp(&irp, IOCTL_EVENT_WAIT, EVENT_LEN);
+	HostInitEventIrp(&shortIrp, IOCTL_EVENT_WAIT, 8);
+
+	// a short buffer fails the IRP and keeps the event
+	QueueOn(&queue, 2, 1);
+	RegisterOn(&queue, 2, &shortIrp);
+	CHECK(Completed(&shortIrp));
+	CHECK(shortIrp.Irp.IoStatus.Status == STATUS_INSUFFICIENT_RESOURCES);
+	CHECK(shortIrp.Irp.IoStatus.Information == 0);
+	CHECK(queue.QueuedEventCount == 1);
+
+	RegisterOn(&queue, 2, &irp);
+	CHECK(Completed(&irp));
+	CHECK(HostEventAt(&irp, 0)->SerialNumber == 1);
+
+	// the I/O manager took the cancel routine of a waiting IRP:
+	// its entry is left to the cancel routine and the event stays
+	RegisterOn(&queue, 5, &irp);
+	irpEntry = CONTAINING_RECORD(queue.Shards[5].PendingEvent.ListHead.Flink,
+		IRP_ENTRY, ListEntry);
+	CHECK(IoSetCancelRoutine(&irp.Irp, NULL) == HostCancelEventIrp);
+	QueueOn(&queue, 5, 2);
+	DokanDispatchEvents(&queue, &queue.Shards[5]);
+	CHECK(!Completed(&irp));
+	CHECK(irpEntry->CancelRoutineFreeMemory == TRUE);
+	CHECK(IsListEmpty(&queue.Shards[5].PendingEvent.ListHead));
+	CHECK(CountEvents(&queue.Shards[5]) == 1);
+	CHECK(queue.QueuedEventCount == 1);
+	// what DokanIrpCancelRoutine does then
+	DokanFreeIrpEntry(irpEntry);
+
+	RegisterOn(&queue, 5, &irp);
+	CHECK(Completed(&irp));
+	CHECK(HostEventAt(&irp, 0)->SerialNumber == 2);
+	CHECK(queue.QueuedEventCount == 0);
+
+	HostDeleteEventIrp(&irp);
+	HostDeleteEventIrp(&shortIrp);
+	CHECK(g_HostPoolAllocations == 0);
+}
+
+
+static VOID
+TestRelease(void)
+{
+	DOKAN_EVENT_QUEUE	queue;
+	KEVENT				completed;
+	PEVENT_CONTEXT		eventContext;
+	ULONG				i;
+
+	DokanInitEventQueue(&queue);
+	KeInitializeEvent(&completed, NotificationEvent, FALSE);
+
+	for (i = 0; i < 10; ++i) {
+		QueueOn(&queue, i, i + 1);
+	}
+	g_HostProcessorNumber = 3;
+	eventContext = HostAllocateEvent(11, EVENT_LEN);
+	CONTAINING_RECORD(eventContext, DRIVER_EVENT_CONTEXT, EventContext)->Completed = &completed;
+	DokanQueueEvent(&queue, eventContext);
+	CHECK(queue.QueuedEventCount == 11);
+
+	// the waiter of an event is not left waiting
+	DokanFreeQueuedEvents(&queue);
+	CHECK(queue.QueuedEventCount == 0);
+	CHECK(KeReadStateEvent(&completed) != 0);
+	for (i = 0; i < DOKAN_EVENT_SHARDS; ++i) {
+		CHECK(IsListEmpty(&queue.Shards[i].NotifyEvent));
+	}
+	CHECK(g_HostPoolAllocations == 0);
+}
+
+
+typedef struct _STRESS {
+	DOKAN_EVENT_QUEUE	Queue;
+	volatile LONG		Seen[STRESS_PRODUCERS * STRESS_EVENTS + 1];
+	volatile LONG		Delivered;
+	volatile LONG		Exited;
+	volatile LONG		Stop;
+	ULONG				Index;
+} STRESS, *PSTRESS;
+
+static STRESS	g_Stress;
+
+static void*
+StressProducer(
+	void*	Arg)
+{
+	ULONG	index = (ULONG)(ULONG_PTR)Arg;
+	ULONG	i;
+
+	g_HostProcessorNumber = index;
+	for (i = 0; i < STRESS_EVENTS; ++i) {
+		DokanQueueEvent(&g_Stress.Queue,
+			HostAllocateEvent(index * STRESS_EVENTS + i + 1, EVENT_LEN));
+	}
+	return NULL;
+}
+
+static void*
+StressWorker(
+	void*	Arg)
+{
+	HOST_EVENT_IRP	irp;
+	ULONG			offset;
+	BOOLEAN			stop = FALSE;
+
+	g_HostProcessorNumber = STRESS_PRODUCERS + (ULONG)(ULONG_PTR)Arg;
+	HostInitEventIrp(&irp, IOCTL_EVENT_WAIT_BATCH, 4 * EVENT_CONTEXT_ALIGN(EVENT_LEN));
+
+	while (!stop) {
+		HostRegisterEventIrp(&g_Stress.Queue, &irp);
+		KeWaitForSingleObject(&irp.Completed, Executive, KernelMode, FALSE, NULL);
+
+		for (offset = 0; offset < irp.Irp.IoStatus.Information;
+				offset = EVENT_CONTEXT_ALIGN(offset + EVENT_LEN)) {
+			ULONG serial = HostEventAt(&irp, offset)->SerialNumber;
+			if (serial == STRESS_STOP) {
+				stop = TRUE;
+			} else {
+				InterlockedIncrement(&g_Stress.Seen[serial]);
+				InterlockedIncrement(&g_Stress.Delivered);
+			}
+		}
+	}
+	HostDeleteEventIrp(&irp);
+	InterlockedIncrement(&g_Stress.Exited);
+	return NULL;
+}
+
+// NotificationThread without the ring
+static void*
+StressNotification(
+	void*	Arg)
+{
+	ULONG	i;
+
+	while (1) {
+		KeWaitForSingleObject(&g_Stress.Queue.EventQueued, Executive, KernelMode, FALSE, NULL);
+		if (g_Stress.Stop) {
+			break;
+		}
+		KeClearEvent(&g_Stress.Queue.EventQueued);
+		for (i = 0; i < DOKAN_EVENT_SHARDS; ++i) {
+			DokanDispatchEvents(&g_Stress.Queue, &g_Stress.Queue.Shards[i]);
+		}
+	}
+	return NULL;
+}
+
+static VOID
+TestStress(void)
+{
+	pthread_t	producers[STRESS_PRODUCERS];
+	pthread_t	workers[STRESS_WORKERS];
+	pthread_t	notification;
+	ULONG		i, missing = 0;
+
+	DokanInitEventQueue(&g_Stress.Queue);
+
+	pthread_create(&notification, NULL, StressNotification, NULL);
+	for (i = 0; i < STRESS_WORKERS; ++i) {
+		pthread_create(&workers[i], NULL, StressWorker, (void*)(ULONG_PTR)i);
+	}
+	for (i = 0; i < STRESS_PRODUCERS; ++i) {
+		pthread_create(&producers[i], NULL, StressProducer, (void*)(ULONG_PTR)i);
+	}
+	for (i = 0; i < STRESS_PRODUCERS; ++i) {
+		pthread_join(producers[i], NULL);
+	}
+	while (g_Stress.Delivered < STRESS_PRODUCERS * STRESS_EVENTS) {
+		sched_yield();
+	}
+
+	// one stop event at a time, each stops one worker
+	for (i = 0; i < STRESS_WORKERS; ++i) {
+		g_HostProcessorNumber = i;
+		DokanQueueEvent(&g_Stress.Queue, HostAllocateEvent(STRESS_STOP, EVENT_LEN));
+		while (g_Stress.Exited == (LONG)i) {
+			sched_yield();
+		}
+	}
+	for (i = 0; i < STRESS_WORKERS; ++i) {
+		pthread_join(workers[i], NULL);
+	}
+	g_Stress.Stop = TRUE;
+	KeSetEvent(&g_Stress.Queue.EventQueued, IO_NO_INCREMENT, FALSE);
+	pthread_join(notification, NULL);
+
+	for (i = 1; i <= STRESS_PRODUCERS * STRESS_EVENTS; ++i) {
+		if (g_Stress.Seen[i] != 1) {
+			missing++;
+		}
+	}
+	CHECK(missing == 0);
+	CHECK(g_Stress.Delivered == STRESS_PRODUCERS * STRESS_EVENTS);
+	CHECK(g_Stress.Queue.QueuedEventCount == 0);
+	CHECK(g_HostPoolAllocations == 0);
+}
+
+
+int main(void)
+{
+	TestPairAndSteal();
+	TestHandoff();
+	TestBatch();
+	TestShortBufferAndCancel();
+	TestRelease();
+	TestStress();
+
+	return TestResult("eventqueue_test");
+}
@@ -0,0 +1,138 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2008 Hiroki Asakawa info@dokan-dev.net
+
+  http://dokan-dev.net/en
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "test.h"
+#include "hostfcb.h"
+
+
+// FCB lookup
+//
+// ns per insert (growth included) and per lookup of the FCB table for
+// 1k to 1M open FCBs, against the scan of Vcb->NextFCB which
+// DokanGetFCB did before the table. The scan is timed on as many
+// lookups as take about the same time as those of the table.
+
+#define FCB_BENCH_LOOKUPS		1000000
+#define FCB_BENCH_SCAN_COMPARES	100000000
+
+
+static PDokanFCB
+ScanFcbList(
+	PLIST_ENTRY	List,
+	PWCHAR		FileName,
+	ULONG		FileNameLength)
+{
+	PLIST_ENTRY	thisEntry;
+	ULONG		pos;
+
+	for (thisEntry = List->Flink; thisEntry != List; thisEntry = thisEntry->Flink) {
+		PDokanFCB fcb = CONTAINING_RECORD(thisEntry, DokanFCB, NextFCB);
+		if (fcb->FileName.Length == FileNameLength) {
+			for (pos = 0; pos < FileNameLength/sizeof(WCHAR); ++pos) {
+				if (fcb->FileName.Buffer[pos] != FileName[pos])
+					break;
+			}
+			if (pos == FileNameLength/sizeof(WCHAR))
+				return fcb;
+		}
+	}
+	return NULL;
+}
+
+
+int main(void)
+{
+	static const ULONG counts[] = { 1000, 10000, 100000, 1000000 };
+	ULONG	c, i;
+
+	printf("%9s %12s %12s %12s\n", "FCBs", "insert", "lookup", "list scan");
+
+	for (c = 0; c < sizeof(counts) / sizeof(counts[0]); ++c) {
+		ULONG			count = (ULONG)(counts[c] * BenchScale());
+		ULONG			lookups = (ULONG)(FCB_BENCH_LOOKUPS * BenchScale());
+		ULONG			scans;
+		DOKAN_FCB_TABLE	table;
+		LIST_ENTRY		list;
+		PDokanFCB*		fcbs;
+		ULONG			missing = 0;
+		double			start, insert, lookup, scan;
+		WCHAR			name[32];
+
+		if (count < 16) {
+			count = 16;
+		}
+		scans = max(FCB_BENCH_SCAN_COMPARES / count, 1);
+		scans = (ULONG)min(scans * BenchScale() + 1, lookups);
+
+		fcbs = (PDokanFCB*)malloc(count * sizeof(PDokanFCB));
+		for (i = 0; i < count; ++i) {
+			swprintf_s(name, 32, L"\\dir\\f%07u", i);
+			fcbs[i] = HostAllocateFcb(name);
+		}
+
+		DokanFcbTableInitialize(&table);
+		InitializeListHead(&list);
+		start = TestNow();
+		for (i = 0; i < count; ++i) {
+			DokanFcbTableInsert(&table, fcbs[i]);
+		}
+		insert = TestNow() - start;
+		for (i = 0; i < count; ++i) {
+			InsertTailList(&list, &fcbs[i]->NextFCB);
+		}
+
+		// names in a scattered order, looked up as DokanGetFCB does
+		start = TestNow();
+		for (i = 0; i < lookups; ++i) {
+			PDokanFCB fcb = fcbs[(i * 2654435761U) % count];
+			if (DokanFcbTableLookup(&table, fcb->FileName.Buffer, fcb->FileName.Length,
+					DokanFcbNameHash(fcb->FileName.Buffer, fcb->FileName.Length)) != fcb) {
+				missing++;
+			}
+		}
+		lookup = TestNow() - start;
+
+		start = TestNow();
+		for (i = 0; i < scans; ++i) {
+			PDokanFCB fcb = fcbs[(i * 2654435761U) % count];
+			if (ScanFcbList(&list, fcb->FileName.Buffer, fcb->FileName.Length) != fcb) {
+				missing++;
+			}
+		}
+		scan = TestNow() - start;
+
+		printf("%9u %9.1f ns %9.1f ns %9.1f ns\n", count, insert * 1e9 / count,
+			lookup * 1e9 / lookups, scan * 1e9 / scans);
+
+		DokanFcbTableDelete(&table);
+		for (i = 0; i < count; ++i) {
+			HostFreeFcb(fcbs[i]);
+		}
+		free(fcbs);
+
+		if (missing > 0 || g_HostPoolAllocations != 0) {
+			printf("fcbtable_bench: %u FCBs not found, %d pool blocks left\n",
+				missing, g_HostPoolAllocations);
+			return 1;
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,245 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2008 Hiroki Asakawa info@dokan-dev.net
+
+  http://dokan-dev.net/en
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "test.h"
+#include "hostfcb.h"
+
+
+// FCB table of the driver (sys/fcbtable.c)
+//
+// Lookups in the exact case with a hash ignoring case, FCBs of the same name, growth and the
+// return to the first buckets, renames, a failed growth, and
+// DokanFcbTableDelete of a grown table with FCBs left at unmount.
+
+#define FCB_TEST_COUNT	1000
+
+
+static VOID
+MakeName(
+	LPWSTR	Name,
+	ULONG	Index)
+{
+	swprintf_s(Name, 32, L"\\dir\\f%05u", Index);
+}
+
+
+static VOID
+TestLookup(void)
+{
+	DOKAN_FCB_TABLE	table;
+	PDokanFCB		a, b, older, newer;
+
+	DokanFcbTableInitialize(&table);
+
+	a = HostAllocateFcb(L"\\a.txt");
+	b = HostAllocateFcb(L"\\dir\\b.txt");
+	DokanFcbTableInsert(&table, a);
+	DokanFcbTableInsert(&table, b);
+	CHECK(table.Count == 2);
+
+	CHECK(HostLookupFcb(&table, L"\\a.txt") == a);
+	CHECK(HostLookupFcb(&table, L"\\dir\\b.txt") == b);
+	CHECK(HostLookupFcb(&table, L"\\A.TXT") == NULL);
+	// but the hash ignores case, the FCB is found in the same bucket
+	CHECK(DokanFcbNameHash(L"\\A.TXT", 12) == a->NameHash);
+	CHECK(DokanFcbTableNextIgnoreCase(&table, L"\\A.TXT", 12, a->NameHash, NULL) == a);
+	CHECK(DokanFcbTableNextIgnoreCase(&table, L"\\A.TXT", 12, a->NameHash, a) == NULL);
+	CHECK(HostLookupFcb(&table, L"\\a.tx") == NULL);
+	CHECK(HostLookupFcb(&table, L"\\c.txt") == NULL);
+
+	// an FCB of the same name added later is found after the older one
+	older = HostAllocateFcb(L"\\same");
+	newer = HostAllocateFcb(L"\\same");
+	DokanFcbTableInsert(&table, older);
+	DokanFcbTableInsert(&table, newer);
+	CHECK(HostLookupFcb(&table, L"\\same") == older);
+	DokanFcbTableRemove(&table, older);
+	CHECK(HostLookupFcb(&table, L"\\same") == newer);
+	DokanFcbTableRemove(&table, newer);
+	CHECK(HostLookupFcb(&table, L"\\same") == NULL);
+
+	// rename
+	DokanFcbTableRemove(&table, a);
+	free(a->FileName.Buffer);
+	a->FileName.Buffer = (PWCHAR)malloc(sizeof(L"\\renamed"));
+	CopyMemory(a->FileName.Buffer, L"\\renamed", sizeof(L"\\renamed"));
+	a->FileName.Length = sizeof(L"\\renamed") - sizeof(WCHAR);
+	DokanFcbTableInsert(&table, a);
+	CHECK(HostLookupFcb(&table, L"\\a.txt") == NULL);
+	CHECK(HostLookupFcb(&table, L"\\renamed") == a);
+
+	DokanFcbTableRemove(&table, a);
+	DokanFcbTableRemove(&table, b);
+	CHECK(table.Count == 0);
+	CHECK(table.Buckets == table.InitialBuckets);
+
+	HostFreeFcb(older);
+	HostFreeFcb(newer);
+	HostFreeFcb(a);
+	HostFreeFcb(b);
+}
+
+
+static VOID
+TestGrowth(void)
+{
+	DOKAN_FCB_TABLE	table;
+	PDokanFCB		fcbs[FCB_TEST_COUNT];
+	PDokanFCB		first, second;
+	WCHAR			name[32];
+	ULONG			i, missing = 0, wrong = 0;
+
+	DokanFcbTableInitialize(&table);
+
+	// two FCBs of the same name keep their order through the growths
+	first = HostAllocateFcb(L"\\twin");
+	second = HostAllocateFcb(L"\\twin");
+	DokanFcbTableInsert(&table, first);
+	DokanFcbTableInsert(&table, second);
+
+	for (i = 0; i < FCB_TEST_COUNT; ++i) {
+		MakeName(name, i);
+		fcbs[i] = HostAllocateFcb(name);
+		DokanFcbTableInsert(&table, fcbs[i]);
+
+		if (table.Count > table.BucketCount * DOKAN_FCB_TABLE_LOAD) {
+			wrong++;
+		}
+	}
+	CHECK(wrong == 0);
+	CHECK(table.Buckets != table.InitialBuckets);
+	CHECK((table.BucketCount & (table.BucketCount - 1)) == 0);
+	CHECK(table.BucketCount >= (FCB_TEST_COUNT + 2) / DOKAN_FCB_TABLE_LOAD);
+	CHECK(g_HostPoolAllocations == 1);
+
+	for (i = 0; i < FCB_TEST_COUNT; ++i) {
+		MakeName(name, i);
+		if (HostLookupFcb(&table, name) != fcbs[i]) {
+			missing++;
+		}
+	}
+	CHECK(missing == 0);
+	CHECK(HostLookupFcb(&table, L"\\twin") == first);
+	DokanFcbTableRemove(&table, first);
+	CHECK(HostLookupFcb(&table, L"\\twin") == second);
+	DokanFcbTableRemove(&table, second);
+
+	// the grown buckets are freed with the last FCB
+	for (i = 0; i < FCB_TEST_COUNT; ++i) {
+		DokanFcbTableRemove(&table, fcbs[i]);
+		HostFreeFcb(fcbs[i]);
+	}
+	CHECK(table.Count == 0);
+	CHECK(table.Buckets == table.InitialBuckets);
+	CHECK(table.BucketCount == DOKAN_FCB_TABLE_INITIAL_BUCKETS);
+	CHECK(g_HostPoolAllocations == 0);
+
+	HostFreeFcb(first);
+	HostFreeFcb(second);
+}
+
+
+// without memory for a bigger table the chains get longer
+static VOID
+TestGrowthFailure(void)
+{
+	DOKAN_FCB_TABLE	table;
+	PDokanFCB		fcbs[FCB_TEST_COUNT];
+	WCHAR			name[32];
+	ULONG			i, missing = 0;
+
+	DokanFcbTableInitialize(&table);
+
+	g_HostPoolFail = TRUE;
+	for (i = 0; i < FCB_TEST_COUNT; ++i) {
+		MakeName(name, i);
+		fcbs[i] = HostAllocateFcb(name);
+		DokanFcbTableInsert(&table, fcbs[i]);
+	}
+	g_HostPoolFail = FALSE;
+
+	CHECK(table.Buckets == table.InitialBuckets);
+	CHECK(table.Count == FCB_TEST_COUNT);
+	for (i = 0; i < FCB_TEST_COUNT; ++i) {
+		MakeName(name, i);
+		if (HostLookupFcb(&table, name) != fcbs[i]) {
+			missing++;
+		}
+	}
+	CHECK(missing == 0);
+
+	// the next insert grows the table
+	fcbs[0]->FileName.Buffer[1] = L'D';
+	DokanFcbTableRemove(&table, fcbs[0]);
+	DokanFcbTableInsert(&table, fcbs[0]);
+	CHECK(table.Buckets != table.InitialBuckets);
+	CHECK(HostLookupFcb(&table, L"\\Dir\\f00000") == fcbs[0]);
+
+	for (i = 0; i < FCB_TEST_COUNT; ++i) {
+		DokanFcbTableRemove(&table, fcbs[i]);
+		HostFreeFcb(fcbs[i]);
+	}
+	CHECK(g_HostPoolAllocations == 0);
+}
+
+
+// FCBs still open at unmount
+static VOID
+TestDelete(void)
+{
+	DOKAN_FCB_TABLE	table;
+	PDokanFCB		fcbs[FCB_TEST_COUNT];
+	WCHAR			name[32];
+	ULONG			i;
+
+	DokanFcbTableInitialize(&table);
+	DokanFcbTableDelete(&table);
+	CHECK(table.Buckets == table.InitialBuckets);
+	CHECK(g_HostPoolAllocations == 0);
+
+	for (i = 0; i < FCB_TEST_COUNT; ++i) {
+		MakeName(name, i);
+		fcbs[i] = HostAllocateFcb(name);
+		DokanFcbTableInsert(&table, fcbs[i]);
+	}
+	CHECK(g_HostPoolAllocations == 1);
+
+	DokanFcbTableDelete(&table);
+	CHECK(g_HostPoolAllocations == 0);
+	CHECK(table.Buckets == table.InitialBuckets);
+	CHECK(table.Count == 0);
+	CHECK(HostLookupFcb(&table, L"\\dir\\f00000") == NULL);
+
+	for (i = 0; i < FCB_TEST_COUNT; ++i) {
+		HostFreeFcb(fcbs[i]);
+	}
+}
+
+
+int main(void)
+{
+	TestLookup();
+	TestGrowth();
+	TestGrowthFailure();
+	TestDelete();
+
+	return TestResult("fcbtable_test");
+}
@@ -0,0 +1,187 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2008 Hiroki Asakawa info@dokan-dev.net
+
+  http://dokan-dev.net/en
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "test.h"
+#include "hostevent.h"
+
+
+// Event handoff ping-pong
+//
+// Microseconds per request of one application thread which queues an
+// event and waits for the reply, and worker threads which wait in an
+// IRP and reply. "thread hop" queues every event for the notification
+// thread (QueueEvent), as events were delivered before DokanQueueEvent
+// handed them off; "handoff" is DokanQueueEvent, which completes a
+// waiting IRP itself. The threads claim different processors, so the
+// handoff crosses shards.
+
+#define HANDOFF_BENCH_ROUNDS	100000
+#define HANDOFF_BENCH_WORKERS	2
+
+#define EVENT_LEN	((ULONG)sizeof(EVENT_CONTEXT))
+
+
+typedef struct _HANDOFF_BENCH {
+	DOKAN_EVENT_QUEUE	Queue;
+	HOST_EVENT_IRP		Irp[HANDOFF_BENCH_WORKERS];
+	KEVENT				Reply;
+	volatile LONG		Stop;
+	volatile LONG		Done;
+} HANDOFF_BENCH, *PHANDOFF_BENCH;
+
+static HANDOFF_BENCH	g_Bench;
+
+
+static void*
+Worker(
+	void*	Arg)
+{
+	ULONG			index = (ULONG)(ULONG_PTR)Arg;
+	PHOST_EVENT_IRP	irp = &g_Bench.Irp[index];
+
+	g_HostProcessorNumber = index + 1;
+	HostRegisterEventIrp(&g_Bench.Queue, irp);
+
+	while (1) {
+		KeWaitForSingleObject(&irp->Completed, Executive, KernelMode, FALSE, NULL);
+		if (g_Bench.Stop) {
+			break;
+		}
+		// as the service does, the next IRP waits before the reply is seen
+		HostRegisterEventIrp(&g_Bench.Queue, irp);
+		KeSetEvent(&g_Bench.Reply, IO_NO_INCREMENT, FALSE);
+	}
+	return NULL;
+}
+
+// NotificationThread without the ring
+static void*
+Notification(
+	void*	Arg)
+{
+	ULONG	i;
+
+	while (1) {
+		KeWaitForSingleObject(&g_Bench.Queue.EventQueued, Executive, KernelMode, FALSE, NULL);
+		if (g_Bench.Done) {
+			break;
+		}
+		KeClearEvent(&g_Bench.Queue.EventQueued);
+		for (i = 0; i < DOKAN_EVENT_SHARDS; ++i) {
+			DokanDispatchEvents(&g_Bench.Queue, &g_Bench.Queue.Shards[i]);
+		}
+	}
+	return NULL;
+}
+
+
+static VOID
+Queue(
+	BOOLEAN	Handoff,
+	ULONG	Serial)
+{
+	PEVENT_CONTEXT eventContext = HostAllocateEvent(Serial, EVENT_LEN);
+
+	if (Handoff) {
+		DokanQueueEvent(&g_Bench.Queue, eventContext);
+	} else {
+		QueueEvent(&g_Bench.Queue,
+			CONTAINING_RECORD(eventContext, DRIVER_EVENT_CONTEXT, EventContext));
+	}
+}
+
+
+// microseconds per round trip
+static double
+Run(
+	ULONG	IoControlCode,
+	ULONG	Workers,
+	BOOLEAN	Handoff)
+{
+	pthread_t	worker[HANDOFF_BENCH_WORKERS];
+	pthread_t	notification;
+	double		start, elapsed;
+	ULONG		rounds = (ULONG)(HANDOFF_BENCH_ROUNDS * BenchScale()) + 1;
+	ULONG		i;
+
+	ZeroMemory(&g_Bench, sizeof(g_Bench));
+	DokanInitEventQueue(&g_Bench.Queue);
+	KeInitializeEvent(&g_Bench.Reply, NotificationEvent, FALSE);
+
+	pthread_create(&notification, NULL, Notification, NULL);
+	for (i = 0; i < Workers; ++i) {
+		HostInitEventIrp(&g_Bench.Irp[i], IoControlCode, EVENT_LEN);
+		pthread_create(&worker[i], NULL, Worker, (void*)(ULONG_PTR)i);
+	}
+
+	g_HostProcessorNumber = 0;
+	start = TestNow();
+	for (i = 0; i < rounds; ++i) {
+		KeClearEvent(&g_Bench.Reply);
+		Queue(Handoff, i + 1);
+		KeWaitForSingleObject(&g_Bench.Reply, Executive, KernelMode, FALSE, NULL);
+	}
+	elapsed = TestNow() - start;
+
+	// every worker waits again; one last event each lets them go
+	g_Bench.Stop = TRUE;
+	for (i = 0; i < Workers; ++i) {
+		Queue(FALSE, rounds + i + 1);
+	}
+	for (i = 0; i < Workers; ++i) {
+		pthread_join(worker[i], NULL);
+		HostDeleteEventIrp(&g_Bench.Irp[i]);
+	}
+	g_Bench.Done = TRUE;
+	KeSetEvent(&g_Bench.Queue.EventQueued, IO_NO_INCREMENT, FALSE);
+	pthread_join(notification, NULL);
+
+	return elapsed * 1e6 / rounds;
+}
+
+
+int main(void)
+{
+	static const struct {
+		const char*	Name;
+		ULONG		IoControlCode;
+		ULONG		Workers;
+	} modes[] = {
+		{ "EVENT_WAIT x1", IOCTL_EVENT_WAIT, 1 },
+		{ "INFO_WAIT x1", IOCTL_EVENT_INFO_WAIT, 1 },
+		{ "INFO_WAIT x2", IOCTL_EVENT_INFO_WAIT, 2 },
+	};
+	ULONG	i;
+
+	printf("%-16s %12s %12s\n", "", "thread hop", "handoff");
+	for (i = 0; i < sizeof(modes) / sizeof(modes[0]); ++i) {
+		double hop = Run(modes[i].IoControlCode, modes[i].Workers, FALSE);
+		double handoff = Run(modes[i].IoControlCode, modes[i].Workers, TRUE);
+
+		printf("%-16s %9.2f us %9.2f us\n", modes[i].Name, hop, handoff);
+	}
+
+	if (g_HostPoolAllocations != 0) {
+		printf("handoff_bench: %d pool blocks left\n", g_HostPoolAllocations);
+		return 1;
+	}
+	return 0;
+}
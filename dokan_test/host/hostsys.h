@@ -0,0 +1,357 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2008 Hiroki Asakawa info@dokan-dev.net
+
+  http://dokan-dev.net/en
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef _HOST_SYS_H_
+#define _HOST_SYS_H_
+
+// Kernel routines used by the driver sources (sys/) which are tested
+// on the host. A test includes test.h and this file, declares the
+// FCB, VCB and DCB fields the source uses and includes the source
+// file. dokan.h of the library, read through test.h, has the include
+// guard of sys/dokan.h, so the driver sources do not read the latter.
+
+#include <windows.h>
+#include <assert.h>
+#include "list.h"
+#include "fileinfo.h"
+#include "namecmp.h"
+
+#define ASSERT(expr)	assert(expr)
+
+// the kernel formats (%wZ ...) are not those of printf
+#define DDbgPrint(...)
+
+#define TAG		(ULONG)'AKOD'
+
+#define HOST_UNUSED	__attribute__((unused))
+
+// pool blocks not freed yet, and allocations fail while
+// g_HostPoolFail is set
+static volatile LONG	g_HostPoolAllocations HOST_UNUSED;
+static BOOLEAN	g_HostPoolFail HOST_UNUSED;
+
+static PVOID
+HostAllocatePool(
+	SIZE_T	Size)
+{
+	PVOID	p = g_HostPoolFail ? NULL : malloc(Size);
+	if (p != NULL) {
+		InterlockedIncrement(&g_HostPoolAllocations);
+	}
+	return p;
+}
+
+static VOID
+HostFreePool(
+	PVOID	P)
+{
+	InterlockedDecrement(&g_HostPoolAllocations);
+	free(P);
+}
+
+#define NonPagedPool	0
+#define PagedPool		1
+#define ExAllocatePoolWithTag(type, size, tag)	HostAllocatePool(size)
+#define ExAllocatePool(size)	HostAllocatePool(size)
+#define ExFreePool(p)			HostFreePool(p)
+#define ExFreePoolWithTag(p, tag)	HostFreePool(p)
+
+
+// KeQueryInterruptTime is g_HostInterruptTime, moved by the test
+static ULONGLONG	g_HostInterruptTime HOST_UNUSED = 1;
+
+#define KeQueryInterruptTime()	(g_HostInterruptTime)
+
+// KeQueryTickCount is g_HostTickCount, moved by the test,
+// a tick is 15.625 milliseconds as on most machines
+static LONGLONG	g_HostTickCount HOST_UNUSED = 1;
+
+#define KeQueryTickCount(tickCount)	((tickCount)->QuadPart = g_HostTickCount)
+#define KeQueryTimeIncrement()		156250 // in 100 nanoseconds
+
+
+typedef NTSTATUS	*PNTSTATUS;
+
+#define NT_SUCCESS(status)	((NTSTATUS)(status) >= 0)
+
+typedef struct _UNICODE_STRING {
+	USHORT	Length;
+	USHORT	MaximumLength;
+	PWSTR	Buffer;
+} UNICODE_STRING, *PUNICODE_STRING;
+
+
+typedef struct _FAST_MUTEX {
+	pthread_mutex_t	Mutex;
+} FAST_MUTEX, *PFAST_MUTEX;
+
+#define ExInitializeFastMutex(m)	pthread_mutex_init(&(m)->Mutex, NULL)
+#define ExAcquireFastMutex(m)		pthread_mutex_lock(&(m)->Mutex)
+#define ExReleaseFastMutex(m)		pthread_mutex_unlock(&(m)->Mutex)
+
+
+typedef struct _ERESOURCE {
+	pthread_rwlock_t	Lock;
+	// ExDeleteResourceLite was called
+	BOOLEAN				Deleted;
+} ERESOURCE, *PERESOURCE;
+
+static NTSTATUS
+ExInitializeResourceLite(
+	PERESOURCE	Resource)
+{
+	Resource->Deleted = FALSE;
+	return pthread_rwlock_init(&Resource->Lock, NULL) == 0 ? STATUS_SUCCESS : STATUS_INSUFFICIENT_RESOURCES;
+}
+
+static NTSTATUS
+ExDeleteResourceLite(
+	PERESOURCE	Resource)
+{
+	Resource->Deleted = TRUE;
+	pthread_rwlock_destroy(&Resource->Lock);
+	return STATUS_SUCCESS;
+}
+
+static BOOLEAN
+ExAcquireResourceSharedLite(
+	PERESOURCE	Resource,
+	BOOLEAN		Wait)
+{
+	return pthread_rwlock_rdlock(&Resource->Lock) == 0;
+}
+
+static BOOLEAN
+ExAcquireResourceExclusiveLite(
+	PERESOURCE	Resource,
+	BOOLEAN		Wait)
+{
+	return pthread_rwlock_wrlock(&Resource->Lock) == 0;
+}
+
+#define ExReleaseResourceLite(r)	pthread_rwlock_unlock(&(r)->Lock)
+
+#define KeEnterCriticalRegion()
+#define KeLeaveCriticalRegion()
+
+
+// the host threads run at PASSIVE_LEVEL, a spin lock does not raise it
+typedef UCHAR	KIRQL, *PKIRQL;
+
+#define PASSIVE_LEVEL	0
+#define DISPATCH_LEVEL	2
+
+#define KeGetCurrentIrql()	PASSIVE_LEVEL
+
+typedef pthread_spinlock_t	KSPIN_LOCK, *PKSPIN_LOCK;
+
+#define KeInitializeSpinLock(l)		pthread_spin_init(l, PTHREAD_PROCESS_PRIVATE)
+#define KeAcquireSpinLock(l, irql)	(*(irql) = PASSIVE_LEVEL, pthread_spin_lock(l))
+#define KeReleaseSpinLock(l, irql)	pthread_spin_unlock(l)
+#define KeAcquireSpinLockAtDpcLevel(l)		pthread_spin_lock(l)
+#define KeReleaseSpinLockFromDpcLevel(l)	pthread_spin_unlock(l)
+
+// the processor a host thread claims to run on, set by the test
+static __thread ULONG	g_HostProcessorNumber HOST_UNUSED;
+
+#define KeGetCurrentProcessorNumber()	(g_HostProcessorNumber)
+
+
+// notification events only
+typedef struct _KEVENT {
+	pthread_mutex_t	Mutex;
+	pthread_cond_t	Cond;
+	LONG			SignalState;
+} KEVENT, *PKEVENT;
+
+#define NotificationEvent	0
+#define IO_NO_INCREMENT		0
+
+static VOID
+KeInitializeEvent(
+	PKEVENT	Event,
+	int		Type,
+	BOOLEAN	State)
+{
+	pthread_mutex_init(&Event->Mutex, NULL);
+	pthread_cond_init(&Event->Cond, NULL);
+	Event->SignalState = State;
+}
+
+static LONG
+KeSetEvent(
+	PKEVENT	Event,
+	LONG	Increment,
+	BOOLEAN	Wait)
+{
+	LONG	previous;
+
+	pthread_mutex_lock(&Event->Mutex);
+	previous = InterlockedExchange(&Event->SignalState, 1);
+	pthread_cond_broadcast(&Event->Cond);
+	pthread_mutex_unlock(&Event->Mutex);
+	return previous;
+}
+
+#define KeClearEvent(e)		InterlockedExchange(&(e)->SignalState, 0)
+#define KeResetEvent(e)		InterlockedExchange(&(e)->SignalState, 0)
+#define KeReadStateEvent(e)	__atomic_load_n(&(e)->SignalState, __ATOMIC_SEQ_CST)
+
+// waits without a timeout, the other arguments are those of the kernel
+#define KeWaitForSingleObject(e, reason, mode, alertable, timeout) \
+	HostWaitForEvent(e)
+
+static NTSTATUS
+HostWaitForEvent(
+	PKEVENT	Event)
+{
+	pthread_mutex_lock(&Event->Mutex);
+	while (Event->SignalState == 0) {
+		pthread_cond_wait(&Event->Cond, &Event->Mutex);
+	}
+	pthread_mutex_unlock(&Event->Mutex);
+	return STATUS_SUCCESS;
+}
+
+
+#define SL_RESTART_SCAN			0x01
+#define SL_RETURN_SINGLE_ENTRY	0x02
+#define SL_INDEX_SPECIFIED		0x04
+
+typedef struct _IO_STACK_LOCATION {
+	UCHAR	MajorFunction;
+	UCHAR	MinorFunction;
+	UCHAR	Flags;
+	union {
+		struct {
+			ULONG	Length;
+			PUNICODE_STRING	FileName;
+			FILE_INFORMATION_CLASS	FileInformationClass;
+			ULONG	FileIndex;
+		} QueryDirectory;
+		struct {
+			ULONG	OutputBufferLength;
+			ULONG	InputBufferLength;
+			ULONG	IoControlCode;
+			PVOID	Type3InputBuffer;
+		} DeviceIoControl;
+	} Parameters;
+} IO_STACK_LOCATION, *PIO_STACK_LOCATION;
+
+#define STATUS_PENDING			((NTSTATUS)0x00000103L)
+#define STATUS_DEVICE_BUSY		((NTSTATUS)0x80000011L)
+#define STATUS_BUFFER_TOO_SMALL	((NTSTATUS)0xC0000023L)
+#define STATUS_CANCELLED		((NTSTATUS)0xC0000120L)
+
+typedef struct _IO_STATUS_BLOCK {
+	NTSTATUS	Status;
+	ULONG_PTR	Information;
+} IO_STATUS_BLOCK, *PIO_STATUS_BLOCK;
+
+struct _DEVICE_OBJECT;
+struct _IRP;
+
+typedef VOID DRIVER_CANCEL(struct _DEVICE_OBJECT* DeviceObject, struct _IRP* Irp);
+typedef DRIVER_CANCEL *PDRIVER_CANCEL;
+
+// the buffer of METHOD_OUT_DIRECT, mapped where the test has it
+typedef struct _MDL {
+	PVOID	MappedSystemVa;
+} MDL, *PMDL;
+
+#define NormalPagePriority	16
+#define MmGetSystemAddressForMdlSafe(mdl, priority)	((mdl)->MappedSystemVa)
+
+typedef struct _IRP {
+	union {
+		PVOID	SystemBuffer;
+	} AssociatedIrp;
+	PMDL				MdlAddress;
+	IO_STATUS_BLOCK		IoStatus;
+	BOOLEAN				Cancel;
+	KIRQL				CancelIrql;
+	PDRIVER_CANCEL		CancelRoutine;
+	// the one stack location of the host
+	PIO_STACK_LOCATION	CurrentStackLocation;
+	struct {
+		struct {
+			PVOID	DriverContext[4];
+		} Overlay;
+	} Tail;
+	// set by IoCompleteRequest, NULL when the test does not wait
+	PKEVENT				HostCompleted;
+} IRP, *PIRP;
+
+#define IoGetCurrentIrpStackLocation(irp)	((irp)->CurrentStackLocation)
+#define IoMarkIrpPending(irp)
+#define IoReleaseCancelSpinLock(irql)
+
+#define IoSetCancelRoutine(irp, routine) \
+	((PDRIVER_CANCEL)InterlockedExchangePointer((PVOID*)&(irp)->CancelRoutine, (PVOID)(routine)))
+
+static VOID
+IoCompleteRequest(
+	PIRP	Irp,
+	CHAR	PriorityBoost)
+{
+	if (Irp->HostCompleted != NULL) {
+		KeSetEvent(Irp->HostCompleted, IO_NO_INCREMENT, FALSE);
+	}
+}
+
+typedef struct _DEVICE_OBJECT {
+	PVOID	DeviceExtension;
+} DEVICE_OBJECT, *PDEVICE_OBJECT;
+
+typedef NTSTATUS DRIVER_DISPATCH(PDEVICE_OBJECT DeviceObject, PIRP Irp);
+
+
+// the handles a test passes to the driver are the objects themselves,
+// g_HostObjectReferences counts the references not dropped yet
+static volatile LONG	g_HostObjectReferences HOST_UNUSED;
+static PVOID	g_HostEventObjectType HOST_UNUSED;
+
+#define UserMode			1
+#define EVENT_MODIFY_STATE	0x0002
+#define SYNCHRONIZE			0x00100000L
+#define ExEventObjectType	(&g_HostEventObjectType)
+
+static NTSTATUS
+ObReferenceObjectByHandle(
+	HANDLE	Handle,
+	ULONG	DesiredAccess,
+	PVOID	ObjectType,
+	CHAR	AccessMode,
+	PVOID*	Object,
+	PVOID	HandleInformation)
+{
+	if (Handle == NULL) {
+		return STATUS_INVALID_HANDLE;
+	}
+	InterlockedIncrement(&g_HostObjectReferences);
+	*Object = Handle;
+	return STATUS_SUCCESS;
+}
+
+#define ObReferenceObject(o)	InterlockedIncrement(&g_HostObjectReferences)
+#define ObDereferenceObject(o)	InterlockedDecrement(&g_HostObjectReferences)
+
+#endif // _HOST_SYS_H_
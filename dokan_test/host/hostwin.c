@@ -0,0 +1,1033 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2008 Hiroki Asakawa info@dokan-dev.net
+
+  http://dokan-dev.net/en
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+#include <windows.h>
+#include <process.h>
+
+
+// Win32 objects of windows.h on pthreads
+
+#define HOST_EVENT		1
+#define HOST_SEMAPHORE	2
+#define HOST_THREAD		3
+
+typedef struct _HOST_OBJECT {
+	int				Type;
+	pthread_mutex_t	Mutex;
+	pthread_cond_t	Cond;
+	// freed when it drops to zero, a thread holds one itself
+	LONG			RefCount;
+	// event: signaled, semaphore: count, thread: exited
+	LONG			State;
+	LONG			Maximum;
+	BOOL			ManualReset;
+	unsigned		(__stdcall *StartAddress)(void*);
+	void*			ArgList;
+} HOST_OBJECT, *PHOST_OBJECT;
+
+
+static __thread DWORD		t_LastError;
+static __thread PHOST_OBJECT	t_Thread;
+
+
+static PHOST_OBJECT
+NewObject(
+	int		Type,
+	LONG	RefCount)
+{
+	PHOST_OBJECT object = (PHOST_OBJECT)calloc(1, sizeof(HOST_OBJECT));
+	if (object == NULL) {
+		SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+		return NULL;
+	}
+	object->Type = Type;
+	object->RefCount = RefCount;
+	pthread_mutex_init(&object->Mutex, NULL);
+	pthread_cond_init(&object->Cond, NULL);
+	return object;
+}
+
+
+static VOID
+ReleaseObject(
+	PHOST_OBJECT	Object)
+{
+	if (InterlockedDecrement(&Object->RefCount) == 0) {
+		pthread_cond_destroy(&Object->Cond);
+		pthread_mutex_destroy(&Object->Mutex);
+		free(Object);
+	}
+}
+
+
+VOID
+InitializeCriticalSection(
+	LPCRITICAL_SECTION	CriticalSection)
+{
+	pthread_mutexattr_t	attr;
+	pthread_mutex_t*	mutex = (pthread_mutex_t*)malloc(sizeof(pthread_mutex_t));
+
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(mutex, &attr);
+	pthread_mutexattr_destroy(&attr);
+	CriticalSection->Mutex = mutex;
+}
+
+
+BOOL
+InitializeCriticalSectionAndSpinCount(
+	LPCRITICAL_SECTION	CriticalSection,
+	DWORD				SpinCount)
+{
+	UNREFERENCED_PARAMETER(SpinCount);
+	InitializeCriticalSection(CriticalSection);
+	return TRUE;
+}
+
+
+VOID
+EnterCriticalSection(
+	LPCRITICAL_SECTION	CriticalSection)
+{
+	pthread_mutex_lock((pthread_mutex_t*)CriticalSection->Mutex);
+}
+
+
+BOOL
+TryEnterCriticalSection(
+	LPCRITICAL_SECTION	CriticalSection)
+{
+	return pthread_mutex_trylock((pthread_mutex_t*)CriticalSection->Mutex) == 0;
+}
+
+
+VOID
+LeaveCriticalSection(
+	LPCRITICAL_SECTION	CriticalSection)
+{
+	pthread_mutex_unlock((pthread_mutex_t*)CriticalSection->Mutex);
+}
+
+
+VOID
+DeleteCriticalSection(
+	LPCRITICAL_SECTION	CriticalSection)
+{
+	pthread_mutex_destroy((pthread_mutex_t*)CriticalSection->Mutex);
+	free(CriticalSection->Mutex);
+	CriticalSection->Mutex = NULL;
+}
+
+
+HANDLE
+CreateEventW(
+	LPSECURITY_ATTRIBUTES	Attributes,
+	BOOL					ManualReset,
+	BOOL					InitialState,
+	LPCWSTR					Name)
+{
+	PHOST_OBJECT event = NewObject(HOST_EVENT, 1);
+
+	UNREFERENCED_PARAMETER(Attributes);
+	UNREFERENCED_PARAMETER(Name);
+
+	if (event) {
+		event->ManualReset = ManualReset;
+		event->State = InitialState ? 1 : 0;
+	}
+	return event;
+}
+
+
+HANDLE
+CreateSemaphoreW(
+	LPSECURITY_ATTRIBUTES	Attributes,
+	LONG					InitialCount,
+	LONG					MaximumCount,
+	LPCWSTR					Name)
+{
+	PHOST_OBJECT semaphore = NewObject(HOST_SEMAPHORE, 1);
+
+	UNREFERENCED_PARAMETER(Attributes);
+	UNREFERENCED_PARAMETER(Name);
+
+	if (semaphore) {
+		semaphore->State = InitialCount;
+		semaphore->Maximum = MaximumCount;
+	}
+	return semaphore;
+}
+
+
+BOOL
+SetEvent(
+	HANDLE	Event)
+{
+	PHOST_OBJECT event = (PHOST_OBJECT)Event;
+
+	pthread_mutex_lock(&event->Mutex);
+	event->State = 1;
+	if (event->ManualReset) {
+		pthread_cond_broadcast(&event->Cond);
+	} else {
+		pthread_cond_signal(&event->Cond);
+	}
+	pthread_mutex_unlock(&event->Mutex);
+	return TRUE;
+}
+
+
+BOOL
+ResetEvent(
+	HANDLE	Event)
+{
+	PHOST_OBJECT event = (PHOST_OBJECT)Event;
+
+	pthread_mutex_lock(&event->Mutex);
+	event->State = 0;
+	pthread_mutex_unlock(&event->Mutex);
+	return TRUE;
+}
+
+
+BOOL
+ReleaseSemaphore(
+	HANDLE	Semaphore,
+	LONG	ReleaseCount,
+	PLONG	PreviousCount)
+{
+	PHOST_OBJECT semaphore = (PHOST_OBJECT)Semaphore;
+	BOOL status = TRUE;
+
+	pthread_mutex_lock(&semaphore->Mutex);
+	if (PreviousCount) {
+		*PreviousCount = semaphore->State;
+	}
+	if (ReleaseCount <= 0 || semaphore->Maximum - semaphore->State < ReleaseCount) {
+		SetLastError(ERROR_INVALID_PARAMETER);
+		status = FALSE;
+	} else {
+		semaphore->State += ReleaseCount;
+		if (ReleaseCount == 1) {
+			pthread_cond_signal(&semaphore->Cond);
+		} else {
+			pthread_cond_broadcast(&semaphore->Cond);
+		}
+	}
+	pthread_mutex_unlock(&semaphore->Mutex);
+	return status;
+}
+
+
+DWORD
+WaitForSingleObject(
+	HANDLE	Handle,
+	DWORD	Milliseconds)
+{
+	PHOST_OBJECT	object = (PHOST_OBJECT)Handle;
+	struct timespec	deadline;
+	DWORD			status = WAIT_OBJECT_0;
+
+	if (Milliseconds != INFINITE) {
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_sec += Milliseconds / 1000;
+		deadline.tv_nsec += (long)(Milliseconds % 1000) * 1000000;
+		if (deadline.tv_nsec >= 1000000000) {
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000;
+		}
+	}
+
+	pthread_mutex_lock(&object->Mutex);
+	while (object->State == 0) {
+		if (Milliseconds == INFINITE) {
+			pthread_cond_wait(&object->Cond, &object->Mutex);
+		} else if (Milliseconds == 0 ||
+			pthread_cond_timedwait(&object->Cond, &object->Mutex, &deadline) == ETIMEDOUT) {
+			if (object->State == 0) {
+				status = WAIT_TIMEOUT;
+				break;
+			}
+		}
+	}
+	if (status == WAIT_OBJECT_0) {
+		if (object->Type == HOST_SEMAPHORE) {
+			object->State--;
+		} else if (object->Type == HOST_EVENT && !object->ManualReset) {
+			object->State = 0;
+		}
+	}
+	pthread_mutex_unlock(&object->Mutex);
+	return status;
+}
+
+
+DWORD
+WaitForMultipleObjects(
+	DWORD			Count,
+	const HANDLE*	Handles,
+	BOOL			WaitAll,
+	DWORD			Milliseconds)
+{
+	DWORD	start = GetTickCount();
+	DWORD	i;
+
+	if (WaitAll) {
+		SetLastError(ERROR_NOT_SUPPORTED);
+		return WAIT_FAILED;
+	}
+	for (;;) {
+		for (i = 0; i < Count; ++i) {
+			if (WaitForSingleObject(Handles[i], 0) == WAIT_OBJECT_0) {
+				return WAIT_OBJECT_0 + i;
+			}
+		}
+		if (Milliseconds != INFINITE && GetTickCount() - start >= Milliseconds) {
+			return WAIT_TIMEOUT;
+		}
+		Sleep(1);
+	}
+}
+
+
+BOOL
+CloseHandle(
+	HANDLE	Handle)
+{
+	if (Handle == NULL || Handle == INVALID_HANDLE_VALUE) {
+		SetLastError(ERROR_INVALID_HANDLE);
+		return FALSE;
+	}
+	ReleaseObject((PHOST_OBJECT)Handle);
+	return TRUE;
+}
+
+
+static VOID
+ExitHostThread(
+	void)
+{
+	PHOST_OBJECT thread = t_Thread;
+
+	pthread_mutex_lock(&thread->Mutex);
+	thread->State = 1;
+	pthread_cond_broadcast(&thread->Cond);
+	pthread_mutex_unlock(&thread->Mutex);
+	ReleaseObject(thread);
+}
+
+
+static void*
+HostThreadMain(
+	void*	Parameter)
+{
+	PHOST_OBJECT thread = (PHOST_OBJECT)Parameter;
+
+	t_Thread = thread;
+	thread->StartAddress(thread->ArgList);
+	ExitHostThread();
+	return NULL;
+}
+
+
+uintptr_t
+_beginthreadex(
+	void*		Security,
+	unsigned	StackSize,
+	unsigned	(__stdcall *StartAddress)(void*),
+	void*		ArgList,
+	unsigned	InitFlag,
+	unsigned*	ThreadId)
+{
+	PHOST_OBJECT	thread = NewObject(HOST_THREAD, 2);
+	pthread_t		id;
+	pthread_attr_t	attr;
+
+	UNREFERENCED_PARAMETER(Security);
+	UNREFERENCED_PARAMETER(StackSize);
+	UNREFERENCED_PARAMETER(InitFlag);
+
+	if (thread == NULL) {
+		return 0;
+	}
+	thread->StartAddress = StartAddress;
+	thread->ArgList = ArgList;
+
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	if (pthread_create(&id, &attr, HostThreadMain, thread) != 0) {
+		pthread_attr_destroy(&attr);
+		ReleaseObject(thread);
+		ReleaseObject(thread);
+		SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+		return 0;
+	}
+	pthread_attr_destroy(&attr);
+
+	if (ThreadId) {
+		*ThreadId = (unsigned)(uintptr_t)thread;
+	}
+	return (uintptr_t)thread;
+}
+
+
+void
+_endthreadex(
+	unsigned	ExitCode)
+{
+	UNREFERENCED_PARAMETER(ExitCode);
+	ExitHostThread();
+	pthread_exit(NULL);
+}
+
+
+HANDLE
+CreateFileW(
+	LPCWSTR					FileName,
+	DWORD					DesiredAccess,
+	DWORD					ShareMode,
+	LPSECURITY_ATTRIBUTES	Attributes,
+	DWORD					CreationDisposition,
+	DWORD					FlagsAndAttributes,
+	HANDLE					TemplateFile)
+{
+	UNREFERENCED_PARAMETER(FileName);
+	UNREFERENCED_PARAMETER(DesiredAccess);
+	UNREFERENCED_PARAMETER(ShareMode);
+	UNREFERENCED_PARAMETER(Attributes);
+	UNREFERENCED_PARAMETER(CreationDisposition);
+	UNREFERENCED_PARAMETER(FlagsAndAttributes);
+	UNREFERENCED_PARAMETER(TemplateFile);
+
+	SetLastError(ERROR_FILE_NOT_FOUND);
+	return INVALID_HANDLE_VALUE;
+}
+
+
+BOOL
+DeviceIoControl(
+	HANDLE			Device,
+	DWORD			IoControlCode,
+	LPVOID			InBuffer,
+	DWORD			InBufferSize,
+	LPVOID			OutBuffer,
+	DWORD			OutBufferSize,
+	LPDWORD			BytesReturned,
+	LPOVERLAPPED	Overlapped)
+{
+	UNREFERENCED_PARAMETER(Device);
+	UNREFERENCED_PARAMETER(IoControlCode);
+	UNREFERENCED_PARAMETER(InBuffer);
+	UNREFERENCED_PARAMETER(InBufferSize);
+	UNREFERENCED_PARAMETER(OutBuffer);
+	UNREFERENCED_PARAMETER(OutBufferSize);
+	UNREFERENCED_PARAMETER(Overlapped);
+
+	if (BytesReturned) {
+		*BytesReturned = 0;
+	}
+	SetLastError(ERROR_INVALID_HANDLE);
+	return FALSE;
+}
+
+
+BOOL
+CancelIo(
+	HANDLE	File)
+{
+	UNREFERENCED_PARAMETER(File);
+	return TRUE;
+}
+
+
+BOOL
+GetOverlappedResult(
+	HANDLE			File,
+	LPOVERLAPPED	Overlapped,
+	LPDWORD			NumberOfBytesTransferred,
+	BOOL			Wait)
+{
+	UNREFERENCED_PARAMETER(File);
+
+	if (Wait && Overlapped->hEvent) {
+		WaitForSingleObject(Overlapped->hEvent, INFINITE);
+	}
+	if (!HasOverlappedIoCompleted(Overlapped)) {
+		SetLastError(ERROR_IO_INCOMPLETE);
+		return FALSE;
+	}
+	*NumberOfBytesTransferred = (DWORD)Overlapped->InternalHigh;
+	if (Overlapped->Internal != 0) {
+		SetLastError(ERROR_OPERATION_ABORTED);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+
+LPVOID
+VirtualAlloc(
+	LPVOID	Address,
+	SIZE_T	Size,
+	DWORD	AllocationType,
+	DWORD	Protect)
+{
+	LPVOID	p;
+
+	UNREFERENCED_PARAMETER(AllocationType);
+	UNREFERENCED_PARAMETER(Protect);
+
+	if (Address != NULL) {
+		SetLastError(ERROR_INVALID_PARAMETER);
+		return NULL;
+	}
+	p = calloc(1, Size);
+	if (p == NULL) {
+		SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+	}
+	return p;
+}
+
+
+BOOL
+VirtualFree(
+	LPVOID	Address,
+	SIZE_T	Size,
+	DWORD	FreeType)
+{
+	UNREFERENCED_PARAMETER(Size);
+	UNREFERENCED_PARAMETER(FreeType);
+	free(Address);
+	return TRUE;
+}
+
+
+DWORD
+TlsAlloc(
+	void)
+{
+	pthread_key_t key;
+	if (pthread_key_create(&key, NULL) != 0) {
+		return TLS_OUT_OF_INDEXES;
+	}
+	return (DWORD)key;
+}
+
+
+BOOL
+TlsFree(
+	DWORD	Index)
+{
+	return pthread_key_delete((pthread_key_t)Index) == 0;
+}
+
+
+LPVOID
+TlsGetValue(
+	DWORD	Index)
+{
+	return pthread_getspecific((pthread_key_t)Index);
+}
+
+
+BOOL
+TlsSetValue(
+	DWORD	Index,
+	LPVOID	Value)
+{
+	return pthread_setspecific((pthread_key_t)Index, Value) == 0;
+}
+
+
+DWORD
+GetTickCount(
+	void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (DWORD)((ULONGLONG)now.tv_sec * 1000 + now.tv_nsec / 1000000);
+}
+
+
+VOID
+Sleep(
+	DWORD	Milliseconds)
+{
+	struct timespec duration;
+
+	if (Milliseconds == 0) {
+		sched_yield();
+		return;
+	}
+	duration.tv_sec = Milliseconds / 1000;
+	duration.tv_nsec = (long)(Milliseconds % 1000) * 1000000;
+	while (nanosleep(&duration, &duration) != 0 && errno == EINTR) {
+	}
+}
+
+
+DWORD
+GetLastError(
+	void)
+{
+	return t_LastError;
+}
+
+
+VOID
+SetLastError(
+	DWORD	Error)
+{
+	t_LastError = Error;
+}
+
+
+DWORD
+GetCurrentProcessId(
+	void)
+{
+	return (DWORD)getpid();
+}
+
+
+DWORD
+GetCurrentThreadId(
+	void)
+{
+	return (DWORD)(uintptr_t)t_Thread;
+}
+
+
+VOID
+OutputDebugStringA(
+	LPCSTR	OutputString)
+{
+	fputs(OutputString, stderr);
+}
+
+
+VOID
+OutputDebugStringW(
+	LPCWSTR	OutputString)
+{
+	char* string = HostNarrowString(OutputString);
+	if (string) {
+		fputs(string, stderr);
+		free(string);
+	}
+}
+
+
+// wide strings
+
+size_t
+HostWcslen(
+	const WCHAR*	String)
+{
+	const WCHAR* end = String;
+	while (*end) {
+		end++;
+	}
+	return (size_t)(end - String);
+}
+
+
+int
+HostWcsncmp(
+	const WCHAR*	String1,
+	const WCHAR*	String2,
+	size_t			Count)
+{
+	size_t i;
+	for (i = 0; i < Count; i++) {
+		if (String1[i] != String2[i]) {
+			return String1[i] < String2[i] ? -1 : 1;
+		}
+		if (String1[i] == 0) {
+			break;
+		}
+	}
+	return 0;
+}
+
+
+int
+HostWcscmp(
+	const WCHAR*	String1,
+	const WCHAR*	String2)
+{
+	return HostWcsncmp(String1, String2, (size_t)-1);
+}
+
+
+int
+HostWcsnicmp(
+	const WCHAR*	String1,
+	const WCHAR*	String2,
+	size_t			Count)
+{
+	size_t i;
+	for (i = 0; i < Count; i++) {
+		WCHAR c1 = (WCHAR)towlower(String1[i]);
+		WCHAR c2 = (WCHAR)towlower(String2[i]);
+		if (c1 != c2) {
+			return c1 < c2 ? -1 : 1;
+		}
+		if (c1 == 0) {
+			break;
+		}
+	}
+	return 0;
+}
+
+
+int
+HostWcsicmp(
+	const WCHAR*	String1,
+	const WCHAR*	String2)
+{
+	return HostWcsnicmp(String1, String2, (size_t)-1);
+}
+
+
+WCHAR*
+HostWcschr(
+	const WCHAR*	String,
+	WCHAR			Char)
+{
+	for (;; String++) {
+		if (*String == Char) {
+			return (WCHAR*)String;
+		}
+		if (*String == 0) {
+			return NULL;
+		}
+	}
+}
+
+
+WCHAR*
+HostWcsrchr(
+	const WCHAR*	String,
+	WCHAR			Char)
+{
+	const WCHAR* found = NULL;
+	for (;; String++) {
+		if (*String == Char) {
+			found = String;
+		}
+		if (*String == 0) {
+			return (WCHAR*)found;
+		}
+	}
+}
+
+
+int
+HostWcsncpy_s(
+	WCHAR*			Dest,
+	size_t			Size,
+	const WCHAR*	Source,
+	size_t			Count)
+{
+	size_t length = HostWcslen(Source);
+
+	if (Count != _TRUNCATE && Count < length) {
+		length = Count;
+	}
+	if (length >= Size) {
+		if (Count != _TRUNCATE || Size == 0) {
+			if (Size > 0) {
+				Dest[0] = 0;
+			}
+			return ERANGE;
+		}
+		length = Size - 1;
+	}
+	memcpy(Dest, Source, length * sizeof(WCHAR));
+	Dest[length] = 0;
+	return 0;
+}
+
+
+int
+HostWcscpy_s(
+	WCHAR*			Dest,
+	size_t			Size,
+	const WCHAR*	Source)
+{
+	return HostWcsncpy_s(Dest, Size, Source, HostWcslen(Source));
+}
+
+
+int
+HostWcscat_s(
+	WCHAR*			Dest,
+	size_t			Size,
+	const WCHAR*	Source)
+{
+	size_t length = HostWcslen(Dest);
+	if (length >= Size) {
+		return EINVAL;
+	}
+	return HostWcscpy_s(Dest + length, Size - length, Source);
+}
+
+
+char*
+HostNarrowString(
+	const WCHAR*	String)
+{
+	size_t	length = HostWcslen(String);
+	char*	narrow = (char*)malloc(length + 1);
+	size_t	i;
+
+	if (narrow == NULL) {
+		return NULL;
+	}
+	for (i = 0; i < length; i++) {
+		narrow[i] = String[i] < 0x80 ? (char)String[i] : '?';
+	}
+	narrow[length] = 0;
+	return narrow;
+}
+
+
+// Formats as the MSVC printf family, which is what the DbgPrint callers
+// expect: %ws and %S take wide strings, %s takes a wide string in the
+// wide functions, l is 32 bit and I64 is 64 bit.
+static int
+HostFormat(
+	char*		Buffer,
+	size_t		Size,
+	const char*	Format,
+	BOOL		Wide,
+	va_list		Args)
+{
+	size_t	length = 0;
+	char	spec[32];
+
+#define HOST_APPEND(...) \
+	do { \
+		int n = snprintf(Buffer + length, Size > length ? Size - length : 0, __VA_ARGS__); \
+		if (n > 0) length += (size_t)n; \
+	} while (0)
+
+	while (*Format) {
+		const char*	start = Format;
+		size_t		specLength;
+		int			size = 0; // 1: h, 2: l or w, 3: I64 or ll
+		char		conversion;
+
+		if (*Format != '%') {
+			HOST_APPEND("%c", *Format++);
+			continue;
+		}
+		Format++;
+		while (*Format && strchr("-+ #0123456789.*", *Format)) {
+			Format++;
+		}
+		specLength = (size_t)(Format - start);
+		for (;;) {
+			if (*Format == 'h') {
+				size = 1;
+				Format++;
+			} else if (*Format == 'l' || *Format == 'w') {
+				size = size == 2 ? 3 : 2;
+				Format++;
+			} else if (strncmp(Format, "I64", 3) == 0) {
+				size = 3;
+				Format += 3;
+			} else if (*Format == 'I') {
+				size = 4;
+				Format++;
+			} else {
+				break;
+			}
+		}
+		conversion = *Format;
+		if (conversion == 0 || specLength + 4 > sizeof(spec)) {
+			break;
+		}
+		Format++;
+		memcpy(spec, start, specLength);
+		spec[specLength] = 0;
+
+		switch (conversion) {
+		case 'd': case 'i': case 'u': case 'x': case 'X': case 'o':
+			if (size == 3) {
+				strcat(spec, "ll");
+				spec[specLength + 2] = conversion;
+				spec[specLength + 3] = 0;
+				HOST_APPEND(spec, va_arg(Args, long long));
+			} else if (size == 4) {
+				strcat(spec, "z");
+				spec[specLength + 1] = conversion;
+				spec[specLength + 2] = 0;
+				HOST_APPEND(spec, va_arg(Args, size_t));
+			} else {
+				spec[specLength] = conversion;
+				spec[specLength + 1] = 0;
+				HOST_APPEND(spec, va_arg(Args, int));
+			}
+			break;
+		case 'c': case 'C':
+			HOST_APPEND("%c", (char)va_arg(Args, int));
+			break;
+		case 's': case 'S':
+			{
+				BOOL wideArg = (conversion == 's') ? (size == 2 || (Wide && size != 1))
+												   : !(Wide || size == 1);
+				spec[specLength] = 's';
+				spec[specLength + 1] = 0;
+				if (wideArg) {
+					const WCHAR* string = va_arg(Args, const WCHAR*);
+					char* narrow = string ? HostNarrowString(string) : NULL;
+					HOST_APPEND(spec, narrow ? narrow : "(null)");
+					free(narrow);
+				} else {
+					const char* string = va_arg(Args, const char*);
+					HOST_APPEND(spec, string ? string : "(null)");
+				}
+			}
+			break;
+		case 'p':
+			HOST_APPEND("%p", va_arg(Args, void*));
+			break;
+		case 'f': case 'g': case 'e':
+			spec[specLength] = conversion;
+			spec[specLength + 1] = 0;
+			HOST_APPEND(spec, va_arg(Args, double));
+			break;
+		case '%':
+			HOST_APPEND("%%");
+			break;
+		default:
+			HOST_APPEND("%%%c", conversion);
+			break;
+		}
+	}
+#undef HOST_APPEND
+
+	if (Size > 0) {
+		Buffer[length < Size ? length : Size - 1] = 0;
+	}
+	return (int)length;
+}
+
+
+int
+HostVsprintf_s(
+	char*		Buffer,
+	size_t		Size,
+	const char*	Format,
+	va_list		Args)
+{
+	return HostFormat(Buffer, Size, Format, FALSE, Args);
+}
+
+
+int
+HostSprintf_s(
+	char*		Buffer,
+	size_t		Size,
+	const char*	Format,
+	...)
+{
+	va_list	args;
+	int		length;
+	va_start(args, Format);
+	length = HostFormat(Buffer, Size, Format, FALSE, args);
+	va_end(args);
+	return length;
+}
+
+
+int
+HostVswprintf_s(
+	WCHAR*			Buffer,
+	size_t			Size,
+	const WCHAR*	Format,
+	va_list			Args)
+{
+	char*	format = HostNarrowString(Format);
+	char*	narrow = (char*)malloc(Size);
+	int		length = 0;
+	size_t	i;
+
+	if (format && narrow && Size > 0) {
+		length = HostFormat(narrow, Size, format, TRUE, Args);
+		for (i = 0; i < Size && narrow[i]; i++) {
+			Buffer[i] = (unsigned char)narrow[i];
+		}
+		Buffer[i < Size ? i : Size - 1] = 0;
+	}
+	free(format);
+	free(narrow);
+	return length;
+}
+
+
+int
+HostSwprintf_s(
+	WCHAR*			Buffer,
+	size_t			Size,
+	const WCHAR*	Format,
+	...)
+{
+	va_list	args;
+	int		length;
+	va_start(args, Format);
+	length = HostVswprintf_s(Buffer, Size, Format, args);
+	va_end(args);
+	return length;
+}
+
+
+int
+HostFwprintf(
+	FILE*			Stream,
+	const WCHAR*	Format,
+	...)
+{
+	WCHAR	buffer[1024];
+	char*	narrow;
+	va_list	args;
+	int		length;
+
+	va_start(args, Format);
+	length = HostVswprintf_s(buffer, sizeof(buffer) / sizeof(WCHAR), Format, args);
+	va_end(args);
+
+	narrow = HostNarrowString(buffer);
+	if (narrow) {
+		fputs(narrow, Stream);
+		free(narrow);
+	}
+	return length;
+}
@@ -0,0 +1,62 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2008 Hiroki Asakawa info@dokan-dev.net
+
+  http://dokan-dev.net/en
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "dokani.h"
+
+
+// mount.c and ring.c are not built on the host, there is no
+// mounter service nor dokan.sys to talk to.
+
+BOOL
+DokanMount(
+	LPCWSTR	MountPoint,
+	LPCWSTR	DeviceName)
+{
+	UNREFERENCED_PARAMETER(MountPoint);
+	UNREFERENCED_PARAMETER(DeviceName);
+	return FALSE;
+}
+
+
+BOOL DOKANAPI
+DokanRemoveMountPoint(
+	LPCWSTR MountPoint)
+{
+	UNREFERENCED_PARAMETER(MountPoint);
+	return FALSE;
+}
+
+
+BOOL
+DokanRingStart(
+	PDOKAN_INSTANCE	DokanInstance)
+{
+	UNREFERENCED_PARAMETER(DokanInstance);
+	return FALSE;
+}
+
+
+VOID
+DokanRingStop(
+	PDOKAN_INSTANCE	DokanInstance)
+{
+	UNREFERENCED_PARAMETER(DokanInstance);
+}
@@ -0,0 +1,41 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2008 Hiroki Asakawa info@dokan-dev.net
+
+  http://dokan-dev.net/en
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef _HOST_PROCESS_H_
+#define _HOST_PROCESS_H_
+
+#include <windows.h>
+
+// the returned handle is waited for and closed as a Windows thread handle
+uintptr_t
+_beginthreadex(
+	void*		Security,
+	unsigned	StackSize,
+	unsigned	(__stdcall *StartAddress)(void*),
+	void*		ArgList,
+	unsigned	InitFlag,
+	unsigned*	ThreadId);
+
+void
+_endthreadex(
+	unsigned	ExitCode);
+
+#endif // _HOST_PROCESS_H_
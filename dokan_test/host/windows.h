@@ -0,0 +1,441 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2008 Hiroki Asakawa info@dokan-dev.net
+
+  http://dokan-dev.net/en
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef _HOST_WINDOWS_H_
+#define _HOST_WINDOWS_H_
+
+// The part of windows.h dokan.dll uses, so that the library and
+// the tests in dokan_test can be built and run on a POSIX host.
+// Build with -fshort-wchar: WCHAR is wchar_t as on Windows and the
+// wcs* functions of the C library are replaced by Host* below.
+// Threads, events and semaphores are pthread objects, see hostwin.c.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+#include <wctype.h>
+
+#if __SIZEOF_WCHAR_T__ != 2
+#error "build with -fshort-wchar"
+#endif
+
+#if defined(__x86_64__) && !defined(_M_AMD64)
+#define _M_AMD64	100
+#endif
+
+// before __inline is redefined below, immintrin.h declares the AVX2
+// intrinsics for functions built with __attribute__((target("avx2")))
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+#include <pthread.h>
+
+
+// the library is built as with the compiler of the WDK
+#define _MSC_VER	1500
+
+#define __stdcall
+#define __cdecl
+#define __declspec(x)
+#define __inline	static __inline__
+#define FORCEINLINE	static __inline__
+
+#define WINAPI		__stdcall
+#define CALLBACK	__stdcall
+#define CONST		const
+#define IN
+#define OUT
+#define OPTIONAL
+
+#define __in
+#define __out
+#define __inout
+#define __in_opt
+#define __out_opt
+
+#ifndef VOID
+#define VOID void
+#endif
+
+typedef char				CHAR, CCHAR, *PCHAR, *LPSTR;
+typedef const char			*LPCSTR, *PCSTR;
+typedef unsigned char		UCHAR, *PUCHAR, BYTE, *PBYTE, *LPBYTE;
+typedef wchar_t				WCHAR, *PWCHAR, *LPWSTR, *PWSTR;
+typedef const wchar_t		*LPCWSTR, *PCWSTR;
+typedef short				SHORT;
+typedef unsigned short		USHORT, WORD, *PUSHORT;
+typedef int					INT, BOOL, *PBOOL, *LPBOOL;
+typedef unsigned int		UINT;
+typedef int32_t				LONG, *PLONG;
+typedef uint32_t			ULONG, *PULONG, DWORD, *PDWORD, *LPDWORD;
+typedef unsigned char		BOOLEAN, *PBOOLEAN;
+typedef int64_t				LONGLONG, LONG64, *PLONGLONG;
+typedef uint64_t			ULONGLONG, ULONG64, UINT64, DWORD64, *PULONGLONG, *PULONG64;
+typedef intptr_t			LONG_PTR, INT_PTR;
+typedef uintptr_t			ULONG_PTR, UINT_PTR, DWORD_PTR;
+typedef size_t				SIZE_T;
+typedef void				*PVOID, *LPVOID;
+typedef const void			*LPCVOID;
+typedef void				*HANDLE, **PHANDLE;
+typedef void				*HINSTANCE, *HMODULE, *SC_HANDLE;
+typedef LONG				NTSTATUS;
+
+typedef DWORD				ACCESS_MASK, *PACCESS_MASK;
+typedef DWORD				SECURITY_INFORMATION, *PSECURITY_INFORMATION;
+typedef void				*PSECURITY_DESCRIPTOR;
+typedef void				*LPSECURITY_ATTRIBUTES;
+
+#ifndef TRUE
+#define TRUE	1
+#define FALSE	0
+#endif
+
+#define MAXLONG		0x7fffffff
+#define MAXULONG	0xffffffff
+#define MAXDWORD	0xffffffff
+#define MAX_PATH	260
+
+#ifndef min
+#define min(a, b)	(((a) < (b)) ? (a) : (b))
+#define max(a, b)	(((a) > (b)) ? (a) : (b))
+#endif
+
+#define FIELD_OFFSET(type, field)	((LONG)offsetof(type, field))
+#define CONTAINING_RECORD(address, type, field) \
+	((type *)((PCHAR)(address) - (ULONG_PTR)(&((type *)0)->field)))
+
+#define UNREFERENCED_PARAMETER(P)	((void)(P))
+
+#define ZeroMemory(d, l)		memset((d), 0, (l))
+#define RtlZeroMemory(d, l)		memset((d), 0, (l))
+#define FillMemory(d, l, f)		memset((d), (f), (l))
+#define CopyMemory(d, s, l)		memcpy((d), (s), (l))
+#define RtlCopyMemory(d, s, l)	memcpy((d), (s), (l))
+#define MoveMemory(d, s, l)		memmove((d), (s), (l))
+
+
+typedef union _LARGE_INTEGER {
+	struct {
+		DWORD	LowPart;
+		LONG	HighPart;
+	};
+	LONGLONG	QuadPart;
+} LARGE_INTEGER, *PLARGE_INTEGER;
+
+typedef union _ULARGE_INTEGER {
+	struct {
+		DWORD	LowPart;
+		DWORD	HighPart;
+	};
+	ULONGLONG	QuadPart;
+} ULARGE_INTEGER, *PULARGE_INTEGER;
+
+typedef struct _LIST_ENTRY {
+	struct _LIST_ENTRY	*Flink;
+	struct _LIST_ENTRY	*Blink;
+} LIST_ENTRY, *PLIST_ENTRY;
+
+typedef struct _SINGLE_LIST_ENTRY {
+	struct _SINGLE_LIST_ENTRY	*Next;
+} SINGLE_LIST_ENTRY, *PSINGLE_LIST_ENTRY;
+
+typedef struct _FILETIME {
+	DWORD	dwLowDateTime;
+	DWORD	dwHighDateTime;
+} FILETIME, *PFILETIME, *LPFILETIME;
+
+typedef struct _BY_HANDLE_FILE_INFORMATION {
+	DWORD		dwFileAttributes;
+	FILETIME	ftCreationTime;
+	FILETIME	ftLastAccessTime;
+	FILETIME	ftLastWriteTime;
+	DWORD		dwVolumeSerialNumber;
+	DWORD		nFileSizeHigh;
+	DWORD		nFileSizeLow;
+	DWORD		nNumberOfLinks;
+	DWORD		nFileIndexHigh;
+	DWORD		nFileIndexLow;
+} BY_HANDLE_FILE_INFORMATION, *PBY_HANDLE_FILE_INFORMATION, *LPBY_HANDLE_FILE_INFORMATION;
+
+typedef struct _WIN32_FIND_DATAW {
+	DWORD		dwFileAttributes;
+	FILETIME	ftCreationTime;
+	FILETIME	ftLastAccessTime;
+	FILETIME	ftLastWriteTime;
+	DWORD		nFileSizeHigh;
+	DWORD		nFileSizeLow;
+	DWORD		dwReserved0;
+	DWORD		dwReserved1;
+	WCHAR		cFileName[MAX_PATH];
+	WCHAR		cAlternateFileName[14];
+} WIN32_FIND_DATAW, *PWIN32_FIND_DATAW, *LPWIN32_FIND_DATAW;
+
+typedef struct _OVERLAPPED {
+	ULONG_PTR	Internal;
+	ULONG_PTR	InternalHigh;
+	DWORD		Offset;
+	DWORD		OffsetHigh;
+	HANDLE		hEvent;
+} OVERLAPPED, *LPOVERLAPPED;
+
+// Internal is STATUS_PENDING until the I/O completes
+#define HasOverlappedIoCompleted(lpOverlapped) \
+	(((DWORD)(lpOverlapped)->Internal) != 0x00000103L)
+
+
+#define ERROR_SUCCESS				0
+#define ERROR_FILE_NOT_FOUND		2
+#define ERROR_PATH_NOT_FOUND		3
+#define ERROR_ACCESS_DENIED			5
+#define ERROR_INVALID_HANDLE		6
+#define ERROR_NOT_ENOUGH_MEMORY		8
+#define ERROR_NOT_READY				21
+#define ERROR_SHARING_VIOLATION		32
+#define ERROR_HANDLE_EOF			38
+#define ERROR_NOT_SUPPORTED			50
+#define ERROR_FILE_EXISTS			80
+#define ERROR_INVALID_PARAMETER		87
+#define ERROR_DISK_FULL				112
+#define ERROR_CALL_NOT_IMPLEMENTED	120
+#define ERROR_INSUFFICIENT_BUFFER	122
+#define ERROR_INVALID_NAME			123
+#define ERROR_DIR_NOT_EMPTY			145
+#define ERROR_ALREADY_EXISTS		183
+#define ERROR_PIPE_BUSY				231
+#define ERROR_NO_MORE_ITEMS			259
+#define ERROR_PRIVILEGE_NOT_HELD	1314
+#define ERROR_SERVICE_EXISTS		1073
+#define ERROR_IO_INCOMPLETE			996
+#define ERROR_IO_PENDING			997
+#define ERROR_BUFFER_OVERFLOW		111
+#define ERROR_OPERATION_ABORTED		995
+
+#define FILE_ATTRIBUTE_READONLY		0x00000001
+#define FILE_ATTRIBUTE_HIDDEN		0x00000002
+#define FILE_ATTRIBUTE_SYSTEM		0x00000004
+#define FILE_ATTRIBUTE_DIRECTORY	0x00000010
+#define FILE_ATTRIBUTE_ARCHIVE		0x00000020
+#define FILE_ATTRIBUTE_NORMAL		0x00000080
+#define FILE_ATTRIBUTE_TEMPORARY	0x00000100
+
+#define GENERIC_READ				0x80000000
+#define GENERIC_WRITE				0x40000000
+#define GENERIC_EXECUTE				0x20000000
+#define GENERIC_ALL					0x10000000
+
+#define FILE_SHARE_READ				0x00000001
+#define FILE_SHARE_WRITE			0x00000002
+#define FILE_SHARE_DELETE			0x00000004
+
+#define CREATE_NEW					1
+#define CREATE_ALWAYS				2
+#define OPEN_EXISTING				3
+#define OPEN_ALWAYS					4
+#define TRUNCATE_EXISTING			5
+
+#define FILE_FLAG_WRITE_THROUGH		0x80000000
+#define FILE_FLAG_OVERLAPPED		0x40000000
+#define FILE_FLAG_NO_BUFFERING		0x20000000
+#define FILE_FLAG_RANDOM_ACCESS		0x10000000
+#define FILE_FLAG_SEQUENTIAL_SCAN	0x08000000
+#define FILE_FLAG_DELETE_ON_CLOSE	0x04000000
+#define FILE_FLAG_BACKUP_SEMANTICS	0x02000000
+#define FILE_FLAG_OPEN_REPARSE_POINT	0x00200000
+
+#define FILE_CASE_SENSITIVE_SEARCH		0x00000001
+#define FILE_CASE_PRESERVED_NAMES		0x00000002
+#define FILE_UNICODE_ON_DISK			0x00000004
+#define FILE_PERSISTENT_ACLS			0x00000008
+#define FILE_SUPPORTS_REMOTE_STORAGE	0x00000100
+
+#define OWNER_SECURITY_INFORMATION	0x00000001
+#define GROUP_SECURITY_INFORMATION	0x00000002
+#define DACL_SECURITY_INFORMATION	0x00000004
+#define SACL_SECURITY_INFORMATION	0x00000008
+
+#define INVALID_HANDLE_VALUE		((HANDLE)(LONG_PTR)-1)
+#define INFINITE					0xFFFFFFFF
+#define WAIT_OBJECT_0				0
+#define WAIT_TIMEOUT				258
+#define WAIT_FAILED					0xFFFFFFFF
+#define TLS_OUT_OF_INDEXES			0xFFFFFFFF
+
+#define DLL_PROCESS_DETACH			0
+#define DLL_PROCESS_ATTACH			1
+#define DLL_THREAD_ATTACH			2
+#define DLL_THREAD_DETACH			3
+
+
+// CRITICAL_SECTION is recursive as on Windows
+typedef struct _CRITICAL_SECTION {
+	void*	Mutex;
+} CRITICAL_SECTION, *PCRITICAL_SECTION, *LPCRITICAL_SECTION;
+
+VOID	InitializeCriticalSection(LPCRITICAL_SECTION CriticalSection);
+BOOL	InitializeCriticalSectionAndSpinCount(LPCRITICAL_SECTION CriticalSection, DWORD SpinCount);
+VOID	EnterCriticalSection(LPCRITICAL_SECTION CriticalSection);
+BOOL	TryEnterCriticalSection(LPCRITICAL_SECTION CriticalSection);
+VOID	LeaveCriticalSection(LPCRITICAL_SECTION CriticalSection);
+VOID	DeleteCriticalSection(LPCRITICAL_SECTION CriticalSection);
+
+
+#define CreateEvent		CreateEventW
+#define CreateSemaphore	CreateSemaphoreW
+#define CreateFile		CreateFileW
+
+HANDLE	CreateEventW(LPSECURITY_ATTRIBUTES Attributes, BOOL ManualReset, BOOL InitialState, LPCWSTR Name);
+HANDLE	CreateSemaphoreW(LPSECURITY_ATTRIBUTES Attributes, LONG InitialCount, LONG MaximumCount, LPCWSTR Name);
+BOOL	SetEvent(HANDLE Event);
+BOOL	ResetEvent(HANDLE Event);
+BOOL	ReleaseSemaphore(HANDLE Semaphore, LONG ReleaseCount, PLONG PreviousCount);
+DWORD	WaitForSingleObject(HANDLE Handle, DWORD Milliseconds);
+// polls the objects, WaitAll is not supported
+DWORD	WaitForMultipleObjects(DWORD Count, const HANDLE* Handles, BOOL WaitAll, DWORD Milliseconds);
+BOOL	CloseHandle(HANDLE Handle);
+
+// always fail, there is no dokan.sys on the host
+HANDLE	CreateFileW(LPCWSTR FileName, DWORD DesiredAccess, DWORD ShareMode,
+				LPSECURITY_ATTRIBUTES Attributes, DWORD CreationDisposition,
+				DWORD FlagsAndAttributes, HANDLE TemplateFile);
+BOOL	DeviceIoControl(HANDLE Device, DWORD IoControlCode, LPVOID InBuffer,
+				DWORD InBufferSize, LPVOID OutBuffer, DWORD OutBufferSize,
+				LPDWORD BytesReturned, LPOVERLAPPED Overlapped);
+// a test completes an OVERLAPPED by setting Internal and hEvent
+BOOL	CancelIo(HANDLE File);
+BOOL	GetOverlappedResult(HANDLE File, LPOVERLAPPED Overlapped,
+				LPDWORD NumberOfBytesTransferred, BOOL Wait);
+
+#define MEM_COMMIT		0x1000
+#define MEM_RESERVE		0x2000
+#define MEM_RELEASE		0x8000
+#define PAGE_READWRITE	0x04
+
+// zeroed memory of the C library
+LPVOID	VirtualAlloc(LPVOID Address, SIZE_T Size, DWORD AllocationType, DWORD Protect);
+BOOL	VirtualFree(LPVOID Address, SIZE_T Size, DWORD FreeType);
+
+DWORD	TlsAlloc(void);
+BOOL	TlsFree(DWORD Index);
+LPVOID	TlsGetValue(DWORD Index);
+BOOL	TlsSetValue(DWORD Index, LPVOID Value);
+
+DWORD	GetTickCount(void);
+VOID	Sleep(DWORD Milliseconds);
+DWORD	GetLastError(void);
+VOID	SetLastError(DWORD Error);
+DWORD	GetCurrentProcessId(void);
+DWORD	GetCurrentThreadId(void);
+VOID	OutputDebugStringA(LPCSTR OutputString);
+VOID	OutputDebugStringW(LPCWSTR OutputString);
+
+
+static __inline__ LONG
+InterlockedIncrement(LONG volatile* Addend)
+{
+	return __atomic_add_fetch(Addend, 1, __ATOMIC_SEQ_CST);
+}
+
+static __inline__ LONG
+InterlockedDecrement(LONG volatile* Addend)
+{
+	return __atomic_sub_fetch(Addend, 1, __ATOMIC_SEQ_CST);
+}
+
+static __inline__ LONG
+InterlockedExchange(LONG volatile* Target, LONG Value)
+{
+	return __atomic_exchange_n(Target, Value, __ATOMIC_SEQ_CST);
+}
+
+static __inline__ LONG
+InterlockedExchangeAdd(LONG volatile* Addend, LONG Value)
+{
+	return __atomic_fetch_add(Addend, Value, __ATOMIC_SEQ_CST);
+}
+
+static __inline__ LONG
+InterlockedCompareExchange(LONG volatile* Destination, LONG Exchange, LONG Comparand)
+{
+	__atomic_compare_exchange_n(Destination, &Comparand, Exchange, 0,
+		__ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+	return Comparand;
+}
+
+static __inline__ PVOID
+InterlockedCompareExchangePointer(PVOID volatile* Destination, PVOID Exchange, PVOID Comparand)
+{
+	__atomic_compare_exchange_n(Destination, &Comparand, Exchange, 0,
+		__ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+	return Comparand;
+}
+
+static __inline__ PVOID
+InterlockedExchangePointer(PVOID volatile* Target, PVOID Value)
+{
+	return __atomic_exchange_n(Target, Value, __ATOMIC_SEQ_CST);
+}
+
+
+// 16 bit wide strings, the C library works on 32 bit wchar_t
+#define wcslen		HostWcslen
+#define wcscmp		HostWcscmp
+#define wcsncmp		HostWcsncmp
+#define _wcsicmp	HostWcsicmp
+#define _wcsnicmp	HostWcsnicmp
+#define wcschr		HostWcschr
+#define wcsrchr		HostWcsrchr
+#define wcscpy_s	HostWcscpy_s
+#define wcscat_s	HostWcscat_s
+#define wcsncpy_s	HostWcsncpy_s
+#define vswprintf_s	HostVswprintf_s
+#define swprintf_s	HostSwprintf_s
+#define fwprintf	HostFwprintf
+#define vsprintf_s	HostVsprintf_s
+#define sprintf_s	HostSprintf_s
+#define _TRUNCATE	((size_t)-1)
+
+size_t		HostWcslen(const WCHAR* String);
+int			HostWcscmp(const WCHAR* String1, const WCHAR* String2);
+int			HostWcsncmp(const WCHAR* String1, const WCHAR* String2, size_t Count);
+int			HostWcsicmp(const WCHAR* String1, const WCHAR* String2);
+int			HostWcsnicmp(const WCHAR* String1, const WCHAR* String2, size_t Count);
+WCHAR*		HostWcschr(const WCHAR* String, WCHAR Char);
+WCHAR*		HostWcsrchr(const WCHAR* String, WCHAR Char);
+int			HostWcscpy_s(WCHAR* Dest, size_t Size, const WCHAR* Source);
+int			HostWcscat_s(WCHAR* Dest, size_t Size, const WCHAR* Source);
+int			HostWcsncpy_s(WCHAR* Dest, size_t Size, const WCHAR* Source, size_t Count);
+int			HostVswprintf_s(WCHAR* Buffer, size_t Size, const WCHAR* Format, va_list Args);
+int			HostSwprintf_s(WCHAR* Buffer, size_t Size, const WCHAR* Format, ...);
+int			HostFwprintf(FILE* Stream, const WCHAR* Format, ...);
+int			HostVsprintf_s(char* Buffer, size_t Size, const char* Format, va_list Args);
+int			HostSprintf_s(char* Buffer, size_t Size, const char* Format, ...);
+
+// narrow copy of String for printing, freed by the caller
+char*		HostNarrowString(const WCHAR* String);
+
+#endif // _HOST_WINDOWS_H_
@@ -0,0 +1,165 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2008 Hiroki Asakawa info@dokan-dev.net
+
+  http://dokan-dev.net/en
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef _HOSTEVENT_H_
+#define _HOSTEVENT_H_
+
+#include "hostsys.h"
+
+// IRP_LIST, IRP_ENTRY and DRIVER_EVENT_CONTEXT fields of the event queue
+// (sys/eventqueue.c), which eventqueue_test and eventqueue_bench include
+
+typedef struct _IRP_LIST {
+	LIST_ENTRY		ListHead;
+	KEVENT			NotEmpty;
+	KSPIN_LOCK		ListLock;
+} IRP_LIST, *PIRP_LIST;
+
+typedef struct _IRP_ENTRY {
+	LIST_ENTRY			ListEntry;
+	ULONG				SerialNumber;
+	PIRP				Irp;
+	PIO_STACK_LOCATION	IrpSp;
+	BOOLEAN				CancelRoutineFreeMemory;
+	PIRP_LIST			IrpList;
+} IRP_ENTRY, *PIRP_ENTRY;
+
+typedef struct _DRIVER_EVENT_CONTEXT {
+	LIST_ENTRY		ListEntry;
+	PKEVENT			Completed;
+	EVENT_CONTEXT	EventContext;
+} DRIVER_EVENT_CONTEXT, *PDRIVER_EVENT_CONTEXT;
+
+static VOID
+DokanInitIrpList(
+	PIRP_LIST	IrpList)
+{
+	InitializeListHead(&IrpList->ListHead);
+	KeInitializeSpinLock(&IrpList->ListLock);
+	KeInitializeEvent(&IrpList->NotEmpty, NotificationEvent, FALSE);
+}
+
+#define DokanFreeIrpEntry(e)	ExFreePool(e)
+
+#include "eventqueue.h"
+#include "../sys/eventqueue.c"
+
+
+// an IOCTL_EVENT_WAIT IRP of the host
+typedef struct _HOST_EVENT_IRP {
+	IRP					Irp;
+	IO_STACK_LOCATION	Stack;
+	KEVENT				Completed;
+	PCHAR				Buffer;
+} HOST_EVENT_IRP, *PHOST_EVENT_IRP;
+
+static VOID
+HostCancelEventIrp(
+	PDEVICE_OBJECT	DeviceObject,
+	PIRP			Irp)
+{
+}
+
+static VOID
+HostInitEventIrp(
+	PHOST_EVENT_IRP	HostIrp,
+	ULONG			IoControlCode,
+	ULONG			BufferLength)
+{
+	ZeroMemory(HostIrp, sizeof(HOST_EVENT_IRP));
+	HostIrp->Buffer = (PCHAR)malloc(BufferLength + 1);
+	HostIrp->Stack.Parameters.DeviceIoControl.IoControlCode = IoControlCode;
+	HostIrp->Stack.Parameters.DeviceIoControl.OutputBufferLength = BufferLength;
+	HostIrp->Irp.AssociatedIrp.SystemBuffer = BufferLength ? HostIrp->Buffer : NULL;
+	HostIrp->Irp.CurrentStackLocation = &HostIrp->Stack;
+	HostIrp->Irp.HostCompleted = &HostIrp->Completed;
+	KeInitializeEvent(&HostIrp->Completed, NotificationEvent, FALSE);
+}
+
+static VOID
+HostDeleteEventIrp(
+	PHOST_EVENT_IRP	HostIrp)
+{
+	free(HostIrp->Buffer);
+}
+
+// what RegisterPendingIrpMain does for DokanRegisterPendingIrpForEvent
+static VOID
+HostInsertEventIrp(
+	PDOKAN_EVENT_QUEUE	Queue,
+	PHOST_EVENT_IRP		HostIrp)
+{
+	PDOKAN_EVENT_SHARD	shard = DokanCurrentEventShard(Queue);
+	PIRP_ENTRY			irpEntry = ExAllocatePool(sizeof(IRP_ENTRY));
+	KIRQL				oldIrql;
+
+	ASSERT(irpEntry != NULL);
+	RtlZeroMemory(irpEntry, sizeof(IRP_ENTRY));
+	irpEntry->Irp = &HostIrp->Irp;
+	irpEntry->IrpSp = &HostIrp->Stack;
+	irpEntry->IrpList = &shard->PendingEvent;
+
+	KeClearEvent(&HostIrp->Completed);
+	HostIrp->Irp.IoStatus.Status = STATUS_PENDING;
+	HostIrp->Irp.IoStatus.Information = 0;
+
+	KeAcquireSpinLock(&shard->PendingEvent.ListLock, &oldIrql);
+	IoSetCancelRoutine(&HostIrp->Irp, HostCancelEventIrp);
+	InsertTailList(&shard->PendingEvent.ListHead, &irpEntry->ListEntry);
+	KeSetEvent(&shard->PendingEvent.NotEmpty, IO_NO_INCREMENT, FALSE);
+	KeReleaseSpinLock(&shard->PendingEvent.ListLock, oldIrql);
+}
+
+// RegisterPendingIrpMain and DokanDispatchEvents as
+// DokanRegisterPendingIrpForEvent does them
+static VOID
+HostRegisterEventIrp(
+	PDOKAN_EVENT_QUEUE	Queue,
+	PHOST_EVENT_IRP		HostIrp)
+{
+	HostInsertEventIrp(Queue, HostIrp);
+	DokanDispatchEvents(Queue, DokanCurrentEventShard(Queue));
+}
+
+// an event of Length bytes (at least sizeof(EVENT_CONTEXT)) queued by
+// dispatch routines, SerialNumber tells the events apart
+static PEVENT_CONTEXT
+HostAllocateEvent(
+	ULONG	SerialNumber,
+	ULONG	Length)
+{
+	PDRIVER_EVENT_CONTEXT	driverEventContext;
+
+	driverEventContext = ExAllocatePool(
+		Length - sizeof(EVENT_CONTEXT) + sizeof(DRIVER_EVENT_CONTEXT));
+	ASSERT(driverEventContext != NULL);
+	RtlZeroMemory(driverEventContext, sizeof(DRIVER_EVENT_CONTEXT));
+	InitializeListHead(&driverEventContext->ListEntry);
+	driverEventContext->EventContext.Length = Length;
+	driverEventContext->EventContext.SerialNumber = SerialNumber;
+	return &driverEventContext->EventContext;
+}
+
+// the EVENT_CONTEXT at Offset of the output of a completed IRP
+#define HostEventAt(HostIrp, Offset) \
+	((PEVENT_CONTEXT)((HostIrp)->Buffer + (Offset)))
+
+#endif // _HOSTEVENT_H_
@@ -0,0 +1,74 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2008 Hiroki Asakawa info@dokan-dev.net
+
+  http://dokan-dev.net/en
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef _HOSTFCB_H_
+#define _HOSTFCB_H_
+
+#include "hostsys.h"
+
+// FCB fields of the FCB table (sys/fcbtable.c), which fcbtable_test and
+// fcbtable_bench include
+
+typedef struct _DokanFCB {
+	LIST_ENTRY		NextFCB;
+	LIST_ENTRY		HashEntry;
+	ULONG			NameHash;
+	UNICODE_STRING	FileName;
+} DokanFCB, *PDokanFCB;
+
+#include "fcbtable.h"
+#include "../sys/fcbtable.c"
+
+
+// an FCB of Name, which is copied
+static PDokanFCB
+HostAllocateFcb(
+	LPCWSTR	Name)
+{
+	PDokanFCB	fcb = (PDokanFCB)calloc(1, sizeof(DokanFCB));
+	ULONG		length = (ULONG)wcslen(Name);
+
+	fcb->FileName.Buffer = (PWCHAR)malloc((length + 1) * sizeof(WCHAR));
+	CopyMemory(fcb->FileName.Buffer, Name, (length + 1) * sizeof(WCHAR));
+	fcb->FileName.Length = (USHORT)(length * sizeof(WCHAR));
+	fcb->FileName.MaximumLength = fcb->FileName.Length + sizeof(WCHAR);
+	return fcb;
+}
+
+static VOID
+HostFreeFcb(
+	PDokanFCB	Fcb)
+{
+	free(Fcb->FileName.Buffer);
+	free(Fcb);
+}
+
+static PDokanFCB
+HostLookupFcb(
+	PDOKAN_FCB_TABLE	Table,
+	LPCWSTR				Name)
+{
+	ULONG	length = (ULONG)(wcslen(Name) * sizeof(WCHAR));
+	return DokanFcbTableLookup(Table, (PWCHAR)Name, length,
+		DokanFcbNameHash((PWCHAR)Name, length));
+}
+
+#endif // _HOSTFCB_H_
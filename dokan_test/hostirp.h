@@ -0,0 +1,154 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2008 Hiroki Asakawa info@dokan-dev.net
+
+  http://dokan-dev.net/en
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef _HOSTIRP_H_
+#define _HOSTIRP_H_
+
+#include "hostsys.h"
+
+// IRP_LIST and IRP_ENTRY fields of the pending IRP index and timeout
+// wheel (sys/pendingirp.c), which pendingirp_test includes
+
+#define DRIVER_CONTEXT_IRP_ENTRY	3
+#define DOKAN_IRP_PENDING_TIMEOUT	(1000 * 15) // in millisecond
+#define DOKAN_CHECK_INTERVAL		(1000 * 5) // in millisecond
+#define DOKAN_PENDING_IRP_SHARDS	8
+
+#include "pendingirp.h"
+
+typedef struct _IRP_LIST {
+	LIST_ENTRY		ListHead;
+	KEVENT			NotEmpty;
+	KSPIN_LOCK		ListLock;
+	PLIST_ENTRY		SerialIndex;
+	PDOKAN_TIMEOUT_WHEEL	TimeoutWheel;
+} IRP_LIST, *PIRP_LIST;
+
+typedef struct _IRP_ENTRY {
+	LIST_ENTRY			ListEntry;
+	LIST_ENTRY			SerialEntry;
+	LIST_ENTRY			TimeoutEntry;
+	ULONG				SerialNumber;
+	PIRP				Irp;
+	BOOLEAN				CancelRoutineFreeMemory;
+	LARGE_INTEGER		TickCount;
+	PIRP_LIST			IrpList;
+} IRP_ENTRY, *PIRP_ENTRY;
+
+#define DokanFreeIrpEntry(e)	ExFreePool(e)
+
+// declared with the event functions in sys/dokan.h
+VOID
+DokanScheduleTimeout(
+	PIRP_LIST	IrpList,
+	PIRP_ENTRY	IrpEntry);
+
+#include "../sys/pendingirp.c"
+
+
+// a shard of Dcb->PendingIrp as DokanCreateDiskDevice sets it up
+typedef struct _HOST_PENDING_IRPS {
+	IRP_LIST			List;
+	LIST_ENTRY			Index[DOKAN_PENDING_IRP_BUCKETS];
+	DOKAN_TIMEOUT_WHEEL	Wheel;
+} HOST_PENDING_IRPS, *PHOST_PENDING_IRPS;
+
+// an IRP_ENTRY with its IRP, freed together by DokanFreeIrpEntry
+typedef struct _HOST_PENDING_IRP {
+	IRP_ENTRY	Entry;
+	IRP			Irp;
+} HOST_PENDING_IRP, *PHOST_PENDING_IRP;
+
+static VOID
+HostCancelPendingIrp(
+	PDEVICE_OBJECT	DeviceObject,
+	PIRP			Irp)
+{
+}
+
+// DokanUpdateTimeout
+static VOID
+HostUpdateTimeout(
+	PLARGE_INTEGER	TickCount,
+	ULONG			Timeout)
+{
+	KeQueryTickCount(TickCount);
+	TickCount->QuadPart += Timeout * 1000 * 10 / KeQueryTimeIncrement();
+}
+
+static VOID
+HostInitPendingIrps(
+	PHOST_PENDING_IRPS	Pending)
+{
+	ULONG	i;
+
+	InitializeListHead(&Pending->List.ListHead);
+	KeInitializeSpinLock(&Pending->List.ListLock);
+	KeInitializeEvent(&Pending->List.NotEmpty, NotificationEvent, FALSE);
+	for (i = 0; i < DOKAN_PENDING_IRP_BUCKETS; ++i) {
+		InitializeListHead(&Pending->Index[i]);
+	}
+	Pending->List.SerialIndex = Pending->Index;
+	DokanInitTimeoutWheel(&Pending->Wheel);
+	Pending->List.TimeoutWheel = &Pending->Wheel;
+}
+
+// what RegisterPendingIrpMain does for an IRP waiting for a reply
+static PIRP_ENTRY
+HostInsertPendingIrp(
+	PHOST_PENDING_IRPS	Pending,
+	ULONG				SerialNumber)
+{
+	PHOST_PENDING_IRP	hostIrp = ExAllocatePool(sizeof(HOST_PENDING_IRP));
+	PIRP_ENTRY			irpEntry;
+
+	ASSERT(hostIrp != NULL);
+	RtlZeroMemory(hostIrp, sizeof(HOST_PENDING_IRP));
+	irpEntry = &hostIrp->Entry;
+	InitializeListHead(&irpEntry->ListEntry);
+	InitializeListHead(&irpEntry->SerialEntry);
+	InitializeListHead(&irpEntry->TimeoutEntry);
+	irpEntry->SerialNumber = SerialNumber;
+	irpEntry->Irp = &hostIrp->Irp;
+	irpEntry->IrpList = &Pending->List;
+	HostUpdateTimeout(&irpEntry->TickCount, DOKAN_IRP_PENDING_TIMEOUT);
+
+	IoSetCancelRoutine(&hostIrp->Irp, HostCancelPendingIrp);
+	hostIrp->Irp.Tail.Overlay.DriverContext[DRIVER_CONTEXT_IRP_ENTRY] = irpEntry;
+
+	DokanInsertPendingIrp(&Pending->List, irpEntry);
+	return irpEntry;
+}
+
+static ULONG
+HostCountEntries(
+	PLIST_ENTRY	ListHead)
+{
+	PLIST_ENTRY	entry;
+	ULONG		count = 0;
+
+	for (entry = ListHead->Flink; entry != ListHead; entry = entry->Flink) {
+		count++;
+	}
+	return count;
+}
+
+#endif // _HOSTIRP_H_
@@ -0,0 +1,156 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2008 Hiroki Asakawa info@dokan-dev.net
+
+  http://dokan-dev.net/en
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef _HOSTRING_H_
+#define _HOSTRING_H_
+
+#include "hostevent.h"
+
+// VCB and DCB fields of the driver side of the ring (sys/ring.c) and the
+// device channel of the library side (dokan/ring.c), which ring_test
+// includes both
+
+typedef struct _FSD_IDENTIFIER {
+	ULONG	Type;
+	ULONG	Size;
+} FSD_IDENTIFIER, *PFSD_IDENTIFIER;
+
+#define VCB		1
+#define GetIdentifierType(Obj) (((PFSD_IDENTIFIER)Obj)->Type)
+
+typedef struct _DOKAN_RING {
+	KSPIN_LOCK		Lock;
+	PIRP			Irp;
+	PVOID			Base;
+	ULONG			SlotCount;
+	ULONG			SlotSize;
+	ULONG			NextSlot;
+	PKEVENT			RequestEvent;
+	PKEVENT			ReplyEvent;
+} DOKAN_RING, *PDOKAN_RING;
+
+typedef struct _DokanDCB {
+	PVOID				Vcb;
+	DOKAN_EVENT_QUEUE	EventQueue;
+	DOKAN_RING			Ring;
+	USHORT				Mounted;
+	ULONG				EventBufferSize;
+} DokanDCB, *PDokanDCB;
+
+typedef struct _DokanVCB {
+	FSD_IDENTIFIER	Identifier;
+	PDokanDCB		Dcb;
+} DokanVCB, *PDokanVCB;
+
+
+// replies the driver took from the ring, in the order of CompleteIrpMain
+#define HOST_MAX_REPLIES	1024
+
+static ULONG	g_HostReplySerial[HOST_MAX_REPLIES];
+static ULONG	g_HostReplyCount;
+
+static NTSTATUS
+CompleteIrpMain(
+	PDokanVCB			Vcb,
+	PEVENT_INFORMATION	EventInfo)
+{
+	ASSERT(g_HostReplyCount < HOST_MAX_REPLIES);
+	g_HostReplySerial[g_HostReplyCount++] = EventInfo->SerialNumber;
+	return STATUS_SUCCESS;
+}
+
+#include "../sys/ring.c"
+
+
+// the device channel under the ring, which counts what reaches it
+static ULONG	g_HostDeviceReplies;
+static ULONG	g_HostDeviceWrites;
+static ULONG	g_HostDeviceSerial;
+
+static HANDLE
+HostOpenDeviceChannel(
+	PDOKAN_INSTANCE	DokanInstance)
+{
+	return (HANDLE)DokanInstance;
+}
+
+static VOID
+HostCloseDeviceChannel(
+	HANDLE	Channel)
+{
+}
+
+static BOOL
+HostWaitDeviceEvent(
+	HANDLE	Channel,
+	PVOID	Buffer,
+	ULONG	BufferLength,
+	PULONG	ReturnedLength)
+{
+	*ReturnedLength = 0;
+	return FALSE;
+}
+
+static BOOL
+HostSendDeviceEventInformation(
+	HANDLE				Channel,
+	PEVENT_INFORMATION	EventInfo,
+	ULONG				EventLength)
+{
+	g_HostDeviceReplies++;
+	g_HostDeviceSerial = EventInfo->SerialNumber;
+	return TRUE;
+}
+
+static BOOL
+HostSendDeviceWriteRequest(
+	HANDLE				Channel,
+	PEVENT_INFORMATION	EventInfo,
+	ULONG				EventLength,
+	PVOID				Buffer,
+	ULONG				BufferLength)
+{
+	g_HostDeviceWrites++;
+	g_HostDeviceSerial = EventInfo->SerialNumber;
+	return TRUE;
+}
+
+static DOKAN_TRANSPORT HostDeviceTransport = {
+	HostOpenDeviceChannel,
+	HostCloseDeviceChannel,
+	HostWaitDeviceEvent,
+	HostSendDeviceEventInformation,
+	HostSendDeviceWriteRequest
+};
+
+// DokanRingStart and DokanRingStop need dokan.sys, those of
+// host/nodevice.c are linked
+#define DokanRingStart			HostRingStartOnDevice
+#define DokanRingStop			HostRingStopOnDevice
+#define DokanDeviceTransport	HostDeviceTransport
+
+#include "../dokan/ring.c"
+
+#undef DokanRingStart
+#undef DokanRingStop
+#undef DokanDeviceTransport
+
+#endif // _HOSTRING_H_
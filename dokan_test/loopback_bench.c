@@ -0,0 +1,263 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2008 Hiroki Asakawa info@dokan-dev.net
+
+  http://dokan-dev.net/en
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <process.h>
+#include "test.h"
+#include "memfs.h"
+#include "request.h"
+
+
+// ops/sec and latency of each dispatch path through the loopback,
+// with 1 and 4 client threads against 4 DokanLoop threads
+
+#define BENCH_CLIENTS_MAX	4
+
+typedef struct _BENCH_PATH {
+	const char*	Name;
+	// one operation, returns FALSE on failure
+	BOOL		(*Run)(PDOKAN_LOOPBACK Loopback, ULONG Client, ULONG Iteration);
+} BENCH_PATH, *PBENCH_PATH;
+
+typedef struct _BENCH_CLIENT {
+	PDOKAN_LOOPBACK	Loopback;
+	PBENCH_PATH		Path;
+	ULONG			Index;
+	ULONG			Count;
+	double*			Latency;
+	ULONG			Failures;
+} BENCH_CLIENT, *PBENCH_CLIENT;
+
+
+static ULONG64	g_FileContext[BENCH_CLIENTS_MAX];
+static ULONG64	g_DirContext[BENCH_CLIENTS_MAX];
+static CHAR		g_Data[4096];
+
+
+static BOOL
+RunCreateClose(
+	PDOKAN_LOOPBACK	Loopback,
+	ULONG			Client,
+	ULONG			Iteration)
+{
+	ULONG64 context;
+
+	UNREFERENCED_PARAMETER(Client);
+	UNREFERENCED_PARAMETER(Iteration);
+
+	if (RequestCreate(Loopback, L"\\file", FILE_OPEN, 0, &context) != STATUS_SUCCESS) {
+		return FALSE;
+	}
+	return RequestClose(Loopback, L"\\file", context) == STATUS_SUCCESS;
+}
+
+
+static BOOL
+RunRead(
+	PDOKAN_LOOPBACK	Loopback,
+	ULONG			Client,
+	ULONG			Iteration)
+{
+	CHAR	buffer[4096];
+	ULONG	length;
+
+	return RequestRead(Loopback, L"\\file", g_FileContext[Client],
+				(Iteration % 16) * 4096, buffer, sizeof(buffer), &length) == STATUS_SUCCESS &&
+			length == sizeof(buffer);
+}
+
+
+static BOOL
+RunWrite(
+	PDOKAN_LOOPBACK	Loopback,
+	ULONG			Client,
+	ULONG			Iteration)
+{
+	return RequestWrite(Loopback, L"\\file", g_FileContext[Client],
+				(Iteration % 16) * 4096, g_Data, sizeof(g_Data)) == STATUS_SUCCESS;
+}
+
+
+static BOOL
+RunQueryInformation(
+	PDOKAN_LOOPBACK	Loopback,
+	ULONG			Client,
+	ULONG			Iteration)
+{
+	FILE_STANDARD_INFORMATION	standard;
+	ULONG						length;
+
+	UNREFERENCED_PARAMETER(Iteration);
+
+	return RequestQueryInformation(Loopback, L"\\file", g_FileContext[Client],
+				FileStandardInformation, &standard, sizeof(standard), &length) == STATUS_SUCCESS;
+}
+
+
+static BOOL
+RunDirectory(
+	PDOKAN_LOOPBACK	Loopback,
+	ULONG			Client,
+	ULONG			Iteration)
+{
+	CHAR	buffer[4096];
+	ULONG	length;
+	ULONG	index = 0;
+
+	UNREFERENCED_PARAMETER(Iteration);
+
+	// first page of a 100 entries directory
+	return RequestDirectory(Loopback, L"\\dir", L"*", g_DirContext[Client],
+				FileDirectoryInformation, &index, buffer, sizeof(buffer), &length) == STATUS_SUCCESS;
+}
+
+
+static BENCH_PATH g_Paths[] = {
+	{ "create+close",	RunCreateClose },
+	{ "read 4KB",		RunRead },
+	{ "write 4KB",		RunWrite },
+	{ "query info",		RunQueryInformation },
+	{ "directory",		RunDirectory },
+};
+
+
+static unsigned __stdcall
+ClientThread(
+	void*	Parameter)
+{
+	PBENCH_CLIENT	client = (PBENCH_CLIENT)Parameter;
+	ULONG			i;
+
+	for (i = 0; i < client->Count; ++i) {
+		double start = TestNow();
+		if (!client->Path->Run(client->Loopback, client->Index, i)) {
+			client->Failures++;
+		}
+		client->Latency[i] = TestNow() - start;
+	}
+	return 0;
+}
+
+
+static int
+CompareDouble(
+	const void*	Left,
+	const void*	Right)
+{
+	double l = *(const double*)Left;
+	double r = *(const double*)Right;
+	return l < r ? -1 : l > r ? 1 : 0;
+}
+
+
+static ULONG
+RunPath(
+	PDOKAN_LOOPBACK	Loopback,
+	PBENCH_PATH		Path,
+	ULONG			Clients,
+	ULONG			Count)
+{
+	BENCH_CLIENT	client[BENCH_CLIENTS_MAX];
+	HANDLE			thread[BENCH_CLIENTS_MAX];
+	double*			latency = (double*)malloc(sizeof(double) * Count * Clients);
+	double			start, elapsed;
+	ULONG			failures = 0;
+	ULONG			i;
+
+	start = TestNow();
+	for (i = 0; i < Clients; ++i) {
+		client[i].Loopback = Loopback;
+		client[i].Path = Path;
+		client[i].Index = i;
+		client[i].Count = Count;
+		client[i].Latency = latency + i * Count;
+		client[i].Failures = 0;
+		thread[i] = (HANDLE)_beginthreadex(NULL, 0, ClientThread, &client[i], 0, NULL);
+	}
+	for (i = 0; i < Clients; ++i) {
+		WaitForSingleObject(thread[i], INFINITE);
+		CloseHandle(thread[i]);
+		failures += client[i].Failures;
+	}
+	elapsed = TestNow() - start;
+
+	qsort(latency, Count * Clients, sizeof(double), CompareDouble);
+	printf("%-14s %u client%s %10.0f ops/s  p50 %7.2f us  p99 %7.2f us%s\n",
+		Path->Name, Clients, Clients > 1 ? "s" : " ",
+		Count * Clients / elapsed,
+		latency[Count * Clients / 2] * 1e6,
+		latency[Count * Clients * 99 / 100] * 1e6,
+		failures ? "  FAILED" : "");
+	free(latency);
+	return failures;
+}
+
+
+int
+main(void)
+{
+	DOKAN_OPTIONS		options;
+	DOKAN_OPERATIONS	operations;
+	PDOKAN_LOOPBACK		loopback;
+	ULONG				count = (ULONG)(20000 * BenchScale());
+	ULONG				failures = 0;
+	ULONG				clients;
+	ULONG				i;
+	WCHAR				name[32];
+
+	TestInitialize();
+	MemfsInitialize(&operations, FALSE);
+	MemfsAddFile(L"\\file", 16 * 4096);
+	MemfsAddDirectory(L"\\dir");
+	for (i = 0; i < 100; ++i) {
+		wcscpy_s(name, 32, L"\\dir\\");
+		MemfsSyntheticName(i, name + 5);
+		MemfsAddFile(name, i);
+	}
+
+	ZeroMemory(&options, sizeof(DOKAN_OPTIONS));
+	options.Version = DOKAN_VERSION;
+	options.ThreadCount = 4;
+	options.MountPoint = L"M:\\";
+
+	loopback = DokanLoopbackStart(&options, &operations);
+	if (loopback == NULL) {
+		fprintf(stderr, "DokanLoopbackStart failed\n");
+		return 1;
+	}
+
+	for (i = 0; i < BENCH_CLIENTS_MAX; ++i) {
+		RequestCreate(loopback, L"\\file", FILE_OPEN, 0, &g_FileContext[i]);
+		RequestCreate(loopback, L"\\dir", FILE_OPEN, FILE_DIRECTORY_FILE, &g_DirContext[i]);
+	}
+
+	for (clients = 1; clients <= BENCH_CLIENTS_MAX; clients *= 4) {
+		for (i = 0; i < sizeof(g_Paths) / sizeof(g_Paths[0]); ++i) {
+			failures += RunPath(loopback, &g_Paths[i], clients, count);
+		}
+	}
+
+	for (i = 0; i < BENCH_CLIENTS_MAX; ++i) {
+		RequestClose(loopback, L"\\file", g_FileContext[i]);
+		RequestClose(loopback, L"\\dir", g_DirContext[i]);
+	}
+	DokanLoopbackStop(loopback);
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,1131 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2008 Hiroki Asakawa info@dokan-dev.net
+
+  http://dokan-dev.net/en
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <process.h>
+#include "test.h"
+#include "memfs.h"
+#include "request.h"
+
+
+// names in a FILE_NAMES_INFORMATION listing
+static ULONG
+CountNames(
+	PVOID	Buffer,
+	ULONG	Length,
+	LPCWSTR	Name,
+	PBOOL	Found)
+{
+	PFILE_NAMES_INFORMATION	info = (PFILE_NAMES_INFORMATION)Buffer;
+	ULONG					count = 0;
+
+	if (Length == 0) {
+		return 0;
+	}
+	for (;;) {
+		count++;
+		if (info->FileNameLength == wcslen(Name) * sizeof(WCHAR) &&
+			memcmp(info->FileName, Name, info->FileNameLength) == 0) {
+			*Found = TRUE;
+		}
+		if (info->NextEntryOffset == 0) {
+			break;
+		}
+		info = (PFILE_NAMES_INFORMATION)((PCHAR)info + info->NextEntryOffset);
+	}
+	return count;
+}
+
+
+static VOID
+TestReadWrite(
+	PDOKAN_LOOPBACK	Loopback)
+{
+	ULONG64	context;
+	CHAR	data[5000];
+	CHAR	buffer[8000];
+	ULONG	length;
+	ULONG	i;
+	FILE_STANDARD_INFORMATION standard;
+
+	for (i = 0; i < sizeof(data); ++i) {
+		data[i] = (CHAR)(i * 7);
+	}
+
+	CHECK(RequestCreate(Loopback, L"\\new.txt", FILE_OPEN, 0, &context) != STATUS_SUCCESS);
+	CHECK(RequestCreate(Loopback, L"\\new.txt", FILE_CREATE, 0, &context) == STATUS_SUCCESS);
+	CHECK(context != 0);
+
+	CHECK(RequestWrite(Loopback, L"\\new.txt", context, 0, data, sizeof(data)) == STATUS_SUCCESS);
+	CHECK(RequestRead(Loopback, L"\\new.txt", context, 0, buffer, sizeof(buffer), &length) == STATUS_SUCCESS);
+	CHECK(length == sizeof(data));
+	CHECK(memcmp(buffer, data, sizeof(data)) == 0);
+
+	CHECK(RequestRead(Loopback, L"\\new.txt", context, 4000, buffer, 100, &length) == STATUS_SUCCESS);
+	CHECK(length == 100);
+	CHECK(memcmp(buffer, data + 4000, 100) == 0);
+
+	CHECK(RequestQueryInformation(Loopback, L"\\new.txt", context, FileStandardInformation,
+			&standard, sizeof(standard), &length) == STATUS_SUCCESS);
+	CHECK(length == sizeof(standard));
+	CHECK(standard.EndOfFile.QuadPart == sizeof(data));
+	CHECK(!standard.Directory);
+
+	// short reads into reused reply buffers send only what was read
+	for (i = 0; i < 8; ++i) {
+		CHECK(RequestRead(Loopback, L"\\new.txt", context, 0, buffer, 4000, &length) == STATUS_SUCCESS);
+		CHECK(RequestRead(Loopback, L"\\new.txt", context, 4990, buffer, 4000, &length) == STATUS_SUCCESS);
+		CHECK(length == 10);
+		CHECK(memcmp(buffer, data + 4990, 10) == 0);
+	}
+
+	// and so does a failed rename, whose buffer had room for the new name
+	CHECK(MemfsAddFile(L"\\taken.txt", 1));
+	CHECK(RequestRename(Loopback, L"\\new.txt", context, L"\\taken.txt")
+		== STATUS_OBJECT_NAME_COLLISION);
+	CHECK(RequestRename(Loopback, L"\\new.txt", context, L"\\renamed.txt") == STATUS_SUCCESS);
+	CHECK(RequestClose(Loopback, L"\\renamed.txt", context) == STATUS_SUCCESS);
+
+	// a write bigger than the event buffer goes through SendWriteRequest
+	{
+		ULONG	size = 256 * 1024;
+		PCHAR	big = (PCHAR)malloc(size);
+		PCHAR	back = (PCHAR)malloc(size);
+
+		for (i = 0; i < size; ++i) {
+			big[i] = (CHAR)(i % 251);
+		}
+		CHECK(RequestCreate(Loopback, L"\\big.bin", FILE_OVERWRITE_IF, 0, &context) == STATUS_SUCCESS);
+		CHECK(RequestWrite(Loopback, L"\\big.bin", context, 0, big, size) == STATUS_SUCCESS);
+		CHECK(RequestRead(Loopback, L"\\big.bin", context, 0, back, size, &length) == STATUS_SUCCESS);
+		CHECK(length == size);
+		CHECK(memcmp(big, back, size) == 0);
+		CHECK(RequestClose(Loopback, L"\\big.bin", context) == STATUS_SUCCESS);
+		free(big);
+		free(back);
+	}
+}
+
+
+static VOID
+TestDirectory(
+	PDOKAN_LOOPBACK	Loopback)
+{
+	ULONG64	context;
+	CHAR	buffer[4096];
+	ULONG	length;
+	ULONG	index = 0;
+	ULONG	total = 0;
+	BOOL	found = FALSE;
+	ULONG	status;
+
+	CHECK(MemfsAddDirectory(L"\\dir"));
+	CHECK(MemfsAddFile(L"\\dir\\a.txt", 10));
+	CHECK(MemfsAddFile(L"\\dir\\b.txt", 20));
+	CHECK(MemfsAddFile(L"\\dir\\c.doc", 30));
+
+	CHECK(RequestCreate(Loopback, L"\\dir", FILE_OPEN, FILE_DIRECTORY_FILE, &context) == STATUS_SUCCESS);
+
+	// small buffers make the listing resume several times
+	for (;;) {
+		status = RequestDirectory(Loopback, L"\\dir", L"*", context, FileNamesInformation,
+					&index, buffer, 64, &length);
+		if (status != STATUS_SUCCESS) {
+			CHECK(status == STATUS_NO_MORE_FILES);
+			break;
+		}
+		total += CountNames(buffer, length, L"b.txt", &found);
+		CHECK(total <= 3);
+	}
+	// memfs lists no "." and ".."
+	CHECK(total == 3);
+	CHECK(found);
+
+	index = 0;
+	found = FALSE;
+	CHECK(RequestDirectory(Loopback, L"\\dir", L"*.txt", context, FileNamesInformation,
+			&index, buffer, sizeof(buffer), &length) == STATUS_SUCCESS);
+	CHECK(CountNames(buffer, length, L"a.txt", &found) == 2);
+	CHECK(found);
+
+	CHECK(RequestClose(Loopback, L"\\dir", context) == STATUS_SUCCESS);
+}
+
+
+// checks a FILE_DIRECTORY_INFORMATION listing holds the synthetic names
+// from First on and the long name after them, returns the number of entries
+static ULONG
+CheckDirectoryEntries(
+	PVOID	Buffer,
+	ULONG	Length,
+	ULONG	First,
+	ULONG	SyntheticCount,
+	LPCWSTR	LongName)
+{
+	PFILE_DIRECTORY_INFORMATION	info = (PFILE_DIRECTORY_INFORMATION)Buffer;
+	WCHAR						name[16];
+	ULONG						count = 0;
+
+	if (Length == 0) {
+		return 0;
+	}
+	for (;;) {
+		if (First + count < SyntheticCount) {
+			MemfsSyntheticName(First + count, name);
+			CHECK(info->FileNameLength == 8 * sizeof(WCHAR) &&
+				memcmp(info->FileName, name, info->FileNameLength) == 0);
+			CHECK(info->EndOfFile.QuadPart == First + count);
+		} else {
+			CHECK(info->FileNameLength == wcslen(LongName) * sizeof(WCHAR) &&
+				memcmp(info->FileName, LongName, info->FileNameLength) == 0);
+			CHECK(info->EndOfFile.QuadPart == 7);
+		}
+		CHECK(info->LastWriteTime.LowPart == 0x01020304);
+		count++;
+		if (info->NextEntryOffset == 0) {
+			break;
+		}
+		info = (PFILE_DIRECTORY_INFORMATION)((PCHAR)info + info->NextEntryOffset);
+	}
+	return count;
+}
+
+
+// a listing of several chunks of the store of FindFiles (dokan/directory.c)
+static VOID
+TestLargeDirectory(
+	PDOKAN_LOOPBACK	Loopback)
+{
+	ULONG64	context;
+	CHAR	buffer[4096];
+	WCHAR	longName[MAX_PATH];
+	WCHAR	path[MAX_PATH + 16];
+	ULONG	length;
+	ULONG	index = 0;
+	ULONG	total = 0;
+	ULONG	status;
+	LONG	finds;
+
+	wmemset(longName, L'x', 250);
+	longName[250] = 0;
+	swprintf_s(path, MAX_PATH + 16, L"\\large\\%s", longName);
+	CHECK(MemfsAddSyntheticDirectory(L"\\large", 3000));
+	CHECK(MemfsAddFile(path, 7));
+
+	CHECK(RequestCreate(Loopback, L"\\large", FILE_OPEN, FILE_DIRECTORY_FILE, &context)
+			== STATUS_SUCCESS);
+
+	finds = g_MemfsCalls[MEMFS_FIND_FILES];
+	for (;;) {
+		status = RequestDirectory(Loopback, L"\\large", L"*", context, FileDirectoryInformation,
+					&index, buffer, sizeof(buffer), &length);
+		if (status != STATUS_SUCCESS) {
+			CHECK(status == STATUS_NO_MORE_FILES);
+			break;
+		}
+		total += CheckDirectoryEntries(buffer, length, total, 3000, longName);
+		CHECK(total <= 3001);
+	}
+	CHECK(total == 3001);
+	// the entries are kept for the queries which resume
+	CHECK(g_MemfsCalls[MEMFS_FIND_FILES] - finds == 1);
+
+	// the listing is read again from the start
+	index = 0;
+	CHECK(RequestDirectory(Loopback, L"\\large", L"*", context, FileDirectoryInformation,
+			&index, buffer, sizeof(buffer), &length) == STATUS_SUCCESS);
+	CHECK(CheckDirectoryEntries(buffer, length, 0, 3000, longName) > 0);
+	CHECK(g_MemfsCalls[MEMFS_FIND_FILES] - finds == 2);
+
+	CHECK(RequestClose(Loopback, L"\\large", context) == STATUS_SUCCESS);
+}
+
+
+// IRP_MJ_CLOSE has no reply, waits until CloseFile was called Count times
+static LONG
+WaitCloseFile(
+	LONG	Count)
+{
+	ULONG	i;
+
+	for (i = 0; i < 1000 && g_MemfsCalls[MEMFS_CLOSE_FILE] < Count; ++i) {
+		Sleep(1);
+	}
+	return g_MemfsCalls[MEMFS_CLOSE_FILE];
+}
+
+
+static VOID
+TestHandles(
+	PDOKAN_LOOPBACK	Loopback)
+{
+	ULONG64	context, stale;
+	CHAR	buffer[16];
+	ULONG	length;
+	ULONG	index = 0;
+	LONG	reads, writes, infos, finds, closes;
+
+	CHECK(MemfsAddFile(L"\\handle.txt", 16));
+	// the Close of the tests before may still be on the way
+	closes = g_RequestCloses;
+	CHECK(WaitCloseFile(closes) == closes);
+	CHECK(RequestCreate(Loopback, L"\\handle.txt", FILE_OPEN, 0, &stale) == STATUS_SUCCESS);
+	CHECK(RequestClose(Loopback, L"\\handle.txt", stale) == STATUS_SUCCESS);
+	closes++;
+	CHECK(WaitCloseFile(closes) == closes);
+
+	// the entry is used again with the next generation
+	CHECK(RequestCreate(Loopback, L"\\handle.txt", FILE_OPEN, 0, &context) == STATUS_SUCCESS);
+	CHECK((ULONG)context == (ULONG)stale);
+	CHECK(context != stale);
+
+	reads = g_MemfsCalls[MEMFS_READ_FILE];
+	writes = g_MemfsCalls[MEMFS_WRITE_FILE];
+	infos = g_MemfsCalls[MEMFS_GET_FILE_INFO];
+	finds = g_MemfsCalls[MEMFS_FIND_FILES];
+
+	// a stale generation, 0 and an index out of the table are rejected
+	// without calling the file system
+	CHECK(RequestRead(Loopback, L"\\handle.txt", stale, 0, buffer, sizeof(buffer), &length)
+			== STATUS_INVALID_HANDLE);
+	CHECK(RequestRead(Loopback, L"\\handle.txt", 0, 0, buffer, sizeof(buffer), &length)
+			== STATUS_INVALID_HANDLE);
+	CHECK(RequestRead(Loopback, L"\\handle.txt", ((ULONG64)1 << 32) | 0xFFFFFF,
+			0, buffer, sizeof(buffer), &length) == STATUS_INVALID_HANDLE);
+	CHECK(RequestWrite(Loopback, L"\\handle.txt", stale, 0, "x", 1) == STATUS_INVALID_HANDLE);
+	CHECK(RequestWrite(Loopback, L"\\handle.txt", 0, 0, "x", 1) == STATUS_INVALID_HANDLE);
+	CHECK(RequestQueryInformation(Loopback, L"\\handle.txt", stale, FileStandardInformation,
+			buffer, sizeof(buffer), &length) == STATUS_INVALID_HANDLE);
+	CHECK(RequestDirectory(Loopback, L"\\", L"*", 0, FileNamesInformation,
+			&index, buffer, sizeof(buffer), &length) == STATUS_INVALID_HANDLE);
+	CHECK(RequestClose(Loopback, L"\\handle.txt", stale) == STATUS_INVALID_HANDLE);
+	CHECK(RequestClose(Loopback, L"\\handle.txt", 0) == STATUS_INVALID_HANDLE);
+
+	CHECK(g_MemfsCalls[MEMFS_READ_FILE] == reads);
+	CHECK(g_MemfsCalls[MEMFS_WRITE_FILE] == writes);
+	CHECK(g_MemfsCalls[MEMFS_GET_FILE_INFO] == infos);
+	CHECK(g_MemfsCalls[MEMFS_FIND_FILES] == finds);
+
+	// the open file is not disturbed
+	CHECK(RequestRead(Loopback, L"\\handle.txt", context, 0, buffer, sizeof(buffer), &length)
+			== STATUS_SUCCESS);
+	CHECK(length == sizeof(buffer));
+	CHECK(RequestClose(Loopback, L"\\handle.txt", context) == STATUS_SUCCESS);
+	// only the Close of context comes to the file system
+	CHECK(WaitCloseFile(closes + 1) == closes + 1);
+	Sleep(10);
+	CHECK(g_MemfsCalls[MEMFS_CLOSE_FILE] == closes + 1);
+}
+
+
+static VOID
+TestThreads(
+	PDOKAN_LOOPBACK	Loopback)
+{
+	ULONG64	context;
+	CHAR	buffer[16];
+	ULONG	length;
+	ULONG	i;
+
+	// more requests than threads, each one gets its own reply
+	CHECK(MemfsAddFile(L"\\data", 256));
+	CHECK(RequestCreate(Loopback, L"\\data", FILE_OPEN, 0, &context) == STATUS_SUCCESS);
+	for (i = 0; i < 200; ++i) {
+		CHECK(RequestRead(Loopback, L"\\data", context, i, buffer, 1, &length) == STATUS_SUCCESS);
+		CHECK(length == 1 && buffer[0] == (CHAR)i);
+	}
+	CHECK(RequestClose(Loopback, L"\\data", context) == STATUS_SUCCESS);
+}
+
+
+static DOKAN_OPERATIONS	g_MemfsOperations;
+static volatile LONG	g_BlockedReads;
+static HANDLE			g_BlockRelease;
+static volatile LONG	g_MaxBatch;
+static BOOL	(*g_WaitEvent)(HANDLE, PVOID, ULONG, PULONG);
+
+typedef struct _READ_CLIENT {
+	PDOKAN_LOOPBACK	Loopback;
+	LPCWSTR			FileName;
+	ULONG64			Context;
+	CHAR			Buffer[16];
+	ULONG			Length;
+	ULONG			Status;
+} READ_CLIENT, *PREAD_CLIENT;
+
+
+// reads the head of FileName on a thread of its own
+static unsigned __stdcall
+ReadClientThread(
+	void*	Parameter)
+{
+	PREAD_CLIENT	client = (PREAD_CLIENT)Parameter;
+
+	client->Status = RequestRead(client->Loopback, client->FileName, client->Context,
+						0, client->Buffer, sizeof(client->Buffer), &client->Length);
+	return 0;
+}
+
+
+// ReadFile stays in the callback until g_BlockRelease is set
+static int DOKAN_CALLBACK
+BlockReadFile(
+	LPCWSTR				FileName,
+	LPVOID				Buffer,
+	DWORD				BufferLength,
+	LPDWORD				ReadLength,
+	LONGLONG			Offset,
+	PDOKAN_FILE_INFO	DokanFileInfo)
+{
+	InterlockedIncrement(&g_BlockedReads);
+	WaitForSingleObject(g_BlockRelease, INFINITE);
+	return g_MemfsOperations.ReadFile(FileName, Buffer, BufferLength, ReadLength,
+				Offset, DokanFileInfo);
+}
+
+
+// waits until Count reads are in BlockReadFile
+static LONG
+WaitBlockedReads(
+	LONG	Count)
+{
+	ULONG	i;
+
+	for (i = 0; i < 1000 && g_BlockedReads < Count; ++i) {
+		Sleep(1);
+	}
+	return g_BlockedReads;
+}
+
+
+// the largest number of events a DokanLoop thread got at once
+static BOOL
+CountBatchWaitEvent(
+	HANDLE	Channel,
+	PVOID	Buffer,
+	ULONG	BufferLength,
+	PULONG	ReturnedLength)
+{
+	BOOL	status = g_WaitEvent(Channel, Buffer, BufferLength, ReturnedLength);
+	ULONG	offset;
+	LONG	count = 0;
+
+	for (offset = 0; status && offset < *ReturnedLength; ++count) {
+		offset = EVENT_CONTEXT_ALIGN(offset + ((PEVENT_CONTEXT)((PCHAR)Buffer + offset))->Length);
+	}
+	if (count > g_MaxBatch) {
+		g_MaxBatch = count;
+	}
+	return status;
+}
+
+
+// IRP_MJ_CLOSE without IRP_MJ_CLEANUP, returns once it is queued
+static VOID
+QueueClose(
+	PDOKAN_LOOPBACK	Loopback,
+	LPCWSTR			FileName,
+	ULONG64			Context)
+{
+	PEVENT_CONTEXT	eventContext = DokanLoopbackAllocateEvent(IRP_MJ_CLOSE, FileName, NULL, 0);
+
+	eventContext->Context = Context;
+	DokanLoopbackSubmit(Loopback, eventContext, NULL, 0, NULL);
+	DokanLoopbackFreeEvent(eventContext);
+}
+
+
+static VOID
+TestBatch(
+	PDOKAN_OPERATIONS	MemfsOperations)
+{
+	DOKAN_OPTIONS		options;
+	DOKAN_OPERATIONS	operations;
+	PDOKAN_LOOPBACK		loopback;
+	READ_CLIENT			client;
+	HANDLE				clientThread;
+	ULONG64				contexts[3];
+	WCHAR				name[16];
+	LONG				closes;
+	ULONG				i;
+
+	g_MemfsOperations = *MemfsOperations;
+	operations = *MemfsOperations;
+	operations.ReadFile = BlockReadFile;
+	g_BlockRelease = CreateEvent(NULL, TRUE, FALSE, NULL);
+	g_BlockedReads = 0;
+	g_MaxBatch = 0;
+
+	// a single thread, the events queued while it is busy come in one batch
+	ZeroMemory(&options, sizeof(DOKAN_OPTIONS));
+	options.Version = DOKAN_VERSION;
+	options.ThreadCount = 1;
+	options.MountPoint = L"Q:\\";
+
+	g_WaitEvent = DokanLoopbackTransport.WaitEvent;
+	DokanLoopbackTransport.WaitEvent = CountBatchWaitEvent;
+
+	loopback = DokanLoopbackStart(&options, &operations);
+	CHECK(loopback != NULL);
+	if (loopback == NULL) {
+		DokanLoopbackTransport.WaitEvent = g_WaitEvent;
+		CloseHandle(g_BlockRelease);
+		return;
+	}
+
+	CHECK(MemfsAddFile(L"\\block.txt", 16));
+	for (i = 0; i < 3; ++i) {
+		swprintf_s(name, 16, L"\\batch%u.txt", i);
+		CHECK(MemfsAddFile(name, 1));
+		CHECK(RequestCreate(loopback, name, FILE_OPEN, 0, &contexts[i]) == STATUS_SUCCESS);
+	}
+	CHECK(g_MaxBatch == 1);
+
+	ZeroMemory(&client, sizeof(client));
+	client.Loopback = loopback;
+	client.FileName = L"\\block.txt";
+	CHECK(RequestCreate(loopback, L"\\block.txt", FILE_OPEN, 0, &client.Context)
+			== STATUS_SUCCESS);
+	closes = g_RequestCloses;
+	CHECK(WaitCloseFile(closes) == closes);
+
+	clientThread = (HANDLE)_beginthreadex(NULL, 0, ReadClientThread, &client, 0, NULL);
+	CHECK(WaitBlockedReads(1) == 1);
+
+	for (i = 0; i < 3; ++i) {
+		swprintf_s(name, 16, L"\\batch%u.txt", i);
+		QueueClose(loopback, name, contexts[i]);
+	}
+	closes += 3;
+	CHECK(g_MemfsCalls[MEMFS_CLOSE_FILE] < closes);
+
+	SetEvent(g_BlockRelease);
+	WaitForSingleObject(clientThread, INFINITE);
+	CloseHandle(clientThread);
+	CHECK(client.Status == STATUS_SUCCESS && client.Length == 16);
+
+	// every event of the batch is dispatched
+	CHECK(WaitCloseFile(closes) == closes);
+	CHECK(g_MaxBatch == 3);
+
+	CHECK(RequestClose(loopback, L"\\block.txt", client.Context) == STATUS_SUCCESS);
+	DokanLoopbackStop(loopback);
+	DokanLoopbackTransport.WaitEvent = g_WaitEvent;
+	CloseHandle(g_BlockRelease);
+}
+
+
+static VOID
+TestPool(
+	PDOKAN_OPERATIONS	MemfsOperations)
+{
+	DOKAN_OPTIONS			options;
+	DOKAN_OPERATIONS		operations;
+	DOKAN_THREAD_POOL_INFO	info;
+	PDOKAN_LOOPBACK			loopback;
+	READ_CLIENT				clients[4];
+	HANDLE					clientThreads[4];
+	ULONG64					context;
+	ULONG					i;
+
+	g_MemfsOperations = *MemfsOperations;
+	operations = *MemfsOperations;
+	operations.ReadFile = BlockReadFile;
+	g_BlockRelease = CreateEvent(NULL, TRUE, FALSE, NULL);
+	g_BlockedReads = 0;
+
+	ZeroMemory(&options, sizeof(DOKAN_OPTIONS));
+	options.Version = DOKAN_VERSION;
+	options.ThreadCount = 1;
+	options.MaxThreadCount = 3;
+	options.MountPoint = L"R:\\";
+
+	loopback = DokanLoopbackStart(&options, &operations);
+	CHECK(loopback != NULL);
+	if (loopback == NULL) {
+		CloseHandle(g_BlockRelease);
+		return;
+	}
+	CHECK(DokanGetThreadPoolInfo(L"R:\\", &info));
+	CHECK(info.ThreadCount == 1 && info.MinThreadCount == 1 && info.MaxThreadCount == 3);
+
+	CHECK(RequestCreate(loopback, L"\\block.txt", FILE_OPEN, 0, &context) == STATUS_SUCCESS);
+
+	// a thread is added whenever none is left waiting, up to MaxThreadCount.
+	// The reads come one by one, so that none is packed behind another.
+	for (i = 0; i < 4; ++i) {
+		ZeroMemory(&clients[i], sizeof(READ_CLIENT));
+		clients[i].Loopback = loopback;
+		clients[i].FileName = L"\\block.txt";
+		clients[i].Context = context;
+		clientThreads[i] = (HANDLE)_beginthreadex(NULL, 0, ReadClientThread,
+							&clients[i], 0, NULL);
+		CHECK(WaitBlockedReads(min(i + 1, 3)) == (LONG)min(i + 1, 3));
+	}
+	Sleep(20);
+	CHECK(g_BlockedReads == 3);
+	CHECK(DokanGetThreadPoolInfo(L"R:\\", &info));
+	CHECK(info.ThreadCount == 3);
+	CHECK(info.IdleThreadCount == 0);
+
+	SetEvent(g_BlockRelease);
+	for (i = 0; i < 4; ++i) {
+		WaitForSingleObject(clientThreads[i], INFINITE);
+		CloseHandle(clientThreads[i]);
+		CHECK(clients[i].Status == STATUS_SUCCESS && clients[i].Length == 16);
+	}
+	CHECK(g_BlockedReads == 4);
+
+	// the pool does not shrink below ThreadCount
+	CHECK(DokanGetThreadPoolInfo(L"R:\\", &info));
+	CHECK(info.ThreadCount >= 1 && info.ThreadCount <= 3);
+
+	CHECK(RequestClose(loopback, L"\\block.txt", context) == STATUS_SUCCESS);
+	DokanLoopbackStop(loopback);
+	CloseHandle(g_BlockRelease);
+	CHECK(!DokanGetThreadPoolInfo(L"R:\\", &info));
+
+	// MaxThreadCount is not known to older versions
+	options.Version = DOKAN_THREAD_POOL_SUPPORTED_VERSION - 10;
+	loopback = DokanLoopbackStart(&options, &operations);
+	CHECK(loopback != NULL);
+	if (loopback != NULL) {
+		CHECK(DokanGetThreadPoolInfo(L"R:\\", &info));
+		CHECK(info.MinThreadCount == 1 && info.MaxThreadCount == 1);
+		DokanLoopbackStop(loopback);
+	}
+}
+
+
+// DOKAN_OPTION_ASYNC: ReadFile and WriteFile return ERROR_IO_PENDING and
+// AsyncThread runs memfs and calls DokanCompleteOperation, one operation
+// at a time while AsyncRelease is set
+
+#define ASYNC_QUEUE_LENGTH	16
+
+typedef struct _ASYNC_OPERATION {
+	LPCWSTR				FileName;
+	LPVOID				Buffer;
+	DWORD				Length;
+	LONGLONG			Offset;
+	BOOL				Write;
+	PDOKAN_FILE_INFO	DokanFileInfo;
+	// DokanLoop thread which called ReadFile or WriteFile
+	DWORD				ThreadId;
+} ASYNC_OPERATION, *PASYNC_OPERATION;
+
+static CRITICAL_SECTION	g_AsyncLock;
+static ASYNC_OPERATION	g_AsyncQueue[ASYNC_QUEUE_LENGTH];
+static ULONG			g_AsyncHead;
+static ULONG			g_AsyncTail;
+static HANDLE			g_AsyncQueued;
+static HANDLE			g_AsyncRelease;
+static volatile LONG	g_AsyncBegun;
+static volatile LONG	g_AsyncCompleted;
+static volatile BOOL	g_AsyncOtherThread;
+
+
+static int
+QueueAsyncOperation(
+	LPCWSTR				FileName,
+	LPVOID				Buffer,
+	DWORD				Length,
+	LONGLONG			Offset,
+	BOOL				Write,
+	PDOKAN_FILE_INFO	DokanFileInfo)
+{
+	PASYNC_OPERATION	operation;
+
+	EnterCriticalSection(&g_AsyncLock);
+	if (g_AsyncTail - g_AsyncHead == ASYNC_QUEUE_LENGTH) {
+		LeaveCriticalSection(&g_AsyncLock);
+		return -ERROR_NOT_ENOUGH_MEMORY;
+	}
+	operation = &g_AsyncQueue[g_AsyncTail++ % ASYNC_QUEUE_LENGTH];
+	operation->FileName = FileName;
+	operation->Buffer = Buffer;
+	operation->Length = Length;
+	operation->Offset = Offset;
+	operation->Write = Write;
+	operation->DokanFileInfo = DokanFileInfo;
+	operation->ThreadId = GetCurrentThreadId();
+	LeaveCriticalSection(&g_AsyncLock);
+
+	InterlockedIncrement(&g_AsyncBegun);
+	ReleaseSemaphore(g_AsyncQueued, 1, NULL);
+	return ERROR_IO_PENDING;
+}
+
+
+static int DOKAN_CALLBACK
+AsyncReadFile(
+	LPCWSTR				FileName,
+	LPVOID				Buffer,
+	DWORD				BufferLength,
+	LPDWORD				ReadLength,
+	LONGLONG			Offset,
+	PDOKAN_FILE_INFO	DokanFileInfo)
+{
+	*ReadLength = 0;
+	return QueueAsyncOperation(FileName, Buffer, BufferLength, Offset, FALSE, DokanFileInfo);
+}
+
+
+static int DOKAN_CALLBACK
+AsyncWriteFile(
+	LPCWSTR				FileName,
+	LPCVOID				Buffer,
+	DWORD				NumberOfBytesToWrite,
+	LPDWORD				NumberOfBytesWritten,
+	LONGLONG			Offset,
+	PDOKAN_FILE_INFO	DokanFileInfo)
+{
+	*NumberOfBytesWritten = 0;
+	return QueueAsyncOperation(FileName, (LPVOID)Buffer, NumberOfBytesToWrite, Offset,
+				TRUE, DokanFileInfo);
+}
+
+
+static unsigned __stdcall
+AsyncThread(
+	void*	Parameter)
+{
+	DWORD			threadId = GetCurrentThreadId();
+	ASYNC_OPERATION	operation;
+	DWORD			length;
+	int				status;
+
+	UNREFERENCED_PARAMETER(Parameter);
+
+	for (;;) {
+		WaitForSingleObject(g_AsyncQueued, INFINITE);
+		EnterCriticalSection(&g_AsyncLock);
+		if (g_AsyncHead == g_AsyncTail) {
+			// woken up to exit
+			LeaveCriticalSection(&g_AsyncLock);
+			break;
+		}
+		operation = g_AsyncQueue[g_AsyncHead % ASYNC_QUEUE_LENGTH];
+		LeaveCriticalSection(&g_AsyncLock);
+
+		WaitForSingleObject(g_AsyncRelease, INFINITE);
+
+		if (operation.Write) {
+			status = g_MemfsOperations.WriteFile(operation.FileName, operation.Buffer,
+						operation.Length, &length, operation.Offset, operation.DokanFileInfo);
+		} else {
+			status = g_MemfsOperations.ReadFile(operation.FileName, operation.Buffer,
+						operation.Length, &length, operation.Offset, operation.DokanFileInfo);
+		}
+		if (operation.ThreadId != threadId) {
+			g_AsyncOtherThread = TRUE;
+		}
+		EnterCriticalSection(&g_AsyncLock);
+		g_AsyncHead++;
+		LeaveCriticalSection(&g_AsyncLock);
+
+		// the requester may see the reply before DokanCompleteOperation returns
+		InterlockedIncrement(&g_AsyncCompleted);
+		DokanCompleteOperation(operation.DokanFileInfo, status, length);
+	}
+	return 0;
+}
+
+
+static unsigned __stdcall
+AsyncStopThread(
+	void*	Parameter)
+{
+	DokanLoopbackStop((PDOKAN_LOOPBACK)Parameter);
+	return 0;
+}
+
+
+static VOID
+TestAsync(
+	PDOKAN_OPERATIONS	MemfsOperations)
+{
+	DOKAN_OPTIONS		options;
+	DOKAN_OPERATIONS	operations;
+	PDOKAN_LOOPBACK		loopback;
+	READ_CLIENT			client;
+	HANDLE				asyncThread, clientThread, stopThread;
+	ULONG64				context;
+	CHAR				buffer[16];
+	ULONG				length;
+	ULONG				i;
+
+	g_MemfsOperations = *MemfsOperations;
+	operations = *MemfsOperations;
+	operations.ReadFile = AsyncReadFile;
+	operations.WriteFile = AsyncWriteFile;
+
+	InitializeCriticalSection(&g_AsyncLock);
+	g_AsyncQueued = CreateSemaphore(NULL, 0, MAXLONG, NULL);
+	g_AsyncRelease = CreateEvent(NULL, TRUE, TRUE, NULL);
+	asyncThread = (HANDLE)_beginthreadex(NULL, 0, AsyncThread, NULL, 0, NULL);
+
+	ZeroMemory(&options, sizeof(DOKAN_OPTIONS));
+	options.Version = DOKAN_VERSION;
+	options.ThreadCount = 2;
+	options.Options = DOKAN_OPTION_ASYNC;
+	options.MountPoint = L"N:\\";
+
+	loopback = DokanLoopbackStart(&options, &operations);
+	CHECK(loopback != NULL);
+	if (loopback == NULL) {
+		return;
+	}
+
+	// the replies come through the CompletionChannel from AsyncThread
+	CHECK(RequestCreate(loopback, L"\\async.txt", FILE_CREATE, 0, &context) == STATUS_SUCCESS);
+	CHECK(RequestWrite(loopback, L"\\async.txt", context, 0, "0123456789abcdef", 16)
+			== STATUS_SUCCESS);
+	for (i = 0; i < 16; ++i) {
+		CHECK(RequestRead(loopback, L"\\async.txt", context, i, buffer, 1, &length)
+				== STATUS_SUCCESS);
+		CHECK(length == 1 && buffer[0] == "0123456789abcdef"[i]);
+	}
+	CHECK(RequestRead(loopback, L"\\async.txt", context, 16, buffer, 1, &length)
+			== STATUS_END_OF_FILE);
+	CHECK(g_AsyncBegun == 18);
+	CHECK(g_AsyncCompleted == 18);
+	CHECK(g_AsyncOtherThread);
+
+	// unmount waits for the read which is not completed yet
+	ResetEvent(g_AsyncRelease);
+	client.Loopback = loopback;
+	client.FileName = L"\\async.txt";
+	client.Context = context;
+	client.Length = 0;
+	client.Status = (ULONG)-1;
+	clientThread = (HANDLE)_beginthreadex(NULL, 0, ReadClientThread, &client, 0, NULL);
+	for (i = 0; i < 1000 && g_AsyncBegun < 19; ++i) {
+		Sleep(1);
+	}
+	CHECK(g_AsyncBegun == 19);
+
+	stopThread = (HANDLE)_beginthreadex(NULL, 0, AsyncStopThread, loopback, 0, NULL);
+	CHECK(WaitForSingleObject(stopThread, 50) == WAIT_TIMEOUT);
+	CHECK(WaitForSingleObject(clientThread, 0) == WAIT_TIMEOUT);
+
+	SetEvent(g_AsyncRelease);
+	CHECK(WaitForSingleObject(stopThread, 5000) == WAIT_OBJECT_0);
+	WaitForSingleObject(clientThread, INFINITE);
+	CHECK(client.Status == STATUS_SUCCESS);
+	CHECK(client.Length == 16 && memcmp(client.Buffer, "0123456789abcdef", 16) == 0);
+	CHECK(g_AsyncCompleted == 19);
+
+	CloseHandle(stopThread);
+	CloseHandle(clientThread);
+
+	ReleaseSemaphore(g_AsyncQueued, 1, NULL);
+	WaitForSingleObject(asyncThread, INFINITE);
+	CloseHandle(asyncThread);
+	CloseHandle(g_AsyncQueued);
+	CloseHandle(g_AsyncRelease);
+	DeleteCriticalSection(&g_AsyncLock);
+}
+
+
+static volatile LONG	g_WriteRequests;
+static BOOL	(*g_SendWriteRequest)(HANDLE, PEVENT_INFORMATION, ULONG, PVOID, ULONG);
+
+// counts the writes fetched in a second round-trip
+static BOOL
+CountWriteRequest(
+	HANDLE				Channel,
+	PEVENT_INFORMATION	EventInfo,
+	ULONG				EventLength,
+	PVOID				Buffer,
+	ULONG				BufferLength)
+{
+	InterlockedIncrement(&g_WriteRequests);
+	return g_SendWriteRequest(Channel, EventInfo, EventLength, Buffer, BufferLength);
+}
+
+
+static VOID
+TestEventBufferSize(
+	PDOKAN_OPERATIONS	Operations)
+{
+	DOKAN_OPTIONS		options;
+	PDOKAN_LOOPBACK		loopback;
+	ULONG64				context;
+	ULONG				size = 256 * 1024;
+	PCHAR				data = (PCHAR)malloc(size * 3);
+	ULONG				length;
+	ULONG				i;
+
+	ZeroMemory(&options, sizeof(DOKAN_OPTIONS));
+	options.Version = DOKAN_VERSION;
+
+	// rounded into the range the driver accepts
+	CHECK(GetEventBufferSize(&options) == EVENT_CONTEXT_MAX_SIZE);
+	options.EventBufferSize = 1024;
+	CHECK(GetEventBufferSize(&options) == EVENT_CONTEXT_MAX_SIZE);
+	options.EventBufferSize = size * 2 + 5;
+	CHECK(GetEventBufferSize(&options) == size * 2);
+	options.EventBufferSize = EVENT_CONTEXT_MAX_BUFFER_SIZE * 2;
+	CHECK(GetEventBufferSize(&options) == EVENT_CONTEXT_MAX_BUFFER_SIZE);
+	options.Version = DOKAN_EVENT_BUFFER_SUPPORTED_VERSION - 10;
+	CHECK(GetEventBufferSize(&options) == EVENT_CONTEXT_MAX_SIZE);
+
+	options.Version = DOKAN_VERSION;
+	options.ThreadCount = 2;
+	options.MountPoint = L"O:\\";
+	options.EventBufferSize = size * 2 + 5;
+
+	g_SendWriteRequest = DokanLoopbackTransport.SendWriteRequest;
+	DokanLoopbackTransport.SendWriteRequest = CountWriteRequest;
+
+	loopback = DokanLoopbackStart(&options, Operations);
+	CHECK(loopback != NULL);
+	if (loopback == NULL) {
+		DokanLoopbackTransport.SendWriteRequest = g_SendWriteRequest;
+		free(data);
+		return;
+	}
+
+	for (i = 0; i < size * 3; ++i) {
+		data[i] = (CHAR)(i % 253);
+	}
+	CHECK(RequestCreate(loopback, L"\\buffer.bin", FILE_OVERWRITE_IF, 0, &context)
+			== STATUS_SUCCESS);
+
+	// a write which fits the event buffer comes in the event
+	CHECK(RequestWrite(loopback, L"\\buffer.bin", context, 0, data, size) == STATUS_SUCCESS);
+	CHECK(g_WriteRequests == 0);
+
+	// a bigger one is fetched in a second round-trip
+	CHECK(RequestWrite(loopback, L"\\buffer.bin", context, 0, data, size * 3) == STATUS_SUCCESS);
+	CHECK(g_WriteRequests == 1);
+
+	ZeroMemory(data, size * 3);
+	CHECK(RequestRead(loopback, L"\\buffer.bin", context, 0, data, size * 3, &length)
+			== STATUS_SUCCESS);
+	CHECK(length == size * 3);
+	CHECK(data[size * 3 - 1] == (CHAR)((size * 3 - 1) % 253));
+	CHECK(RequestClose(loopback, L"\\buffer.bin", context) == STATUS_SUCCESS);
+
+	DokanLoopbackStop(loopback);
+	DokanLoopbackTransport.SendWriteRequest = g_SendWriteRequest;
+	free(data);
+}
+
+
+static volatile LONG		g_CursorVisited;
+static PFillFindDataWithCursor	g_CursorFill;
+static PDOKAN_OPERATIONS	g_CursorOperations;
+
+// counts the entries the file system walks through
+static int WINAPI
+CountCursorFill(
+	PWIN32_FIND_DATAW	FindData,
+	ULONG64				NextCursor,
+	PDOKAN_FILE_INFO	DokanFileInfo)
+{
+	InterlockedIncrement(&g_CursorVisited);
+	return g_CursorFill(FindData, NextCursor, DokanFileInfo);
+}
+
+
+static int DOKAN_CALLBACK
+CountFindFilesWithCursor(
+	LPCWSTR					FileName,
+	LPCWSTR					SearchPattern,
+	ULONG64					Cursor,
+	PFillFindDataWithCursor	FillFindData,
+	PDOKAN_FILE_INFO		DokanFileInfo)
+{
+	g_CursorFill = FillFindData;
+	return g_CursorOperations->FindFilesWithCursor(FileName, SearchPattern, Cursor,
+				CountCursorFill, DokanFileInfo);
+}
+
+
+// checks a FILE_NAMES_INFORMATION listing holds the synthetic names
+// from First on, returns the number of names
+static ULONG
+CheckSyntheticNames(
+	PVOID	Buffer,
+	ULONG	Length,
+	ULONG	First)
+{
+	PFILE_NAMES_INFORMATION	info = (PFILE_NAMES_INFORMATION)Buffer;
+	WCHAR					name[16];
+	ULONG					count = 0;
+
+	if (Length == 0) {
+		return 0;
+	}
+	for (;;) {
+		MemfsSyntheticName(First + count, name);
+		CHECK(info->FileNameLength == 8 * sizeof(WCHAR) &&
+			memcmp(info->FileName, name, info->FileNameLength) == 0);
+		count++;
+		if (info->NextEntryOffset == 0) {
+			break;
+		}
+		info = (PFILE_NAMES_INFORMATION)((PCHAR)info + info->NextEntryOffset);
+	}
+	return count;
+}
+
+
+static VOID
+TestCursor(VOID)
+{
+	DOKAN_OPTIONS		options;
+	DOKAN_OPERATIONS	memfs;
+	DOKAN_OPERATIONS	operations;
+	PDOKAN_LOOPBACK		loopback;
+	ULONG64				context;
+	CHAR				buffer[4096];
+	ULONG				length;
+	ULONG				index = 0;
+	ULONG				total = 0;
+	ULONG				queries = 0;
+	ULONG				count = 0;
+	LONG				finds;
+	BOOL				found = FALSE;
+	ULONG				status;
+
+	MemfsInitialize(&memfs, TRUE);
+	g_CursorOperations = &memfs;
+	operations = memfs;
+	operations.FindFilesWithCursor = CountFindFilesWithCursor;
+
+	ZeroMemory(&options, sizeof(DOKAN_OPTIONS));
+	options.Version = DOKAN_VERSION;
+	options.ThreadCount = 2;
+	options.MountPoint = L"P:\\";
+
+	loopback = DokanLoopbackStart(&options, &operations);
+	CHECK(loopback != NULL);
+	if (loopback == NULL) {
+		return;
+	}
+
+	CHECK(MemfsAddSyntheticDirectory(L"\\many", 3000));
+	CHECK(RequestCreate(loopback, L"\\many", FILE_OPEN, FILE_DIRECTORY_FILE, &context)
+			== STATUS_SUCCESS);
+
+	// each query resumes at the cursor, the file system walks every
+	// entry once plus the one which did not fit
+	finds = g_MemfsCalls[MEMFS_FIND_FILES];
+	g_CursorVisited = 0;
+	for (;;) {
+		status = RequestDirectory(loopback, L"\\many", L"*", context, FileNamesInformation,
+					&index, buffer, sizeof(buffer), &length);
+		if (status != STATUS_SUCCESS) {
+			CHECK(status == STATUS_NO_MORE_FILES);
+			break;
+		}
+		queries++;
+		total += CheckSyntheticNames(buffer, length, total);
+		CHECK(index == total);
+		CHECK(total <= 3000);
+	}
+	CHECK(total == 3000);
+	CHECK(queries > 1);
+	CHECK(g_MemfsCalls[MEMFS_FIND_FILES] - finds == (LONG)queries + 1);
+	CHECK(g_CursorVisited <= (LONG)(3000 + queries));
+
+	// 0 starts over, an index the last query did not return skips
+	// as many entries
+	index = 0;
+	CHECK(RequestDirectory(loopback, L"\\many", L"*", context, FileNamesInformation,
+			&index, buffer, sizeof(buffer), &length) == STATUS_SUCCESS);
+	CHECK(CheckSyntheticNames(buffer, length, 0) > 0);
+	index = 10;
+	CHECK(RequestDirectory(loopback, L"\\many", L"*", context, FileNamesInformation,
+			&index, buffer, sizeof(buffer), &length) == STATUS_SUCCESS);
+	count = CheckSyntheticNames(buffer, length, 10);
+	CHECK(count > 0);
+	CHECK(index == 10 + count);
+
+	// the pattern is applied to the streamed entries
+	index = 0;
+	total = 0;
+	for (;;) {
+		status = RequestDirectory(loopback, L"\\many", L"f00001*", context, FileNamesInformation,
+					&index, buffer, sizeof(buffer), &length);
+		if (status != STATUS_SUCCESS) {
+			CHECK(status == STATUS_NO_MORE_FILES);
+			break;
+		}
+		total += CheckSyntheticNames(buffer, length, 100 + total);
+	}
+	CHECK(total == 100);
+
+	index = 0;
+	CHECK(RequestDirectory(loopback, L"\\many", L"none*", context, FileNamesInformation,
+			&index, buffer, sizeof(buffer), &length) == STATUS_NO_SUCH_FILE);
+
+	CHECK(MemfsAddFile(L"\\many\\z.txt", 1));
+	index = 2999;
+	CHECK(RequestDirectory(loopback, L"\\many", L"*", context, FileNamesInformation,
+			&index, buffer, sizeof(buffer), &length) == STATUS_SUCCESS);
+	CHECK(CountNames(buffer, length, L"z.txt", &found) == 2);
+	CHECK(found);
+
+	CHECK(RequestClose(loopback, L"\\many", context) == STATUS_SUCCESS);
+	DokanLoopbackStop(loopback);
+}
+
+
+int
+main(void)
+{
+	DOKAN_OPTIONS		options;
+	DOKAN_OPERATIONS	operations;
+	PDOKAN_LOOPBACK		loopback;
+
+	TestInitialize();
+	MemfsInitialize(&operations, FALSE);
+
+	ZeroMemory(&options, sizeof(DOKAN_OPTIONS));
+	options.Version = DOKAN_VERSION;
+	options.ThreadCount = 4;
+	options.MountPoint = L"M:\\";
+
+	loopback = DokanLoopbackStart(&options, &operations);
+	CHECK(loopback != NULL);
+	if (loopback == NULL) {
+		return TestResult("loopback_test");
+	}
+
+	TestReadWrite(loopback);
+	TestDirectory(loopback);
+	TestLargeDirectory(loopback);
+	TestHandles(loopback);
+	TestThreads(loopback);
+	CHECK(g_RequestLongReplies == 0);
+
+	DokanLoopbackStop(loopback);
+
+	TestEventBufferSize(&operations);
+	TestAsync(&operations);
+	TestBatch(&operations);
+	TestPool(&operations);
+	TestCursor();
+	return TestResult("loopback_test");
+}
@@ -0,0 +1,137 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2008 Hiroki Asakawa info@dokan-dev.net
+
+  http://dokan-dev.net/en
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "test.h"
+#include "refmatch.h"
+
+
+// Search pattern matching
+//
+// Cost per name of the recursive matcher (refmatch.c), of
+// DokanIsNameInExpression, which compiles the expression on each call,
+// and of an expression compiled once per listing as FindFiles does.
+
+#define MATCH_BENCH_NAMES	100000
+#define MATCH_BENCH_ROUNDS	20
+
+
+static LPCWSTR g_Extensions[] = { L"txt", L"c", L"h", L"tar.gz", L"" };
+
+static LPCWSTR g_Patterns[] = {
+	L"*",
+	L"*.txt",
+	L"F000*5.TXT",
+	L"<.txt",
+	L"<\">>>",
+	L"*a*b*c*",
+};
+
+
+static VOID
+MakeNames(
+	LPWSTR*	Names,
+	ULONG	Count)
+{
+	ULONG	extensions = sizeof(g_Extensions) / sizeof(g_Extensions[0]);
+	ULONG	i;
+
+	for (i = 0; i < Count; ++i) {
+		LPCWSTR	extension = g_Extensions[i % extensions];
+		Names[i] = (LPWSTR)malloc(32 * sizeof(WCHAR));
+		if (extension[0]) {
+			swprintf_s(Names[i], 32, L"f%07u.%s", i, extension);
+		} else {
+			swprintf_s(Names[i], 32, L"f%07u", i);
+		}
+	}
+}
+
+
+int main(void)
+{
+	ULONG	count = (ULONG)(MATCH_BENCH_NAMES * BenchScale());
+	ULONG	rounds = MATCH_BENCH_ROUNDS;
+	LPWSTR*	names;
+	ULONG	p, r, i;
+
+	TestInitialize();
+
+	if (count < 100) {
+		count = 100;
+	}
+	names = (LPWSTR*)malloc(count * sizeof(LPWSTR));
+	MakeNames(names, count);
+
+	printf("%-12s %10s %12s %12s %12s\n", "pattern", "matched",
+		"recursive", "per call", "compiled");
+
+	for (p = 0; p < sizeof(g_Patterns) / sizeof(g_Patterns[0]); ++p) {
+		LPCWSTR	pattern = g_Patterns[p];
+		ULONG	refMatched = 0, callMatched = 0, compiledMatched = 0;
+		double	start, ref, call, compiled;
+		char*	label;
+
+		start = TestNow();
+		for (r = 0; r < rounds; ++r) {
+			for (i = 0; i < count; ++i) {
+				refMatched += RefIsNameInExpression(pattern, names[i], TRUE, REF_CHANGE_ALL);
+			}
+		}
+		ref = TestNow() - start;
+
+		start = TestNow();
+		for (r = 0; r < rounds; ++r) {
+			for (i = 0; i < count; ++i) {
+				callMatched += DokanIsNameInExpression(pattern, names[i], TRUE);
+			}
+		}
+		call = TestNow() - start;
+
+		start = TestNow();
+		for (r = 0; r < rounds; ++r) {
+			PDOKAN_NAME_EXPRESSION expression = CompileNameExpression(pattern, TRUE);
+			for (i = 0; i < count; ++i) {
+				compiledMatched += MatchNameExpression(expression, names[i]);
+			}
+			FreeNameExpression(expression);
+		}
+		compiled = TestNow() - start;
+
+		label = HostNarrowString(pattern);
+		printf("%-12s %10u %9.1f ns %9.1f ns %9.1f ns\n", label, refMatched / rounds,
+			ref * 1e9 / ((double)count * rounds),
+			call * 1e9 / ((double)count * rounds),
+			compiled * 1e9 / ((double)count * rounds));
+		free(label);
+
+		if (refMatched != callMatched || refMatched != compiledMatched) {
+			printf("match_bench: results differ, %u, %u and %u names matched\n",
+				refMatched, callMatched, compiledMatched);
+			return 1;
+		}
+	}
+
+	for (i = 0; i < count; ++i) {
+		free(names[i]);
+	}
+	free(names);
+	return 0;
+}
@@ -0,0 +1,378 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2008 Hiroki Asakawa info@dokan-dev.net
+
+  http://dokan-dev.net/en
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "test.h"
+#include "refmatch.h"
+
+
+// Search pattern matching
+//
+// The compiled expressions of dokan/match.c are compared with the
+// recursive matcher they replaced (refmatch.c) with the behavior changes
+// of match.c: for fixed corner cases, for every expression and name up
+// to a few characters and for random longer ones. Each behavior change
+// is checked against the baseline, and where the baseline differs from
+// match.c one of the changes alone must account for it.
+
+#define MATCH_EXPRESSION_CHARS	L"aB.*?<>\""
+#define MATCH_NAME_CHARS		L"ab."
+#define MATCH_RANDOM_PAIRS		200000
+#define MATCH_MAX_REPORTS		10
+
+
+static ULONG g_Mismatches;
+
+
+static VOID
+PrintPair(
+	LPCWSTR		Expression,
+	LPCWSTR		Name,
+	BOOL		IgnoreCase)
+{
+	char*	expression = HostNarrowString(Expression);
+	char*	name = HostNarrowString(Name);
+
+	fprintf(stderr, "  '%s' '%s' ignorecase %d: ",
+		expression ? expression : "", name ? name : "", IgnoreCase);
+	free(expression);
+	free(name);
+}
+
+
+static VOID
+CheckCase(
+	LPCWSTR		Expression,
+	LPCWSTR		Name,
+	BOOL		IgnoreCase,
+	BOOL		Expected)
+{
+	BOOL	ref = RefIsNameInExpression(Expression, Name, IgnoreCase, REF_CHANGE_ALL);
+	BOOL	match = DokanIsNameInExpression(Expression, Name, IgnoreCase);
+
+	CHECK(ref == Expected);
+	CHECK(match == Expected);
+	if (ref != Expected || match != Expected) {
+		PrintPair(Expression, Name, IgnoreCase);
+		fprintf(stderr, "expected %d, reference %d, compiled %d\n", Expected, ref, match);
+	}
+}
+
+
+// Change of refmatch.h turns Baseline into Expected
+static VOID
+CheckChange(
+	LPCWSTR		Expression,
+	LPCWSTR		Name,
+	ULONG		Change,
+	BOOL		Baseline,
+	BOOL		Expected)
+{
+	// the nulls the baseline reads past the name
+	WCHAR	name[32];
+	BOOL	base, ref, match;
+
+	ZeroMemory(name, sizeof(name));
+	wcscpy_s(name, 16, Name);
+
+	base = RefIsNameInExpression(Expression, name, TRUE, 0);
+	ref = RefIsNameInExpression(Expression, name, TRUE, Change);
+	match = DokanIsNameInExpression(Expression, name, TRUE);
+
+	CHECK(base == Baseline);
+	CHECK(ref == Expected);
+	CHECK(match == Expected);
+	if (base != Baseline || ref != Expected || match != Expected) {
+		PrintPair(Expression, Name, TRUE);
+		fprintf(stderr, "baseline %d, changed %d, compiled %d\n", base, ref, match);
+	}
+}
+
+
+static VOID
+ReportMismatch(
+	LPCWSTR		Expression,
+	LPCWSTR		Name,
+	BOOL		IgnoreCase,
+	BOOL		Ref,
+	BOOL		Match)
+{
+	if (g_Mismatches++ < MATCH_MAX_REPORTS) {
+		PrintPair(Expression, Name, IgnoreCase);
+		fprintf(stderr, "reference %d, compiled %d\n", Ref, Match);
+	}
+}
+
+
+static VOID
+TestCornerCases(void)
+{
+	// DOS_QM matches zero characters at the end of the name
+	CheckCase(L"<\">>>", L"a.b", TRUE, TRUE);
+	CheckCase(L"<.>>>", L"a.b", TRUE, TRUE);
+	CheckCase(L">>>", L"ab", TRUE, TRUE);
+	CheckCase(L">>>", L"abcd", TRUE, FALSE);
+	CheckCase(L"<\">", L"abc", TRUE, TRUE);
+	CheckCase(L"<\">>>", L"a.bcde", TRUE, FALSE);
+
+	// DOS_QM at a period: consumed unless it is the last one
+	CheckCase(L">.b", L"a.b", TRUE, TRUE);
+	CheckCase(L">>.b", L"a.b", TRUE, TRUE);
+	CheckCase(L">>>.b", L"a.b.b", TRUE, TRUE);
+	CheckCase(L">.>", L"a.b.c", TRUE, FALSE);
+
+	// DOS_STAR stops at the last period
+	CheckCase(L"<", L"abc", TRUE, TRUE);
+	CheckCase(L"<", L"a.b", TRUE, FALSE);
+	CheckCase(L"<.txt", L"a.b.txt", TRUE, TRUE);
+	CheckCase(L"<.b", L"a.b.c", TRUE, FALSE);
+
+	// DOS_DOT: a period or nothing
+	CheckCase(L"a\"", L"a", TRUE, TRUE);
+	CheckCase(L"a\"", L"a.", TRUE, TRUE);
+	CheckCase(L"a\"b", L"ab", TRUE, TRUE);
+
+	// '?' is exactly one character
+	CheckCase(L"*.???", L"a.b", TRUE, FALSE);
+	CheckCase(L"*.???", L"a.bcd", TRUE, TRUE);
+	CheckCase(L"?", L"ab", TRUE, FALSE);
+
+	CheckCase(L"*", L"abc", TRUE, TRUE);
+	CheckCase(L"*.txt", L"a.txt", TRUE, TRUE);
+	CheckCase(L"*.txt", L"a.txt.bak", TRUE, FALSE);
+	CheckCase(L"*a*b*", L"xaybz", TRUE, TRUE);
+	CheckCase(L"*a*b*", L"xbyaz", TRUE, FALSE);
+	CheckCase(L"FOO.TXT", L"foo.txt", TRUE, TRUE);
+	CheckCase(L"FOO.TXT", L"foo.txt", FALSE, FALSE);
+	CheckCase(L"F*", L"foo", FALSE, FALSE);
+	CheckCase(L"", L"a", TRUE, FALSE);
+}
+
+
+static VOID
+TestBehaviorChanges(void)
+{
+	// '?' stepped over the end of the name
+	CheckChange(L"a?*", L"a", REF_CHANGE_END_OF_NAME, TRUE, FALSE);
+	CheckChange(L"a??*", L"a", REF_CHANGE_END_OF_NAME, TRUE, FALSE);
+	CheckChange(L"a?", L"a", REF_CHANGE_END_OF_NAME, FALSE, FALSE);
+
+	// DOS_QM stepped over the end of the name too, so names shorter
+	// than the run of DOS_QMs did not match
+	CheckChange(L">>>", L"ab", REF_CHANGE_END_OF_NAME, FALSE, TRUE);
+	CheckChange(L"<\">>>", L"a.b", REF_CHANGE_END_OF_NAME, FALSE, TRUE);
+	CheckChange(L">>", L"ab", REF_CHANGE_END_OF_NAME, TRUE, TRUE);
+
+	// DOS_STAR at the start of a name without a period stopped at once
+	CheckChange(L"<", L"abc", REF_CHANGE_DOS_STAR, FALSE, TRUE);
+	CheckChange(L"<b", L"ab", REF_CHANGE_DOS_STAR, FALSE, TRUE);
+	CheckChange(L"a<", L"abc", REF_CHANGE_DOS_STAR, TRUE, TRUE);
+	CheckChange(L"<.txt", L"a.txt", REF_CHANGE_DOS_STAR, TRUE, TRUE);
+}
+
+
+// an expression longer than MAX_PATH is not compiled on the stack
+static VOID
+TestLongExpression(void)
+{
+	WCHAR	expression[MAX_PATH + 64];
+	WCHAR	name[MAX_PATH + 64];
+	ULONG	length = MAX_PATH + 40;
+	ULONG	i;
+
+	for (i = 0; i < length; ++i) {
+		expression[i] = i % 3 == 0 ? L'?' : L'a';
+		name[i] = L'a';
+	}
+	expression[length] = L'\0';
+	name[length] = L'\0';
+	CheckCase(expression, name, TRUE, TRUE);
+
+	expression[length - 1] = L'*';
+	CheckCase(expression, name, TRUE, TRUE);
+	name[length - 1] = L'\0';
+	CheckCase(expression, name, TRUE, TRUE);
+	name[length - 2] = L'\0';
+	CheckCase(expression, name, TRUE, FALSE);
+}
+
+
+// Length characters of Alphabet for Index, in base of the alphabet
+static VOID
+MakeString(
+	LPWSTR		String,
+	LPCWSTR		Alphabet,
+	ULONG		Length,
+	ULONG		Index)
+{
+	ULONG	base = (ULONG)wcslen(Alphabet);
+	ULONG	i;
+
+	for (i = 0; i < Length; ++i) {
+		String[i] = Alphabet[Index % base];
+		Index /= base;
+	}
+	String[Length] = L'\0';
+}
+
+
+static ULONG
+Power(
+	ULONG	Base,
+	ULONG	Exponent)
+{
+	ULONG	value = 1;
+	while (Exponent-- > 0) {
+		value *= Base;
+	}
+	return value;
+}
+
+
+// every expression of up to 4 characters against every name of up to
+// 5, one compiled expression for all names, and the pairs where the
+// baseline differs by the changes it takes
+static VOID
+TestExhaustive(void)
+{
+	ULONG	expressionChars = (ULONG)wcslen(MATCH_EXPRESSION_CHARS);
+	ULONG	nameChars = (ULONG)wcslen(MATCH_NAME_CHARS);
+	ULONG	pairs = 0;
+	ULONG	endOfName = 0;
+	ULONG	dosStar = 0;
+	ULONG	both = 0;
+	ULONG	el, ei, nl, ni;
+	int		ignoreCase;
+
+	g_Mismatches = 0;
+
+	for (ignoreCase = 0; ignoreCase < 2; ++ignoreCase) {
+		for (el = 0; el <= 4; ++el) {
+			for (ei = 0; ei < Power(expressionChars, el); ++ei) {
+				WCHAR	expression[8];
+				PDOKAN_NAME_EXPRESSION	compiled;
+
+				MakeString(expression, MATCH_EXPRESSION_CHARS, el, ei);
+				compiled = CompileNameExpression(expression, ignoreCase);
+				CHECK(compiled != NULL);
+				if (compiled == NULL) {
+					return;
+				}
+
+				for (nl = 1; nl <= 5; ++nl) {
+					for (ni = 0; ni < Power(nameChars, nl); ++ni) {
+						// the nulls the baseline reads past the name
+						WCHAR	name[16] = { 0 };
+						BOOL	ref, match, base;
+
+						MakeString(name, MATCH_NAME_CHARS, nl, ni);
+						ref = RefIsNameInExpression(expression, name, ignoreCase, REF_CHANGE_ALL);
+						match = MatchNameExpression(compiled, name);
+						if (ref != match) {
+							ReportMismatch(expression, name, ignoreCase, ref, match);
+						}
+						pairs++;
+
+						base = RefIsNameInExpression(expression, name, ignoreCase, 0);
+						if (base == match) {
+							continue;
+						}
+						if (RefIsNameInExpression(expression, name, ignoreCase,
+								REF_CHANGE_END_OF_NAME) == match) {
+							endOfName++;
+						} else if (RefIsNameInExpression(expression, name, ignoreCase,
+								REF_CHANGE_DOS_STAR) == match) {
+							dosStar++;
+						} else {
+							// DOS_STAR over a name without a period,
+							// then DOS_QM at its end ("<a>" "ba")
+							both++;
+						}
+					}
+				}
+				FreeNameExpression(compiled);
+			}
+		}
+	}
+
+	printf("  exhaustive: %u pairs, %u mismatches\n", pairs, g_Mismatches);
+	printf("  baseline: %u changed at the end of the name, %u by DOS_STAR, %u by both\n",
+		endOfName, dosStar, both);
+	CHECK(g_Mismatches == 0);
+	CHECK(endOfName > 0);
+	CHECK(dosStar > 0);
+}
+
+
+// random expressions of up to 10 characters against names of up to 12
+static VOID
+TestRandom(void)
+{
+	ULONG	expressionChars = (ULONG)wcslen(MATCH_EXPRESSION_CHARS);
+	ULONG	nameChars = (ULONG)wcslen(MATCH_NAME_CHARS);
+	ULONG	matches = 0;
+	ULONG	i, j;
+
+	g_Mismatches = 0;
+	srand(1);
+
+	for (i = 0; i < MATCH_RANDOM_PAIRS; ++i) {
+		WCHAR	expression[12];
+		WCHAR	name[14];
+		ULONG	el = rand() % 11;
+		ULONG	nl = 1 + rand() % 12;
+		BOOL	ignoreCase = rand() & 1;
+		BOOL	ref, match;
+
+		for (j = 0; j < el; ++j) {
+			expression[j] = MATCH_EXPRESSION_CHARS[rand() % expressionChars];
+		}
+		expression[el] = L'\0';
+		for (j = 0; j < nl; ++j) {
+			name[j] = MATCH_NAME_CHARS[rand() % nameChars];
+		}
+		name[nl] = L'\0';
+
+		ref = RefIsNameInExpression(expression, name, ignoreCase, REF_CHANGE_ALL);
+		match = DokanIsNameInExpression(expression, name, ignoreCase);
+		if (ref != match) {
+			ReportMismatch(expression, name, ignoreCase, ref, match);
+		}
+		matches += match;
+	}
+
+	printf("  random: %u pairs, %u matched, %u mismatches\n",
+		MATCH_RANDOM_PAIRS, matches, g_Mismatches);
+	CHECK(g_Mismatches == 0);
+}
+
+
+int main(void)
+{
+	TestInitialize();
+
+	TestCornerCases();
+	TestBehaviorChanges();
+	TestLongExpression();
+	TestExhaustive();
+	TestRandom();
+
+	return TestResult("match_test");
+}
@@ -0,0 +1,647 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2008 Hiroki Asakawa info@dokan-dev.net
+
+  http://dokan-dev.net/en
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "dokani.h"
+#include "memfs.h"
+
+
+typedef struct _MEMFS_NODE {
+	WCHAR	Name[MAX_PATH];
+	BOOL	IsDirectory;
+	PCHAR	Data;
+	ULONG	Size;
+	ULONG	Capacity;
+	// > 0 for a synthetic directory
+	ULONG	SyntheticCount;
+} MEMFS_NODE, *PMEMFS_NODE;
+
+
+LONG	g_MemfsCalls[MEMFS_CALL_KINDS];
+
+static CRITICAL_SECTION	g_MemfsLock;
+static PMEMFS_NODE		g_MemfsNodes;
+static ULONG			g_MemfsNodeCount;
+static ULONG			g_MemfsNodeCapacity;
+
+
+// called with g_MemfsLock held
+static PMEMFS_NODE
+FindNode(
+	LPCWSTR	FileName)
+{
+	ULONG i;
+	for (i = 0; i < g_MemfsNodeCount; ++i) {
+		if (_wcsicmp(g_MemfsNodes[i].Name, FileName) == 0) {
+			return &g_MemfsNodes[i];
+		}
+	}
+	return NULL;
+}
+
+
+// called with g_MemfsLock held
+static PMEMFS_NODE
+AddNode(
+	LPCWSTR	FileName,
+	BOOL	IsDirectory)
+{
+	PMEMFS_NODE node;
+
+	if (wcslen(FileName) >= MAX_PATH || FindNode(FileName)) {
+		return NULL;
+	}
+	if (g_MemfsNodeCount == g_MemfsNodeCapacity) {
+		ULONG capacity = g_MemfsNodeCapacity ? g_MemfsNodeCapacity * 2 : 64;
+		PMEMFS_NODE nodes = (PMEMFS_NODE)realloc(g_MemfsNodes, capacity * sizeof(MEMFS_NODE));
+		if (nodes == NULL) {
+			return NULL;
+		}
+		g_MemfsNodes = nodes;
+		g_MemfsNodeCapacity = capacity;
+	}
+	node = &g_MemfsNodes[g_MemfsNodeCount++];
+	ZeroMemory(node, sizeof(MEMFS_NODE));
+	wcscpy_s(node->Name, MAX_PATH, FileName);
+	node->IsDirectory = IsDirectory;
+	return node;
+}
+
+
+// called with g_MemfsLock held
+static VOID
+RemoveNode(
+	PMEMFS_NODE	Node)
+{
+	free(Node->Data);
+	*Node = g_MemfsNodes[--g_MemfsNodeCount];
+}
+
+
+// called with g_MemfsLock held
+static BOOL
+ResizeNode(
+	PMEMFS_NODE	Node,
+	ULONG		Size)
+{
+	if (Size > Node->Capacity) {
+		ULONG capacity = max(Size, Node->Capacity * 2);
+		PCHAR data = (PCHAR)realloc(Node->Data, capacity);
+		if (data == NULL) {
+			return FALSE;
+		}
+		Node->Data = data;
+		Node->Capacity = capacity;
+	}
+	if (Size > Node->Size) {
+		ZeroMemory(Node->Data + Node->Size, Size - Node->Size);
+	}
+	Node->Size = Size;
+	return TRUE;
+}
+
+
+// TRUE when FileName is right under Directory
+static BOOL
+IsChild(
+	LPCWSTR	Directory,
+	LPCWSTR	FileName)
+{
+	size_t			length = wcslen(Directory);
+	const WCHAR*	name;
+
+	if (length == 1) {
+		// "\"
+		length = 0;
+	}
+	if (_wcsnicmp(Directory, FileName, length) != 0 || FileName[length] != L'\\') {
+		return FALSE;
+	}
+	name = FileName + length + 1;
+	return *name != 0 && wcschr(name, L'\\') == NULL;
+}
+
+
+static VOID
+FillFindData(
+	PWIN32_FIND_DATAW	FindData,
+	LPCWSTR				Name,
+	BOOL				IsDirectory,
+	ULONG				Size)
+{
+	ZeroMemory(FindData, sizeof(WIN32_FIND_DATAW));
+	FindData->dwFileAttributes = IsDirectory ? FILE_ATTRIBUTE_DIRECTORY : FILE_ATTRIBUTE_NORMAL;
+	FindData->nFileSizeLow = Size;
+	FindData->ftLastWriteTime.dwLowDateTime = 0x01020304;
+	wcscpy_s(FindData->cFileName, MAX_PATH, Name);
+}
+
+
+VOID
+MemfsSyntheticName(
+	ULONG	Index,
+	PWCHAR	Name)
+{
+	int i;
+	Name[0] = L'f';
+	for (i = 7; i >= 1; --i) {
+		Name[i] = (WCHAR)(L'0' + Index % 10);
+		Index /= 10;
+	}
+	Name[8] = 0;
+}
+
+
+static int DOKAN_CALLBACK
+MemfsCreateFile(
+	LPCWSTR				FileName,
+	DWORD				AccessMode,
+	DWORD				ShareMode,
+	DWORD				CreationDisposition,
+	DWORD				FlagsAndAttributes,
+	PDOKAN_FILE_INFO	DokanFileInfo)
+{
+	PMEMFS_NODE	node;
+	int			status = 0;
+
+	UNREFERENCED_PARAMETER(AccessMode);
+	UNREFERENCED_PARAMETER(ShareMode);
+	UNREFERENCED_PARAMETER(FlagsAndAttributes);
+
+	InterlockedIncrement(&g_MemfsCalls[MEMFS_CREATE_FILE]);
+
+	EnterCriticalSection(&g_MemfsLock);
+	node = FindNode(FileName);
+	switch (CreationDisposition) {
+	case CREATE_NEW:
+		if (node) {
+			status = -ERROR_FILE_EXISTS;
+		} else if ((node = AddNode(FileName, FALSE)) == NULL) {
+			status = -ERROR_ACCESS_DENIED;
+		}
+		break;
+	case OPEN_ALWAYS:
+	case CREATE_ALWAYS:
+		if (node == NULL && (node = AddNode(FileName, FALSE)) == NULL) {
+			status = -ERROR_ACCESS_DENIED;
+		} else if (CreationDisposition == CREATE_ALWAYS && !node->IsDirectory) {
+			ResizeNode(node, 0);
+		}
+		break;
+	default:
+		if (node == NULL) {
+			status = -ERROR_FILE_NOT_FOUND;
+		} else if (CreationDisposition == TRUNCATE_EXISTING && !node->IsDirectory) {
+			ResizeNode(node, 0);
+		}
+		break;
+	}
+	if (status == 0) {
+		DokanFileInfo->IsDirectory = (UCHAR)node->IsDirectory;
+	}
+	LeaveCriticalSection(&g_MemfsLock);
+	return status;
+}
+
+
+static int DOKAN_CALLBACK
+MemfsOpenDirectory(
+	LPCWSTR				FileName,
+	PDOKAN_FILE_INFO	DokanFileInfo)
+{
+	PMEMFS_NODE	node;
+	int			status = 0;
+
+	UNREFERENCED_PARAMETER(DokanFileInfo);
+
+	InterlockedIncrement(&g_MemfsCalls[MEMFS_OPEN_DIRECTORY]);
+
+	EnterCriticalSection(&g_MemfsLock);
+	node = FindNode(FileName);
+	if (node == NULL || !node->IsDirectory) {
+		status = -ERROR_PATH_NOT_FOUND;
+	}
+	LeaveCriticalSection(&g_MemfsLock);
+	return status;
+}
+
+
+static int DOKAN_CALLBACK
+MemfsCreateDirectory(
+	LPCWSTR				FileName,
+	PDOKAN_FILE_INFO	DokanFileInfo)
+{
+	UNREFERENCED_PARAMETER(DokanFileInfo);
+	return MemfsAddDirectory(FileName) ? 0 : -ERROR_ALREADY_EXISTS;
+}
+
+
+static int DOKAN_CALLBACK
+MemfsCleanup(
+	LPCWSTR				FileName,
+	PDOKAN_FILE_INFO	DokanFileInfo)
+{
+	PMEMFS_NODE node;
+
+	if (DokanFileInfo->DeleteOnClose) {
+		EnterCriticalSection(&g_MemfsLock);
+		node = FindNode(FileName);
+		if (node) {
+			RemoveNode(node);
+		}
+		LeaveCriticalSection(&g_MemfsLock);
+	}
+	return 0;
+}
+
+
+static int DOKAN_CALLBACK
+MemfsCloseFile(
+	LPCWSTR				FileName,
+	PDOKAN_FILE_INFO	DokanFileInfo)
+{
+	UNREFERENCED_PARAMETER(FileName);
+	UNREFERENCED_PARAMETER(DokanFileInfo);
+
+	InterlockedIncrement(&g_MemfsCalls[MEMFS_CLOSE_FILE]);
+	return 0;
+}
+
+
+static int DOKAN_CALLBACK
+MemfsReadFile(
+	LPCWSTR				FileName,
+	LPVOID				Buffer,
+	DWORD				BufferLength,
+	LPDWORD				ReadLength,
+	LONGLONG			Offset,
+	PDOKAN_FILE_INFO	DokanFileInfo)
+{
+	PMEMFS_NODE	node;
+	int			status = 0;
+
+	UNREFERENCED_PARAMETER(DokanFileInfo);
+
+	InterlockedIncrement(&g_MemfsCalls[MEMFS_READ_FILE]);
+
+	*ReadLength = 0;
+	EnterCriticalSection(&g_MemfsLock);
+	node = FindNode(FileName);
+	if (node == NULL || node->IsDirectory) {
+		status = -ERROR_FILE_NOT_FOUND;
+	} else if (Offset < node->Size) {
+		*ReadLength = (DWORD)min((LONGLONG)BufferLength, node->Size - Offset);
+		CopyMemory(Buffer, node->Data + Offset, *ReadLength);
+	}
+	LeaveCriticalSection(&g_MemfsLock);
+	return status;
+}
+
+
+static int DOKAN_CALLBACK
+MemfsWriteFile(
+	LPCWSTR				FileName,
+	LPCVOID				Buffer,
+	DWORD				NumberOfBytesToWrite,
+	LPDWORD				NumberOfBytesWritten,
+	LONGLONG			Offset,
+	PDOKAN_FILE_INFO	DokanFileInfo)
+{
+	PMEMFS_NODE	node;
+	int			status = 0;
+
+	InterlockedIncrement(&g_MemfsCalls[MEMFS_WRITE_FILE]);
+
+	*NumberOfBytesWritten = 0;
+	EnterCriticalSection(&g_MemfsLock);
+	node = FindNode(FileName);
+	if (node == NULL || node->IsDirectory) {
+		status = -ERROR_FILE_NOT_FOUND;
+	} else {
+		if (DokanFileInfo->WriteToEndOfFile) {
+			Offset = node->Size;
+		}
+		if (Offset + NumberOfBytesToWrite > node->Size &&
+			!ResizeNode(node, (ULONG)(Offset + NumberOfBytesToWrite))) {
+			status = -ERROR_DISK_FULL;
+		} else {
+			CopyMemory(node->Data + Offset, Buffer, NumberOfBytesToWrite);
+			*NumberOfBytesWritten = NumberOfBytesToWrite;
+		}
+	}
+	LeaveCriticalSection(&g_MemfsLock);
+	return status;
+}
+
+
+static int DOKAN_CALLBACK
+MemfsGetFileInformation(
+	LPCWSTR							FileName,
+	LPBY_HANDLE_FILE_INFORMATION	Information,
+	PDOKAN_FILE_INFO				DokanFileInfo)
+{
+	PMEMFS_NODE	node;
+	int			status = 0;
+
+	UNREFERENCED_PARAMETER(DokanFileInfo);
+
+	InterlockedIncrement(&g_MemfsCalls[MEMFS_GET_FILE_INFO]);
+
+	EnterCriticalSection(&g_MemfsLock);
+	node = FindNode(FileName);
+	if (node == NULL) {
+		status = -ERROR_FILE_NOT_FOUND;
+	} else {
+		ZeroMemory(Information, sizeof(BY_HANDLE_FILE_INFORMATION));
+		Information->dwFileAttributes = node->IsDirectory ?
+			FILE_ATTRIBUTE_DIRECTORY : FILE_ATTRIBUTE_NORMAL;
+		Information->nFileSizeLow = node->Size;
+		Information->nNumberOfLinks = 1;
+		Information->nFileIndexLow = (DWORD)(node - g_MemfsNodes);
+	}
+	LeaveCriticalSection(&g_MemfsLock);
+	return status;
+}
+
+
+// entries of FileName from Cursor, each one is passed to Fill with its
+// cursor until Fill returns 1
+static int
+EnumerateNodes(
+	LPCWSTR				FileName,
+	ULONG64				Cursor,
+	PFillFindData		Fill,
+	PFillFindDataWithCursor	FillWithCursor,
+	PDOKAN_FILE_INFO	DokanFileInfo)
+{
+	WIN32_FIND_DATAW	findData;
+	PMEMFS_NODE			directory;
+	ULONG				count;
+	ULONG				i;
+	WCHAR				name[16];
+
+	EnterCriticalSection(&g_MemfsLock);
+	directory = FindNode(FileName);
+	if (directory == NULL || !directory->IsDirectory) {
+		LeaveCriticalSection(&g_MemfsLock);
+		return -ERROR_PATH_NOT_FOUND;
+	}
+
+	// synthetic entries come first, then the stored children in
+	// table order
+	count = directory->SyntheticCount;
+	for (i = (ULONG)Cursor; i < count; ++i) {
+		MemfsSyntheticName(i, name);
+		FillFindData(&findData, name, FALSE, i);
+		if (FillWithCursor) {
+			if (FillWithCursor(&findData, i + 1, DokanFileInfo)) {
+				goto done;
+			}
+		} else {
+			Fill(&findData, DokanFileInfo);
+		}
+	}
+	for (i = (ULONG)(Cursor > count ? Cursor - count : 0); i < g_MemfsNodeCount; ++i) {
+		PMEMFS_NODE node = &g_MemfsNodes[i];
+		if (!IsChild(directory->Name, node->Name)) {
+			continue;
+		}
+		FillFindData(&findData, wcsrchr(node->Name, L'\\') + 1, node->IsDirectory, node->Size);
+		if (FillWithCursor) {
+			if (FillWithCursor(&findData, count + i + 1, DokanFileInfo)) {
+				goto done;
+			}
+		} else {
+			Fill(&findData, DokanFileInfo);
+		}
+	}
+done:
+	LeaveCriticalSection(&g_MemfsLock);
+	return 0;
+}
+
+
+static int DOKAN_CALLBACK
+MemfsFindFiles(
+	LPCWSTR				FileName,
+	PFillFindData		FillFindData,
+	PDOKAN_FILE_INFO	DokanFileInfo)
+{
+	InterlockedIncrement(&g_MemfsCalls[MEMFS_FIND_FILES]);
+	return EnumerateNodes(FileName, 0, FillFindData, NULL, DokanFileInfo);
+}
+
+
+static int DOKAN_CALLBACK
+MemfsFindFilesWithCursor(
+	LPCWSTR					FileName,
+	LPCWSTR					SearchPattern,
+	ULONG64					Cursor,
+	PFillFindDataWithCursor	FillFindData,
+	PDOKAN_FILE_INFO		DokanFileInfo)
+{
+	UNREFERENCED_PARAMETER(SearchPattern);
+
+	InterlockedIncrement(&g_MemfsCalls[MEMFS_FIND_FILES]);
+	return EnumerateNodes(FileName, Cursor, NULL, FillFindData, DokanFileInfo);
+}
+
+
+// the nodes under a directory are moved with it
+static int DOKAN_CALLBACK
+MemfsMoveFile(
+	LPCWSTR				FileName,
+	LPCWSTR				NewFileName,
+	BOOL				ReplaceIfExisting,
+	PDOKAN_FILE_INFO	DokanFileInfo)
+{
+	PMEMFS_NODE	node;
+	size_t		length = wcslen(FileName);
+	size_t		newLength = wcslen(NewFileName);
+	int			status = 0;
+	ULONG		i;
+
+	UNREFERENCED_PARAMETER(DokanFileInfo);
+
+	EnterCriticalSection(&g_MemfsLock);
+	node = FindNode(NewFileName);
+	if (FindNode(FileName) == NULL) {
+		status = -ERROR_FILE_NOT_FOUND;
+	} else if (node != NULL && !ReplaceIfExisting) {
+		status = -ERROR_ALREADY_EXISTS;
+	} else {
+		if (node != NULL) {
+			RemoveNode(node);
+		}
+		for (i = 0; i < g_MemfsNodeCount; ++i) {
+			PWCHAR name = g_MemfsNodes[i].Name;
+			if (_wcsnicmp(name, FileName, length) != 0 ||
+				(name[length] != 0 && name[length] != L'\\')) {
+				continue;
+			}
+			if (newLength + wcslen(name + length) >= MAX_PATH) {
+				status = -ERROR_INVALID_NAME;
+				continue;
+			}
+			memmove(name + newLength, name + length, (wcslen(name + length) + 1) * sizeof(WCHAR));
+			CopyMemory(name, NewFileName, newLength * sizeof(WCHAR));
+		}
+	}
+	LeaveCriticalSection(&g_MemfsLock);
+	return status;
+}
+
+
+static int DOKAN_CALLBACK
+MemfsDeleteFile(
+	LPCWSTR				FileName,
+	PDOKAN_FILE_INFO	DokanFileInfo)
+{
+	int status = 0;
+
+	UNREFERENCED_PARAMETER(DokanFileInfo);
+
+	EnterCriticalSection(&g_MemfsLock);
+	if (FindNode(FileName) == NULL) {
+		status = -ERROR_FILE_NOT_FOUND;
+	}
+	LeaveCriticalSection(&g_MemfsLock);
+	return status;
+}
+
+
+static int DOKAN_CALLBACK
+MemfsSetEndOfFile(
+	LPCWSTR				FileName,
+	LONGLONG			Length,
+	PDOKAN_FILE_INFO	DokanFileInfo)
+{
+	PMEMFS_NODE	node;
+	int			status = 0;
+
+	UNREFERENCED_PARAMETER(DokanFileInfo);
+
+	EnterCriticalSection(&g_MemfsLock);
+	node = FindNode(FileName);
+	if (node == NULL || node->IsDirectory) {
+		status = -ERROR_FILE_NOT_FOUND;
+	} else if (!ResizeNode(node, (ULONG)Length)) {
+		status = -ERROR_DISK_FULL;
+	}
+	LeaveCriticalSection(&g_MemfsLock);
+	return status;
+}
+
+
+VOID
+MemfsReset(void)
+{
+	EnterCriticalSection(&g_MemfsLock);
+	while (g_MemfsNodeCount > 0) {
+		RemoveNode(&g_MemfsNodes[g_MemfsNodeCount - 1]);
+	}
+	AddNode(L"\\", TRUE);
+	LeaveCriticalSection(&g_MemfsLock);
+	ZeroMemory(g_MemfsCalls, sizeof(g_MemfsCalls));
+}
+
+
+VOID
+MemfsInitialize(
+	PDOKAN_OPERATIONS	Operations,
+	BOOL				WithCursor)
+{
+	static BOOL initialized = FALSE;
+
+	if (!initialized) {
+		InitializeCriticalSection(&g_MemfsLock);
+		initialized = TRUE;
+	}
+	MemfsReset();
+
+	ZeroMemory(Operations, sizeof(DOKAN_OPERATIONS));
+	Operations->CreateFile = MemfsCreateFile;
+	Operations->OpenDirectory = MemfsOpenDirectory;
+	Operations->CreateDirectory = MemfsCreateDirectory;
+	Operations->Cleanup = MemfsCleanup;
+	Operations->CloseFile = MemfsCloseFile;
+	Operations->ReadFile = MemfsReadFile;
+	Operations->WriteFile = MemfsWriteFile;
+	Operations->GetFileInformation = MemfsGetFileInformation;
+	Operations->FindFiles = MemfsFindFiles;
+	Operations->DeleteFile = MemfsDeleteFile;
+	Operations->MoveFile = MemfsMoveFile;
+	Operations->SetEndOfFile = MemfsSetEndOfFile;
+	if (WithCursor) {
+		Operations->FindFilesWithCursor = MemfsFindFilesWithCursor;
+	}
+}
+
+
+BOOL
+MemfsAddFile(
+	LPCWSTR	FileName,
+	ULONG	Size)
+{
+	PMEMFS_NODE	node;
+	BOOL		status = FALSE;
+	ULONG		i;
+
+	EnterCriticalSection(&g_MemfsLock);
+	node = AddNode(FileName, FALSE);
+	if (node && ResizeNode(node, Size)) {
+		for (i = 0; i < Size; ++i) {
+			node->Data[i] = (CHAR)i;
+		}
+		status = TRUE;
+	}
+	LeaveCriticalSection(&g_MemfsLock);
+	return status;
+}
+
+
+BOOL
+MemfsAddDirectory(
+	LPCWSTR	FileName)
+{
+	BOOL status;
+
+	EnterCriticalSection(&g_MemfsLock);
+	status = AddNode(FileName, TRUE) != NULL;
+	LeaveCriticalSection(&g_MemfsLock);
+	return status;
+}
+
+
+BOOL
+MemfsAddSyntheticDirectory(
+	LPCWSTR	FileName,
+	ULONG	Count)
+{
+	PMEMFS_NODE node;
+
+	EnterCriticalSection(&g_MemfsLock);
+	node = AddNode(FileName, TRUE);
+	if (node) {
+		node->SyntheticCount = Count;
+	}
+	LeaveCriticalSection(&g_MemfsLock);
+	return node != NULL;
+}
@@ -0,0 +1,76 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2008 Hiroki Asakawa info@dokan-dev.net
+
+  http://dokan-dev.net/en
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef _MEMFS_H_
+#define _MEMFS_H_
+
+#include "dokani.h"
+
+// In-memory file system for the host tests and benchmarks.
+//
+// Files and directories are kept in a flat table under one lock.
+// A synthetic directory lists Count generated files ("f0000000" ...)
+// without storing them, so that listings of millions of entries
+// cost nothing to set up.
+
+// callbacks counted in g_MemfsCalls
+#define MEMFS_CREATE_FILE		0
+#define MEMFS_OPEN_DIRECTORY	1
+#define MEMFS_READ_FILE			2
+#define MEMFS_WRITE_FILE		3
+#define MEMFS_GET_FILE_INFO		4
+#define MEMFS_FIND_FILES		5
+#define MEMFS_CLOSE_FILE		6
+#define MEMFS_CALL_KINDS		7
+
+extern LONG g_MemfsCalls[MEMFS_CALL_KINDS];
+
+// fills Operations, FindFilesWithCursor is set when WithCursor
+VOID
+MemfsInitialize(
+	PDOKAN_OPERATIONS	Operations,
+	BOOL				WithCursor);
+
+// drops all files but "\"
+VOID
+MemfsReset(void);
+
+BOOL
+MemfsAddFile(
+	LPCWSTR	FileName,
+	ULONG	Size);
+
+BOOL
+MemfsAddDirectory(
+	LPCWSTR	FileName);
+
+// FileName lists Count files named as MemfsSyntheticName
+BOOL
+MemfsAddSyntheticDirectory(
+	LPCWSTR	FileName,
+	ULONG	Count);
+
+VOID
+MemfsSyntheticName(
+	ULONG	Index,
+	PWCHAR	Name);
+
+#endif // _MEMFS_H_
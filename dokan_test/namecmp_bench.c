@@ -0,0 +1,298 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2008 Hiroki Asakawa info@dokan-dev.net
+
+  http://dokan-dev.net/en
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "test.h"
+#include "namecmp_kernels.h"
+
+
+// Name compare
+//
+// ns per call of the name routines of sys/namecmp.h, scalar and SSE2,
+// for names of 8 to 255 WCHARs:
+//   equal        DokanNameEqual of equal names
+//   ignore case  DokanNameEqualIgnoreCase of names differing in case
+//   non-ASCII    the same with a non-ASCII WCHAR in every 8
+//   upcase       DokanNameUpcase
+// With gcc or clang on x64 a 16 WCHAR AVX2 version of the two compares
+// runs too, when the processor has AVX2. namecmp.h does not use AVX2:
+// the driver would have to save the extended state around it.
+
+#define NAMECMP_BENCH_CHARS		200000000
+#define NAMECMP_BENCH_RANDOM	100000
+#define NAMECMP_MAX_LENGTH		255
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define NAMECMP_BENCH_AVX2
+#endif
+
+
+typedef BOOLEAN (*NAME_COMPARE)(const WCHAR*, const WCHAR*, ULONG);
+typedef VOID (*NAME_UPCASE)(WCHAR*, const WCHAR*, ULONG);
+
+
+#ifdef NAMECMP_BENCH_AVX2
+
+#define Avx2FoldAscii16(X) \
+	_mm256_sub_epi16((X), _mm256_and_si256( \
+		_mm256_and_si256( \
+			_mm256_cmpgt_epi16((X), _mm256_set1_epi16(L'a' - 1)), \
+			_mm256_cmpgt_epi16(_mm256_set1_epi16(L'z' + 1), (X))), \
+		_mm256_set1_epi16(L'a' - L'A')))
+
+__attribute__((target("avx2"))) static BOOLEAN
+Avx2NameEqual(
+	const WCHAR*	Name1,
+	const WCHAR*	Name2,
+	ULONG			Count)
+{
+	ULONG	pos = 0;
+
+	for (; pos + 16 <= Count; pos += 16) {
+		__m256i x = _mm256_loadu_si256((const __m256i*)&Name1[pos]);
+		__m256i y = _mm256_loadu_si256((const __m256i*)&Name2[pos]);
+		if ((ULONG)_mm256_movemask_epi8(_mm256_cmpeq_epi16(x, y)) != 0xFFFFFFFF)
+			return FALSE;
+	}
+	return Sse2NameEqual(&Name1[pos], &Name2[pos], Count - pos);
+}
+
+__attribute__((target("avx2"))) static BOOLEAN
+Avx2NameEqualIgnoreCase(
+	const WCHAR*	Name1,
+	const WCHAR*	Name2,
+	ULONG			Count)
+{
+	ULONG	pos = 0;
+
+	for (; pos + 16 <= Count; pos += 16) {
+		__m256i x = _mm256_loadu_si256((const __m256i*)&Name1[pos]);
+		__m256i y = _mm256_loadu_si256((const __m256i*)&Name2[pos]);
+
+		if ((ULONG)_mm256_movemask_epi8(_mm256_cmpeq_epi16(x, y)) == 0xFFFFFFFF)
+			continue;
+
+		if (_mm256_movemask_epi8(_mm256_and_si256(_mm256_or_si256(x, y),
+				_mm256_set1_epi16((short)0xFF80))) == 0) {
+			if ((ULONG)_mm256_movemask_epi8(_mm256_cmpeq_epi16(
+					Avx2FoldAscii16(x), Avx2FoldAscii16(y))) != 0xFFFFFFFF)
+				return FALSE;
+			continue;
+		}
+
+		if (!Sse2NameEqualIgnoreCase(&Name1[pos], &Name2[pos], 16))
+			return FALSE;
+	}
+	return Sse2NameEqualIgnoreCase(&Name1[pos], &Name2[pos], Count - pos);
+}
+
+#endif
+
+
+static ULONG	g_Seed = 1;
+
+static ULONG
+Random(void)
+{
+	g_Seed = g_Seed * 1103515245 + 12345;
+	return (g_Seed >> 16) & 0x7FFF;
+}
+
+
+static WCHAR
+RandomChar(void)
+{
+	static const WCHAR chars[] = { L'a', L'Z', L'q', L'0', L'.', L'_', 0xE9, 0xC9, 0x3A3 };
+	return chars[Random() % (sizeof(chars) / sizeof(chars[0]))];
+}
+
+
+// the variants agree on random names, returns FALSE when they do not
+static BOOL
+CheckVariants(void)
+{
+	WCHAR	name1[NAMECMP_MAX_LENGTH];
+	WCHAR	name2[NAMECMP_MAX_LENGTH];
+	WCHAR	upcase1[NAMECMP_MAX_LENGTH];
+	WCHAR	upcase2[NAMECMP_MAX_LENGTH];
+	ULONG	i, j;
+
+	for (i = 0; i < NAMECMP_BENCH_RANDOM; ++i) {
+		ULONG	length = Random() % NAMECMP_MAX_LENGTH;
+		BOOLEAN	equal, ignoreCase;
+
+		for (j = 0; j < length; ++j) {
+			name1[j] = RandomChar();
+			name2[j] = name1[j];
+			if (Random() % 4 == 0)
+				name2[j] = (WCHAR)towupper(name2[j]);
+			if (Random() % 64 == 0)
+				name2[j] = RandomChar();
+		}
+
+		equal = ScalarNameEqual(name1, name2, length);
+		ignoreCase = ScalarNameEqualIgnoreCase(name1, name2, length);
+		if (Sse2NameEqual(name1, name2, length) != equal ||
+			Sse2NameEqualIgnoreCase(name1, name2, length) != ignoreCase) {
+			return FALSE;
+		}
+#ifdef NAMECMP_BENCH_AVX2
+		if (__builtin_cpu_supports("avx2") &&
+			(Avx2NameEqual(name1, name2, length) != equal ||
+			Avx2NameEqualIgnoreCase(name1, name2, length) != ignoreCase)) {
+			return FALSE;
+		}
+#endif
+		ScalarNameUpcase(upcase1, name1, length);
+		Sse2NameUpcase(upcase2, name1, length);
+		if (memcmp(upcase1, upcase2, length * sizeof(WCHAR)) != 0) {
+			return FALSE;
+		}
+	}
+	return TRUE;
+}
+
+
+static double
+TimeCompare(
+	NAME_COMPARE	Compare,
+	const WCHAR*	Name1,
+	const WCHAR*	Name2,
+	ULONG			Length,
+	ULONG			Iterations)
+{
+	volatile ULONG	equal = 0;
+	double			start = TestNow();
+	ULONG			i;
+
+	for (i = 0; i < Iterations; ++i) {
+		equal += Compare(Name1, Name2, Length);
+	}
+	if (equal != Iterations) {
+		printf("namecmp_bench: names of %u WCHARs differ\n", Length);
+		exit(1);
+	}
+	return (TestNow() - start) * 1e9 / Iterations;
+}
+
+
+static double
+TimeUpcase(
+	NAME_UPCASE		Upcase,
+	const WCHAR*	Name,
+	ULONG			Length,
+	ULONG			Iterations)
+{
+	WCHAR	dest[NAMECMP_MAX_LENGTH];
+	double	start = TestNow();
+	ULONG	i;
+
+	for (i = 0; i < Iterations; ++i) {
+		Upcase(dest, Name, Length);
+	}
+	return (TestNow() - start) * 1e9 / Iterations;
+}
+
+
+int main(void)
+{
+	static const ULONG lengths[] = { 8, 12, 32, 64, NAMECMP_MAX_LENGTH };
+	static const char* cases[] = { "equal", "ignore case", "non-ASCII", "upcase" };
+	WCHAR	lower[NAMECMP_MAX_LENGTH];
+	WCHAR	same[NAMECMP_MAX_LENGTH];
+	WCHAR	upper[NAMECMP_MAX_LENGTH];
+	WCHAR	accented[NAMECMP_MAX_LENGTH];
+	WCHAR	accentedUpper[NAMECMP_MAX_LENGTH];
+	BOOL	avx2 = FALSE;
+	ULONG	c, l, i;
+
+	TestInitialize();
+
+#ifdef NAMECMP_BENCH_AVX2
+	avx2 = __builtin_cpu_supports("avx2");
+#endif
+
+	if (!CheckVariants()) {
+		printf("namecmp_bench: scalar, SSE2 and AVX2 results differ\n");
+		return 1;
+	}
+
+	for (i = 0; i < NAMECMP_MAX_LENGTH; ++i) {
+		lower[i] = (WCHAR)(L'a' + i % 26);
+		same[i] = lower[i];
+		upper[i] = (WCHAR)(L'A' + i % 26);
+		accented[i] = i % 8 == 3 ? 0xE9 : lower[i];
+		accentedUpper[i] = i % 8 == 3 ? 0xE9 : upper[i];
+	}
+
+	printf("%-12s %6s %10s %10s %10s\n", "", "WCHARs", "scalar", "SSE2",
+		avx2 ? "AVX2" : "");
+
+	for (c = 0; c < sizeof(cases) / sizeof(cases[0]); ++c) {
+		for (l = 0; l < sizeof(lengths) / sizeof(lengths[0]); ++l) {
+			ULONG	length = lengths[l];
+			ULONG	iterations = (ULONG)(NAMECMP_BENCH_CHARS * BenchScale() / length);
+			double	scalar, sse2, wide = 0;
+
+			if (iterations == 0) {
+				iterations = 1;
+			}
+
+			switch (c) {
+			case 0:
+				scalar = TimeCompare(ScalarNameEqual, lower, same, length, iterations);
+				sse2 = TimeCompare(Sse2NameEqual, lower, same, length, iterations);
+#ifdef NAMECMP_BENCH_AVX2
+				if (avx2)
+					wide = TimeCompare(Avx2NameEqual, lower, same, length, iterations);
+#endif
+				break;
+			case 1:
+				scalar = TimeCompare(ScalarNameEqualIgnoreCase, lower, upper, length, iterations);
+				sse2 = TimeCompare(Sse2NameEqualIgnoreCase, lower, upper, length, iterations);
+#ifdef NAMECMP_BENCH_AVX2
+				if (avx2)
+					wide = TimeCompare(Avx2NameEqualIgnoreCase, lower, upper, length, iterations);
+#endif
+				break;
+			case 2:
+				scalar = TimeCompare(ScalarNameEqualIgnoreCase, accented, accentedUpper, length, iterations);
+				sse2 = TimeCompare(Sse2NameEqualIgnoreCase, accented, accentedUpper, length, iterations);
+#ifdef NAMECMP_BENCH_AVX2
+				if (avx2)
+					wide = TimeCompare(Avx2NameEqualIgnoreCase, accented, accentedUpper, length, iterations);
+#endif
+				break;
+			default:
+				scalar = TimeUpcase(ScalarNameUpcase, lower, length, iterations);
+				sse2 = TimeUpcase(Sse2NameUpcase, lower, length, iterations);
+				break;
+			}
+
+			if (wide > 0) {
+				printf("%-12s %6u %7.1f ns %7.1f ns %7.1f ns\n",
+					cases[c], length, scalar, sse2, wide);
+			} else {
+				printf("%-12s %6u %7.1f ns %7.1f ns\n", cases[c], length, scalar, sse2);
+			}
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,61 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2008 Hiroki Asakawa info@dokan-dev.net
+
+  http://dokan-dev.net/en
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <windows.h>
+#include "namecmp.h"
+#include "namecmp_kernels.h"
+
+
+// built with -DNAMECMP_VARIANT=Scalar -DDOKAN_NAMECMP_NO_SSE2 and
+// with -DNAMECMP_VARIANT=Sse2
+
+#define NAMECMP_KERNEL2(Variant, Name)	Variant##Name
+#define NAMECMP_KERNEL(Variant, Name)	NAMECMP_KERNEL2(Variant, Name)
+
+
+BOOLEAN
+NAMECMP_KERNEL(NAMECMP_VARIANT, NameEqual)(
+	const WCHAR*	Name1,
+	const WCHAR*	Name2,
+	ULONG			Count)
+{
+	return DokanNameEqual(Name1, Name2, Count);
+}
+
+
+BOOLEAN
+NAMECMP_KERNEL(NAMECMP_VARIANT, NameEqualIgnoreCase)(
+	const WCHAR*	Name1,
+	const WCHAR*	Name2,
+	ULONG			Count)
+{
+	return DokanNameEqualIgnoreCase(Name1, Name2, Count);
+}
+
+
+VOID
+NAMECMP_KERNEL(NAMECMP_VARIANT, NameUpcase)(
+	WCHAR*			Dest,
+	const WCHAR*	Source,
+	ULONG			Count)
+{
+	DokanNameUpcase(Dest, Source, Count);
+}
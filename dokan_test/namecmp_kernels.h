@@ -0,0 +1,37 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2008 Hiroki Asakawa info@dokan-dev.net
+
+  http://dokan-dev.net/en
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef _NAMECMP_KERNELS_H_
+#define _NAMECMP_KERNELS_H_
+
+// The routines of sys/namecmp.h built once with SSE2 (Sse2Name*) and
+// once with DOKAN_NAMECMP_NO_SSE2 (ScalarName*), see
+// namecmp_kernels.c and the Makefile.
+
+#define NAMECMP_DECLARE_KERNELS(Variant) \
+	BOOLEAN Variant##NameEqual(const WCHAR* Name1, const WCHAR* Name2, ULONG Count); \
+	BOOLEAN Variant##NameEqualIgnoreCase(const WCHAR* Name1, const WCHAR* Name2, ULONG Count); \
+	VOID Variant##NameUpcase(WCHAR* Dest, const WCHAR* Source, ULONG Count);
+
+NAMECMP_DECLARE_KERNELS(Scalar)
+NAMECMP_DECLARE_KERNELS(Sse2)
+
+#endif // _NAMECMP_KERNELS_H_
@@ -0,0 +1,273 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2008 Hiroki Asakawa info@dokan-dev.net
+
+  http://dokan-dev.net/en
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "test.h"
+#include "hostirp.h"
+
+
+// Pending IRP index and timeout wheel of the driver (sys/pendingirp.c)
+//
+// Lookups by serial number with several entries per bucket and the
+// highest serial numbers, removal by completion, and the cancel routine
+// removing an entry before or after completion took it off.
+// Timeouts in deadline order, an extended timeout in front of expired
+// ones, deadlines more than one turn away, a late sweep, and entries
+// completed or being canceled before their deadline.
+
+#define IRP_TEST_COUNT	(DOKAN_PENDING_IRP_BUCKETS * 3)
+#define IRP_TEST_SHARD	3
+
+// the serial numbers of one shard, as DokanPendingIrpList spreads them
+#define TestSerial(Index)	((ULONG)(Index) * DOKAN_PENDING_IRP_SHARDS + IRP_TEST_SHARD)
+
+
+static VOID
+TestLookup(void)
+{
+	HOST_PENDING_IRPS	pending;
+	PIRP_ENTRY			entries[IRP_TEST_COUNT];
+	PIRP_ENTRY			high;
+	ULONG				i;
+	BOOL				found = TRUE;
+
+	HostInitPendingIrps(&pending);
+
+	for (i = 0; i < IRP_TEST_COUNT; ++i) {
+		entries[i] = HostInsertPendingIrp(&pending, TestSerial(i));
+	}
+	// the last serial number of the shard before they wrap
+	high = HostInsertPendingIrp(&pending, TestSerial(0xFFFFFFFF / DOKAN_PENDING_IRP_SHARDS));
+	CHECK(HostCountEntries(&pending.List.ListHead) == IRP_TEST_COUNT + 1);
+	CHECK(HostCountEntries(&pending.Index[0]) == 3);
+
+	for (i = 0; i < IRP_TEST_COUNT; ++i) {
+		found &= DokanFindPendingIrp(&pending.List, TestSerial(i)) == entries[i];
+	}
+	CHECK(found);
+	CHECK(DokanFindPendingIrp(&pending.List, high->SerialNumber) == high);
+
+	// serial numbers of the same buckets which are not pending
+	CHECK(DokanFindPendingIrp(&pending.List, TestSerial(IRP_TEST_COUNT)) == NULL);
+	CHECK(DokanFindPendingIrp(&pending.List, TestSerial(0) - 1) == NULL);
+
+	// completion removes the entries of the replies
+	for (i = 0; i < IRP_TEST_COUNT; i += 2) {
+		DokanRemovePendingIrp(entries[i]);
+	}
+	found = TRUE;
+	for (i = 0; i < IRP_TEST_COUNT; ++i) {
+		found &= DokanFindPendingIrp(&pending.List, TestSerial(i)) == (i % 2 ? entries[i] : NULL);
+	}
+	CHECK(found);
+	CHECK(HostCountEntries(&pending.List.ListHead) == IRP_TEST_COUNT / 2 + 1);
+	CHECK(IsListEmpty(&pending.Index[0]));
+	CHECK(HostCountEntries(&pending.Index[1]) == 3);
+
+	for (i = 0; i < IRP_TEST_COUNT; ++i) {
+		if (i % 2) {
+			DokanRemovePendingIrp(entries[i]);
+		}
+		DokanFreeIrpEntry(entries[i]);
+	}
+	DokanRemovePendingIrp(high);
+	DokanFreeIrpEntry(high);
+
+	CHECK(IsListEmpty(&pending.List.ListHead));
+	for (i = 0; i < DOKAN_PENDING_IRP_BUCKETS; ++i) {
+		CHECK(IsListEmpty(&pending.Index[i]));
+	}
+	CHECK(g_HostPoolAllocations == 0);
+}
+
+
+static VOID
+TestCancel(void)
+{
+	HOST_PENDING_IRPS	pending;
+	PIRP_ENTRY			before, entry, after;
+
+	HostInitPendingIrps(&pending);
+
+	// three entries of one bucket
+	before = HostInsertPendingIrp(&pending, TestSerial(0));
+	entry = HostInsertPendingIrp(&pending, TestSerial(DOKAN_PENDING_IRP_BUCKETS));
+	after = HostInsertPendingIrp(&pending, TestSerial(DOKAN_PENDING_IRP_BUCKETS * 2));
+
+	// the reply took the entry off while the IRP was being canceled,
+	// CompleteIrpMain leaves it to the cancel routine
+	CHECK(DokanFindPendingIrp(&pending.List, entry->SerialNumber) == entry);
+	DokanRemovePendingIrp(entry);
+	InitializeListHead(&entry->ListEntry);
+	entry->CancelRoutineFreeMemory = TRUE;
+	DokanRemovePendingIrp(entry);
+	CHECK(IsListEmpty(&entry->ListEntry));
+	CHECK(IsListEmpty(&entry->SerialEntry));
+	CHECK(DokanFindPendingIrp(&pending.List, entry->SerialNumber) == NULL);
+	CHECK(DokanFindPendingIrp(&pending.List, before->SerialNumber) == before);
+	CHECK(DokanFindPendingIrp(&pending.List, after->SerialNumber) == after);
+	CHECK(HostCountEntries(&pending.List.ListHead) == 2);
+	CHECK(HostCountEntries(pending.List.SerialIndex) == 2);
+	DokanFreeIrpEntry(entry);
+
+	// the IRP was canceled before its reply came
+	DokanRemovePendingIrp(after);
+	CHECK(DokanFindPendingIrp(&pending.List, after->SerialNumber) == NULL);
+	CHECK(DokanFindPendingIrp(&pending.List, before->SerialNumber) == before);
+	DokanFreeIrpEntry(after);
+
+	DokanRemovePendingIrp(before);
+	DokanFreeIrpEntry(before);
+	CHECK(IsListEmpty(&pending.List.ListHead));
+	CHECK(IsListEmpty(pending.List.SerialIndex));
+	CHECK(g_HostPoolAllocations == 0);
+}
+
+
+// what DokanResetPendingIrpTimeout does
+static VOID
+SetDeadline(
+	PHOST_PENDING_IRPS	Pending,
+	PIRP_ENTRY			IrpEntry,
+	LONGLONG			TickCount)
+{
+	IrpEntry->TickCount.QuadPart = TickCount;
+	DokanScheduleTimeout(&Pending->List, IrpEntry);
+}
+
+// what ReleaseTimeoutPendingIrp does at TickCount,
+// returns the number of IRPs which timed out
+static ULONG
+Sweep(
+	PHOST_PENDING_IRPS	Pending,
+	LONGLONG			TickCount)
+{
+	LIST_ENTRY	completeList;
+	ULONG		count = 0;
+
+	g_HostTickCount = TickCount;
+	InitializeListHead(&completeList);
+	DokanCollectTimeoutIrps(&Pending->List, &completeList);
+
+	while (!IsListEmpty(&completeList)) {
+		PIRP_ENTRY irpEntry = CONTAINING_RECORD(
+			RemoveHeadList(&completeList), IRP_ENTRY, ListEntry);
+		CHECK(irpEntry->Irp->Tail.Overlay.DriverContext[DRIVER_CONTEXT_IRP_ENTRY] == NULL);
+		DokanFreeIrpEntry(irpEntry);
+		count++;
+	}
+	return count;
+}
+
+#define IsPending(Pending, IrpEntry) \
+	(DokanFindPendingIrp(&(Pending)->List, (IrpEntry)->SerialNumber) == (IrpEntry))
+
+
+static VOID
+TestTimeout(void)
+{
+	HOST_PENDING_IRPS	pending;
+	PIRP_ENTRY			a, b, extended, expired, far, late, done, canceling;
+	LONGLONG			slot, now;
+	ULONG				taken = 0;
+	ULONG				i;
+
+	HostInitPendingIrps(&pending);
+	slot = pending.Wheel.SlotTicks;
+	CHECK(slot == DOKAN_CHECK_INTERVAL * 1000 * 10 / KeQueryTimeIncrement());
+
+	// in deadline order
+	now = g_HostTickCount;
+	a = HostInsertPendingIrp(&pending, TestSerial(1));
+	b = HostInsertPendingIrp(&pending, TestSerial(2));
+	SetDeadline(&pending, a, now + slot);
+	SetDeadline(&pending, b, now + slot * 3);
+	CHECK(Sweep(&pending, now) == 0);
+	CHECK(Sweep(&pending, now + slot) == 1);
+	// the sweep freed it
+	CHECK(DokanFindPendingIrp(&pending.List, TestSerial(1)) == NULL);
+	CHECK(IsPending(&pending, b));
+	CHECK(Sweep(&pending, now + slot * 3 - 1) == 0);
+	CHECK(Sweep(&pending, now + slot * 3) == 1);
+	CHECK(IsListEmpty(&pending.List.ListHead));
+
+	// an extended timeout in front of the list, and of the slot a turn
+	// later, does not hide one which expires
+	now = g_HostTickCount;
+	extended = HostInsertPendingIrp(&pending, TestSerial(3));
+	expired = HostInsertPendingIrp(&pending, TestSerial(4));
+	SetDeadline(&pending, extended, now + slot * (DOKAN_TIMEOUT_WHEEL_SLOTS + 3));
+	SetDeadline(&pending, expired, now + slot * 3);
+	CHECK(Sweep(&pending, now + slot * 3) == 1);
+	CHECK(DokanFindPendingIrp(&pending.List, TestSerial(4)) == NULL);
+	CHECK(IsPending(&pending, extended));
+	CHECK(Sweep(&pending, extended->TickCount.QuadPart - 1) == 0);
+	CHECK(Sweep(&pending, extended->TickCount.QuadPart) == 1);
+
+	// a deadline more than one turn away waits in its slot for later turns
+	now = g_HostTickCount;
+	far = HostInsertPendingIrp(&pending, TestSerial(5));
+	SetDeadline(&pending, far, now + slot * (DOKAN_TIMEOUT_WHEEL_SLOTS * 2 + 5));
+	for (i = 0; i < DOKAN_TIMEOUT_WHEEL_SLOTS * 2 + 5; ++i) {
+		taken += Sweep(&pending, now + slot * i);
+	}
+	CHECK(taken == 0);
+	CHECK(IsPending(&pending, far));
+	CHECK(Sweep(&pending, far->TickCount.QuadPart) == 1);
+
+	// a sweep which comes more than a turn late visits every slot
+	now = g_HostTickCount;
+	a = HostInsertPendingIrp(&pending, TestSerial(6));
+	late = HostInsertPendingIrp(&pending, TestSerial(7));
+	SetDeadline(&pending, a, now + slot);
+	SetDeadline(&pending, late, now + slot * (DOKAN_TIMEOUT_WHEEL_SLOTS - 1));
+	CHECK(Sweep(&pending, now + slot * DOKAN_TIMEOUT_WHEEL_SLOTS * 3) == 2);
+
+	// a completed IRP is off the wheel, one being canceled
+	// is left to its cancel routine
+	now = g_HostTickCount;
+	done = HostInsertPendingIrp(&pending, TestSerial(8));
+	canceling = HostInsertPendingIrp(&pending, TestSerial(9));
+	DokanRemovePendingIrp(done);
+	DokanFreeIrpEntry(done);
+	CHECK(IoSetCancelRoutine(canceling->Irp, NULL) == HostCancelPendingIrp);
+	CHECK(Sweep(&pending, canceling->TickCount.QuadPart) == 0);
+	CHECK(!IsPending(&pending, canceling));
+	CHECK(canceling->CancelRoutineFreeMemory);
+	CHECK(IsListEmpty(&canceling->ListEntry));
+	DokanRemovePendingIrp(canceling);
+	DokanFreeIrpEntry(canceling);
+
+	CHECK(IsListEmpty(&pending.List.ListHead));
+	for (i = 0; i < DOKAN_TIMEOUT_WHEEL_SLOTS; ++i) {
+		CHECK(IsListEmpty(&pending.Wheel.Slots[i]));
+	}
+	CHECK(g_HostPoolAllocations == 0);
+}
+
+
+int main(void)
+{
+	TestLookup();
+	TestCancel();
+	TestTimeout();
+
+	return TestResult("pendingirp_test");
+}
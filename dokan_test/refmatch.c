@@ -0,0 +1,122 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2008 Hiroki Asakawa info@dokan-dev.net
+
+  http://dokan-dev.net/en
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "refmatch.h"
+
+
+#define DOS_STAR                        (L'<')
+#define DOS_QM                          (L'>')
+#define DOS_DOT                         (L'"')
+
+// DokanIsNameInExpression as it was before dokan/match.c,
+// and with the REF_CHANGE_* of Changes
+BOOL
+RefIsNameInExpression(
+	LPCWSTR		Expression, // matching pattern
+	LPCWSTR		Name, // file name
+	BOOL		IgnoreCase,
+	ULONG		Changes)
+{
+	ULONG ei = 0;
+	ULONG ni = 0;
+
+	while (Expression[ei] != '\0') {
+
+		if (Expression[ei] == L'*') {
+			ei++;
+			if (Expression[ei] == '\0')
+				return TRUE;
+
+			while (Name[ni] != '\0') {
+				if (RefIsNameInExpression(&Expression[ei], &Name[ni], IgnoreCase, Changes))
+					return TRUE;
+				ni++;
+			}
+
+		} else if (Expression[ei] == DOS_STAR) {
+
+			ULONG p = ni;
+			// the baseline took 0 for no period
+			LONG lastDot = Changes & REF_CHANGE_DOS_STAR ? -1 : 0;
+			ei++;
+
+			while (Name[p] != '\0') {
+				if (Name[p] == L'.')
+					lastDot = p;
+				p++;
+			}
+
+			while (TRUE) {
+				if (Name[ni] == '\0' || (LONG)ni == lastDot)
+					break;
+
+				if (RefIsNameInExpression(&Expression[ei], &Name[ni], IgnoreCase, Changes))
+					return TRUE;
+				ni++;
+			}
+
+		} else if (Expression[ei] == DOS_QM)  {
+
+			ei++;
+			if (Changes & REF_CHANGE_END_OF_NAME && Name[ni] == '\0') {
+				// zero characters at the end of the name
+			} else if (Name[ni] != L'.') {
+				ni++;
+			} else {
+
+				ULONG p = ni + 1;
+				while (Name[p] != '\0') {
+					if (Name[p] == L'.')
+						break;
+					p++;
+				}
+
+				if (Name[p] == L'.')
+					ni++;
+			}
+
+		} else if (Expression[ei] == DOS_DOT) {
+			ei++;
+
+			if (Name[ni] == L'.')
+				ni++;
+
+		} else {
+			// the baseline stepped over the null for '?'
+			if (Changes & REF_CHANGE_END_OF_NAME && Name[ni] == '\0') {
+				return FALSE;
+			} else if (Expression[ei] == L'?') {
+				ei++; ni++;
+			} else if(IgnoreCase && towupper(Expression[ei]) == towupper(Name[ni])) {
+				ei++; ni++;
+			} else if(!IgnoreCase && Expression[ei] == Name[ni]) {
+				ei++; ni++;
+			} else {
+				return FALSE;
+			}
+		}
+	}
+
+	if (ei == wcslen(Expression) && ni == wcslen(Name))
+		return TRUE;
+
+	return FALSE;
+}
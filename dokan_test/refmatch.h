@@ -0,0 +1,46 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2008 Hiroki Asakawa info@dokan-dev.net
+
+  http://dokan-dev.net/en
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef _REFMATCH_H_
+#define _REFMATCH_H_
+
+#include "dokani.h"
+
+// The recursive DokanIsNameInExpression of the baseline, which the
+// compiled expressions of dokan/match.c are checked against. Changes
+// selects the behavior changes of match.c, 0 is the baseline as it was.
+// The baseline reads past the null of Name after '?' and DOS_QM, the
+// name must be followed by as many nulls as the expression is long.
+
+// '?' does not match the end of the name, DOS_QM matches nothing there
+#define REF_CHANGE_END_OF_NAME	0x1
+// DOS_STAR at the start of a name without a period matches
+#define REF_CHANGE_DOS_STAR		0x2
+#define REF_CHANGE_ALL			(REF_CHANGE_END_OF_NAME | REF_CHANGE_DOS_STAR)
+
+BOOL
+RefIsNameInExpression(
+	LPCWSTR		Expression,
+	LPCWSTR		Name,
+	BOOL		IgnoreCase,
+	ULONG		Changes);
+
+#endif // _REFMATCH_H_
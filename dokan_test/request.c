@@ -0,0 +1,299 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2008 Hiroki Asakawa info@dokan-dev.net
+
+  http://dokan-dev.net/en
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "request.h"
+
+
+volatile LONG	g_RequestCloses;
+volatile LONG	g_RequestLongReplies;
+
+
+// submits EventContext, frees it and copies the reply data to Buffer
+static ULONG
+Submit(
+	PDOKAN_LOOPBACK		Loopback,
+	PEVENT_CONTEXT		EventContext,
+	PEVENT_INFORMATION	EventInfo,
+	ULONG				EventInfoLength)
+{
+	ULONG	returnedLength = 0;
+	BOOL	status;
+
+	ZeroMemory(EventInfo, EventInfoLength);
+	status = DokanLoopbackSubmit(Loopback, EventContext, EventInfo,
+				EventInfoLength, &returnedLength);
+	DokanLoopbackFreeEvent(EventContext);
+
+	if (!status) {
+		return STATUS_DEVICE_NOT_READY;
+	}
+	if (returnedLength > sizeof(EVENT_INFORMATION) &&
+		returnedLength > FIELD_OFFSET(EVENT_INFORMATION, Buffer) + EventInfo->BufferLength) {
+		InterlockedIncrement(&g_RequestLongReplies);
+	}
+	return EventInfo->Status;
+}
+
+
+static PEVENT_INFORMATION
+AllocateReply(
+	ULONG	BufferLength,
+	PULONG	EventInfoLength)
+{
+	*EventInfoLength = sizeof(EVENT_INFORMATION) + BufferLength;
+	return (PEVENT_INFORMATION)malloc(*EventInfoLength);
+}
+
+
+ULONG
+RequestCreate(
+	PDOKAN_LOOPBACK	Loopback,
+	LPCWSTR			FileName,
+	ULONG			Disposition,
+	ULONG			Options,
+	PULONG64		Context)
+{
+	EVENT_INFORMATION	eventInfo;
+	PEVENT_CONTEXT		eventContext;
+	ULONG				status;
+
+	*Context = 0;
+	eventContext = DokanLoopbackAllocateEvent(IRP_MJ_CREATE, FileName, NULL, 0);
+	if (eventContext == NULL) {
+		return STATUS_INSUFFICIENT_RESOURCES;
+	}
+	eventContext->Create.CreateOptions = (Disposition << 24) | Options;
+	eventContext->Create.DesiredAccess = GENERIC_READ | GENERIC_WRITE;
+	eventContext->Create.ShareAccess = FILE_SHARE_READ | FILE_SHARE_WRITE;
+
+	status = Submit(Loopback, eventContext, &eventInfo, sizeof(EVENT_INFORMATION));
+	if (status == STATUS_SUCCESS) {
+		*Context = eventInfo.Context;
+	}
+	return status;
+}
+
+
+ULONG
+RequestClose(
+	PDOKAN_LOOPBACK	Loopback,
+	LPCWSTR			FileName,
+	ULONG64			Context)
+{
+	EVENT_INFORMATION	eventInfo;
+	PEVENT_CONTEXT		eventContext;
+	ULONG				status;
+
+	eventContext = DokanLoopbackAllocateEvent(IRP_MJ_CLEANUP, FileName, NULL, 0);
+	if (eventContext == NULL) {
+		return STATUS_INSUFFICIENT_RESOURCES;
+	}
+	eventContext->Context = Context;
+	status = Submit(Loopback, eventContext, &eventInfo, sizeof(EVENT_INFORMATION));
+
+	// IRP_MJ_CLOSE has no reply
+	eventContext = DokanLoopbackAllocateEvent(IRP_MJ_CLOSE, FileName, NULL, 0);
+	if (eventContext == NULL) {
+		return STATUS_INSUFFICIENT_RESOURCES;
+	}
+	eventContext->Context = Context;
+	if (status == STATUS_SUCCESS) {
+		InterlockedIncrement(&g_RequestCloses);
+	}
+	DokanLoopbackSubmit(Loopback, eventContext, NULL, 0, NULL);
+	DokanLoopbackFreeEvent(eventContext);
+	return status;
+}
+
+
+ULONG
+RequestRead(
+	PDOKAN_LOOPBACK	Loopback,
+	LPCWSTR			FileName,
+	ULONG64			Context,
+	LONGLONG		Offset,
+	PVOID			Buffer,
+	ULONG			Length,
+	PULONG			ReadLength)
+{
+	PEVENT_INFORMATION	eventInfo;
+	PEVENT_CONTEXT		eventContext;
+	ULONG				eventInfoLength;
+	ULONG				status;
+
+	*ReadLength = 0;
+	eventInfo = AllocateReply(Length, &eventInfoLength);
+	eventContext = DokanLoopbackAllocateEvent(IRP_MJ_READ, FileName, NULL, 0);
+	if (eventInfo == NULL || eventContext == NULL) {
+		free(eventInfo);
+		free(eventContext);
+		return STATUS_INSUFFICIENT_RESOURCES;
+	}
+	eventContext->Context = Context;
+	eventContext->Read.ByteOffset.QuadPart = Offset;
+	eventContext->Read.BufferLength = Length;
+
+	status = Submit(Loopback, eventContext, eventInfo, eventInfoLength);
+	if (status == STATUS_SUCCESS) {
+		*ReadLength = min(eventInfo->BufferLength, Length);
+		CopyMemory(Buffer, eventInfo->Buffer, *ReadLength);
+	}
+	free(eventInfo);
+	return status;
+}
+
+
+ULONG
+RequestWrite(
+	PDOKAN_LOOPBACK	Loopback,
+	LPCWSTR			FileName,
+	ULONG64			Context,
+	LONGLONG		Offset,
+	const VOID*		Buffer,
+	ULONG			Length)
+{
+	EVENT_INFORMATION	eventInfo;
+	PEVENT_CONTEXT		eventContext;
+
+	eventContext = DokanLoopbackAllocateEvent(IRP_MJ_WRITE, FileName, NULL, Length);
+	if (eventContext == NULL) {
+		return STATUS_INSUFFICIENT_RESOURCES;
+	}
+	eventContext->Context = Context;
+	eventContext->Write.ByteOffset.QuadPart = Offset;
+	CopyMemory((PCHAR)eventContext + eventContext->Write.BufferOffset, Buffer, Length);
+
+	return Submit(Loopback, eventContext, &eventInfo, sizeof(EVENT_INFORMATION));
+}
+
+
+ULONG
+RequestQueryInformation(
+	PDOKAN_LOOPBACK	Loopback,
+	LPCWSTR			FileName,
+	ULONG64			Context,
+	ULONG			InformationClass,
+	PVOID			Buffer,
+	ULONG			Length,
+	PULONG			ReturnedLength)
+{
+	PEVENT_INFORMATION	eventInfo;
+	PEVENT_CONTEXT		eventContext;
+	ULONG				eventInfoLength;
+	ULONG				status;
+
+	*ReturnedLength = 0;
+	eventInfo = AllocateReply(Length, &eventInfoLength);
+	eventContext = DokanLoopbackAllocateEvent(IRP_MJ_QUERY_INFORMATION, FileName, NULL, 0);
+	if (eventInfo == NULL || eventContext == NULL) {
+		free(eventInfo);
+		free(eventContext);
+		return STATUS_INSUFFICIENT_RESOURCES;
+	}
+	eventContext->Context = Context;
+	eventContext->File.FileInformationClass = InformationClass;
+	eventContext->File.BufferLength = Length;
+
+	status = Submit(Loopback, eventContext, eventInfo, eventInfoLength);
+	if (status == STATUS_SUCCESS) {
+		*ReturnedLength = min(eventInfo->BufferLength, Length);
+		CopyMemory(Buffer, eventInfo->Buffer, *ReturnedLength);
+	}
+	free(eventInfo);
+	return status;
+}
+
+
+ULONG
+RequestDirectory(
+	PDOKAN_LOOPBACK	Loopback,
+	LPCWSTR			DirectoryName,
+	LPCWSTR			SearchPattern,
+	ULONG64			Context,
+	ULONG			InformationClass,
+	PULONG			FileIndex,
+	PVOID			Buffer,
+	ULONG			Length,
+	PULONG			ReturnedLength)
+{
+	PEVENT_INFORMATION	eventInfo;
+	PEVENT_CONTEXT		eventContext;
+	ULONG				eventInfoLength;
+	ULONG				status;
+
+	*ReturnedLength = 0;
+	eventInfo = AllocateReply(Length, &eventInfoLength);
+	eventContext = DokanLoopbackAllocateEvent(IRP_MJ_DIRECTORY_CONTROL,
+						DirectoryName, SearchPattern, 0);
+	if (eventInfo == NULL || eventContext == NULL) {
+		free(eventInfo);
+		free(eventContext);
+		return STATUS_INSUFFICIENT_RESOURCES;
+	}
+	eventContext->Context = Context;
+	eventContext->Directory.FileInformationClass = InformationClass;
+	eventContext->Directory.FileIndex = *FileIndex;
+	eventContext->Directory.BufferLength = Length;
+
+	status = Submit(Loopback, eventContext, eventInfo, eventInfoLength);
+	if (status == STATUS_SUCCESS) {
+		*ReturnedLength = min(eventInfo->BufferLength, Length);
+		CopyMemory(Buffer, eventInfo->Buffer, *ReturnedLength);
+		*FileIndex = eventInfo->Directory.Index;
+	}
+	free(eventInfo);
+	return status;
+}
+
+
+ULONG
+RequestRename(
+	PDOKAN_LOOPBACK	Loopback,
+	LPCWSTR			FileName,
+	ULONG64			Context,
+	LPCWSTR			NewFileName)
+{
+	PEVENT_INFORMATION			eventInfo;
+	PEVENT_CONTEXT				eventContext;
+	PDOKAN_RENAME_INFORMATION	renameInfo;
+	ULONG	nameLength = (ULONG)(wcslen(NewFileName) * sizeof(WCHAR));
+	ULONG	eventInfoLength;
+	ULONG	status;
+
+	eventInfo = AllocateReply(nameLength, &eventInfoLength);
+	eventContext = DokanLoopbackAllocateEvent(IRP_MJ_SET_INFORMATION, FileName, NULL,
+						sizeof(DOKAN_RENAME_INFORMATION) + nameLength);
+	if (eventInfo == NULL || eventContext == NULL) {
+		free(eventInfo);
+		free(eventContext);
+		return STATUS_INSUFFICIENT_RESOURCES;
+	}
+	eventContext->Context = Context;
+	eventContext->SetFile.FileInformationClass = FileRenameInformation;
+	renameInfo = (PDOKAN_RENAME_INFORMATION)
+		((PCHAR)eventContext + eventContext->SetFile.BufferOffset);
+	renameInfo->FileNameLength = nameLength;
+	CopyMemory(renameInfo->FileName, NewFileName, nameLength);
+
+	status = Submit(Loopback, eventContext, eventInfo, eventInfoLength);
+	free(eventInfo);
+	return status;
+}
@@ -0,0 +1,108 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2008 Hiroki Asakawa info@dokan-dev.net
+
+  http://dokan-dev.net/en
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef _REQUEST_H_
+#define _REQUEST_H_
+
+#include "dokani.h"
+#include "fileinfo.h"
+#include "loopback.h"
+
+// Requests sent through DokanLoopbackSubmit as dokan.sys would send
+// them. Each one returns EVENT_INFORMATION.Status.
+
+// Context receives the EVENT_INFORMATION.Context of the create,
+// Disposition and Options are those of IRP_MJ_CREATE (FILE_OPEN ...)
+ULONG
+RequestCreate(
+	PDOKAN_LOOPBACK	Loopback,
+	LPCWSTR			FileName,
+	ULONG			Disposition,
+	ULONG			Options,
+	PULONG64		Context);
+
+// IRP_MJ_CLOSEs sent after a successful IRP_MJ_CLEANUP, each one comes
+// to CloseFile of the file system some time after RequestClose returns
+extern volatile LONG	g_RequestCloses;
+
+// replies longer than their BufferLength, the rest of a reused reply
+// buffer may hold data of another reply
+extern volatile LONG	g_RequestLongReplies;
+
+// IRP_MJ_CLEANUP and IRP_MJ_CLOSE
+ULONG
+RequestClose(
+	PDOKAN_LOOPBACK	Loopback,
+	LPCWSTR			FileName,
+	ULONG64			Context);
+
+ULONG
+RequestRead(
+	PDOKAN_LOOPBACK	Loopback,
+	LPCWSTR			FileName,
+	ULONG64			Context,
+	LONGLONG		Offset,
+	PVOID			Buffer,
+	ULONG			Length,
+	PULONG			ReadLength);
+
+ULONG
+RequestWrite(
+	PDOKAN_LOOPBACK	Loopback,
+	LPCWSTR			FileName,
+	ULONG64			Context,
+	LONGLONG		Offset,
+	const VOID*		Buffer,
+	ULONG			Length);
+
+ULONG
+RequestQueryInformation(
+	PDOKAN_LOOPBACK	Loopback,
+	LPCWSTR			FileName,
+	ULONG64			Context,
+	ULONG			InformationClass,
+	PVOID			Buffer,
+	ULONG			Length,
+	PULONG			ReturnedLength);
+
+// one IRP_MN_QUERY_DIRECTORY, FileIndex is the Index of the previous
+// reply (0 restarts the scan) and receives the Index of this one
+ULONG
+RequestDirectory(
+	PDOKAN_LOOPBACK	Loopback,
+	LPCWSTR			DirectoryName,
+	LPCWSTR			SearchPattern,
+	ULONG64			Context,
+	ULONG			InformationClass,
+	PULONG			FileIndex,
+	PVOID			Buffer,
+	ULONG			Length,
+	PULONG			ReturnedLength);
+
+// FileRenameInformation, NewFileName is "\\dir\\file"
+ULONG
+RequestRename(
+	PDOKAN_LOOPBACK	Loopback,
+	LPCWSTR			FileName,
+	ULONG64			Context,
+	LPCWSTR			NewFileName);
+
+#endif // _REQUEST_H_
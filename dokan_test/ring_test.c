@@ -0,0 +1,518 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2008 Hiroki Asakawa info@dokan-dev.net
+
+  http://dokan-dev.net/en
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "test.h"
+#include "hostring.h"
+
+
+// Request/reply ring (sys/ring.c and dokan/ring.c)
+//
+// What IOCTL_RING_REGISTER accepts, a slot going FREE -> REQUEST ->
+// BUSY -> REPLY -> FREE, the ring wrapping around, events and replies
+// which do not fit into a slot, replies which go to the device channel
+// and the index of the BUSY slots by SerialNumber.
+
+#define EVENT_LEN			((ULONG)sizeof(EVENT_CONTEXT))
+#define RING_SLOT_SIZE		(FIELD_OFFSET(DOKAN_RING_SLOT, Data) + EVENT_CONTEXT_MAX_SIZE)
+#define RING_SLOT_COUNT		4
+
+
+typedef struct _HOST_RING {
+	// driver side
+	DokanDCB			Dcb;
+	DokanVCB			Vcb;
+	DEVICE_OBJECT		Device;
+	KEVENT				RequestEvent;
+	KEVENT				ReplyEvent;
+
+	// IOCTL_RING_REGISTER
+	DOKAN_RING_REGISTER	Register;
+	IRP					Irp;
+	IO_STACK_LOCATION	Stack;
+	MDL					Mdl;
+	KEVENT				Completed;
+
+	// library side
+	PDOKAN_RING_CONTEXT	Ring;
+	RING_CHANNEL		Channel;
+	PCHAR				Buffer;
+} HOST_RING, *PHOST_RING;
+
+
+// a mounted volume and a ring of SlotCount slots which is not registered
+static VOID
+InitRing(
+	PHOST_RING	Host,
+	ULONG		SlotCount)
+{
+	PDOKAN_RING_CONTEXT	ring;
+
+	ZeroMemory(Host, sizeof(HOST_RING));
+	Host->Vcb.Identifier.Type = VCB;
+	Host->Vcb.Dcb = &Host->Dcb;
+	Host->Dcb.Vcb = &Host->Vcb;
+	Host->Dcb.Mounted = 1;
+	Host->Dcb.EventBufferSize = EVENT_CONTEXT_MAX_SIZE;
+	DokanInitEventQueue(&Host->Dcb.EventQueue);
+	KeInitializeSpinLock(&Host->Dcb.Ring.Lock);
+	Host->Device.DeviceExtension = &Host->Vcb;
+	KeInitializeEvent(&Host->RequestEvent, NotificationEvent, FALSE);
+	KeInitializeEvent(&Host->ReplyEvent, NotificationEvent, FALSE);
+	KeInitializeEvent(&Host->Completed, NotificationEvent, FALSE);
+
+	// what DokanRingStart does before IOCTL_RING_REGISTER
+	ring = (PDOKAN_RING_CONTEXT)calloc(1, sizeof(DOKAN_RING_CONTEXT));
+	ring->Device = INVALID_HANDLE_VALUE;
+	ring->SlotSize = RING_SLOT_SIZE;
+	ring->SlotCount = SlotCount;
+	ring->Length = DOKAN_RING_LENGTH(ring->SlotSize, ring->SlotCount);
+	ring->Base = (PDOKAN_RING_HEADER)VirtualAlloc(
+					NULL, ring->Length, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+	ring->RequestEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+	ring->ReplyEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+	ring->Overlapped.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+	ring->Overlapped.Internal = STATUS_PENDING;
+
+	Host->Ring = ring;
+	Host->Channel.Ring = ring;
+	Host->Channel.DeviceChannel = HostDeviceTransport.OpenChannel(NULL);
+	Host->Buffer = (PCHAR)malloc(EVENT_CONTEXT_MAX_SIZE);
+
+	Host->Register.RequestEvent = (HANDLE)&Host->RequestEvent;
+	Host->Register.ReplyEvent = (HANDLE)&Host->ReplyEvent;
+	Host->Register.SlotCount = ring->SlotCount;
+	Host->Register.SlotSize = ring->SlotSize;
+}
+
+static NTSTATUS
+RegisterRing(
+	PHOST_RING	Host)
+{
+	ZeroMemory(&Host->Irp, sizeof(IRP));
+	ZeroMemory(&Host->Stack, sizeof(IO_STACK_LOCATION));
+	Host->Stack.Parameters.DeviceIoControl.IoControlCode = IOCTL_RING_REGISTER;
+	Host->Stack.Parameters.DeviceIoControl.InputBufferLength = sizeof(DOKAN_RING_REGISTER);
+	Host->Stack.Parameters.DeviceIoControl.OutputBufferLength = (ULONG)Host->Ring->Length;
+	Host->Mdl.MappedSystemVa = Host->Ring->Base;
+	Host->Irp.AssociatedIrp.SystemBuffer = &Host->Register;
+	Host->Irp.MdlAddress = &Host->Mdl;
+	Host->Irp.CurrentStackLocation = &Host->Stack;
+	Host->Irp.HostCompleted = &Host->Completed;
+	KeClearEvent(&Host->Completed);
+
+	return DokanRingRegister(&Host->Device, &Host->Irp);
+}
+
+static VOID
+DeleteHostRing(
+	PHOST_RING	Host)
+{
+	DokanRingRelease(&Host->Dcb);
+	DokanFreeQueuedEvents(&Host->Dcb.EventQueue);
+	DeleteRing(Host->Ring);
+	free(Host->Buffer);
+}
+
+static VOID
+QueueRingEvent(
+	PHOST_RING	Host,
+	ULONG		SerialNumber,
+	ULONG		Length)
+{
+	DokanQueueEvent(&Host->Dcb.EventQueue, HostAllocateEvent(SerialNumber, Length));
+}
+
+#define SlotOf(Host, Index)		RingSlot((Host)->Ring, Index)
+#define SignaledEvent(e)		(KeReadStateEvent(e) != 0)
+#define SignaledHandle(h)		(WaitForSingleObject(h, 0) == WAIT_OBJECT_0)
+
+// RingWaitEvent when a REQUEST slot is there, which it would wait for,
+// returns the SerialNumber taken or 0
+static ULONG
+TakeEvent(
+	PHOST_RING	Host)
+{
+	ULONG	length;
+	ULONG	i;
+
+	for (i = 0; i < Host->Ring->SlotCount; ++i) {
+		if (SlotOf(Host, i)->State == DOKAN_RING_SLOT_REQUEST) {
+			break;
+		}
+	}
+	if (i == Host->Ring->SlotCount ||
+		!RingWaitEvent(&Host->Channel, Host->Buffer, EVENT_CONTEXT_MAX_SIZE, &length)) {
+		return 0;
+	}
+	CHECK(length == ((PEVENT_CONTEXT)Host->Buffer)->Length);
+	return ((PEVENT_CONTEXT)Host->Buffer)->SerialNumber;
+}
+
+static BOOL
+Reply(
+	PHOST_RING	Host,
+	ULONG		SerialNumber,
+	ULONG		EventLength)
+{
+	EVENT_INFORMATION	eventInfo;
+
+	ZeroMemory(&eventInfo, sizeof(EVENT_INFORMATION));
+	eventInfo.SerialNumber = SerialNumber;
+	eventInfo.Status = STATUS_SUCCESS;
+	return RingSendEventInformation(&Host->Channel, &eventInfo, EventLength);
+}
+
+
+
+static VOID
+TestRegister(void)
+{
+	HOST_RING	host;
+	PIRP		irp = &host.Irp;
+
+	InitRing(&host, RING_SLOT_COUNT);
+
+	// a slot holds EventBufferSize, no more and no less
+	host.Register.SlotSize = RING_SLOT_SIZE - 8;
+	CHECK(RegisterRing(&host) == STATUS_INVALID_PARAMETER);
+	host.Register.SlotSize = FIELD_OFFSET(DOKAN_RING_SLOT, Data) + EVENT_CONTEXT_MAX_BUFFER_SIZE;
+	CHECK(RegisterRing(&host) == STATUS_INVALID_PARAMETER);
+	host.Register.SlotSize = RING_SLOT_SIZE;
+
+	// the locked memory is bounded
+	host.Register.SlotCount = 0;
+	CHECK(RegisterRing(&host) == STATUS_INVALID_PARAMETER);
+	host.Register.SlotCount = DOKAN_RING_MAX_LENGTH / RING_SLOT_SIZE + 1;
+	CHECK(host.Register.SlotCount <= DOKAN_RING_MAX_SLOT_COUNT);
+	CHECK(RegisterRing(&host) == STATUS_INVALID_PARAMETER);
+	host.Register.SlotCount = RING_SLOT_COUNT;
+
+	host.Stack.Parameters.DeviceIoControl.OutputBufferLength = 0;
+	CHECK(g_HostObjectReferences == 0);
+	CHECK(host.Dcb.Ring.Irp == NULL);
+
+	CHECK(RegisterRing(&host) == STATUS_PENDING);
+	CHECK(host.Dcb.Ring.Irp == irp);
+	CHECK(host.Ring->Base->SlotCount == RING_SLOT_COUNT);
+	CHECK(host.Ring->Base->SlotSize == RING_SLOT_SIZE);
+	CHECK(g_HostObjectReferences == 2);
+	// NotificationThread starts to wait for ReplyEvent
+	CHECK(SignaledEvent(&host.Dcb.EventQueue.EventQueued));
+
+	// one ring per volume
+	CHECK(DokanRingRegister(&host.Device, &host.Irp) == STATUS_DEVICE_BUSY);
+	CHECK(g_HostObjectReferences == 2);
+
+	// unmount completes the IRP
+	DokanRingRelease(&host.Dcb);
+	CHECK(SignaledEvent(&host.Completed));
+	CHECK(irp->IoStatus.Status == STATUS_SUCCESS);
+	CHECK(host.Dcb.Ring.Irp == NULL);
+	CHECK(g_HostObjectReferences == 0);
+
+	// and so does a cancel, as IoCancelIrp calls the routine
+	CHECK(RegisterRing(&host) == STATUS_PENDING);
+	IoSetCancelRoutine(irp, NULL)(&host.Device, irp);
+	CHECK(SignaledEvent(&host.Completed));
+	CHECK(irp->IoStatus.Status == STATUS_CANCELLED);
+	CHECK(host.Dcb.Ring.Irp == NULL);
+	CHECK(g_HostObjectReferences == 0);
+
+	// not before the volume is mounted
+	host.Dcb.Mounted = 0;
+	CHECK(RegisterRing(&host) == STATUS_DEVICE_BUSY);
+	CHECK(g_HostObjectReferences == 0);
+
+	DeleteHostRing(&host);
+	CHECK(g_HostPoolAllocations == 0);
+}
+
+
+static VOID
+TestTransitions(void)
+{
+	HOST_RING			host;
+	PDOKAN_RING_SLOT	slot;
+
+	InitRing(&host, RING_SLOT_COUNT);
+	CHECK(RegisterRing(&host) == STATUS_PENDING);
+	slot = SlotOf(&host, 0);
+	g_HostReplyCount = 0;
+	g_HostDeviceReplies = 0;
+
+	QueueRingEvent(&host, 1, EVENT_LEN + 100);
+	CHECK(host.Dcb.EventQueue.QueuedEventCount == 1);
+	CHECK(slot->State == DOKAN_RING_SLOT_FREE);
+
+	// the driver copies the event in and frees it
+	DokanRingNotify(&host.Dcb);
+	CHECK(slot->State == DOKAN_RING_SLOT_REQUEST);
+	CHECK(slot->Length == EVENT_LEN + 100);
+	CHECK(SignaledEvent(&host.RequestEvent));
+	CHECK(host.Dcb.EventQueue.QueuedEventCount == 0);
+	CHECK(g_HostPoolAllocations == 0);
+
+	// a DokanLoop thread takes it
+	CHECK(TakeEvent(&host) == 1);
+	CHECK(slot->State == DOKAN_RING_SLOT_BUSY);
+	CHECK(host.Ring->BusySlot[1] == 1);
+
+	// the driver leaves BUSY slots alone
+	DokanRingNotify(&host.Dcb);
+	CHECK(slot->State == DOKAN_RING_SLOT_BUSY);
+	CHECK(g_HostReplyCount == 0);
+
+	// the reply goes into the same slot
+	CHECK(Reply(&host, 1, sizeof(EVENT_INFORMATION)));
+	CHECK(slot->State == DOKAN_RING_SLOT_REPLY);
+	CHECK(slot->Length == sizeof(EVENT_INFORMATION));
+	CHECK(SignaledHandle(host.Ring->ReplyEvent));
+	CHECK(host.Ring->BusySlot[1] == 0);
+	CHECK(g_HostDeviceReplies == 0);
+
+	// and completes the IRP
+	DokanRingNotify(&host.Dcb);
+	CHECK(slot->State == DOKAN_RING_SLOT_FREE);
+	CHECK(g_HostReplyCount == 1);
+	CHECK(g_HostReplySerial[0] == 1);
+	CHECK(g_HostPoolAllocations == 0);
+
+	DeleteHostRing(&host);
+	CHECK(g_HostObjectReferences == 0);
+}
+
+
+static VOID
+TestWraparound(void)
+{
+	HOST_RING	host;
+	ULONG		serial = 0;
+	ULONG		taken = 0;
+	ULONG		expected;
+	ULONG		round, i;
+
+	InitRing(&host, RING_SLOT_COUNT);
+	CHECK(RegisterRing(&host) == STATUS_PENDING);
+	g_HostReplyCount = 0;
+
+	// 6 events for 4 slots
+	for (i = 1; i <= 6; ++i) {
+		QueueRingEvent(&host, i, EVENT_LEN);
+	}
+	DokanRingNotify(&host.Dcb);
+	CHECK(host.Dcb.EventQueue.QueuedEventCount == 2);
+	for (i = 1; i <= 4; ++i) {
+		CHECK(TakeEvent(&host) == i);
+	}
+	CHECK(TakeEvent(&host) == 0);
+
+	// replies out of order free slots 1 and 2, where 5 and 6 go
+	CHECK(Reply(&host, 3, sizeof(EVENT_INFORMATION)));
+	CHECK(Reply(&host, 2, sizeof(EVENT_INFORMATION)));
+	DokanRingNotify(&host.Dcb);
+	CHECK(g_HostReplyCount == 2);
+	CHECK(host.Dcb.EventQueue.QueuedEventCount == 0);
+	CHECK(SlotOf(&host, 0)->State == DOKAN_RING_SLOT_BUSY);
+	CHECK(SlotOf(&host, 1)->State == DOKAN_RING_SLOT_REQUEST);
+	CHECK(SlotOf(&host, 2)->State == DOKAN_RING_SLOT_REQUEST);
+	CHECK(SlotOf(&host, 3)->State == DOKAN_RING_SLOT_BUSY);
+	CHECK(TakeEvent(&host) == 5);
+	CHECK(TakeEvent(&host) == 6);
+
+	for (i = 1; i <= 6; ++i) {
+		if (i != 2 && i != 3) {
+			CHECK(Reply(&host, i, sizeof(EVENT_INFORMATION)));
+		}
+	}
+	DokanRingNotify(&host.Dcb);
+	CHECK(g_HostReplyCount == 6);
+	for (i = 0; i < RING_SLOT_COUNT; ++i) {
+		CHECK(SlotOf(&host, i)->State == DOKAN_RING_SLOT_FREE);
+	}
+
+	// many turns of the ring keep the order of the events,
+	// up to 6 events come while 4 slots are there
+	serial = 6;
+	expected = 7;
+	g_HostReplyCount = 0;
+	for (round = 0; round < 300 || host.Dcb.EventQueue.QueuedEventCount > 0; ++round) {
+		for (i = 0; round < 300 && i < round % 7; ++i) {
+			QueueRingEvent(&host, ++serial, EVENT_LEN);
+		}
+		DokanRingNotify(&host.Dcb);
+		while ((i = TakeEvent(&host)) != 0) {
+			taken += i == expected++;
+			Reply(&host, i, sizeof(EVENT_INFORMATION));
+		}
+	}
+	DokanRingNotify(&host.Dcb);
+	CHECK(taken == serial - 6);
+	CHECK(expected == serial + 1);
+	CHECK(g_HostReplyCount == taken);
+	CHECK(host.Ring->Unindexed == 0);
+	CHECK(g_HostPoolAllocations == 0);
+
+	DeleteHostRing(&host);
+}
+
+
+static VOID
+TestOversized(void)
+{
+	HOST_RING			host;
+	PDOKAN_RING_SLOT	slot;
+
+	InitRing(&host, RING_SLOT_COUNT);
+	CHECK(RegisterRing(&host) == STATUS_PENDING);
+	slot = SlotOf(&host, 0);
+	g_HostReplyCount = 0;
+	g_HostDeviceReplies = 0;
+
+	// an event bigger than a slot is left to IOCTL_EVENT_WAIT,
+	// and those after it in the shard are not put before it
+	QueueRingEvent(&host, 1, EVENT_CONTEXT_MAX_SIZE + 8);
+	QueueRingEvent(&host, 2, EVENT_LEN);
+	KeClearEvent(&host.RequestEvent);
+	DokanRingNotify(&host.Dcb);
+	CHECK(slot->State == DOKAN_RING_SLOT_FREE);
+	CHECK(!SignaledEvent(&host.RequestEvent));
+	CHECK(host.Dcb.EventQueue.QueuedEventCount == 2);
+	DokanFreeQueuedEvents(&host.Dcb.EventQueue);
+
+	// a slot longer than the buffer of the thread is dropped
+	QueueRingEvent(&host, 3, EVENT_LEN + 64);
+	DokanRingNotify(&host.Dcb);
+	CHECK(slot->State == DOKAN_RING_SLOT_REQUEST);
+	CHECK(TakeRequest(host.Ring, host.Buffer, EVENT_LEN) == 0);
+	CHECK(slot->State == DOKAN_RING_SLOT_FREE);
+	CHECK(SignaledHandle(host.Ring->ReplyEvent));
+	CHECK(host.Ring->BusySlot[3] == 0);
+	CHECK(host.Ring->Unindexed == 0);
+
+	// a reply bigger than a slot goes to the device channel
+	// and frees the slot
+	QueueRingEvent(&host, 4, EVENT_LEN);
+	DokanRingNotify(&host.Dcb);
+	CHECK(TakeEvent(&host) == 4);
+	slot = SlotOf(&host, host.Ring->BusySlot[4] - 1);
+	CHECK(slot->State == DOKAN_RING_SLOT_BUSY);
+	CHECK(Reply(&host, 4, EVENT_CONTEXT_MAX_SIZE + 8));
+	CHECK(g_HostDeviceReplies == 1);
+	CHECK(g_HostDeviceSerial == 4);
+	CHECK(slot->State == DOKAN_RING_SLOT_FREE);
+	CHECK(SignaledHandle(host.Ring->ReplyEvent));
+	CHECK(host.Ring->BusySlot[4] == 0);
+	DokanRingNotify(&host.Dcb);
+	CHECK(g_HostReplyCount == 0);
+
+	// a reply whose length is broken is dropped by the driver
+	QueueRingEvent(&host, 5, EVENT_LEN);
+	DokanRingNotify(&host.Dcb);
+	CHECK(TakeEvent(&host) == 5);
+	slot = SlotOf(&host, host.Ring->BusySlot[5] - 1);
+	CHECK(Reply(&host, 5, sizeof(EVENT_INFORMATION)));
+	slot->Length = RING_SLOT_SIZE;
+	DokanRingNotify(&host.Dcb);
+	CHECK(slot->State == DOKAN_RING_SLOT_FREE);
+	CHECK(g_HostReplyCount == 0);
+
+	CHECK(g_HostPoolAllocations == 0);
+	DeleteHostRing(&host);
+}
+
+
+static VOID
+TestFallback(void)
+{
+	HOST_RING			host;
+	EVENT_INFORMATION	eventInfo;
+	PDOKAN_RING_SLOT	slot;
+	ULONG				a = 7;
+	ULONG				b = 7 + DOKAN_RING_BUSY_HASH;
+
+	InitRing(&host, RING_SLOT_COUNT);
+	CHECK(RegisterRing(&host) == STATUS_PENDING);
+	g_HostReplyCount = 0;
+	g_HostDeviceReplies = 0;
+	g_HostDeviceWrites = 0;
+
+	// the event came by IOCTL_EVENT_WAIT
+	ResetEvent(host.Ring->ReplyEvent);
+	CHECK(Reply(&host, 1, sizeof(EVENT_INFORMATION)));
+	CHECK(g_HostDeviceReplies == 1);
+	CHECK(g_HostDeviceSerial == 1);
+	CHECK(!SignaledHandle(host.Ring->ReplyEvent));
+
+	// a write whose data is fetched by IOCTL_EVENT_WRITE frees its slot
+	QueueRingEvent(&host, 2, EVENT_LEN);
+	DokanRingNotify(&host.Dcb);
+	CHECK(TakeEvent(&host) == 2);
+	slot = SlotOf(&host, host.Ring->BusySlot[2] - 1);
+	ZeroMemory(&eventInfo, sizeof(EVENT_INFORMATION));
+	eventInfo.SerialNumber = 2;
+	CHECK(RingSendWriteRequest(&host.Channel, &eventInfo, sizeof(EVENT_INFORMATION),
+			host.Buffer, EVENT_CONTEXT_MAX_SIZE));
+	CHECK(g_HostDeviceWrites == 1);
+	CHECK(slot->State == DOKAN_RING_SLOT_FREE);
+	CHECK(host.Ring->BusySlot[2] == 0);
+
+	// two BUSY events of the same index entry, the second one is
+	// found by a scan
+	QueueRingEvent(&host, a, EVENT_LEN);
+	QueueRingEvent(&host, b, EVENT_LEN);
+	DokanRingNotify(&host.Dcb);
+	CHECK(TakeEvent(&host) == a);
+	CHECK(TakeEvent(&host) == b);
+	CHECK(host.Ring->Unindexed == 1);
+	slot = SlotOf(&host, host.Ring->BusySlot[a % DOKAN_RING_BUSY_HASH] - 1);
+	CHECK(((PEVENT_CONTEXT)slot->Data)->SerialNumber == a);
+
+	CHECK(Reply(&host, b, sizeof(EVENT_INFORMATION)));
+	CHECK(host.Ring->Unindexed == 0);
+	CHECK(slot->State == DOKAN_RING_SLOT_BUSY);
+	CHECK(Reply(&host, a, sizeof(EVENT_INFORMATION)));
+	CHECK(slot->State == DOKAN_RING_SLOT_REPLY);
+	CHECK(host.Ring->BusySlot[a % DOKAN_RING_BUSY_HASH] == 0);
+	CHECK(g_HostDeviceReplies == 1);
+
+	// a stale entry does not match another event
+	CHECK(Reply(&host, a, sizeof(EVENT_INFORMATION)));
+	CHECK(g_HostDeviceReplies == 2);
+
+	DokanRingNotify(&host.Dcb);
+	CHECK(g_HostReplyCount == 2);
+	CHECK(g_HostReplySerial[0] + g_HostReplySerial[1] == a + b);
+
+	CHECK(g_HostPoolAllocations == 0);
+	DeleteHostRing(&host);
+}
+
+
+int main(void)
+{
+	TestRegister();
+	TestTransitions();
+	TestWraparound();
+	TestOversized();
+	TestFallback();
+
+	return TestResult("ring_test");
+}
@@ -0,0 +1,78 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2008 Hiroki Asakawa info@dokan-dev.net
+
+  http://dokan-dev.net/en
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef _TEST_H_
+#define _TEST_H_
+
+#include <time.h>
+#include "dokani.h"
+
+// Checks and timers shared by the tests and benchmarks of dokan_test.
+// Each test program calls TestInitialize first and returns TestResult.
+
+static int g_TestFailures;
+static int g_TestChecks;
+
+#define CHECK(expr) \
+	do {\
+		g_TestChecks++;\
+		if (!(expr)) {\
+			fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #expr);\
+			g_TestFailures++;\
+		}\
+	} while(0)
+
+BOOL WINAPI DllMain(HINSTANCE Instance, DWORD Reason, LPVOID Reserved);
+
+static VOID
+TestInitialize(void)
+{
+	// done by the loader on Windows
+	DllMain(NULL, DLL_PROCESS_ATTACH, NULL);
+}
+
+static int
+TestResult(
+	const char*	Name)
+{
+	printf("%s: %d checks, %d failed\n", Name, g_TestChecks, g_TestFailures);
+	return g_TestFailures ? 1 : 0;
+}
+
+// seconds from an arbitrary point
+static double
+TestNow(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+// scale of benchmark loops, BENCH_SCALE=0.1 runs them 10 times shorter
+static double
+BenchScale(void)
+{
+	const char*	scale = getenv("BENCH_SCALE");
+	double		value = scale ? atof(scale) : 1.0;
+	return value > 0 ? value : 1.0;
+}
+
+#endif // _TEST_H_
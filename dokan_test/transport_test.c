@@ -0,0 +1,215 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2008 Hiroki Asakawa info@dokan-dev.net
+
+  http://dokan-dev.net/en
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "test.h"
+
+
+// Device transport of the library (dokan/transport.c)
+//
+// The reply to the last event of a batch waits in the channel and goes
+// to the driver with the next IOCTL_EVENT_INFO_WAIT, the replies to
+// other events, replies which do not fit and a reply left at close go
+// out with IOCTL_EVENT_INFO. The ioctls are recorded by
+// HostDeviceIoControl, there is no dokan.sys on the host.
+
+#define HOST_MAX_IOCTLS	16
+
+typedef struct _HOST_IOCTL {
+	DWORD	IoControlCode;
+	DWORD	InBufferSize;
+	ULONG	SerialNumber;	// of the EVENT_INFORMATION passed in
+} HOST_IOCTL, *PHOST_IOCTL;
+
+static HOST_IOCTL	g_HostIoctls[HOST_MAX_IOCTLS];
+static ULONG		g_HostIoctlCount;
+
+// events IOCTL_EVENT_INFO_WAIT returns next
+static ULONG64		g_HostEvents[1024];
+static ULONG		g_HostEventsLength;
+static BOOL			g_HostIoctlFails;
+
+static BOOL
+HostDeviceIoControl(
+	HANDLE			Device,
+	DWORD			IoControlCode,
+	LPVOID			InBuffer,
+	DWORD			InBufferSize,
+	LPVOID			OutBuffer,
+	DWORD			OutBufferSize,
+	LPDWORD			BytesReturned,
+	LPOVERLAPPED	Overlapped)
+{
+	PHOST_IOCTL	ioctl;
+
+	UNREFERENCED_PARAMETER(Device);
+	UNREFERENCED_PARAMETER(Overlapped);
+
+	if (g_HostIoctlCount == HOST_MAX_IOCTLS) {
+		SetLastError(ERROR_INVALID_HANDLE);
+		return FALSE;
+	}
+	ioctl = &g_HostIoctls[g_HostIoctlCount++];
+	ioctl->IoControlCode = IoControlCode;
+	ioctl->InBufferSize = InBuffer != NULL ? InBufferSize : 0;
+	ioctl->SerialNumber = ioctl->InBufferSize >= sizeof(EVENT_INFORMATION) ?
+							((PEVENT_INFORMATION)InBuffer)->SerialNumber : 0;
+
+	*BytesReturned = 0;
+	if (g_HostIoctlFails) {
+		SetLastError(ERROR_OPERATION_ABORTED);
+		return FALSE;
+	}
+	if (IoControlCode == IOCTL_EVENT_INFO_WAIT) {
+		*BytesReturned = min(g_HostEventsLength, OutBufferSize);
+		CopyMemory(OutBuffer, g_HostEvents, *BytesReturned);
+	}
+	return TRUE;
+}
+
+#define DeviceIoControl			HostDeviceIoControl
+#define DokanDeviceTransport	HostDeviceTransport
+
+#include "../dokan/transport.c"
+
+
+// the events of Serials are returned by the next IOCTL_EVENT_INFO_WAIT
+static VOID
+SetEvents(
+	const ULONG*	Serials,
+	ULONG			Count)
+{
+	ULONG	i;
+
+	ZeroMemory(g_HostEvents, sizeof(g_HostEvents));
+	g_HostEventsLength = 0;
+	for (i = 0; i < Count; ++i) {
+		PEVENT_CONTEXT context = (PEVENT_CONTEXT)((PCHAR)g_HostEvents + g_HostEventsLength);
+		context->Length = sizeof(EVENT_CONTEXT);
+		context->SerialNumber = Serials[i];
+		g_HostEventsLength = EVENT_CONTEXT_ALIGN(g_HostEventsLength + context->Length);
+	}
+}
+
+
+static BOOL
+Reply(
+	HANDLE	Channel,
+	ULONG	SerialNumber,
+	ULONG	Length)
+{
+	PEVENT_INFORMATION	eventInfo = (PEVENT_INFORMATION)malloc(Length);
+	BOOL				status;
+
+	ZeroMemory(eventInfo, Length);
+	eventInfo->SerialNumber = SerialNumber;
+	eventInfo->BufferLength = Length - sizeof(EVENT_INFORMATION);
+	status = HostDeviceTransport.SendEventInformation(Channel, eventInfo, Length);
+	free(eventInfo);
+	return status;
+}
+
+
+static BOOL
+IsIoctl(
+	ULONG	Index,
+	DWORD	IoControlCode,
+	ULONG	SerialNumber)
+{
+	return Index < g_HostIoctlCount &&
+		g_HostIoctls[Index].IoControlCode == IoControlCode &&
+		g_HostIoctls[Index].SerialNumber == SerialNumber;
+}
+
+
+int
+main(void)
+{
+	PDEVICE_CHANNEL	channel;
+	HANDLE			handle;
+	ULONG64			buffer[1024];
+	ULONG			length;
+	const ULONG		batch[] = { 1, 2 };
+	const ULONG		single[] = { 3 };
+	const ULONG		next[] = { 4 };
+
+	TestInitialize();
+
+	// DeviceOpenChannel needs the device of a mount
+	channel = (PDEVICE_CHANNEL)malloc(sizeof(DEVICE_CHANNEL));
+	ZeroMemory(channel, sizeof(DEVICE_CHANNEL));
+	channel->Device = CreateEvent(NULL, FALSE, FALSE, NULL);
+	handle = (HANDLE)channel;
+
+	// nothing to reply to yet
+	SetEvents(batch, 2);
+	CHECK(HostDeviceTransport.WaitEvent(handle, buffer, sizeof(buffer), &length));
+	CHECK(length == g_HostEventsLength);
+	CHECK(IsIoctl(0, IOCTL_EVENT_INFO_WAIT, 0));
+	CHECK(g_HostIoctls[0].InBufferSize == 0);
+
+	// the reply to the first event of the batch goes out at once,
+	// the one to the last waits for the next call
+	CHECK(Reply(handle, 1, sizeof(EVENT_INFORMATION)));
+	CHECK(IsIoctl(1, IOCTL_EVENT_INFO, 1));
+	CHECK(Reply(handle, 2, sizeof(EVENT_INFORMATION) + 16));
+	CHECK(g_HostIoctlCount == 2);
+
+	SetEvents(single, 1);
+	CHECK(HostDeviceTransport.WaitEvent(handle, buffer, sizeof(buffer), &length));
+	CHECK(IsIoctl(2, IOCTL_EVENT_INFO_WAIT, 2));
+	CHECK(g_HostIoctls[2].InBufferSize == sizeof(EVENT_INFORMATION) + 16);
+	CHECK(((PEVENT_CONTEXT)buffer)->SerialNumber == 3);
+
+	// a reply bigger than the channel keeps is sent at once
+	CHECK(Reply(handle, 3, EVENT_CONTEXT_MAX_SIZE + 8));
+	CHECK(IsIoctl(3, IOCTL_EVENT_INFO, 3));
+
+	SetEvents(next, 1);
+	CHECK(HostDeviceTransport.WaitEvent(handle, buffer, sizeof(buffer), &length));
+	CHECK(IsIoctl(4, IOCTL_EVENT_INFO_WAIT, 0));
+
+	// an event of another call, then the last one twice
+	CHECK(Reply(handle, 9, sizeof(EVENT_INFORMATION)));
+	CHECK(IsIoctl(5, IOCTL_EVENT_INFO, 9));
+	CHECK(Reply(handle, 4, sizeof(EVENT_INFORMATION)));
+	CHECK(g_HostIoctlCount == 6);
+	CHECK(Reply(handle, 4, sizeof(EVENT_INFORMATION)));
+	CHECK(IsIoctl(6, IOCTL_EVENT_INFO, 4));
+
+	// a failed wait passes the reply on and leaves no last event
+	g_HostIoctlFails = TRUE;
+	CHECK(!HostDeviceTransport.WaitEvent(handle, buffer, sizeof(buffer), &length));
+	CHECK(IsIoctl(7, IOCTL_EVENT_INFO_WAIT, 4));
+	CHECK(length == 0);
+	g_HostIoctlFails = FALSE;
+	CHECK(Reply(handle, 4, sizeof(EVENT_INFORMATION)));
+	CHECK(IsIoctl(8, IOCTL_EVENT_INFO, 4));
+
+	// the reply left at close is not lost
+	SetEvents(single, 1);
+	CHECK(HostDeviceTransport.WaitEvent(handle, buffer, sizeof(buffer), &length));
+	CHECK(Reply(handle, 3, sizeof(EVENT_INFORMATION)));
+	CHECK(g_HostIoctlCount == 10);
+	HostDeviceTransport.CloseChannel(handle);
+	CHECK(IsIoctl(10, IOCTL_EVENT_INFO, 3));
+	CHECK(g_HostIoctlCount == 11);
+
+	return TestResult("transport_test");
+}
@@ -27,7 +27,6 @@ DokanGetAccessToken(
    )
 {
 	KIRQL				oldIrql;
-    PLIST_ENTRY			thisEntry, nextEntry, listHead;
 	PIRP_ENTRY			irpEntry;
 	PDokanVCB			vcb;
 	PEVENT_INFORMATION	eventInfo;
@@ -38,7 +37,8 @@ DokanGetAccessToken(
 	BOOLEAN				hasLock = FALSE;
 	ULONG				outBufferLen;
 	ULONG				inBufferLen;
-	PACCESS_STATE		accessState;
+	PACCESS_STATE		accessState = NULL;
+	PIRP_LIST			pendingIrp = NULL;
 
 	DDbgPrint("==> DokanGetAccessToken\n");
 
@@ -69,30 +69,20 @@ DokanGetAccessToken(
 			__leave;
 		}
 
+		pendingIrp = DokanPendingIrpList(vcb->Dcb, eventInfo->SerialNumber);
+
 		ASSERT(KeGetCurrentIrql() <= DISPATCH_LEVEL);
-		KeAcquireSpinLock(&vcb->Dcb->PendingIrp.ListLock, &oldIrql);
+		KeAcquireSpinLock(&pendingIrp->ListLock, &oldIrql);
 		hasLock = TRUE;
 
 		// search corresponding IRP through pending IRP list
-		listHead = &vcb->Dcb->PendingIrp.ListHead;
-
-		for (thisEntry = listHead->Flink; thisEntry != listHead; thisEntry = nextEntry) {
-
-			nextEntry = thisEntry->Flink;
-
-			irpEntry = CONTAINING_RECORD(thisEntry, IRP_ENTRY, ListEntry);
-
-			if (irpEntry->SerialNumber != eventInfo->SerialNumber)  {
-				continue;
-			}
+		irpEntry = DokanFindPendingIrp(pendingIrp, eventInfo->SerialNumber);
 
-			// this irp must be IRP_MJ_CREATE
-			if (irpEntry->IrpSp->Parameters.Create.SecurityContext) {
-				accessState = irpEntry->IrpSp->Parameters.Create.SecurityContext->AccessState;
-			}
-			break;
+		// this irp must be IRP_MJ_CREATE
+		if (irpEntry != NULL && irpEntry->IrpSp->Parameters.Create.SecurityContext) {
+			accessState = irpEntry->IrpSp->Parameters.Create.SecurityContext->AccessState;
 		}
-		KeReleaseSpinLock(&vcb->Dcb->PendingIrp.ListLock, oldIrql);
+		KeReleaseSpinLock(&pendingIrp->ListLock, oldIrql);
 		hasLock = FALSE;
 
 		if (accessState == NULL) {
@@ -120,7 +110,7 @@ DokanGetAccessToken(
 
 	} __finally {
 		if (hasLock) {
-			KeReleaseSpinLock(&vcb->Dcb->PendingIrp.ListLock, oldIrql);
+			KeReleaseSpinLock(&pendingIrp->ListLock, oldIrql);
 		}
 	}
 	DDbgPrint("<== DokanGetAccessToken\n");
@@ -173,6 +173,11 @@ DokanCompleteCleanup(
 		FsRtlNotifyCleanup(vcb->NotifySync, &vcb->DirNotifyList, ccb);
 	}
 
+	// the file was deleted or its size may have changed
+	if (fileObject->DeletePending || fileObject->Flags & FO_FILE_MODIFIED) {
+		DokanDirCacheInvalidateParent(vcb, &fcb->FileName);
+	}
+
 	irp->IoStatus.Status = status;
 	irp->IoStatus.Information = 0;
 	IoCompleteRequest(irp, IO_NO_INCREMENT);
@@ -133,7 +133,7 @@ Return Value:
 		//status = DokanRegisterPendingIrp(DeviceObject, Irp, eventContext->SerialNumber, 0);
 
 		// inform it to user-mode
-		DokanEventNotification(&vcb->Dcb->NotifyEvent, eventContext);
+		DokanQueueEvent(&vcb->Dcb->EventQueue, eventContext);
 
 		status = STATUS_SUCCESS;
 
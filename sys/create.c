@@ -75,6 +75,8 @@ DokanAllocateFCB(
 
 	ExInitializeResourceLite(&fcb->Resource);
 
+	DokanDirCacheInitialize(fcb);
+
 	InitializeListHead(&fcb->NextCCB);
 	InsertTailList(&Vcb->NextFCB, &fcb->NextFCB);
 
@@ -90,38 +92,33 @@ DokanGetFCB(
 	__in PWCHAR		FileName,
 	__in ULONG		FileNameLength)
 {
-	PLIST_ENTRY		thisEntry, nextEntry, listHead;
-	PDokanFCB		fcb = NULL;
-	ULONG			pos;
+	PDokanFCB		fcb;
+	ULONG			hash = DokanFcbNameHash(FileName, FileNameLength);
 
 	KeEnterCriticalRegion();
-	ExAcquireResourceExclusiveLite(&Vcb->Resource, TRUE);
 
 	// search the FCB which is already allocated
-	// (being used now)
-	listHead = &Vcb->NextFCB;
+	// (being used now), opens of other files do not wait
+	ExAcquireResourceSharedLite(&Vcb->Resource, TRUE);
 
-    for (thisEntry = listHead->Flink;
-			thisEntry != listHead;
-			thisEntry = nextEntry) {
+	fcb = DokanFcbTableLookup(&Vcb->FcbTable, FileName, FileNameLength, hash);
+	if (fcb != NULL) {
+		// DokanFreeFCB waits for Vcb->Resource to drop the last reference
+		InterlockedIncrement(&fcb->FileCount);
 
-		nextEntry = thisEntry->Flink;
+		ExReleaseResourceLite(&Vcb->Resource);
+		KeLeaveCriticalRegion();
 
-        fcb = CONTAINING_RECORD(thisEntry, DokanFCB, NextFCB);
+		// FileName (argument) is never used and must be freed
+		ExFreePool(FileName);
+		return fcb;
+	}
 
-		if (fcb->FileName.Length == FileNameLength) {
-			// FileNameLength in bytes
-			for (pos = 0; pos < FileNameLength/sizeof(WCHAR); ++pos) {
-				if (fcb->FileName.Buffer[pos] != FileName[pos])
-					break;
-			}
-			// we have the FCB which is already allocated and used
-			if (pos == FileNameLength/sizeof(WCHAR))
-				break;
-		}
+	ExReleaseResourceLite(&Vcb->Resource);
+	ExAcquireResourceExclusiveLite(&Vcb->Resource, TRUE);
 
-		fcb = NULL;
-	}
+	// another open of the file may have allocated it meanwhile
+	fcb = DokanFcbTableLookup(&Vcb->FcbTable, FileName, FileNameLength, hash);
 
 	// we don't have FCB
 	if (fcb == NULL) {
@@ -143,16 +140,19 @@ DokanGetFCB(
 		fcb->FileName.Length = (USHORT)FileNameLength;
 		fcb->FileName.MaximumLength = (USHORT)FileNameLength;
 
+		DokanFcbTableInsert(&Vcb->FcbTable, fcb);
+
 	// we already have FCB
 	} else {
 		// FileName (argument) is never used and must be freed
 		ExFreePool(FileName);
 	}
 
+	InterlockedIncrement(&fcb->FileCount);
+
 	ExReleaseResourceLite(&Vcb->Resource);
 	KeLeaveCriticalRegion();
 
-	InterlockedIncrement(&fcb->FileCount);
 	return fcb;
 }
 
@@ -178,8 +178,10 @@ DokanFreeFCB(
 	if (Fcb->FileCount == 0) {
 
 		RemoveEntryList(&Fcb->NextFCB);
+		DokanFcbTableRemove(&vcb->FcbTable, Fcb);
 
 		DDbgPrint("  Free FCB:%X\n", Fcb);
+		DokanDirCacheClear(Fcb);
 		ExFreePool(Fcb->FileName.Buffer);
 
 #if _WIN32_WINNT >= 0x0501
@@ -634,6 +636,8 @@ DokanCompleteCreate(
 			} else {
 				DokanNotifyReportChange(fcb, FILE_NOTIFY_CHANGE_FILE_NAME, FILE_ACTION_ADDED);
 			}
+		} else if (info == FILE_OVERWRITTEN || info == FILE_SUPERSEDED) {
+			DokanDirCacheInvalidateParent(fcb->Vcb, &fcb->FileName);
 		}
 	} else {
 		DDbgPrint("   IRP_MJ_CREATE failed. Free CCB:%X\n", ccb);
@@ -438,7 +438,9 @@ Return Value:
 		controlCode = irpSp->Parameters.DeviceIoControl.IoControlCode;
 	
 		if (controlCode != IOCTL_EVENT_WAIT &&
+			controlCode != IOCTL_EVENT_WAIT_BATCH &&
 			controlCode != IOCTL_EVENT_INFO &&
+			controlCode != IOCTL_EVENT_INFO_WAIT &&
 			controlCode != IOCTL_KEEPALIVE) {
 
 			DDbgPrint("==> DokanDispatchIoControl\n");
@@ -460,6 +462,7 @@ Return Value:
 
 		switch (irpSp->Parameters.DeviceIoControl.IoControlCode) {
 		case IOCTL_EVENT_WAIT:
+		case IOCTL_EVENT_WAIT_BATCH:
 			//DDbgPrint("  IOCTL_EVENT_WAIT\n");
 			status = DokanRegisterPendingIrpForEvent(DeviceObject, Irp);
 			break;
@@ -469,6 +472,21 @@ Return Value:
 			status = DokanCompleteIrp(DeviceObject, Irp);
 			break;
 
+		case IOCTL_EVENT_INFO_WAIT:
+			//DDbgPrint("  IOCTL_EVENT_INFO_WAIT\n");
+			status = DokanCompleteIrpAndWait(DeviceObject, Irp);
+			break;
+
+		case IOCTL_RING_REGISTER:
+			DDbgPrint("  IOCTL_RING_REGISTER\n");
+			status = DokanRingRegister(DeviceObject, Irp);
+			break;
+
+		case IOCTL_DIR_CACHE_INVALIDATE:
+			DDbgPrint("  IOCTL_DIR_CACHE_INVALIDATE\n");
+			status = DokanDirCacheInvalidateIoctl(DeviceObject, Irp);
+			break;
+
 		case IOCTL_EVENT_RELEASE:
 			DDbgPrint("  IOCTL_EVENT_RELEASE\n");
 			status = DokanEventRelease(DeviceObject);
@@ -518,7 +536,9 @@ Return Value:
 		}
 
 		if (controlCode != IOCTL_EVENT_WAIT &&
+			controlCode != IOCTL_EVENT_WAIT_BATCH &&
 			controlCode != IOCTL_EVENT_INFO &&
+			controlCode != IOCTL_EVENT_INFO_WAIT &&
 			controlCode != IOCTL_KEEPALIVE) {
 
 			DokanPrintNTStatus(status);
@@ -0,0 +1,369 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2008 Hiroki Asakawa info@dokan-dev.net
+
+  http://dokan-dev.net/en
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+
+Directory listing cache
+
+  Enabled when EVENT_START.DirCacheTimeout is not 0.
+
+IRP_MN_QUERY_DIRECTORY:
+DokanQueryDirectory
+  DokanDirCacheLookup
+    # found and not expired: copy the reply to the user buffer
+      and complete the IRP without user-mode
+  # otherwise send the event
+DokanCompleteDirectoryControl
+  DokanDirCacheInsert
+    # keep the reply on the directory FCB
+
+Invalidation:
+  DokanNotifyReportChange0 (create, rename, delete, set information)
+  cleanup of a file which was written or deleted
+  IOCTL_DIR_CACHE_INVALIDATE from user-mode
+    DokanDirCacheInvalidate
+      # find the FCBs of the directory in Vcb->FcbTable
+        and clear their cache
+
+A reply is keyed by the query (information class, index, buffer length,
+SL_RETURN_SINGLE_ENTRY and search pattern), so an enumeration repeated
+the same way is answered by the same replies. The cache lives as long
+as the FCB of the directory.
+
+*/
+
+
+#include "dokan.h"
+
+
+typedef struct _DOKAN_DIR_CACHE_ENTRY {
+	LIST_ENTRY	ListEntry;
+	// KeQueryInterruptTime
+	ULONGLONG	ExpireTime;
+
+	ULONG		InformationClass;
+	ULONG		FileIndex;
+	ULONG		BufferLength;
+	ULONG		Flags;
+	ULONG		SearchPatternLength;
+
+	NTSTATUS	Status;
+	ULONG		NextIndex;
+	ULONG		DataLength;
+
+	// SearchPattern followed by the reply
+	ULONG64		Buffer[1];
+} DOKAN_DIR_CACHE_ENTRY, *PDOKAN_DIR_CACHE_ENTRY;
+
+
+#define DirCacheQuadAlign(Length)	(((Length) + 7) & ~7)
+
+#define DirCacheEntryData(Entry) \
+	((PCHAR)(Entry)->Buffer + DirCacheQuadAlign((Entry)->SearchPatternLength))
+
+
+static BOOLEAN
+DirCacheKeyEqual(
+	__in PDOKAN_DIR_CACHE_ENTRY	Entry,
+	__in PDOKAN_DIR_CACHE_KEY	Key)
+{
+	return Entry->InformationClass == Key->InformationClass &&
+		Entry->FileIndex == Key->FileIndex &&
+		Entry->BufferLength == Key->BufferLength &&
+		Entry->Flags == Key->Flags &&
+		Entry->SearchPatternLength == Key->SearchPatternLength &&
+		DokanNameEqual((PWCHAR)Entry->Buffer, Key->SearchPattern,
+			Key->SearchPatternLength / sizeof(WCHAR));
+}
+
+
+// IrpSp->Parameters.QueryDirectory.FileIndex is the index computed
+// by DokanQueryDirectory
+VOID
+DokanDirCacheMakeKey(
+	__out PDOKAN_DIR_CACHE_KEY	Key,
+	__in PIO_STACK_LOCATION		IrpSp,
+	__in PDokanCCB				Ccb)
+{
+	Key->InformationClass	= IrpSp->Parameters.QueryDirectory.FileInformationClass;
+	Key->FileIndex			= IrpSp->Parameters.QueryDirectory.FileIndex;
+	Key->BufferLength		= IrpSp->Parameters.QueryDirectory.Length;
+	Key->Flags				= IrpSp->Flags & SL_RETURN_SINGLE_ENTRY;
+	Key->SearchPattern		= Ccb->SearchPattern;
+	Key->SearchPatternLength = Ccb->SearchPattern ? Ccb->SearchPatternLength : 0;
+}
+
+
+VOID
+DokanDirCacheInitialize(
+	__in PDokanFCB	Fcb)
+{
+	ExInitializeFastMutex(&Fcb->DirCacheMutex);
+	InitializeListHead(&Fcb->DirCache);
+	Fcb->DirCacheCount = 0;
+}
+
+
+// Fcb->DirCacheMutex must be held
+static VOID
+DirCacheRemove(
+	__in PDokanFCB				Fcb,
+	__in PDOKAN_DIR_CACHE_ENTRY	Entry)
+{
+	RemoveEntryList(&Entry->ListEntry);
+	Fcb->DirCacheCount--;
+	ExFreePool(Entry);
+}
+
+
+VOID
+DokanDirCacheClear(
+	__in PDokanFCB	Fcb)
+{
+	ExAcquireFastMutex(&Fcb->DirCacheMutex);
+
+	while (!IsListEmpty(&Fcb->DirCache)) {
+		PDOKAN_DIR_CACHE_ENTRY entry = CONTAINING_RECORD(
+			Fcb->DirCache.Flink, DOKAN_DIR_CACHE_ENTRY, ListEntry);
+		DirCacheRemove(Fcb, entry);
+	}
+
+	ExReleaseFastMutex(&Fcb->DirCacheMutex);
+}
+
+
+// Buffer must have Key->BufferLength bytes
+BOOLEAN
+DokanDirCacheLookup(
+	__in PDokanFCB				Fcb,
+	__in PDOKAN_DIR_CACHE_KEY	Key,
+	__out PVOID					Buffer,
+	__out PNTSTATUS				Status,
+	__out PULONG				NextIndex,
+	__out PULONG				DataLength)
+{
+	PLIST_ENTRY	thisEntry, nextEntry;
+	ULONGLONG	now = KeQueryInterruptTime();
+	BOOLEAN		found = FALSE;
+
+	ExAcquireFastMutex(&Fcb->DirCacheMutex);
+
+	for (thisEntry = Fcb->DirCache.Flink;
+		thisEntry != &Fcb->DirCache;
+		thisEntry = nextEntry) {
+
+		PDOKAN_DIR_CACHE_ENTRY entry = CONTAINING_RECORD(
+			thisEntry, DOKAN_DIR_CACHE_ENTRY, ListEntry);
+		nextEntry = thisEntry->Flink;
+
+		if (entry->ExpireTime <= now) {
+			DirCacheRemove(Fcb, entry);
+			continue;
+		}
+
+		if (DirCacheKeyEqual(entry, Key)) {
+			RtlCopyMemory(Buffer, DirCacheEntryData(entry), entry->DataLength);
+			*Status		= entry->Status;
+			*NextIndex	= entry->NextIndex;
+			*DataLength	= entry->DataLength;
+			found = TRUE;
+			break;
+		}
+	}
+
+	ExReleaseFastMutex(&Fcb->DirCacheMutex);
+	return found;
+}
+
+
+VOID
+DokanDirCacheInsert(
+	__in PDokanFCB				Fcb,
+	__in PDOKAN_DIR_CACHE_KEY	Key,
+	__in NTSTATUS				Status,
+	__in ULONG					NextIndex,
+	__in PVOID					Data,
+	__in ULONG					DataLength)
+{
+	PDokanDCB				dcb = Fcb->Vcb->Dcb;
+	PDOKAN_DIR_CACHE_ENTRY	entry;
+	PLIST_ENTRY				thisEntry;
+	ULONG					size;
+
+	// errors may be transient, do not keep them
+	if (Status != STATUS_SUCCESS &&
+		Status != STATUS_NO_MORE_FILES &&
+		Status != STATUS_NO_SUCH_FILE) {
+		return;
+	}
+
+	if (dcb->DirCacheTimeout == 0 ||
+		DataLength > DOKAN_DIR_CACHE_MAX_LENGTH ||
+		DataLength > Key->BufferLength) {
+		return;
+	}
+
+	size = FIELD_OFFSET(DOKAN_DIR_CACHE_ENTRY, Buffer) +
+		DirCacheQuadAlign(Key->SearchPatternLength) + DataLength;
+
+	entry = ExAllocatePool(size);
+	if (entry == NULL) {
+		return;
+	}
+
+	entry->ExpireTime = KeQueryInterruptTime() +
+		(ULONGLONG)dcb->DirCacheTimeout * 10000;
+
+	entry->InformationClass		= Key->InformationClass;
+	entry->FileIndex			= Key->FileIndex;
+	entry->BufferLength			= Key->BufferLength;
+	entry->Flags				= Key->Flags;
+	entry->SearchPatternLength	= Key->SearchPatternLength;
+	entry->Status				= Status;
+	entry->NextIndex			= NextIndex;
+	entry->DataLength			= DataLength;
+
+	RtlCopyMemory(entry->Buffer, Key->SearchPattern, Key->SearchPatternLength);
+	RtlCopyMemory(DirCacheEntryData(entry), Data, DataLength);
+
+	ExAcquireFastMutex(&Fcb->DirCacheMutex);
+
+	// replace the old reply of the same query
+	for (thisEntry = Fcb->DirCache.Flink;
+		thisEntry != &Fcb->DirCache;
+		thisEntry = thisEntry->Flink) {
+
+		PDOKAN_DIR_CACHE_ENTRY old = CONTAINING_RECORD(
+			thisEntry, DOKAN_DIR_CACHE_ENTRY, ListEntry);
+
+		if (DirCacheKeyEqual(old, Key)) {
+			DirCacheRemove(Fcb, old);
+			break;
+		}
+	}
+
+	InsertHeadList(&Fcb->DirCache, &entry->ListEntry);
+	Fcb->DirCacheCount++;
+
+	// drop the oldest
+	if (Fcb->DirCacheCount > DOKAN_DIR_CACHE_MAX_ENTRIES) {
+		DirCacheRemove(Fcb, CONTAINING_RECORD(
+			Fcb->DirCache.Blink, DOKAN_DIR_CACHE_ENTRY, ListEntry));
+	}
+
+	ExReleaseFastMutex(&Fcb->DirCacheMutex);
+}
+
+
+// DirectoryNameLength is in bytes, 0 invalidates all directories.
+// Names are compared ignoring case since the file system may do so,
+// the FCBs of the name are in one bucket of Vcb->FcbTable.
+VOID
+DokanDirCacheInvalidate(
+	__in PDokanVCB	Vcb,
+	__in PWCHAR		DirectoryName,
+	__in ULONG		DirectoryNameLength)
+{
+	PLIST_ENTRY	thisEntry;
+	PDokanFCB	fcb;
+	ULONG		hash;
+
+	if (Vcb->Dcb->DirCacheTimeout == 0) {
+		return;
+	}
+
+	KeEnterCriticalRegion();
+	ExAcquireResourceSharedLite(&Vcb->Resource, TRUE);
+
+	if (DirectoryNameLength == 0) {
+		for (thisEntry = Vcb->NextFCB.Flink;
+			thisEntry != &Vcb->NextFCB;
+			thisEntry = thisEntry->Flink) {
+
+			fcb = CONTAINING_RECORD(thisEntry, DokanFCB, NextFCB);
+			DokanDirCacheClear(fcb);
+		}
+	} else {
+		hash = DokanFcbNameHash(DirectoryName, DirectoryNameLength);
+
+		for (fcb = DokanFcbTableNextIgnoreCase(&Vcb->FcbTable,
+				DirectoryName, DirectoryNameLength, hash, NULL);
+			fcb != NULL;
+			fcb = DokanFcbTableNextIgnoreCase(&Vcb->FcbTable,
+				DirectoryName, DirectoryNameLength, hash, fcb)) {
+
+			DDbgPrint("  DirCache invalidated %wZ\n", &fcb->FileName);
+			DokanDirCacheClear(fcb);
+		}
+	}
+
+	ExReleaseResourceLite(&Vcb->Resource);
+	KeLeaveCriticalRegion();
+}
+
+
+VOID
+DokanDirCacheInvalidateParent(
+	__in PDokanVCB			Vcb,
+	__in PUNICODE_STRING	FileName)
+{
+	ULONG	pos;
+
+	if (Vcb->Dcb->DirCacheTimeout == 0 ||
+		FileName->Length < sizeof(WCHAR)) {
+		return;
+	}
+
+	// search the last "\"
+	pos = FileName->Length / sizeof(WCHAR) - 1;
+	while (pos > 0 && FileName->Buffer[pos] != L'\\')
+		--pos;
+
+	// parent of "\foo" is "\"
+	DokanDirCacheInvalidate(Vcb, FileName->Buffer,
+		(pos > 0 ? pos : 1) * sizeof(WCHAR));
+}
+
+
+NTSTATUS
+DokanDirCacheInvalidateIoctl(
+	__in PDEVICE_OBJECT	DeviceObject,
+	__in PIRP			Irp)
+{
+	PIO_STACK_LOCATION	irpSp = IoGetCurrentIrpStackLocation(Irp);
+	PDokanVCB			vcb = DeviceObject->DeviceExtension;
+	ULONG				length = irpSp->Parameters.DeviceIoControl.InputBufferLength;
+
+	DDbgPrint("==> DokanDirCacheInvalidateIoctl\n");
+
+	if (GetIdentifierType(vcb) != VCB) {
+		return STATUS_INVALID_PARAMETER;
+	}
+
+	if (length % sizeof(WCHAR) != 0 ||
+		(length > 0 && Irp->AssociatedIrp.SystemBuffer == NULL)) {
+		return STATUS_INVALID_PARAMETER;
+	}
+
+	DokanDirCacheInvalidate(vcb, (PWCHAR)Irp->AssociatedIrp.SystemBuffer, length);
+
+	DDbgPrint("<== DokanDirCacheInvalidateIoctl\n");
+	return STATUS_SUCCESS;
+}
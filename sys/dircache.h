@@ -0,0 +1,88 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2008 Hiroki Asakawa info@dokan-dev.net
+
+  http://dokan-dev.net/en
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef _DIRCACHE_H_
+#define _DIRCACHE_H_
+
+// Directory listing cache, see dircache.c. Included by dokan.h after
+// the FCB, VCB and CCB types.
+
+#define DOKAN_DIR_CACHE_MAX_ENTRIES	32 // per directory
+#define DOKAN_DIR_CACHE_MAX_LENGTH	(64 * 1024) // bigger replies are not cached
+
+// identifies a reply of IRP_MN_QUERY_DIRECTORY
+typedef struct _DOKAN_DIR_CACHE_KEY {
+	ULONG	InformationClass;
+	ULONG	FileIndex;
+	ULONG	BufferLength;
+	// SL_RETURN_SINGLE_ENTRY
+	ULONG	Flags;
+	// NULL when all entries are returned
+	PWCHAR	SearchPattern;
+	ULONG	SearchPatternLength;
+} DOKAN_DIR_CACHE_KEY, *PDOKAN_DIR_CACHE_KEY;
+
+VOID
+DokanDirCacheMakeKey(
+	__out PDOKAN_DIR_CACHE_KEY	Key,
+	__in PIO_STACK_LOCATION		IrpSp,
+	__in PDokanCCB				Ccb);
+
+VOID
+DokanDirCacheInitialize(
+	__in PDokanFCB	Fcb);
+
+VOID
+DokanDirCacheClear(
+	__in PDokanFCB	Fcb);
+
+BOOLEAN
+DokanDirCacheLookup(
+	__in PDokanFCB				Fcb,
+	__in PDOKAN_DIR_CACHE_KEY	Key,
+	__out PVOID					Buffer,
+	__out PNTSTATUS				Status,
+	__out PULONG				NextIndex,
+	__out PULONG				DataLength);
+
+VOID
+DokanDirCacheInsert(
+	__in PDokanFCB				Fcb,
+	__in PDOKAN_DIR_CACHE_KEY	Key,
+	__in NTSTATUS				Status,
+	__in ULONG					NextIndex,
+	__in PVOID					Data,
+	__in ULONG					DataLength);
+
+VOID
+DokanDirCacheInvalidate(
+	__in PDokanVCB	Vcb,
+	__in PWCHAR		DirectoryName,
+	__in ULONG		DirectoryNameLength);
+
+VOID
+DokanDirCacheInvalidateParent(
+	__in PDokanVCB			Vcb,
+	__in PUNICODE_STRING	FileName);
+
+DRIVER_DISPATCH DokanDirCacheInvalidateIoctl;
+
+#endif // _DIRCACHE_H_
@@ -24,7 +24,8 @@ with this program. If not, see <http://www.gnu.org/licenses/>.
 NTSTATUS
 DokanQueryDirectory(
 	__in PDEVICE_OBJECT DeviceObject,
-	__in PIRP			Irp);
+	__in PIRP			Irp,
+	__out PULONG_PTR	Information);
 
 NTSTATUS
 DokanNotifyChangeDirectory(
@@ -40,6 +41,7 @@ DokanDispatchDirectoryControl(
    )
 {
 	NTSTATUS			status		= STATUS_NOT_IMPLEMENTED;
+	ULONG_PTR			info		= 0;
 	PFILE_OBJECT		fileObject;
 	PIO_STACK_LOCATION	irpSp;
 	PDokanCCB			ccb;
@@ -72,7 +74,7 @@ DokanDispatchDirectoryControl(
 		DokanPrintFileName(fileObject);
 
 		if (irpSp->MinorFunction == IRP_MN_QUERY_DIRECTORY) {
-			status = DokanQueryDirectory(DeviceObject, Irp);
+			status = DokanQueryDirectory(DeviceObject, Irp, &info);
 	
 		} else if( irpSp->MinorFunction == IRP_MN_NOTIFY_CHANGE_DIRECTORY) {
 			status = DokanNotifyChangeDirectory(DeviceObject, Irp);
@@ -85,7 +87,7 @@ DokanDispatchDirectoryControl(
 
 		if (status != STATUS_PENDING) {
 			Irp->IoStatus.Status = status;
-			Irp->IoStatus.Information = 0;
+			Irp->IoStatus.Information = info;
 			IoCompleteRequest(Irp, IO_NO_INCREMENT);
 		}
 
@@ -102,7 +104,8 @@ DokanDispatchDirectoryControl(
 NTSTATUS
 DokanQueryDirectory(
 	__in PDEVICE_OBJECT DeviceObject,
-	__in PIRP			Irp)
+	__in PIRP			Irp,
+	__out PULONG_PTR	Information)
 {
 	PFILE_OBJECT		fileObject;
 	PIO_STACK_LOCATION	irpSp;
@@ -163,6 +166,9 @@ DokanQueryDirectory(
 	case FileIdBothDirectoryInformation:
 		DDbgPrint("  FileIdBothDirectoryInformation\n");
 		break;
+	case FileIdFullDirectoryInformation:
+		DDbgPrint("  FileIdFullDirectoryInformation\n");
+		break;
 	default:
 		DDbgPrint("  unknown FileInfoClass %d\n", irpSp->Parameters.QueryDirectory.FileInformationClass);
 		break;
@@ -213,20 +219,6 @@ DokanQueryDirectory(
 		}
 	}
 
-	// if search pattern is provided, add the length of it to store pattern
-	if (ccb->SearchPattern) {
-		eventLength += ccb->SearchPatternLength;
-	}
-		
-	eventContext = AllocateEventContext(vcb->Dcb, Irp, eventLength, ccb);
-
-	if (eventContext == NULL) {
-		return STATUS_INSUFFICIENT_RESOURCES;
-	}
-
-	eventContext->Context = ccb->UserContext;
-	//DDbgPrint("   get Context %X\n", (ULONG)ccb->UserContext);
-
 	// index which specified index-1 th directory entry has been returned
 	// this time, 'index'th entry should be returned
 	index = 0;
@@ -244,6 +236,48 @@ DokanQueryDirectory(
 		DDbgPrint("    ccb->Context %d\n", index);
 	}
 
+	// DokanCompleteDirectoryControl keys the reply by this index
+	irpSp->Parameters.QueryDirectory.FileIndex = index;
+
+	if (vcb->Dcb->DirCacheTimeout) {
+		DOKAN_DIR_CACHE_KEY	key;
+		PVOID				buffer;
+		ULONG				nextIndex;
+		ULONG				dataLength;
+		BOOLEAN				found = FALSE;
+
+		DokanDirCacheMakeKey(&key, irpSp, ccb);
+
+		buffer = MmGetSystemAddressForMdlSafe(Irp->MdlAddress, NormalPagePriority);
+		if (buffer != NULL) {
+			found = DokanDirCacheLookup(fcb, &key, buffer, &status, &nextIndex, &dataLength);
+		}
+
+		if (found) {
+			DDbgPrint("    directory cache hit %d\n", index);
+			ccb->Context = nextIndex;
+			if (flags & DOKAN_MDL_ALLOCATED) {
+				DokanFreeMdl(Irp);
+			}
+			*Information = dataLength;
+			return status;
+		}
+	}
+
+	// if search pattern is provided, add the length of it to store pattern
+	if (ccb->SearchPattern) {
+		eventLength += ccb->SearchPatternLength;
+	}
+		
+	eventContext = AllocateEventContext(vcb->Dcb, Irp, eventLength, ccb);
+
+	if (eventContext == NULL) {
+		return STATUS_INSUFFICIENT_RESOURCES;
+	}
+
+	eventContext->Context = ccb->UserContext;
+	//DDbgPrint("   get Context %X\n", (ULONG)ccb->UserContext);
+
 	eventContext->Directory.FileInformationClass	= irpSp->Parameters.QueryDirectory.FileInformationClass;
 	eventContext->Directory.BufferLength			= irpSp->Parameters.QueryDirectory.Length; // length of buffer
 	eventContext->Directory.FileIndex				= index; // directory index which should be returned this time
@@ -400,6 +434,13 @@ DokanCompleteDirectoryControl(
 		status = EventInfo->Status;
 		
 		info = EventInfo->BufferLength;
+
+		if (ccb->Fcb->Vcb->Dcb->DirCacheTimeout) {
+			DOKAN_DIR_CACHE_KEY	key;
+			DokanDirCacheMakeKey(&key, irpSp, ccb);
+			DokanDirCacheInsert(ccb->Fcb, &key, status,
+				EventInfo->Directory.Index, EventInfo->Buffer, EventInfo->BufferLength);
+		}
 	}
 
 
@@ -465,6 +465,8 @@ DokanNotifyReportChange0(
 		Action,
 		NULL); // TargetContext
 
+	DokanDirCacheInvalidateParent(Fcb->Vcb, FileName);
+
 	DDbgPrint("<== DokanNotifyReportChange\n");
 }
 
@@ -32,6 +32,7 @@ with this program. If not, see <http://www.gnu.org/licenses/>.
 #include <ntstrsafe.h>
 
 #include "public.h"
+#include "namecmp.h"
 
 //
 // DEFINES
@@ -74,6 +75,8 @@ extern ULONG g_Debug;
 
 #define DOKAN_KEEPALIVE_TIMEOUT		(1000 * 15) // in millisecond
 
+#define DOKAN_PENDING_IRP_SHARDS	8 // lists of IRPs waiting for replies, by serial number
+
 #if _WIN32_WINNT > 0x501
 	#define DDbgPrint(...) \
 	if (g_Debug) { KdPrintEx((DPFLTR_IHVDRIVER_ID, DPFLTR_TRACE_LEVEL, "[DokanFS] " __VA_ARGS__ )); }
@@ -134,13 +137,24 @@ typedef struct _FSD_IDENTIFIER {
 //
 
 
+#include "pendingirp.h"
+
+
 typedef struct _IRP_LIST {
 	LIST_ENTRY		ListHead;
 	KEVENT			NotEmpty;
 	KSPIN_LOCK		ListLock;
+	// DOKAN_PENDING_IRP_BUCKETS lists of entries by SerialNumber,
+	// NULL when the list is not searched by SerialNumber
+	PLIST_ENTRY		SerialIndex;
+	// NULL when entries of the list do not time out
+	PDOKAN_TIMEOUT_WHEEL	TimeoutWheel;
 } IRP_LIST, *PIRP_LIST;
 
 
+#include "eventqueue.h"
+
+
 typedef struct _DOKAN_GLOBAL {
 	FSD_IDENTIFIER	Identifier;
 	ERESOURCE		Resource;
@@ -153,6 +167,23 @@ typedef struct _DOKAN_GLOBAL {
 } DOKAN_GLOBAL, *PDOKAN_GLOBAL;
 
 
+// ring registered by IOCTL_RING_REGISTER, see ring.c
+typedef struct _DOKAN_RING {
+	KSPIN_LOCK		Lock;
+	// pending IOCTL_RING_REGISTER, NULL when no ring is used
+	PIRP			Irp;
+	// system address of the ring
+	PVOID			Base;
+	// copies of the registered values, the ring header is not trusted
+	ULONG			SlotCount;
+	ULONG			SlotSize;
+	// where to look for a free slot first
+	ULONG			NextSlot;
+	PKEVENT			RequestEvent;
+	PKEVENT			ReplyEvent;
+} DOKAN_RING, *PDOKAN_RING;
+
+
 // make sure Identifier is the top of struct
 typedef struct _DokanDiskControlBlock {
 
@@ -166,10 +197,18 @@ typedef struct _DokanDiskControlBlock {
 	
 	PVOID					Vcb;
 
-	// the list of waiting Event
-	IRP_LIST				PendingIrp;
-	IRP_LIST				PendingEvent;
-	IRP_LIST				NotifyEvent;
+	// the list of waiting Event, IRPs waiting for replies are
+	// in the shard of their serial number (DokanPendingIrpList)
+	IRP_LIST				PendingIrp[DOKAN_PENDING_IRP_SHARDS];
+	// IOCTL_EVENT_WAIT IRPs and the events for them
+	DOKAN_EVENT_QUEUE		EventQueue;
+
+	// PendingIrp[].SerialIndex
+	LIST_ENTRY				PendingIrpIndex[DOKAN_PENDING_IRP_SHARDS][DOKAN_PENDING_IRP_BUCKETS];
+	// PendingIrp[].TimeoutWheel
+	DOKAN_TIMEOUT_WHEEL		PendingIrpTimeouts[DOKAN_PENDING_IRP_SHARDS];
+
+	DOKAN_RING				Ring;
 
 	PUNICODE_STRING			DiskDeviceName;
 	PUNICODE_STRING			FileSystemDeviceName;
@@ -200,6 +239,14 @@ typedef struct _DokanDiskControlBlock {
 
 	ULONG					MountId;
 
+	// size of the buffer user-mode waits for events with,
+	// a bigger event is passed in two steps
+	ULONG					EventBufferSize;
+
+	// lifetime of cached directory listings in milliseconds,
+	// 0 disables the cache (see dircache.c)
+	ULONG					DirCacheTimeout;
+
 	LARGE_INTEGER			TickCount;
 
 	CACHE_MANAGER_CALLBACKS CacheManagerCallbacks;
@@ -207,6 +254,13 @@ typedef struct _DokanDiskControlBlock {
 } DokanDCB, *PDokanDCB;
 
 
+#define DokanPendingIrpList(Dcb, SerialNumber) \
+	(&(Dcb)->PendingIrp[(SerialNumber) % DOKAN_PENDING_IRP_SHARDS])
+
+
+#include "fcbtable.h"
+
+
 typedef struct _DokanVolumeControlBlock {
 
 	FSD_IDENTIFIER				Identifier;
@@ -219,6 +273,8 @@ typedef struct _DokanVolumeControlBlock {
 	PDEVICE_OBJECT				DeviceObject;
 	PDokanDCB					Dcb;
 	LIST_ENTRY					NextFCB;
+	// the same FCBs as NextFCB, under Resource
+	DOKAN_FCB_TABLE				FcbTable;
 
 	// NotifySync is used by notify directory change
     PNOTIFY_SYNC				NotifySync;
@@ -246,6 +302,9 @@ typedef struct _DokanFileControlBlock
 	
 	PDokanVCB				Vcb;
 	LIST_ENTRY				NextFCB;
+	// link of Vcb->FcbTable and the hash of FileName
+	LIST_ENTRY				HashEntry;
+	ULONG					NameHash;
 	ERESOURCE				Resource;
 	LIST_ENTRY				NextCCB;
 
@@ -255,6 +314,11 @@ typedef struct _DokanFileControlBlock
 
 	UNICODE_STRING			FileName;
 
+	// replies of IRP_MN_QUERY_DIRECTORY, newest first
+	FAST_MUTEX				DirCacheMutex;
+	LIST_ENTRY				DirCache;
+	ULONG					DirCacheCount;
+
 	//uint32 ReferenceCount;
 	//uint32 OpenHandleCount;
 } DokanFCB, *PDokanFCB;
@@ -284,6 +348,10 @@ typedef struct _DokanContextControlBlock
 // this structure is also used to store event notification IRP
 typedef struct _IRP_ENTRY {
 	LIST_ENTRY			ListEntry;
+	// link of IrpList->SerialIndex, empty when not indexed
+	LIST_ENTRY			SerialEntry;
+	// link of IrpList->TimeoutWheel, empty when not scheduled
+	LIST_ENTRY			TimeoutEntry;
 	ULONG				SerialNumber;
 	PIRP				Irp;
 	PIO_STACK_LOCATION	IrpSp;
@@ -337,6 +405,31 @@ DRIVER_DISPATCH DokanRegisterPendingIrpForService;
 
 DRIVER_DISPATCH DokanCompleteIrp;
 
+DRIVER_DISPATCH DokanCompleteIrpAndWait;
+
+NTSTATUS
+CompleteIrpMain(
+	__in PDokanVCB			Vcb,
+	__in PEVENT_INFORMATION	EventInfo);
+
+DRIVER_DISPATCH DokanRingRegister;
+
+DRIVER_CANCEL DokanRingCancelRoutine;
+
+VOID
+DokanRingRelease(
+	__in PDokanDCB	Dcb);
+
+VOID
+DokanRingNotify(
+	__in PDokanDCB	Dcb);
+
+PKEVENT
+DokanRingReferenceReplyEvent(
+	__in PDokanDCB	Dcb);
+
+#include "dircache.h"
+
 DRIVER_DISPATCH DokanResetPendingIrpTimeout;
 
 DRIVER_DISPATCH DokanGetAccessToken;
@@ -376,11 +469,54 @@ DokanRegisterPendingIrp(
 	__in ULONG			Flags);
 
 
+VOID
+DokanInsertPendingIrp(
+	__in PIRP_LIST	IrpList,
+	__in PIRP_ENTRY	IrpEntry);
+
+PIRP_ENTRY
+DokanFindPendingIrp(
+	__in PIRP_LIST	IrpList,
+	__in ULONG		SerialNumber);
+
+VOID
+DokanRemovePendingIrp(
+	__in PIRP_ENTRY	IrpEntry);
+
+
 VOID
 DokanEventNotification(
 	__in PIRP_LIST		NotifyEvent,
 	__in PEVENT_CONTEXT	EventContext);
 
+VOID
+DokanInitEventQueue(
+	__in PDOKAN_EVENT_QUEUE	Queue);
+
+VOID
+DokanQueueEvent(
+	__in PDOKAN_EVENT_QUEUE	Queue,
+	__in PEVENT_CONTEXT		EventContext);
+
+VOID
+DokanDispatchEvents(
+	__in PDOKAN_EVENT_QUEUE	Queue,
+	__in PDOKAN_EVENT_SHARD	Shard);
+
+VOID
+DokanFreeQueuedEvents(
+	__in PDOKAN_EVENT_QUEUE	Queue);
+
+ULONG
+DokanPairEvents(
+	__in PLIST_ENTRY	PendingIrp,
+	__in PLIST_ENTRY	NotifyEvent,
+	__in PLIST_ENTRY	CompleteList);
+
+VOID
+DokanCompleteEventIrps(
+	__in PLIST_ENTRY	CompleteList);
+
 
 NTSTATUS
 DokanUnmountNotification(
@@ -510,6 +646,45 @@ DokanFreeFCB(
   __in PDokanFCB Fcb);
 
 
+VOID
+DokanFcbTableInitialize(
+	__in PDOKAN_FCB_TABLE	Table);
+
+ULONG
+DokanFcbNameHash(
+	__in PWCHAR	FileName,
+	__in ULONG	FileNameLength);
+
+PDokanFCB
+DokanFcbTableLookup(
+	__in PDOKAN_FCB_TABLE	Table,
+	__in PWCHAR				FileName,
+	__in ULONG				FileNameLength,
+	__in ULONG				Hash);
+
+PDokanFCB
+DokanFcbTableNextIgnoreCase(
+	__in PDOKAN_FCB_TABLE	Table,
+	__in PWCHAR				FileName,
+	__in ULONG				FileNameLength,
+	__in ULONG				Hash,
+	__in_opt PDokanFCB		Fcb);
+
+VOID
+DokanFcbTableInsert(
+	__in PDOKAN_FCB_TABLE	Table,
+	__in PDokanFCB			Fcb);
+
+VOID
+DokanFcbTableRemove(
+	__in PDOKAN_FCB_TABLE	Table,
+	__in PDokanFCB			Fcb);
+
+VOID
+DokanFcbTableDelete(
+	__in PDOKAN_FCB_TABLE	Table);
+
+
 PDokanCCB
 DokanAllocateCCB(
 	__in PDokanDCB Dcb,
@@ -552,6 +727,20 @@ DokanUpdateTimeout(
 	__out PLARGE_INTEGER KickCount,
 	__in ULONG Timeout);
 
+VOID
+DokanInitTimeoutWheel(
+	__in PDOKAN_TIMEOUT_WHEEL	Wheel);
+
+VOID
+DokanScheduleTimeout(
+	__in PIRP_LIST	IrpList,
+	__in PIRP_ENTRY	IrpEntry);
+
+VOID
+DokanCollectTimeoutIrps(
+	__in PIRP_LIST		IrpList,
+	__in PLIST_ENTRY	CompleteList);
+
 VOID
 DokanUnmount(
 	__in PDokanDCB Dcb);
@@ -52,7 +52,7 @@ DokanIrpCancelRoutine(
 
 		serialNumber = irpEntry->SerialNumber;
 
-		RemoveEntryList(&irpEntry->ListEntry);
+		DokanRemovePendingIrp(irpEntry);
 
 		// If Write is canceld before completion and buffer that saves writing
 		// content is not freed, free it here
@@ -132,6 +132,8 @@ RegisterPendingIrpMain(
 	RtlZeroMemory(irpEntry, sizeof(IRP_ENTRY));
 
     InitializeListHead(&irpEntry->ListEntry);
+	InitializeListHead(&irpEntry->SerialEntry);
+	InitializeListHead(&irpEntry->TimeoutEntry);
 
 	irpEntry->SerialNumber		= SerialNumber;
     irpEntry->FileObject		= irpSp->FileObject;
@@ -161,7 +163,7 @@ RegisterPendingIrpMain(
 
     IoMarkIrpPending(Irp);
 
-    InsertTailList(&IrpList->ListHead, &irpEntry->ListEntry);
+	DokanInsertPendingIrp(IrpList, irpEntry);
 
     irpEntry->CancelRoutineFreeMemory = FALSE;
 
@@ -199,12 +201,12 @@ DokanRegisterPendingIrp(
 		DeviceObject,
 		Irp,
 		EventContext->SerialNumber,
-		&vcb->Dcb->PendingIrp,
+		DokanPendingIrpList(vcb->Dcb, EventContext->SerialNumber),
 		Flags,
 		TRUE);
 
 	if (status == STATUS_PENDING) {
-		DokanEventNotification(&vcb->Dcb->NotifyEvent, EventContext);
+		DokanQueueEvent(&vcb->Dcb->EventQueue, EventContext);
 	} else {
 		DokanFreeEventContext(EventContext);
 	}
@@ -220,6 +222,8 @@ DokanRegisterPendingIrpForEvent(
     )
 {
 	PDokanVCB vcb = DeviceObject->DeviceExtension;
+	PDOKAN_EVENT_SHARD shard;
+	NTSTATUS status;
 
 	if (GetIdentifierType(vcb) != VCB) {
 		DbgPrint("  Type != VCB\n");
@@ -228,13 +232,21 @@ DokanRegisterPendingIrpForEvent(
 
 	//DDbgPrint("DokanRegisterPendingIrpForEvent\n");
 
-	return RegisterPendingIrpMain(
+	// the shard of this processor, see eventqueue.c
+	shard = DokanCurrentEventShard(&vcb->Dcb->EventQueue);
+
+	status = RegisterPendingIrpMain(
 		DeviceObject,
 		Irp,
 		0, // SerialNumber
-		&vcb->Dcb->PendingEvent,
+		&shard->PendingEvent,
 		0, // Flags
 		TRUE);
+
+	if (status == STATUS_PENDING) {
+		DokanDispatchEvents(&vcb->Dcb->EventQueue, shard);
+	}
+	return status;
 }
 
 
@@ -263,139 +275,168 @@ DokanRegisterPendingIrpForService(
 }
 
 
-// When user-mode file system application returns EventInformation,
-// search corresponding pending IRP and complete it
+// search the pending IRP which corresponds to EventInfo and complete it
 NTSTATUS
-DokanCompleteIrp(
-    __in PDEVICE_OBJECT DeviceObject,
-    __in PIRP Irp
+CompleteIrpMain(
+	__in PDokanVCB			Vcb,
+	__in PEVENT_INFORMATION	EventInfo
 	)
 {
 	KIRQL				oldIrql;
-    PLIST_ENTRY			thisEntry, nextEntry, listHead;
 	PIRP_ENTRY			irpEntry;
-	PDokanVCB			vcb;
-	PEVENT_INFORMATION	eventInfo;
+	PDokanVCB			vcb = Vcb;
+	PEVENT_INFORMATION	eventInfo = EventInfo;
+	PIRP				irp;
+	PIO_STACK_LOCATION	irpSp;
+	PIRP_LIST			pendingIrp = DokanPendingIrpList(Vcb->Dcb, EventInfo->SerialNumber);
 
-	eventInfo		= (PEVENT_INFORMATION)Irp->AssociatedIrp.SystemBuffer;
-	ASSERT(eventInfo != NULL);
-	
 	//DDbgPrint("==> DokanCompleteIrp [EventInfo #%X]\n", eventInfo->SerialNumber);
 
-	vcb = DeviceObject->DeviceExtension;
-	if (GetIdentifierType(vcb) != VCB) {
-		return STATUS_INVALID_PARAMETER;
-	}
-
 	//DDbgPrint("      Lock IrpList.ListLock\n");
 	ASSERT(KeGetCurrentIrql() <= DISPATCH_LEVEL);
-	KeAcquireSpinLock(&vcb->Dcb->PendingIrp.ListLock, &oldIrql);
+	KeAcquireSpinLock(&pendingIrp->ListLock, &oldIrql);
 
 	// search corresponding IRP through pending IRP list
-	listHead = &vcb->Dcb->PendingIrp.ListHead;
+	irpEntry = DokanFindPendingIrp(pendingIrp, eventInfo->SerialNumber);
 
-    for (thisEntry = listHead->Flink; thisEntry != listHead; thisEntry = nextEntry) {
+	if (irpEntry == NULL) {
+		KeReleaseSpinLock(&pendingIrp->ListLock, oldIrql);
+		// TODO: should return error
+		return STATUS_SUCCESS;
+	}
 
-		PIRP				irp;
-		PIO_STACK_LOCATION	irpSp;
+	// this irpEntry must be freed below
+	DokanRemovePendingIrp(irpEntry);
 
-        nextEntry = thisEntry->Flink;
+	irp = irpEntry->Irp;
 
-        irpEntry = CONTAINING_RECORD(thisEntry, IRP_ENTRY, ListEntry);
+	if (irp == NULL) {
+		// this IRP is already canceled
+		ASSERT(irpEntry->CancelRoutineFreeMemory == FALSE);
+		DokanFreeIrpEntry(irpEntry);
+		KeReleaseSpinLock(&pendingIrp->ListLock, oldIrql);
+		return STATUS_SUCCESS;
+	}
 
-		// check whether this is corresponding IRP
+	if (IoSetCancelRoutine(irp, NULL) == NULL) {
+		// Cancel routine will run as soon as we release the lock
+		InitializeListHead(&irpEntry->ListEntry);
+		irpEntry->CancelRoutineFreeMemory = TRUE;
+		KeReleaseSpinLock(&pendingIrp->ListLock, oldIrql);
+		return STATUS_SUCCESS;
+	}
 
-        //DDbgPrint("SerialNumber irpEntry %X eventInfo %X\n", irpEntry->SerialNumber, eventInfo->SerialNumber);
+	// IRP is not canceled yet
+	irpSp = irpEntry->IrpSp;	
+	
+	ASSERT(irpSp != NULL);
+				
+	// IrpEntry is saved here for CancelRoutine
+	// Clear it to prevent to be completed by CancelRoutine twice
+	irp->Tail.Overlay.DriverContext[DRIVER_CONTEXT_IRP_ENTRY] = NULL;
+	KeReleaseSpinLock(&pendingIrp->ListLock, oldIrql);
+
+	switch (irpSp->MajorFunction) {
+	case IRP_MJ_DIRECTORY_CONTROL:
+		DokanCompleteDirectoryControl(irpEntry, eventInfo);
+		break;
+	case IRP_MJ_READ:
+		DokanCompleteRead(irpEntry, eventInfo);
+		break;
+	case IRP_MJ_WRITE:
+		DokanCompleteWrite(irpEntry, eventInfo);
+		break;
+	case IRP_MJ_QUERY_INFORMATION:
+		DokanCompleteQueryInformation(irpEntry, eventInfo);
+		break;
+	case IRP_MJ_QUERY_VOLUME_INFORMATION:
+		DokanCompleteQueryVolumeInformation(irpEntry, eventInfo);
+		break;
+	case IRP_MJ_CREATE:
+		DokanCompleteCreate(irpEntry, eventInfo);
+		break;
+	case IRP_MJ_CLEANUP:
+		DokanCompleteCleanup(irpEntry, eventInfo);
+		break;
+	case IRP_MJ_LOCK_CONTROL:
+		DokanCompleteLock(irpEntry, eventInfo);
+		break;
+	case IRP_MJ_SET_INFORMATION:
+		DokanCompleteSetInformation(irpEntry, eventInfo);
+		break;
+	case IRP_MJ_FLUSH_BUFFERS:
+		DokanCompleteFlush(irpEntry, eventInfo);
+		break;
+	case IRP_MJ_QUERY_SECURITY:
+		DokanCompleteQuerySecurity(irpEntry, eventInfo);
+		break;
+	case IRP_MJ_SET_SECURITY:
+		DokanCompleteSetSecurity(irpEntry, eventInfo);
+		break;
+	default:
+		DDbgPrint("Unknown IRP %d\n", irpSp->MajorFunction);
+		// TODO: in this case, should complete this IRP
+		break;
+	}		
 
-		// this irpEntry must be freed in this if statement
-		if (irpEntry->SerialNumber != eventInfo->SerialNumber)  {
-			continue;
-		}
+	DokanFreeIrpEntry(irpEntry);
+	irpEntry = NULL;
 
-		RemoveEntryList(thisEntry);
+    //DDbgPrint("<== AACompleteIrp [EventInfo #%X]\n", eventInfo->SerialNumber);
 
-		irp = irpEntry->Irp;
-	
-		if (irp == NULL) {
-			// this IRP is already canceled
-			ASSERT(irpEntry->CancelRoutineFreeMemory == FALSE);
-			DokanFreeIrpEntry(irpEntry);
-			irpEntry = NULL;
-			break;
-		}
+	return STATUS_SUCCESS;
+}
 
-		if (IoSetCancelRoutine(irp, NULL) == NULL) {
-			// Cancel routine will run as soon as we release the lock
-			InitializeListHead(&irpEntry->ListEntry);
-			irpEntry->CancelRoutineFreeMemory = TRUE;
-			break;
-		}
 
-		// IRP is not canceled yet
-		irpSp = irpEntry->IrpSp;	
-		
-		ASSERT(irpSp != NULL);
-					
-		// IrpEntry is saved here for CancelRoutine
-		// Clear it to prevent to be completed by CancelRoutine twice
-		irp->Tail.Overlay.DriverContext[DRIVER_CONTEXT_IRP_ENTRY] = NULL;
-		KeReleaseSpinLock(&vcb->Dcb->PendingIrp.ListLock, oldIrql);
-
-		switch (irpSp->MajorFunction) {
-		case IRP_MJ_DIRECTORY_CONTROL:
-			DokanCompleteDirectoryControl(irpEntry, eventInfo);
-			break;
-		case IRP_MJ_READ:
-			DokanCompleteRead(irpEntry, eventInfo);
-			break;
-		case IRP_MJ_WRITE:
-			DokanCompleteWrite(irpEntry, eventInfo);
-			break;
-		case IRP_MJ_QUERY_INFORMATION:
-			DokanCompleteQueryInformation(irpEntry, eventInfo);
-			break;
-		case IRP_MJ_QUERY_VOLUME_INFORMATION:
-			DokanCompleteQueryVolumeInformation(irpEntry, eventInfo);
-			break;
-		case IRP_MJ_CREATE:
-			DokanCompleteCreate(irpEntry, eventInfo);
-			break;
-		case IRP_MJ_CLEANUP:
-			DokanCompleteCleanup(irpEntry, eventInfo);
-			break;
-		case IRP_MJ_LOCK_CONTROL:
-			DokanCompleteLock(irpEntry, eventInfo);
-			break;
-		case IRP_MJ_SET_INFORMATION:
-			DokanCompleteSetInformation(irpEntry, eventInfo);
-			break;
-		case IRP_MJ_FLUSH_BUFFERS:
-			DokanCompleteFlush(irpEntry, eventInfo);
-			break;
-		case IRP_MJ_QUERY_SECURITY:
-			DokanCompleteQuerySecurity(irpEntry, eventInfo);
-			break;
-		case IRP_MJ_SET_SECURITY:
-			DokanCompleteSetSecurity(irpEntry, eventInfo);
-			break;
-		default:
-			DDbgPrint("Unknown IRP %d\n", irpSp->MajorFunction);
-			// TODO: in this case, should complete this IRP
-			break;
-		}		
+// When user-mode file system application returns EventInformation,
+// search corresponding pending IRP and complete it
+NTSTATUS
+DokanCompleteIrp(
+    __in PDEVICE_OBJECT DeviceObject,
+    __in PIRP Irp
+	)
+{
+	PDokanVCB			vcb;
+	PEVENT_INFORMATION	eventInfo;
 
-		DokanFreeIrpEntry(irpEntry);
-		irpEntry = NULL;
+	eventInfo		= (PEVENT_INFORMATION)Irp->AssociatedIrp.SystemBuffer;
+	ASSERT(eventInfo != NULL);
 
-		return STATUS_SUCCESS;
+	vcb = DeviceObject->DeviceExtension;
+	if (GetIdentifierType(vcb) != VCB) {
+		return STATUS_INVALID_PARAMETER;
 	}
 
-	KeReleaseSpinLock(&vcb->Dcb->PendingIrp.ListLock, oldIrql);
+	return CompleteIrpMain(vcb, eventInfo);
+}
+
 
-    //DDbgPrint("<== AACompleteIrp [EventInfo #%X]\n", eventInfo->SerialNumber);
+// IOCTL_EVENT_INFO_WAIT: IOCTL_EVENT_INFO followed by IOCTL_EVENT_WAIT_BATCH
+// in one call. The input buffer is optional. Since this is METHOD_BUFFERED,
+// EventInformation must be consumed before the IRP is registered; after that
+// DokanPairEvents overwrites the same SystemBuffer with EVENT_CONTEXTs.
+NTSTATUS
+DokanCompleteIrpAndWait(
+    __in PDEVICE_OBJECT DeviceObject,
+    __in PIRP Irp
+	)
+{
+	PDokanVCB			vcb;
+	PIO_STACK_LOCATION	irpSp;
+
+	vcb = DeviceObject->DeviceExtension;
+	if (GetIdentifierType(vcb) != VCB) {
+		return STATUS_INVALID_PARAMETER;
+	}
+
+	irpSp = IoGetCurrentIrpStackLocation(Irp);
+
+	if (irpSp->Parameters.DeviceIoControl.InputBufferLength >= sizeof(EVENT_INFORMATION)) {
+		ASSERT(Irp->AssociatedIrp.SystemBuffer != NULL);
+		CompleteIrpMain(vcb, (PEVENT_INFORMATION)Irp->AssociatedIrp.SystemBuffer);
+	}
 
-	// TODO: should return error
-    return STATUS_SUCCESS;
+	return DokanRegisterPendingIrpForEvent(DeviceObject, Irp);
 }
 
  
@@ -531,6 +572,17 @@ DokanEventStart(
 		DDbgPrint("  KEEP_ALIVE_ON\n");
 		dcb->UseKeepAlive = 1;
 	}
+	dcb->EventBufferSize = EVENT_CONTEXT_MAX_SIZE;
+	if (eventStart.EventBufferSize > EVENT_CONTEXT_MAX_SIZE) {
+		dcb->EventBufferSize =
+			min(eventStart.EventBufferSize, EVENT_CONTEXT_MAX_BUFFER_SIZE) & ~7;
+	}
+	driverInfo->EventBufferSize = dcb->EventBufferSize;
+	DDbgPrint("  EventBufferSize:%d\n", dcb->EventBufferSize);
+	dcb->DirCacheTimeout =
+		min(eventStart.DirCacheTimeout, DOKAN_DIR_CACHE_MAX_TIMEOUT);
+	DDbgPrint("  DirCacheTimeout:%d\n", dcb->DirCacheTimeout);
+
 	dcb->Mounted = 1;
 
 	DokanStartEventNotificationThread(dcb);
@@ -558,11 +610,15 @@ DokanEventWrite(
 	)
 {
 	KIRQL				oldIrql;
-    PLIST_ENTRY			thisEntry, nextEntry, listHead;
 	PIRP_ENTRY			irpEntry;
     PDokanVCB			vcb;
 	PEVENT_INFORMATION	eventInfo;
 	PIRP				writeIrp;
+	PIO_STACK_LOCATION	writeIrpSp, eventIrpSp;
+	PEVENT_CONTEXT		eventContext;
+	ULONG				info = 0;
+	NTSTATUS			status;
+	PIRP_LIST			pendingIrp;
 
 	eventInfo		= (PEVENT_INFORMATION)Irp->AssociatedIrp.SystemBuffer;
 	ASSERT(eventInfo != NULL);
@@ -575,92 +631,79 @@ DokanEventWrite(
 		return STATUS_INVALID_PARAMETER;
 	}
 
+	pendingIrp = DokanPendingIrpList(vcb->Dcb, eventInfo->SerialNumber);
+
 	ASSERT(KeGetCurrentIrql() <= DISPATCH_LEVEL);
-	KeAcquireSpinLock(&vcb->Dcb->PendingIrp.ListLock, &oldIrql);
+	KeAcquireSpinLock(&pendingIrp->ListLock, &oldIrql);
 
 	// search corresponding write IRP through pending IRP list
-	listHead = &vcb->Dcb->PendingIrp.ListHead;
-
-    for (thisEntry = listHead->Flink; thisEntry != listHead; thisEntry = nextEntry) {
-
-		PIO_STACK_LOCATION writeIrpSp, eventIrpSp;
-		PEVENT_CONTEXT	eventContext;
-		ULONG			info = 0;
-		NTSTATUS		status;
-
-		nextEntry = thisEntry->Flink;
-        irpEntry = CONTAINING_RECORD(thisEntry, IRP_ENTRY, ListEntry);
+	irpEntry = DokanFindPendingIrp(pendingIrp, eventInfo->SerialNumber);
 
-		// check whehter this is corresponding IRP
-
-        //DDbgPrint("SerialNumber irpEntry %X eventInfo %X\n", irpEntry->SerialNumber, eventInfo->SerialNumber);
+	if (irpEntry == NULL) {
+		KeReleaseSpinLock(&pendingIrp->ListLock, oldIrql);
+		return STATUS_SUCCESS;
+	}
 
-		if (irpEntry->SerialNumber != eventInfo->SerialNumber)  {
-			continue;
-		}
+	// do NOT free irpEntry here
+	writeIrp = irpEntry->Irp;
+	if (writeIrp == NULL) {
+		// this IRP has already been canceled
+		ASSERT(irpEntry->CancelRoutineFreeMemory == FALSE);
+		DokanRemovePendingIrp(irpEntry);
+		DokanFreeIrpEntry(irpEntry);
+		KeReleaseSpinLock(&pendingIrp->ListLock, oldIrql);
+		return STATUS_SUCCESS;
+	}
 
-		// do NOT free irpEntry here
-		writeIrp = irpEntry->Irp;
-		if (writeIrp == NULL) {
-			// this IRP has already been canceled
-			ASSERT(irpEntry->CancelRoutineFreeMemory == FALSE);
-			DokanFreeIrpEntry(irpEntry);
-			continue;
-		}
+	if (IoSetCancelRoutine(writeIrp, DokanIrpCancelRoutine) == NULL) {
+	//if (IoSetCancelRoutine(writeIrp, NULL) != NULL) {
+		// Cancel routine will run as soon as we release the lock
+		// and removes the entry from the list
+		irpEntry->CancelRoutineFreeMemory = TRUE;
+		KeReleaseSpinLock(&pendingIrp->ListLock, oldIrql);
+		return STATUS_SUCCESS;
+	}
 
-		if (IoSetCancelRoutine(writeIrp, DokanIrpCancelRoutine) == NULL) {
-		//if (IoSetCancelRoutine(writeIrp, NULL) != NULL) {
-			// Cancel routine will run as soon as we release the lock
-			InitializeListHead(&irpEntry->ListEntry);
-			irpEntry->CancelRoutineFreeMemory = TRUE;
-			continue;
-		}
+	writeIrpSp = irpEntry->IrpSp;
+	eventIrpSp = IoGetCurrentIrpStackLocation(Irp);
+		
+	ASSERT(writeIrpSp != NULL);
+	ASSERT(eventIrpSp != NULL);
 
-		writeIrpSp = irpEntry->IrpSp;
-		eventIrpSp = IoGetCurrentIrpStackLocation(Irp);
+	eventContext = (PEVENT_CONTEXT)writeIrp->Tail.Overlay.DriverContext[DRIVER_CONTEXT_EVENT];
+	ASSERT(eventContext != NULL);
 			
-		ASSERT(writeIrpSp != NULL);
-		ASSERT(eventIrpSp != NULL);
-
-		eventContext = (PEVENT_CONTEXT)writeIrp->Tail.Overlay.DriverContext[DRIVER_CONTEXT_EVENT];
-		ASSERT(eventContext != NULL);
+	// short of buffer length
+	if (eventIrpSp->Parameters.DeviceIoControl.OutputBufferLength
+		< eventContext->Length) {		
+		DDbgPrint("  EventWrite: STATUS_INSUFFICIENT_RESOURCE\n");
+		status =  STATUS_INSUFFICIENT_RESOURCES;
+	} else {
+		PVOID buffer;
+		//DDbgPrint("  EventWrite CopyMemory\n");
+		//DDbgPrint("  EventLength %d, BufLength %d\n", eventContext->Length,
+		//			eventIrpSp->Parameters.DeviceIoControl.OutputBufferLength);
+		if (Irp->MdlAddress)
+			buffer = MmGetSystemAddressForMdlSafe(Irp->MdlAddress, NormalPagePriority);
+		else
+			buffer = Irp->AssociatedIrp.SystemBuffer;
 				
-		// short of buffer length
-		if (eventIrpSp->Parameters.DeviceIoControl.OutputBufferLength
-			< eventContext->Length) {		
-			DDbgPrint("  EventWrite: STATUS_INSUFFICIENT_RESOURCE\n");
-			status =  STATUS_INSUFFICIENT_RESOURCES;
-		} else {
-			PVOID buffer;
-			//DDbgPrint("  EventWrite CopyMemory\n");
-			//DDbgPrint("  EventLength %d, BufLength %d\n", eventContext->Length,
-			//			eventIrpSp->Parameters.DeviceIoControl.OutputBufferLength);
-			if (Irp->MdlAddress)
-				buffer = MmGetSystemAddressForMdlSafe(Irp->MdlAddress, NormalPagePriority);
-			else
-				buffer = Irp->AssociatedIrp.SystemBuffer;
+		ASSERT(buffer != NULL);
+		RtlCopyMemory(buffer, eventContext, eventContext->Length);
 					
-			ASSERT(buffer != NULL);
-			RtlCopyMemory(buffer, eventContext, eventContext->Length);
-						
-			info = eventContext->Length;
-			status = STATUS_SUCCESS;
-		}
-
-		DokanFreeEventContext(eventContext);
-		writeIrp->Tail.Overlay.DriverContext[DRIVER_CONTEXT_EVENT] = 0;
-
-		KeReleaseSpinLock(&vcb->Dcb->PendingIrp.ListLock, oldIrql);
+		info = eventContext->Length;
+		status = STATUS_SUCCESS;
+	}
 
-		Irp->IoStatus.Status = status;
-		Irp->IoStatus.Information = info;
+	DokanFreeEventContext(eventContext);
+	writeIrp->Tail.Overlay.DriverContext[DRIVER_CONTEXT_EVENT] = 0;
 
-		// this IRP will be completed by caller function
-		return Irp->IoStatus.Status;
-	}
+	KeReleaseSpinLock(&pendingIrp->ListLock, oldIrql);
 
-	KeReleaseSpinLock(&vcb->Dcb->PendingIrp.ListLock, oldIrql);
+	Irp->IoStatus.Status = status;
+	Irp->IoStatus.Information = info;
 
-   return STATUS_SUCCESS;
+	// this IRP will be completed by caller function
+	return Irp->IoStatus.Status;
 }
 
@@ -0,0 +1,464 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2008 Hiroki Asakawa info@dokan-dev.net
+
+  http://dokan-dev.net/en
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+/*
+
+Event queue
+
+  Events of a volume go to user mode in IOCTL_EVENT_WAIT IRPs (or in
+  the ring, see ring.c). The IRPs and the events which no IRP was
+  waiting for are kept in DOKAN_EVENT_SHARDS shards by the processor
+  they came from, each with its own lock, so that the threads issuing
+  I/O and the threads of the file system do not all take one lock.
+
+DokanRegisterPendingIrp (IRP_MJ_READ ...)
+  DokanQueueEvent
+    # no event is queued:
+      HandoffEvent
+        # complete an IRP waiting in a shard, the shard of this
+        # processor first, without NotificationThread
+    # otherwise, or no IRP is waiting:
+      QueueEvent
+        # add the event to NotifyEvent of the shard of this processor
+        # and set EventQueued
+
+IOCTL_EVENT_WAIT:
+DokanRegisterPendingIrpForEvent
+  # add the IRP to PendingEvent of the shard of this processor
+  DokanDispatchEvents(shard)
+
+NotificationThread (EventQueued)
+  DokanRingNotify
+  DokanDispatchEvents(each shard)
+
+DokanDispatchEvents(Shard)
+  # pair the IRPs of Shard with its events (DokanPairEvents)
+  # while IRPs are left and events are queued, steal the events of
+  # the other shards one by one and pair them in Shard
+
+Only one shard lock is held at a time. After a shard is paired one of
+its lists is empty, so events are only stolen from a shard which has
+no IRP waiting. A shard delivers its events in order; events queued on
+different processors are not ordered. An event is only handed off
+while QueuedEventCount is 0, so it does not overtake a queued one.
+Events which pile up while no IRP waits are packed into the next
+IOCTL_EVENT_WAIT_BATCH IRP by DokanPairEvents.
+
+DokanEventRelease
+  DokanFreeQueuedEvents
+
+*/
+
+
+#include "dokan.h"
+
+
+// IOCTL_EVENT_WAIT_BATCH and IOCTL_EVENT_INFO_WAIT take as many events
+// as fit when no other IRP is waiting
+#define DokanIsBatchIrp(IrpEntry) \
+	((IrpEntry)->IrpSp->Parameters.DeviceIoControl.IoControlCode \
+		== IOCTL_EVENT_WAIT_BATCH || \
+	 (IrpEntry)->IrpSp->Parameters.DeviceIoControl.IoControlCode \
+		== IOCTL_EVENT_INFO_WAIT)
+
+
+VOID
+DokanInitEventQueue(
+	__in PDOKAN_EVENT_QUEUE	Queue)
+{
+	ULONG	i;
+
+	for (i = 0; i < DOKAN_EVENT_SHARDS; ++i) {
+		DokanInitIrpList(&Queue->Shards[i].PendingEvent);
+		InitializeListHead(&Queue->Shards[i].NotifyEvent);
+	}
+	Queue->QueuedEventCount = 0;
+	KeInitializeEvent(&Queue->EventQueued, NotificationEvent, FALSE);
+}
+
+
+// moves all entries of Source to the tail of Dest
+static VOID
+AppendEventList(
+	__in PLIST_ENTRY	Dest,
+	__in PLIST_ENTRY	Source)
+{
+	if (IsListEmpty(Source)) {
+		return;
+	}
+	Source->Flink->Blink = Dest->Blink;
+	Dest->Blink->Flink = Source->Flink;
+	Source->Blink->Flink = Dest;
+	Dest->Blink = Source->Blink;
+	InitializeListHead(Source);
+}
+
+
+// pairs the IRP_ENTRYs of PendingIrp with the DRIVER_EVENT_CONTEXTs of
+// NotifyEvent in order and moves the IRP_ENTRYs to CompleteList for
+// DokanCompleteEventIrps. The locks of both lists must be held.
+// Returns the number of events taken from NotifyEvent.
+ULONG
+DokanPairEvents(
+	__in PLIST_ENTRY	PendingIrp,
+	__in PLIST_ENTRY	NotifyEvent,
+	__in PLIST_ENTRY	CompleteList)
+{
+	PDRIVER_EVENT_CONTEXT	driverEventContext;
+	PLIST_ENTRY	listHead;
+	PIRP_ENTRY	irpEntry;
+	PIRP	irp;
+	ULONG	eventLen;
+	ULONG	bufferLen;
+	PVOID	buffer;
+	ULONG	offset;
+	ULONG	taken = 0;
+
+	while (!IsListEmpty(PendingIrp) && !IsListEmpty(NotifyEvent)) {
+			
+		listHead = RemoveHeadList(NotifyEvent);
+
+		driverEventContext = CONTAINING_RECORD(
+			listHead, DRIVER_EVENT_CONTEXT, ListEntry);
+
+		listHead = RemoveHeadList(PendingIrp);
+		irpEntry = CONTAINING_RECORD(listHead, IRP_ENTRY, ListEntry);
+
+		eventLen = driverEventContext->EventContext.Length;
+
+		// ensure this eventIrp is not cancelled
+		irp = irpEntry->Irp;
+
+		if (irp == NULL) {
+			// this IRP has already been canceled
+			ASSERT(irpEntry->CancelRoutineFreeMemory == FALSE);
+			DokanFreeIrpEntry(irpEntry);
+			// push back
+			InsertHeadList(NotifyEvent, &driverEventContext->ListEntry);
+			continue;
+		}
+
+		if (IoSetCancelRoutine(irp, NULL) == NULL) {
+			// Cancel routine will run as soon as we release the lock
+			InitializeListHead(&irpEntry->ListEntry);
+			irpEntry->CancelRoutineFreeMemory = TRUE;
+			// push back
+			InsertHeadList(NotifyEvent, &driverEventContext->ListEntry);
+			continue;
+		}
+
+		// available size that is used for event notification
+		bufferLen =
+			irpEntry->IrpSp->Parameters.DeviceIoControl.OutputBufferLength;
+		// buffer that is used to inform Event
+		buffer	= irp->AssociatedIrp.SystemBuffer;
+
+		// buffer is not specified or short of length
+		if (bufferLen == 0 || buffer == NULL || bufferLen < eventLen) {
+			DDbgPrint("EventNotice : STATUS_INSUFFICIENT_RESOURCES\n");
+			DDbgPrint("  bufferLen: %d, eventLen: %d\n", bufferLen, eventLen);
+			// push back
+			InsertHeadList(NotifyEvent, &driverEventContext->ListEntry);
+			// marks as STATUS_INSUFFICIENT_RESOURCES
+			irpEntry->SerialNumber = 0;
+		} else {
+			// let's copy EVENT_CONTEXT
+			RtlCopyMemory(buffer, &driverEventContext->EventContext, eventLen);
+			offset = eventLen;
+			taken++;
+
+			if (driverEventContext->Completed) {
+				KeSetEvent(driverEventContext->Completed, IO_NO_INCREMENT, FALSE);
+			}
+			ExFreePool(driverEventContext);
+
+			// When this is the last waiting IRP, pack the rest of events
+			// as long as they fit. Otherwise leave them to other waiting IRPs
+			// so that events are dispatched in parallel.
+			if (DokanIsBatchIrp(irpEntry)) {
+
+				while (IsListEmpty(PendingIrp) && !IsListEmpty(NotifyEvent)) {
+
+					driverEventContext = CONTAINING_RECORD(
+						NotifyEvent->Flink, DRIVER_EVENT_CONTEXT, ListEntry);
+					eventLen = driverEventContext->EventContext.Length;
+
+					if (bufferLen < EVENT_CONTEXT_ALIGN(offset) + eventLen) {
+						break;
+					}
+					offset = EVENT_CONTEXT_ALIGN(offset);
+
+					RemoveEntryList(&driverEventContext->ListEntry);
+					RtlCopyMemory((PCHAR)buffer + offset,
+						&driverEventContext->EventContext, eventLen);
+					offset += eventLen;
+					taken++;
+
+					if (driverEventContext->Completed) {
+						KeSetEvent(driverEventContext->Completed, IO_NO_INCREMENT, FALSE);
+					}
+					ExFreePool(driverEventContext);
+				}
+			}
+
+			// save length of events
+			irpEntry->SerialNumber = offset;
+		}
+		InsertTailList(CompleteList, &irpEntry->ListEntry);
+	}
+
+	return taken;
+}
+
+
+// completes the IRPs DokanPairEvents moved to CompleteList,
+// no lock may be held
+VOID
+DokanCompleteEventIrps(
+	__in PLIST_ENTRY	CompleteList)
+{
+	PLIST_ENTRY	listHead;
+	PIRP_ENTRY	irpEntry;
+	PIRP		irp;
+
+	while (!IsListEmpty(CompleteList)) {
+		listHead = RemoveHeadList(CompleteList);
+		irpEntry = CONTAINING_RECORD(listHead, IRP_ENTRY, ListEntry);
+		irp = irpEntry->Irp;
+		if (irpEntry->SerialNumber == 0) {
+			irp->IoStatus.Information = 0;
+			irp->IoStatus.Status = STATUS_INSUFFICIENT_RESOURCES;
+		} else {
+			irp->IoStatus.Information = irpEntry->SerialNumber;
+			irp->IoStatus.Status = STATUS_SUCCESS;
+		}
+		DokanFreeIrpEntry(irpEntry);
+		IoCompleteRequest(irp, IO_NO_INCREMENT);
+	}
+}
+
+
+// completes an IRP waiting in a shard with DriverEventContext, returns
+// FALSE when no IRP took it or when events are queued
+static BOOLEAN
+HandoffEvent(
+	__in PDOKAN_EVENT_QUEUE		Queue,
+	__in PDRIVER_EVENT_CONTEXT	DriverEventContext)
+{
+	LIST_ENTRY	completeList;
+	KIRQL		oldIrql;
+	ULONG		index = KeGetCurrentProcessorNumber();
+	ULONG		taken = 0;
+	ULONG		i;
+
+	for (i = 0; i < DOKAN_EVENT_SHARDS && taken == 0; ++i) {
+		PDOKAN_EVENT_SHARD shard =
+			&Queue->Shards[(index + i) & (DOKAN_EVENT_SHARDS - 1)];
+		BOOLEAN queued;
+
+		if (IsListEmpty(&shard->PendingEvent.ListHead)) {
+			continue;
+		}
+
+		InitializeListHead(&completeList);
+		KeAcquireSpinLock(&shard->PendingEvent.ListLock, &oldIrql);
+
+		// a batch IRP waiting alone takes the event at once too,
+		// holding it back would only make a single worker wait
+		// for NotificationThread
+		queued = Queue->QueuedEventCount > 0 || !IsListEmpty(&shard->NotifyEvent);
+
+		if (!queued) {
+			InsertTailList(&shard->NotifyEvent, &DriverEventContext->ListEntry);
+			taken = DokanPairEvents(&shard->PendingEvent.ListHead,
+				&shard->NotifyEvent, &completeList);
+			if (taken == 0) {
+				// the waiting IRPs were canceled or too short
+				RemoveEntryList(&DriverEventContext->ListEntry);
+				InitializeListHead(&DriverEventContext->ListEntry);
+			}
+		}
+
+		KeReleaseSpinLock(&shard->PendingEvent.ListLock, oldIrql);
+
+		DokanCompleteEventIrps(&completeList);
+
+		if (queued) {
+			break;
+		}
+	}
+
+	return taken > 0;
+}
+
+
+// adds DriverEventContext to the shard of this processor for
+// an IRP to come or for NotificationThread
+static VOID
+QueueEvent(
+	__in PDOKAN_EVENT_QUEUE		Queue,
+	__in PDRIVER_EVENT_CONTEXT	DriverEventContext)
+{
+	PDOKAN_EVENT_SHARD	shard = DokanCurrentEventShard(Queue);
+	KIRQL		oldIrql;
+	BOOLEAN		signal;
+
+	KeAcquireSpinLock(&shard->PendingEvent.ListLock, &oldIrql);
+
+	InsertTailList(&shard->NotifyEvent, &DriverEventContext->ListEntry);
+	InterlockedIncrement(&Queue->QueuedEventCount);
+
+	// NotificationThread clears EventQueued before it takes the shard
+	// locks, so it either sees the event or has to be woken up
+	signal = KeReadStateEvent(&Queue->EventQueued) == 0;
+
+	KeReleaseSpinLock(&shard->PendingEvent.ListLock, oldIrql);
+
+	if (signal) {
+		KeSetEvent(&Queue->EventQueued, IO_NO_INCREMENT, FALSE);
+	}
+}
+
+
+VOID
+DokanQueueEvent(
+	__in PDOKAN_EVENT_QUEUE	Queue,
+	__in PEVENT_CONTEXT		EventContext)
+{
+	PDRIVER_EVENT_CONTEXT driverEventContext =
+		CONTAINING_RECORD(EventContext, DRIVER_EVENT_CONTEXT, EventContext);
+
+	InitializeListHead(&driverEventContext->ListEntry);
+
+	ASSERT(KeGetCurrentIrql() <= DISPATCH_LEVEL);
+
+	// a waiting IRP takes the event without NotificationThread
+	if (Queue->QueuedEventCount == 0 &&
+		HandoffEvent(Queue, driverEventContext)) {
+		return;
+	}
+
+	QueueEvent(Queue, driverEventContext);
+}
+
+
+// pairs the IRPs waiting in Shard with its events and with the events
+// of the other shards as long as both are left
+VOID
+DokanDispatchEvents(
+	__in PDOKAN_EVENT_QUEUE	Queue,
+	__in PDOKAN_EVENT_SHARD	Shard)
+{
+	LIST_ENTRY	completeList;
+	LIST_ENTRY	stolen;
+	KIRQL		oldIrql;
+	ULONG		index = (ULONG)(Shard - Queue->Shards);
+	ULONG		taken;
+	ULONG		i;
+	BOOLEAN		waiting;
+	BOOLEAN		left = FALSE;
+
+	InitializeListHead(&completeList);
+
+	ASSERT(KeGetCurrentIrql() <= DISPATCH_LEVEL);
+	KeAcquireSpinLock(&Shard->PendingEvent.ListLock, &oldIrql);
+	taken = DokanPairEvents(&Shard->PendingEvent.ListHead,
+		&Shard->NotifyEvent, &completeList);
+	waiting = !IsListEmpty(&Shard->PendingEvent.ListHead);
+	KeReleaseSpinLock(&Shard->PendingEvent.ListLock, oldIrql);
+
+	if (taken > 0) {
+		InterlockedExchangeAdd(&Queue->QueuedEventCount, -(LONG)taken);
+	}
+
+	for (i = 1; i < DOKAN_EVENT_SHARDS && waiting &&
+			Queue->QueuedEventCount > 0; ++i) {
+
+		PDOKAN_EVENT_SHARD victim =
+			&Queue->Shards[(index + i) & (DOKAN_EVENT_SHARDS - 1)];
+
+		if (IsListEmpty(&victim->NotifyEvent)) {
+			continue;
+		}
+
+		InitializeListHead(&stolen);
+		KeAcquireSpinLock(&victim->PendingEvent.ListLock, &oldIrql);
+		AppendEventList(&stolen, &victim->NotifyEvent);
+		KeReleaseSpinLock(&victim->PendingEvent.ListLock, oldIrql);
+
+		if (IsListEmpty(&stolen)) {
+			continue;
+		}
+
+		KeAcquireSpinLock(&Shard->PendingEvent.ListLock, &oldIrql);
+		AppendEventList(&Shard->NotifyEvent, &stolen);
+		taken = DokanPairEvents(&Shard->PendingEvent.ListHead,
+			&Shard->NotifyEvent, &completeList);
+		waiting = !IsListEmpty(&Shard->PendingEvent.ListHead);
+		left = !IsListEmpty(&Shard->NotifyEvent);
+		KeReleaseSpinLock(&Shard->PendingEvent.ListLock, oldIrql);
+
+		if (taken > 0) {
+			InterlockedExchangeAdd(&Queue->QueuedEventCount, -(LONG)taken);
+		}
+	}
+
+	// another shard may have looked for events while they were
+	// being moved here, NotificationThread offers them again
+	if (left) {
+		KeSetEvent(&Queue->EventQueued, IO_NO_INCREMENT, FALSE);
+	}
+
+	DokanCompleteEventIrps(&completeList);
+}
+
+
+// frees the queued events, the IRPs they came from are completed
+// by ReleasePendingIrp
+VOID
+DokanFreeQueuedEvents(
+	__in PDOKAN_EVENT_QUEUE	Queue)
+{
+	PDRIVER_EVENT_CONTEXT	driverEventContext;
+	PLIST_ENTRY	listHead;
+	KIRQL		oldIrql;
+	ULONG		i;
+
+	for (i = 0; i < DOKAN_EVENT_SHARDS; ++i) {
+		PDOKAN_EVENT_SHARD shard = &Queue->Shards[i];
+
+		ASSERT(KeGetCurrentIrql() <= DISPATCH_LEVEL);
+		KeAcquireSpinLock(&shard->PendingEvent.ListLock, &oldIrql);
+
+		while (!IsListEmpty(&shard->NotifyEvent)) {
+			listHead = RemoveHeadList(&shard->NotifyEvent);
+			driverEventContext = CONTAINING_RECORD(
+				listHead, DRIVER_EVENT_CONTEXT, ListEntry);
+			if (driverEventContext->Completed) {
+				KeSetEvent(driverEventContext->Completed, IO_NO_INCREMENT, FALSE);
+			}
+			ExFreePool(driverEventContext);
+			InterlockedDecrement(&Queue->QueuedEventCount);
+		}
+
+		KeReleaseSpinLock(&shard->PendingEvent.ListLock, oldIrql);
+	}
+}
@@ -0,0 +1,50 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2008 Hiroki Asakawa info@dokan-dev.net
+
+  http://dokan-dev.net/en
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef _EVENTQUEUE_H_
+#define _EVENTQUEUE_H_
+
+// Event queue of a volume, see eventqueue.c. Included by dokan.h after
+// IRP_LIST, the functions are declared with the other event functions.
+
+#define DOKAN_EVENT_SHARDS	8 // power of 2, see DokanCurrentEventShard
+
+// IOCTL_EVENT_WAIT IRPs and the events queued for them on a few processors
+typedef struct _DOKAN_EVENT_SHARD {
+	// waiting IRPs, PendingEvent.ListLock also protects NotifyEvent
+	IRP_LIST		PendingEvent;
+	// DRIVER_EVENT_CONTEXTs no IRP of the shard was waiting for
+	LIST_ENTRY		NotifyEvent;
+} DOKAN_EVENT_SHARD, *PDOKAN_EVENT_SHARD;
+
+typedef struct _DOKAN_EVENT_QUEUE {
+	DOKAN_EVENT_SHARD	Shards[DOKAN_EVENT_SHARDS];
+	// events in Shards[].NotifyEvent
+	LONG				QueuedEventCount;
+	// set when events are left for NotificationThread
+	KEVENT				EventQueued;
+} DOKAN_EVENT_QUEUE, *PDOKAN_EVENT_QUEUE;
+
+// the shard of the current processor
+#define DokanCurrentEventShard(Queue) \
+	(&(Queue)->Shards[KeGetCurrentProcessorNumber() & (DOKAN_EVENT_SHARDS - 1)])
+
+#endif // _EVENTQUEUE_H_
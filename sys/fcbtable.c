@@ -0,0 +1,237 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2008 Hiroki Asakawa info@dokan-dev.net
+
+  http://dokan-dev.net/en
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+/*
+
+FCB table
+
+  The FCBs of a volume are hashed by the file name into Vcb->FcbTable,
+  so an open finds the FCB of its file without scanning all of them.
+  Names are compared in the exact case as DokanGetFCB always did, but
+  the hash ignores case, so FCBs of names equal ignoring case share a
+  bucket and DokanDirCacheInvalidate finds them there.
+
+DokanGetFCB
+  # Vcb->Resource shared
+    # DokanFcbTableLookup
+    # found: take a reference and return
+  # Vcb->Resource exclusive
+    # DokanFcbTableLookup, another open may have added it
+    # not found: DokanAllocateFCB, DokanFcbTableInsert
+DokanFreeFCB (the last reference, Vcb->Resource exclusive)
+  DokanFcbTableRemove
+DokanCompleteSetInformation (rename, Vcb->Resource exclusive)
+  DokanFcbTableRemove, DokanFcbTableInsert with the new name
+DokanDirCacheInvalidate (Vcb->Resource shared)
+  DokanFcbTableNextIgnoreCase
+
+The table starts with the buckets in DOKAN_FCB_TABLE and doubles when
+it holds more than DOKAN_FCB_TABLE_LOAD FCBs per bucket. It goes back
+to the first buckets when the last FCB is removed. If a bigger table
+can not be allocated, the chains just get longer.
+
+DokanDeleteDeviceObject
+  DokanFcbTableDelete
+    # free grown buckets, FCBs still open at unmount keep them
+
+The functions only work on the table and the FCB links, the caller
+holds Vcb->Resource.
+
+*/
+
+
+#include "dokan.h"
+
+
+#define DokanFcbBucket(Table, Hash) \
+	(&(Table)->Buckets[(Hash) & ((Table)->BucketCount - 1)])
+
+
+VOID
+DokanFcbTableInitialize(
+	__in PDOKAN_FCB_TABLE	Table)
+{
+	ULONG	i;
+
+	Table->Buckets		= Table->InitialBuckets;
+	Table->BucketCount	= DOKAN_FCB_TABLE_INITIAL_BUCKETS;
+	Table->Count		= 0;
+
+	for (i = 0; i < DOKAN_FCB_TABLE_INITIAL_BUCKETS; ++i) {
+		InitializeListHead(&Table->InitialBuckets[i]);
+	}
+}
+
+
+// FileNameLength in bytes
+ULONG
+DokanFcbNameHash(
+	__in PWCHAR	FileName,
+	__in ULONG	FileNameLength)
+{
+	return DokanNameHash(FileName, FileNameLength / sizeof(WCHAR), TRUE);
+}
+
+
+PDokanFCB
+DokanFcbTableLookup(
+	__in PDOKAN_FCB_TABLE	Table,
+	__in PWCHAR				FileName,
+	__in ULONG				FileNameLength,
+	__in ULONG				Hash)
+{
+	PLIST_ENTRY	listHead = DokanFcbBucket(Table, Hash);
+	PLIST_ENTRY	thisEntry;
+
+	for (thisEntry = listHead->Flink;
+		thisEntry != listHead;
+		thisEntry = thisEntry->Flink) {
+
+		PDokanFCB fcb = CONTAINING_RECORD(thisEntry, DokanFCB, HashEntry);
+
+		if (fcb->NameHash == Hash &&
+			fcb->FileName.Length == FileNameLength &&
+			DokanNameEqual(fcb->FileName.Buffer, FileName, FileNameLength/sizeof(WCHAR))) {
+			return fcb;
+		}
+	}
+	return NULL;
+}
+
+
+// the FCB after Fcb (the first one when NULL) whose name equals
+// FileName ignoring case
+PDokanFCB
+DokanFcbTableNextIgnoreCase(
+	__in PDOKAN_FCB_TABLE	Table,
+	__in PWCHAR				FileName,
+	__in ULONG				FileNameLength,
+	__in ULONG				Hash,
+	__in_opt PDokanFCB		Fcb)
+{
+	PLIST_ENTRY	listHead = DokanFcbBucket(Table, Hash);
+	PLIST_ENTRY	thisEntry;
+
+	for (thisEntry = Fcb != NULL ? Fcb->HashEntry.Flink : listHead->Flink;
+		thisEntry != listHead;
+		thisEntry = thisEntry->Flink) {
+
+		PDokanFCB fcb = CONTAINING_RECORD(thisEntry, DokanFCB, HashEntry);
+
+		if (fcb->NameHash == Hash &&
+			fcb->FileName.Length == FileNameLength &&
+			DokanNameEqualIgnoreCase(fcb->FileName.Buffer, FileName,
+				FileNameLength/sizeof(WCHAR))) {
+			return fcb;
+		}
+	}
+	return NULL;
+}
+
+
+// moves the FCBs to Buckets of BucketCount entries,
+// the order of FCBs of the same name is kept
+static VOID
+DokanFcbTableRehash(
+	__in PDOKAN_FCB_TABLE	Table,
+	__in PLIST_ENTRY		Buckets,
+	__in ULONG				BucketCount)
+{
+	ULONG	i;
+
+	for (i = 0; i < BucketCount; ++i) {
+		InitializeListHead(&Buckets[i]);
+	}
+
+	for (i = 0; i < Table->BucketCount; ++i) {
+		PLIST_ENTRY listHead = &Table->Buckets[i];
+
+		while (!IsListEmpty(listHead)) {
+			PDokanFCB fcb = CONTAINING_RECORD(
+				RemoveHeadList(listHead), DokanFCB, HashEntry);
+			InsertTailList(&Buckets[fcb->NameHash & (BucketCount - 1)], &fcb->HashEntry);
+		}
+	}
+
+	if (Table->Buckets != Table->InitialBuckets) {
+		ExFreePool(Table->Buckets);
+	}
+	Table->Buckets		= Buckets;
+	Table->BucketCount	= BucketCount;
+}
+
+
+VOID
+DokanFcbTableInsert(
+	__in PDOKAN_FCB_TABLE	Table,
+	__in PDokanFCB			Fcb)
+{
+	Fcb->NameHash = DokanFcbNameHash(Fcb->FileName.Buffer, Fcb->FileName.Length);
+
+	if (Table->Count >= Table->BucketCount * DOKAN_FCB_TABLE_LOAD &&
+		Table->BucketCount < DOKAN_FCB_TABLE_MAX_BUCKETS) {
+
+		ULONG		bucketCount = Table->BucketCount * 2;
+		PLIST_ENTRY	buckets = ExAllocatePool(bucketCount * sizeof(LIST_ENTRY));
+
+		if (buckets != NULL) {
+			DDbgPrint("  FCB table grows to %d buckets\n", bucketCount);
+			DokanFcbTableRehash(Table, buckets, bucketCount);
+		}
+	}
+
+	// an FCB added later is found after older ones of the same name
+	InsertTailList(DokanFcbBucket(Table, Fcb->NameHash), &Fcb->HashEntry);
+	Table->Count++;
+}
+
+
+VOID
+DokanFcbTableRemove(
+	__in PDOKAN_FCB_TABLE	Table,
+	__in PDokanFCB			Fcb)
+{
+	ASSERT(Table->Count > 0);
+
+	RemoveEntryList(&Fcb->HashEntry);
+	Table->Count--;
+
+	if (Table->Count == 0 && Table->Buckets != Table->InitialBuckets) {
+		ExFreePool(Table->Buckets);
+		DokanFcbTableInitialize(Table);
+	}
+}
+
+
+// the FCBs left in the table are not freed
+VOID
+DokanFcbTableDelete(
+	__in PDOKAN_FCB_TABLE	Table)
+{
+	if (Table->Count > 0) {
+		DDbgPrint("  FCB table: %d FCBs left\n", Table->Count);
+	}
+
+	if (Table->Buckets != Table->InitialBuckets) {
+		ExFreePool(Table->Buckets);
+	}
+	DokanFcbTableInitialize(Table);
+}
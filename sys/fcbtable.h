@@ -0,0 +1,41 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2008 Hiroki Asakawa info@dokan-dev.net
+
+  http://dokan-dev.net/en
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef _FCBTABLE_H_
+#define _FCBTABLE_H_
+
+// FCB table, see fcbtable.c. Included by dokan.h before the VCB, the
+// functions are declared with the other FCB functions.
+
+#define DOKAN_FCB_TABLE_INITIAL_BUCKETS	16 // power of 2
+#define DOKAN_FCB_TABLE_MAX_BUCKETS		(64 * 1024)
+#define DOKAN_FCB_TABLE_LOAD			2 // FCBs per bucket before the table grows
+
+// FCBs hashed by the file name
+typedef struct _DOKAN_FCB_TABLE {
+	PLIST_ENTRY		Buckets;
+	// power of 2
+	ULONG			BucketCount;
+	ULONG			Count;
+	LIST_ENTRY		InitialBuckets[DOKAN_FCB_TABLE_INITIAL_BUCKETS];
+} DOKAN_FCB_TABLE, *PDOKAN_FCB_TABLE;
+
+#endif // _FCBTABLE_H_
@@ -560,6 +560,8 @@ DokanCompleteSetInformation(
 			if(infoClass == FileRenameInformation) {
 				PVOID buffer = NULL;
 
+				// the FCB is hashed by the name in Vcb->FcbTable
+				ExAcquireResourceExclusiveLite(&fcb->Vcb->Resource, TRUE);
 				ExAcquireResourceExclusiveLite(&fcb->Resource, TRUE);
 
 				// this is used to inform rename in the bellow switch case
@@ -573,10 +575,13 @@ DokanCompleteSetInformation(
 				if (buffer == NULL) {
 					status = STATUS_INSUFFICIENT_RESOURCES;
 					ExReleaseResourceLite(&fcb->Resource);
+					ExReleaseResourceLite(&fcb->Vcb->Resource);
 					ExReleaseResourceLite(&ccb->Resource);
 					__leave;
 				}
 
+				DokanFcbTableRemove(&fcb->Vcb->FcbTable, fcb);
+
 				fcb->FileName.Buffer = buffer;
 
 				ASSERT(fcb->FileName.Buffer != NULL);
@@ -587,7 +592,10 @@ DokanCompleteSetInformation(
 				fcb->FileName.Length = (USHORT)EventInfo->BufferLength;
 				fcb->FileName.MaximumLength = (USHORT)EventInfo->BufferLength;
 
+				DokanFcbTableInsert(&fcb->Vcb->FcbTable, fcb);
+
 				ExReleaseResourceLite(&fcb->Resource);
+				ExReleaseResourceLite(&fcb->Vcb->Resource);
 			}
 		}
 
@@ -265,6 +265,8 @@ DokanInitIrpList(
 	InitializeListHead(&IrpList->ListHead);
 	KeInitializeSpinLock(&IrpList->ListLock);
 	KeInitializeEvent(&IrpList->NotEmpty, NotificationEvent, FALSE);
+	IrpList->SerialIndex = NULL;
+	IrpList->TimeoutWheel = NULL;
 }
 
 
@@ -399,6 +401,7 @@ DokanCreateDiskDevice(
 	UNICODE_STRING		diskDeviceName;
 	NTSTATUS			status;
 	PUNICODE_STRING		symbolicLinkTarget;
+	ULONG				i;
 	BOOLEAN				isNetworkFileSystem = (DeviceType == FILE_DEVICE_NETWORK_FILE_SYSTEM);
 
 	// make DeviceName and SymboliLink
@@ -481,9 +484,18 @@ DokanCreateDiskDevice(
 	diskDeviceObject->Flags |= DO_DIRECT_IO;
 
 	// initialize Event and Event queue
-	DokanInitIrpList(&dcb->PendingIrp);
-	DokanInitIrpList(&dcb->PendingEvent);
-	DokanInitIrpList(&dcb->NotifyEvent);
+	for (i = 0; i < DOKAN_PENDING_IRP_SHARDS; ++i) {
+		ULONG j;
+		DokanInitIrpList(&dcb->PendingIrp[i]);
+		for (j = 0; j < DOKAN_PENDING_IRP_BUCKETS; ++j) {
+			InitializeListHead(&dcb->PendingIrpIndex[i][j]);
+		}
+		dcb->PendingIrp[i].SerialIndex = dcb->PendingIrpIndex[i];
+		DokanInitTimeoutWheel(&dcb->PendingIrpTimeouts[i]);
+		dcb->PendingIrp[i].TimeoutWheel = &dcb->PendingIrpTimeouts[i];
+	}
+	DokanInitEventQueue(&dcb->EventQueue);
+	KeInitializeSpinLock(&dcb->Ring.Lock);
 
 	KeInitializeEvent(&dcb->ReleaseEvent, NotificationEvent, FALSE);
 
@@ -529,7 +541,9 @@ DokanCreateDiskDevice(
 
 	dcb->Vcb = vcb;
 	
+	ExInitializeResourceLite(&vcb->Resource);
 	InitializeListHead(&vcb->NextFCB);
+	DokanFcbTableInitialize(&vcb->FcbTable);
 
 	InitializeListHead(&vcb->DirNotifyList);
 	FsRtlNotifyInitializeSync(&vcb->NotifySync);
@@ -579,6 +593,8 @@ DokanCreateDiskDevice(
 			diskDeviceObject->Vpb->RealDevice = NULL;
 			diskDeviceObject->Vpb->Flags = 0;
 		}
+		FsRtlNotifyUninitializeSync(&vcb->NotifySync);
+		ExDeleteResourceLite(&vcb->Resource);
 		IoDeleteDevice(diskDeviceObject);
 		IoDeleteDevice(fsDeviceObject);
 		DDbgPrint("  IoCreateSymbolicLink returned 0x%x\n", status);
@@ -663,6 +679,11 @@ DokanDeleteDeviceObject(
 	DDbgPrint("  CCB allocated: %d\n", vcb->CcbAllocated);
 	DDbgPrint("  CCB     freed: %d\n", vcb->CcbFreed);
 
+	// the VCB is the extension of its DeviceObject
+	DokanFcbTableDelete(&vcb->FcbTable);
+	FsRtlNotifyUninitializeSync(&vcb->NotifySync);
+	ExDeleteResourceLite(&vcb->Resource);
+
 	// delete diskDeviceObject
 	DDbgPrint("  Delete DeviceObject\n");
 	IoDeleteDevice(vcb->DeviceObject);
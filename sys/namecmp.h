@@ -0,0 +1,215 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2008 Hiroki Asakawa info@dokan-dev.net
+
+  http://dokan-dev.net/en
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef _NAMECMP_H_
+#define _NAMECMP_H_
+
+// Name comparison shared by the driver and the library.
+//
+// Names are compared 8 WCHARs at a time with SSE2. In case-insensitive
+// compares, a block where both names are ASCII is folded in the
+// registers, any other block is compared one WCHAR at a time, and
+// only non-ASCII WCHARs go through DOKAN_UPCASE_CHAR.
+// SSE2 is used on x64 and on x86 user mode built with /arch:SSE2,
+// since the x86 kernel would have to save the floating point state.
+// DOKAN_NAMECMP_NO_SSE2 builds the scalar loops only.
+
+#if defined(_NTIFS_) || defined(_NTDDK_)
+#define DOKAN_UPCASE_CHAR(c)	RtlUpcaseUnicodeChar(c)
+#if defined(_M_AMD64) && !defined(DOKAN_NAMECMP_NO_SSE2)
+#define DOKAN_NAMECMP_SSE2
+#endif
+#else
+#define DOKAN_UPCASE_CHAR(c)	towupper(c)
+#if (defined(_M_AMD64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)) \
+	&& !defined(DOKAN_NAMECMP_NO_SSE2)
+#define DOKAN_NAMECMP_SSE2
+#endif
+#endif
+
+#ifdef DOKAN_NAMECMP_SSE2
+#include <emmintrin.h>
+#endif
+
+
+#define DOKAN_NAME_HASH_SEED	2166136261UL
+#define DOKAN_NAME_HASH_PRIME	16777619UL
+
+
+#define DokanFoldAsciiChar(c) \
+	((WCHAR)(((c) >= L'a' && (c) <= L'z') ? (c) - (L'a' - L'A') : (c)))
+
+// ASCII is folded without the upcase table
+#define DokanUpcaseNameChar(c) \
+	((c) < 0x80 ? DokanFoldAsciiChar(c) : DOKAN_UPCASE_CHAR(c))
+
+
+#ifdef DOKAN_NAMECMP_SSE2
+
+// lowercase ASCII letters of X minus 0x20
+#define DokanFoldAscii8(X) \
+	_mm_sub_epi16((X), _mm_and_si128( \
+		_mm_and_si128( \
+			_mm_cmpgt_epi16((X), _mm_set1_epi16(L'a' - 1)), \
+			_mm_cmplt_epi16((X), _mm_set1_epi16(L'z' + 1))), \
+		_mm_set1_epi16(L'a' - L'A')))
+
+// zero when all 8 WCHARs of X are less than 0x80
+#define DokanNonAscii8(X) \
+	_mm_movemask_epi8(_mm_and_si128((X), _mm_set1_epi16((short)0xFF80)))
+
+#endif
+
+
+// Count is in WCHARs
+__inline BOOLEAN
+DokanNameEqual(
+	const WCHAR*	Name1,
+	const WCHAR*	Name2,
+	ULONG			Count)
+{
+	ULONG	pos = 0;
+
+#ifdef DOKAN_NAMECMP_SSE2
+	for (; pos + 8 <= Count; pos += 8) {
+		__m128i x = _mm_loadu_si128((const __m128i*)&Name1[pos]);
+		__m128i y = _mm_loadu_si128((const __m128i*)&Name2[pos]);
+		if (_mm_movemask_epi8(_mm_cmpeq_epi16(x, y)) != 0xFFFF)
+			return FALSE;
+	}
+#endif
+
+	for (; pos < Count; ++pos) {
+		if (Name1[pos] != Name2[pos])
+			return FALSE;
+	}
+	return TRUE;
+}
+
+
+// one WCHAR at a time, for blocks with non-ASCII WCHARs and the tail
+__inline BOOLEAN
+DokanCharsEqualIgnoreCase(
+	const WCHAR*	Name1,
+	const WCHAR*	Name2,
+	ULONG			Count)
+{
+	ULONG	pos;
+
+	for (pos = 0; pos < Count; ++pos) {
+		WCHAR c1 = Name1[pos];
+		WCHAR c2 = Name2[pos];
+		if (c1 != c2 && DokanUpcaseNameChar(c1) != DokanUpcaseNameChar(c2))
+			return FALSE;
+	}
+	return TRUE;
+}
+
+
+__inline BOOLEAN
+DokanNameEqualIgnoreCase(
+	const WCHAR*	Name1,
+	const WCHAR*	Name2,
+	ULONG			Count)
+{
+	ULONG	pos = 0;
+
+#ifdef DOKAN_NAMECMP_SSE2
+	for (; pos + 8 <= Count; pos += 8) {
+		__m128i x = _mm_loadu_si128((const __m128i*)&Name1[pos]);
+		__m128i y = _mm_loadu_si128((const __m128i*)&Name2[pos]);
+
+		if (_mm_movemask_epi8(_mm_cmpeq_epi16(x, y)) == 0xFFFF)
+			continue;
+
+		if (DokanNonAscii8(_mm_or_si128(x, y)) == 0) {
+			if (_mm_movemask_epi8(_mm_cmpeq_epi16(
+					DokanFoldAscii8(x), DokanFoldAscii8(y))) != 0xFFFF)
+				return FALSE;
+			continue;
+		}
+
+		if (!DokanCharsEqualIgnoreCase(&Name1[pos], &Name2[pos], 8))
+			return FALSE;
+	}
+#endif
+
+	return DokanCharsEqualIgnoreCase(&Name1[pos], &Name2[pos], Count - pos);
+}
+
+
+// upcases Count WCHARs of Source into Dest, which may be Source
+__inline VOID
+DokanNameUpcase(
+	WCHAR*			Dest,
+	const WCHAR*	Source,
+	ULONG			Count)
+{
+	ULONG	pos = 0;
+
+#ifdef DOKAN_NAMECMP_SSE2
+	for (; pos + 8 <= Count; pos += 8) {
+		__m128i x = _mm_loadu_si128((const __m128i*)&Source[pos]);
+		ULONG	end;
+
+		if (DokanNonAscii8(x) == 0) {
+			_mm_storeu_si128((__m128i*)&Dest[pos], DokanFoldAscii8(x));
+			continue;
+		}
+		for (end = pos + 8; pos < end; ++pos) {
+			WCHAR c = Source[pos];
+			Dest[pos] = DokanUpcaseNameChar(c);
+		}
+		pos -= 8;
+	}
+#endif
+
+	for (; pos < Count; ++pos) {
+		WCHAR c = Source[pos];
+		Dest[pos] = DokanUpcaseNameChar(c);
+	}
+}
+
+
+// FNV-1a of the name, names equal by DokanNameEqualIgnoreCase
+// have the same hash when IgnoreCase
+__inline ULONG
+DokanNameHash(
+	const WCHAR*	Name,
+	ULONG			Count,
+	BOOLEAN			IgnoreCase)
+{
+	ULONG	hash = DOKAN_NAME_HASH_SEED;
+	ULONG	pos;
+
+	for (pos = 0; pos < Count; ++pos) {
+		WCHAR c = Name[pos];
+		if (IgnoreCase) {
+			c = DokanUpcaseNameChar(c);
+		}
+		hash = (hash ^ (c & 0xFF)) * DOKAN_NAME_HASH_PRIME;
+		hash = (hash ^ (c >> 8)) * DOKAN_NAME_HASH_PRIME;
+	}
+	return hash;
+}
+
+
+#endif // _NAMECMP_H_
@@ -23,11 +23,10 @@ with this program. If not, see <http://www.gnu.org/licenses/>.
 IOCTL_EVENT_START:
 DokanStartEventNotificationThread
   NotificationThread
-	# PendingEvent has pending IPRs (IOCTL_EVENT_WAIT)
-    # NotifyEvent has IO events (ex.IRP_MJ_READ)
-    # notify NotifyEvent using PendingEvent in this loop
-	NotificationLoop(&Dcb->PendingEvent,
-					      &Dcb->NotifyEvent);
+    # EventQueue has pending IPRs (IOCTL_EVENT_WAIT) and
+    # IO events (ex.IRP_MJ_READ) by processor, see eventqueue.c
+    # pair the events left in a shard with IRPs of any shard
+    DokanDispatchEvents(&Dcb->EventQueue, each shard)
 
     # PendingService has service events (ex. Unmount notification)
 	# NotifyService has pending IRPs (IOCTL_SERVICE_WAIT)
@@ -40,20 +39,37 @@ DokanStopEventNotificationThread
 IRP_MJ_READ:
 DokanDispatchRead
   DokanRegisterPendingIrp
-    # add IRP_MJ_READ to PendingIrp list
-    DokanRegisterPendingIrpMain(PendingIrp)
-	# put MJ_READ event into NotifyEvent
-    DokanEventNotification(NotifyEvent, EventContext)
+    # add IRP_MJ_READ to the PendingIrp shard of its SerialNumber
+    DokanRegisterPendingIrpMain(PendingIrp[SerialNumber % SHARDS])
+    DokanQueueEvent(EventQueue, EventContext)
+      # complete a waiting IRP with the event when no event is queued,
+	  # otherwise put MJ_READ event into the shard of this processor
 
 IOCTL_EVENT_WAIT:
   DokanRegisterPendingIrpForEvent
-    # add this irp to PendingEvent list
-    DokanRegisterPendingIrpMain(PendingEvent)
+    # add this irp to PendingEvent of the shard of this processor
+    DokanRegisterPendingIrpMain(Shard->PendingEvent)
+    # take the events of the shard, or of the others when it has none
+    DokanDispatchEvents(EventQueue, Shard)
+
+IOCTL_EVENT_WAIT_BATCH:
+  # same as IOCTL_EVENT_WAIT, but when no other IRP of the shard is
+  # waiting DokanPairEvents packs as many events as fit into this IRP
+
+IOCTL_EVENT_INFO_WAIT:
+  # IOCTL_EVENT_INFO and then IOCTL_EVENT_WAIT_BATCH
+  DokanCompleteIrpAndWait
 
 IOCTL_EVENT_INFO:
   DokanCompleteIrp
     DokanCompleteRead
 
+IOCTL_RING_REGISTER:
+  # NotificationThread also waits for ReplyEvent of the ring and
+  # DokanRingNotify passes queued events through the ring first, see ring.c
+  # events handed to a waiting IRP by DokanQueueEvent or taken by an IRP
+  # as it is registered do not go through the ring
+
 */
 
 
@@ -181,8 +197,8 @@ ReleasePendingIrp(
 	KeAcquireSpinLock(&PendingIrp->ListLock, &oldIrql);
 
 	while (!IsListEmpty(&PendingIrp->ListHead)) {
-		listHead = RemoveHeadList(&PendingIrp->ListHead);
-		irpEntry = CONTAINING_RECORD(listHead, IRP_ENTRY, ListEntry);
+		irpEntry = CONTAINING_RECORD(PendingIrp->ListHead.Flink, IRP_ENTRY, ListEntry);
+		DokanRemovePendingIrp(irpEntry);
 		irp = irpEntry->Irp;
 		if (irp == NULL) {
 			// this IRP has already been canceled
@@ -245,17 +261,9 @@ NotificationLoop(
 	__in PIRP_LIST	NotifyEvent
 	)
 {
-	PDRIVER_EVENT_CONTEXT	driverEventContext;
-	PLIST_ENTRY	listHead;
-	PIRP_ENTRY	irpEntry;
 	LIST_ENTRY	completeList;
-	NTSTATUS	status;
 	KIRQL	irpIrql;
 	KIRQL	notifyIrql;
-	PIRP	irp;
-	ULONG	eventLen;
-	ULONG	bufferLen;
-	PVOID	buffer;
 
 	//DDbgPrint("=> NotificationLoop\n");
 
@@ -264,71 +272,8 @@ NotificationLoop(
 	ASSERT(KeGetCurrentIrql() <= DISPATCH_LEVEL);
 	KeAcquireSpinLock(&PendingIrp->ListLock, &irpIrql);
 	KeAcquireSpinLock(&NotifyEvent->ListLock, &notifyIrql);
-		
-	while (!IsListEmpty(&PendingIrp->ListHead) &&
-		!IsListEmpty(&NotifyEvent->ListHead)) {
-			
-		listHead = RemoveHeadList(&NotifyEvent->ListHead);
-
-		driverEventContext = CONTAINING_RECORD(
-			listHead, DRIVER_EVENT_CONTEXT, ListEntry);
-
-		listHead = RemoveHeadList(&PendingIrp->ListHead);
-		irpEntry = CONTAINING_RECORD(listHead, IRP_ENTRY, ListEntry);
 
-		eventLen = driverEventContext->EventContext.Length;
-
-		// ensure this eventIrp is not cancelled
-		irp = irpEntry->Irp;
-
-		if (irp == NULL) {
-			// this IRP has already been canceled
-			ASSERT(irpEntry->CancelRoutineFreeMemory == FALSE);
-			DokanFreeIrpEntry(irpEntry);
-			// push back
-			InsertTailList(&NotifyEvent->ListHead,
-							&driverEventContext->ListEntry);
-			continue;
-		}
-
-		if (IoSetCancelRoutine(irp, NULL) == NULL) {
-			// Cancel routine will run as soon as we release the lock
-			InitializeListHead(&irpEntry->ListEntry);
-			irpEntry->CancelRoutineFreeMemory = TRUE;
-			// push back
-			InsertTailList(&NotifyEvent->ListHead,
-							&driverEventContext->ListEntry);
-			continue;
-		}
-
-		// available size that is used for event notification
-		bufferLen =
-			irpEntry->IrpSp->Parameters.DeviceIoControl.OutputBufferLength;
-		// buffer that is used to inform Event
-		buffer	= irp->AssociatedIrp.SystemBuffer;
-
-		// buffer is not specified or short of length
-		if (bufferLen == 0 || buffer == NULL || bufferLen < eventLen) {
-			DDbgPrint("EventNotice : STATUS_INSUFFICIENT_RESOURCES\n");
-			DDbgPrint("  bufferLen: %d, eventLen: %d\n", bufferLen, eventLen);
-			// push back
-			InsertTailList(&NotifyEvent->ListHead,
-							&driverEventContext->ListEntry);
-			// marks as STATUS_INSUFFICIENT_RESOURCES
-			irpEntry->SerialNumber = 0;
-		} else {
-			// let's copy EVENT_CONTEXT
-			RtlCopyMemory(buffer, &driverEventContext->EventContext, eventLen);
-			// save event length
-			irpEntry->SerialNumber = eventLen;
-
-			if (driverEventContext->Completed) {
-				KeSetEvent(driverEventContext->Completed, IO_NO_INCREMENT, FALSE);
-			}
-			ExFreePool(driverEventContext);
-		}
-		InsertTailList(&completeList, &irpEntry->ListEntry);
-	}
+	DokanPairEvents(&PendingIrp->ListHead, &NotifyEvent->ListHead, &completeList);
 
 	KeClearEvent(&NotifyEvent->NotEmpty);
 	KeClearEvent(&PendingIrp->NotEmpty);
@@ -336,20 +281,7 @@ NotificationLoop(
 	KeReleaseSpinLock(&NotifyEvent->ListLock, notifyIrql);
 	KeReleaseSpinLock(&PendingIrp->ListLock, irpIrql);
 
-	while (!IsListEmpty(&completeList)) {
-		listHead = RemoveHeadList(&completeList);
-		irpEntry = CONTAINING_RECORD(listHead, IRP_ENTRY, ListEntry);
-		irp = irpEntry->Irp;
-		if (irpEntry->SerialNumber == 0) {
-			irp->IoStatus.Information = 0;
-			irp->IoStatus.Status = STATUS_INSUFFICIENT_RESOURCES;
-		} else {
-			irp->IoStatus.Information = irpEntry->SerialNumber;
-			irp->IoStatus.Status = STATUS_SUCCESS;
-		}
-		DokanFreeIrpEntry(irpEntry);
-		IoCompleteRequest(irp, IO_NO_INCREMENT);
-	}
+	DokanCompleteEventIrps(&completeList);
 
 	//DDbgPrint("<= NotificationLoop\n");
 }
@@ -364,6 +296,9 @@ NotificationThread(
 	PKEVENT events[5];
 	PKWAIT_BLOCK waitBlock;
 	NTSTATUS status;
+	PKEVENT replyEvent;
+	ULONG count;
+	ULONG i;
 
 	DDbgPrint("==> NotificationThread\n");
 
@@ -373,24 +308,39 @@ NotificationThread(
 		return;
 	}
 	events[0] = &Dcb->ReleaseEvent;
-	events[1] = &Dcb->NotifyEvent.NotEmpty;
-	events[2] = &Dcb->PendingEvent.NotEmpty;
-	events[3] = &Dcb->Global->PendingService.NotEmpty;
-	events[4] = &Dcb->Global->NotifyService.NotEmpty;
+	events[1] = &Dcb->EventQueue.EventQueued;
+	events[2] = &Dcb->Global->PendingService.NotEmpty;
+	events[3] = &Dcb->Global->NotifyService.NotEmpty;
 
 	while (1) {
+		// the ring may be registered or released at any time
+		count = 4;
+		replyEvent = DokanRingReferenceReplyEvent(Dcb);
+		if (replyEvent) {
+			events[count++] = replyEvent;
+		}
+
 		status = KeWaitForMultipleObjects(
-			5, events, WaitAny, Executive, KernelMode, FALSE, NULL, waitBlock);
+			count, events, WaitAny, Executive, KernelMode, FALSE, NULL, waitBlock);
+
+		if (replyEvent) {
+			ObDereferenceObject(replyEvent);
+		}
 
 		if (status == STATUS_WAIT_0) {
 			;
 			break;
 
-		} else if (status == STATUS_WAIT_1 || status == STATUS_WAIT_2) {
+		} else if (status == STATUS_WAIT_1 || status == STATUS_WAIT_0 + 4) {
 
-			NotificationLoop(
-					&Dcb->PendingEvent,
-					&Dcb->NotifyEvent);
+			// cleared before the shards are visited, so that an event
+			// queued after its shard was visited sets it again
+			KeClearEvent(&Dcb->EventQueue.EventQueued);
+			DokanRingNotify(Dcb);
+
+			for (i = 0; i < DOKAN_EVENT_SHARDS; ++i) {
+				DokanDispatchEvents(&Dcb->EventQueue, &Dcb->EventQueue.Shards[i]);
+			}
 
 		} else {
 			NotificationLoop(
@@ -467,6 +417,7 @@ DokanEventRelease(
 	PLIST_ENTRY	fcbEntry, fcbNext, fcbHead;
 	PLIST_ENTRY	ccbEntry, ccbNext, ccbHead;
 	NTSTATUS	status = STATUS_SUCCESS;
+	ULONG		i;
 
 	vcb = DeviceObject->DeviceExtension;
 	if (GetIdentifierType(vcb) != VCB) {
@@ -508,8 +459,14 @@ DokanEventRelease(
 	ExReleaseResourceLite(&vcb->Resource);
 	KeLeaveCriticalRegion();
 
-	ReleasePendingIrp(&dcb->PendingIrp);
-	ReleasePendingIrp(&dcb->PendingEvent);
+	DokanRingRelease(dcb);
+	for (i = 0; i < DOKAN_PENDING_IRP_SHARDS; ++i) {
+		ReleasePendingIrp(&dcb->PendingIrp[i]);
+	}
+	for (i = 0; i < DOKAN_EVENT_SHARDS; ++i) {
+		ReleasePendingIrp(&dcb->EventQueue.Shards[i].PendingEvent);
+	}
+	DokanFreeQueuedEvents(&dcb->EventQueue);
 	DokanStopCheckThread(dcb);
 	DokanStopEventNotificationThread(dcb);
 
@@ -0,0 +1,252 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2008 Hiroki Asakawa info@dokan-dev.net
+
+  http://dokan-dev.net/en
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+/*
+
+Pending IRP index and timeouts
+
+  IRPs waiting for replies are in the shard of Dcb->PendingIrp of their
+  SerialNumber (DokanPendingIrpList), and also in IrpList->SerialIndex,
+  DOKAN_PENDING_IRP_BUCKETS lists by the following bits of SerialNumber.
+  Serial numbers are given in sequence, so the entries spread evenly over
+  the shards and the buckets, and a reply finds its IRP without scanning
+  the list.
+
+  Their deadlines (IRP_ENTRY.TickCount) are kept in IrpList->TimeoutWheel,
+  DOKAN_TIMEOUT_WHEEL_SLOTS lists by deadline. A slot covers
+  DOKAN_CHECK_INTERVAL, so the wheel turns once in
+  DOKAN_TIMEOUT_WHEEL_SLOTS * DOKAN_CHECK_INTERVAL and a deadline further
+  than that waits in its slot for the following turns. Entries are
+  visited by their slots only, so an IRP whose timeout was extended does
+  not hide expired ones behind it.
+
+RegisterPendingIrpMain
+  DokanInsertPendingIrp
+    # link the entry to the list, the index and the slot of its deadline
+CompleteIrpMain, DokanEventWrite, DokanGetAccessToken
+  DokanFindPendingIrp
+DokanResetPendingIrpTimeout
+  DokanFindPendingIrp
+  DokanScheduleTimeout
+    # move the entry to the slot of its new deadline
+DokanTimeoutThread (every DOKAN_CHECK_INTERVAL)
+  ReleaseTimeoutPendingIrp
+    DokanCollectTimeoutIrps (each shard)
+      # visit the slots from the last sweep up to now
+      # take the entries whose deadline passed
+CompleteIrpMain, DokanEventWrite, DokanIrpCancelRoutine,
+DokanCollectTimeoutIrps
+  DokanRemovePendingIrp
+    # leaves the index and wheel links of the entry empty, so the
+    # cancel routine can remove an entry completion already took off
+
+DokanCollectTimeoutIrps takes IrpList->ListLock. The other functions
+only work on the lists and the links of the entries, the caller holds
+IrpList->ListLock.
+
+*/
+
+
+#include "dokan.h"
+
+
+#define DokanSerialBucket(IrpList, SerialNumber) \
+	(&(IrpList)->SerialIndex[((SerialNumber) / DOKAN_PENDING_IRP_SHARDS) \
+		& (DOKAN_PENDING_IRP_BUCKETS - 1)])
+
+
+// links IrpEntry to IrpList, its index and its timeout wheel
+VOID
+DokanInsertPendingIrp(
+	__in PIRP_LIST	IrpList,
+	__in PIRP_ENTRY	IrpEntry)
+{
+	InsertTailList(&IrpList->ListHead, &IrpEntry->ListEntry);
+	if (IrpList->SerialIndex != NULL) {
+		InsertTailList(DokanSerialBucket(IrpList, IrpEntry->SerialNumber),
+			&IrpEntry->SerialEntry);
+	}
+	if (IrpList->TimeoutWheel != NULL) {
+		DokanScheduleTimeout(IrpList, IrpEntry);
+	}
+}
+
+
+PIRP_ENTRY
+DokanFindPendingIrp(
+	__in PIRP_LIST	IrpList,
+	__in ULONG		SerialNumber)
+{
+	PLIST_ENTRY	listHead;
+	PLIST_ENTRY	thisEntry;
+
+	ASSERT(IrpList->SerialIndex != NULL);
+
+	listHead = DokanSerialBucket(IrpList, SerialNumber);
+
+	for (thisEntry = listHead->Flink; thisEntry != listHead; thisEntry = thisEntry->Flink) {
+		PIRP_ENTRY irpEntry = CONTAINING_RECORD(thisEntry, IRP_ENTRY, SerialEntry);
+		if (irpEntry->SerialNumber == SerialNumber) {
+			return irpEntry;
+		}
+	}
+	return NULL;
+}
+
+
+// unlinks IrpEntry from its list, the index and the timeout wheel
+VOID
+DokanRemovePendingIrp(
+	__in PIRP_ENTRY	IrpEntry)
+{
+	RemoveEntryList(&IrpEntry->ListEntry);
+
+	// the cancel routine may remove it again
+	RemoveEntryList(&IrpEntry->SerialEntry);
+	InitializeListHead(&IrpEntry->SerialEntry);
+	RemoveEntryList(&IrpEntry->TimeoutEntry);
+	InitializeListHead(&IrpEntry->TimeoutEntry);
+}
+
+
+VOID
+DokanInitTimeoutWheel(
+	__in PDOKAN_TIMEOUT_WHEEL	Wheel)
+{
+	LARGE_INTEGER	tickCount;
+	ULONG			i;
+
+	for (i = 0; i < DOKAN_TIMEOUT_WHEEL_SLOTS; ++i) {
+		InitializeListHead(&Wheel->Slots[i]);
+	}
+
+	Wheel->SlotTicks = (ULONGLONG)DOKAN_CHECK_INTERVAL * 1000 * 10 / KeQueryTimeIncrement();
+	if (Wheel->SlotTicks == 0) {
+		Wheel->SlotTicks = 1;
+	}
+
+	KeQueryTickCount(&tickCount);
+	Wheel->SweptSlot = (ULONGLONG)tickCount.QuadPart / Wheel->SlotTicks;
+}
+
+
+// links IrpEntry to the slot of IrpEntry->TickCount
+VOID
+DokanScheduleTimeout(
+	__in PIRP_LIST	IrpList,
+	__in PIRP_ENTRY	IrpEntry)
+{
+	PDOKAN_TIMEOUT_WHEEL	wheel = IrpList->TimeoutWheel;
+	ULONGLONG				slot;
+
+	ASSERT(wheel != NULL);
+
+	slot = (ULONGLONG)IrpEntry->TickCount.QuadPart / wheel->SlotTicks;
+
+	// deadlines are set from the current tick count, so they are not
+	// before the last sweep, this only keeps the entry where it is visited
+	if (slot < wheel->SweptSlot) {
+		slot = wheel->SweptSlot;
+	}
+
+	RemoveEntryList(&IrpEntry->TimeoutEntry);
+	InsertTailList(&wheel->Slots[slot % DOKAN_TIMEOUT_WHEEL_SLOTS], &IrpEntry->TimeoutEntry);
+}
+
+
+// moves the entries of IrpList whose deadline passed to CompleteList,
+// the entries whose IRP is being canceled are left to the cancel routine
+VOID
+DokanCollectTimeoutIrps(
+	__in PIRP_LIST		IrpList,
+	__in PLIST_ENTRY	CompleteList)
+{
+	KIRQL				oldIrql;
+    PLIST_ENTRY			thisEntry, nextEntry, listHead;
+	PIRP_ENTRY			irpEntry;
+	LARGE_INTEGER		tickCount;
+	PIRP				irp;
+	PDOKAN_TIMEOUT_WHEEL	wheel = IrpList->TimeoutWheel;
+	ULONGLONG			slot;
+	ULONGLONG			nowSlot;
+	ULONGLONG			lastSlot;
+
+	ASSERT(KeGetCurrentIrql() <= DISPATCH_LEVEL);
+	KeAcquireSpinLock(&IrpList->ListLock, &oldIrql);
+
+	KeQueryTickCount(&tickCount);
+	nowSlot = (ULONGLONG)tickCount.QuadPart / wheel->SlotTicks;
+
+	// one turn visits every slot
+	lastSlot = min(nowSlot, wheel->SweptSlot + DOKAN_TIMEOUT_WHEEL_SLOTS - 1);
+
+	for (slot = wheel->SweptSlot; slot <= lastSlot; ++slot) {
+
+		listHead = &wheel->Slots[slot % DOKAN_TIMEOUT_WHEEL_SLOTS];
+
+		for (thisEntry = listHead->Flink;
+			thisEntry != listHead;
+			thisEntry = nextEntry) {
+
+			nextEntry = thisEntry->Flink;
+
+			irpEntry = CONTAINING_RECORD(thisEntry, IRP_ENTRY, TimeoutEntry);
+
+			// this IRP is NOT timeout yet, or waits for a later turn
+			if (tickCount.QuadPart < irpEntry->TickCount.QuadPart) {
+				continue;
+			}
+
+			DokanRemovePendingIrp(irpEntry);
+
+			DDbgPrint(" timeout Irp #%X\n", irpEntry->SerialNumber);
+
+			irp = irpEntry->Irp;
+
+			if (irp == NULL) {
+				// this IRP has already been canceled
+				ASSERT(irpEntry->CancelRoutineFreeMemory == FALSE);
+				DokanFreeIrpEntry(irpEntry);
+				continue;
+			}
+
+			// this IRP is not canceled yet
+			if (IoSetCancelRoutine(irp, NULL) == NULL) {
+				// Cancel routine will run as soon as we release the lock
+				InitializeListHead(&irpEntry->ListEntry);
+				irpEntry->CancelRoutineFreeMemory = TRUE;
+				continue;
+			}
+			// IrpEntry is saved here for CancelRoutine
+			// Clear it to prevent to be completed by CancelRoutine twice
+			irp->Tail.Overlay.DriverContext[DRIVER_CONTEXT_IRP_ENTRY] = NULL;
+			InsertTailList(CompleteList, &irpEntry->ListEntry);
+		}
+	}
+
+	// the current slot is visited again by the next sweep
+	wheel->SweptSlot = nowSlot;
+
+	if (IsListEmpty(&IrpList->ListHead)) {
+		KeClearEvent(&IrpList->NotEmpty);
+	}
+	KeReleaseSpinLock(&IrpList->ListLock, oldIrql);
+}
@@ -0,0 +1,40 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2008 Hiroki Asakawa info@dokan-dev.net
+
+  http://dokan-dev.net/en
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef _PENDINGIRP_H_
+#define _PENDINGIRP_H_
+
+// Pending IRP index and timeout wheel, see pendingirp.c. Included by dokan.h before
+// IRP_LIST, the functions are declared with the other event functions.
+
+#define DOKAN_PENDING_IRP_BUCKETS	128 // per shard, power of 2, see DokanSerialBucket
+#define DOKAN_TIMEOUT_WHEEL_SLOTS	64 // DOKAN_CHECK_INTERVAL each
+
+// pending IRPs by deadline
+typedef struct _DOKAN_TIMEOUT_WHEEL {
+	LIST_ENTRY		Slots[DOKAN_TIMEOUT_WHEEL_SLOTS];
+	// ticks of KeQueryTickCount a slot covers
+	ULONGLONG		SlotTicks;
+	// deadline / SlotTicks of the slot the last sweep ended at
+	ULONGLONG		SweptSlot;
+} DOKAN_TIMEOUT_WHEEL, *PDOKAN_TIMEOUT_WHEEL;
+
+#endif // _PENDINGIRP_H_
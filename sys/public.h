@@ -24,10 +24,16 @@ with this program. If not, see <http://www.gnu.org/licenses/>.
 
 #include "devioctl.h"
 
-#define DOKAN_DRIVER_VERSION	0x0000190
+#define DOKAN_DRIVER_VERSION	0x0000195
 
 #define EVENT_CONTEXT_MAX_SIZE		(1024*32)
 
+// EVENT_START.EventBufferSize is rounded into
+// [EVENT_CONTEXT_MAX_SIZE, EVENT_CONTEXT_MAX_BUFFER_SIZE].
+// Bigger buffers pass bigger writes in the event itself
+// but each waiting IRP holds a system buffer of this size.
+#define EVENT_CONTEXT_MAX_BUFFER_SIZE	(1024*1024*2)
+
 #define IOCTL_TEST \
 	CTL_CODE(FILE_DEVICE_UNKNOWN, 0x800, METHOD_BUFFERED, FILE_ANY_ACCESS)
 
@@ -49,6 +55,12 @@ with this program. If not, see <http://www.gnu.org/licenses/>.
 #define IOCTL_EVENT_WRITE \
 	CTL_CODE(FILE_DEVICE_UNKNOWN, 0x806, METHOD_OUT_DIRECT, FILE_ANY_ACCESS)
 
+#define IOCTL_EVENT_WAIT_BATCH \
+	CTL_CODE(FILE_DEVICE_UNKNOWN, 0x807, METHOD_BUFFERED, FILE_ANY_ACCESS)
+
+#define IOCTL_EVENT_INFO_WAIT \
+	CTL_CODE(FILE_DEVICE_UNKNOWN, 0x808, METHOD_BUFFERED, FILE_ANY_ACCESS)
+
 #define IOCTL_KEEPALIVE \
 	CTL_CODE(FILE_DEVICE_UNKNOWN, 0x809, METHOD_NEITHER, FILE_ANY_ACCESS)
 
@@ -61,6 +73,13 @@ with this program. If not, see <http://www.gnu.org/licenses/>.
 #define IOCTL_GET_ACCESS_TOKEN \
 	CTL_CODE(FILE_DEVICE_UNKNOWN, 0x80C, METHOD_BUFFERED, FILE_ANY_ACCESS)
 
+#define IOCTL_RING_REGISTER \
+	CTL_CODE(FILE_DEVICE_UNKNOWN, 0x80D, METHOD_OUT_DIRECT, FILE_ANY_ACCESS)
+
+// input is the directory name, empty name invalidates all directories
+#define IOCTL_DIR_CACHE_INVALIDATE \
+	CTL_CODE(FILE_DEVICE_UNKNOWN, 0x80E, METHOD_BUFFERED, FILE_ANY_ACCESS)
+
 
 #define DRIVER_FUNC_INSTALL     0x01
 #define DRIVER_FUNC_REMOVE      0x02
@@ -241,6 +260,14 @@ typedef struct _EVENT_CONTEXT {
 #define WRITE_MAX_SIZE				(EVENT_CONTEXT_MAX_SIZE-sizeof(EVENT_CONTEXT)-256*sizeof(WCHAR))
 
 
+// IOCTL_EVENT_WAIT_BATCH and IOCTL_EVENT_INFO_WAIT pack EVENT_CONTEXTs
+// into the output buffer.
+// The first one is at offset 0 and each of the others starts at
+// EVENT_CONTEXT_ALIGN(end of the previous one). EVENT_CONTEXT.Length
+// is the length of each one.
+#define EVENT_CONTEXT_ALIGN(Length)	(((Length) + 7) & ~7)
+
+
 typedef struct _EVENT_INFORMATION {
 	ULONG		SerialNumber;
 	ULONG		Status;
@@ -286,6 +313,8 @@ typedef struct _EVENT_DRIVER_INFO {
 	ULONG	DeviceNumber;
 	ULONG	MountId;
 	WCHAR	DeviceName[64];
+	// size of the buffer the driver fills with events
+	ULONG	EventBufferSize;
 } EVENT_DRIVER_INFO, *PEVENT_DRIVER_INFO;
 
 typedef struct _EVENT_START {
@@ -293,8 +322,68 @@ typedef struct _EVENT_START {
 	ULONG	DeviceType;
 	ULONG	Flags;
 	WCHAR	DriveLetter;
+	// requested size of the event buffer, 0 means EVENT_CONTEXT_MAX_SIZE
+	ULONG	EventBufferSize;
+	// directory listings are served by the driver for this time
+	// in milliseconds, 0 disables the directory cache
+	ULONG	DirCacheTimeout;
 } EVENT_START, *PEVENT_START;
 
+// upper limit of EVENT_START.DirCacheTimeout
+#define DOKAN_DIR_CACHE_MAX_TIMEOUT	(60*1000)
+
+// Request/reply ring shared by the driver and user-mode, see sys/ring.c.
+//
+// IOCTL_RING_REGISTER takes DOKAN_RING_REGISTER as input and the ring
+// memory as output buffer. The IRP stays pending while the ring is used.
+// The ring is DOKAN_RING_HEADER followed by SlotCount slots of SlotSize.
+//
+// Each slot goes FREE -> REQUEST (driver copies an EVENT_CONTEXT and sets
+// RequestEvent) -> BUSY (a user-mode thread took it) -> REPLY (user-mode
+// copies the EVENT_INFORMATION and sets ReplyEvent) -> FREE (driver
+// completed the IRP). A BUSY slot whose reply does not fit is set FREE by
+// user-mode after sending the reply with IOCTL_EVENT_INFO.
+
+#define DOKAN_RING_SLOT_FREE		0
+#define DOKAN_RING_SLOT_REQUEST		1
+#define DOKAN_RING_SLOT_BUSY		2
+#define DOKAN_RING_SLOT_REPLY		3
+
+#define DOKAN_RING_MAX_SLOT_COUNT	256
+// upper limit of DOKAN_RING_LENGTH, the driver locks this memory
+#define DOKAN_RING_MAX_LENGTH		(1024*1024*4)
+
+typedef struct _DOKAN_RING_REGISTER {
+	HANDLE	RequestEvent;
+	HANDLE	ReplyEvent;
+	ULONG	SlotCount;
+	// DOKAN_RING_SLOT header and EVENT_DRIVER_INFO.EventBufferSize
+	ULONG	SlotSize;
+} DOKAN_RING_REGISTER, *PDOKAN_RING_REGISTER;
+
+typedef struct _DOKAN_RING_HEADER {
+	ULONG	SlotCount;
+	ULONG	SlotSize;
+} DOKAN_RING_HEADER, *PDOKAN_RING_HEADER;
+
+typedef struct _DOKAN_RING_SLOT {
+	LONG	State;
+	// length of EVENT_CONTEXT or EVENT_INFORMATION in Data
+	ULONG	Length;
+	ULONG64	Data[1];
+} DOKAN_RING_SLOT, *PDOKAN_RING_SLOT;
+
+#define DOKAN_RING_SLOT_DATA_SIZE(SlotSize) \
+	((SlotSize) - FIELD_OFFSET(DOKAN_RING_SLOT, Data))
+
+#define DOKAN_RING_LENGTH(SlotSize, SlotCount) \
+	(sizeof(DOKAN_RING_HEADER) + (SIZE_T)(SlotSize) * (SlotCount))
+
+#define DOKAN_RING_SLOT_AT(Ring, SlotSize, Index) \
+	((PDOKAN_RING_SLOT)((PCHAR)(Ring) + sizeof(DOKAN_RING_HEADER) + \
+		(SIZE_T)(SlotSize) * (Index)))
+
+
 typedef struct _DOKAN_RENAME_INFORMATION {
 	BOOLEAN ReplaceIfExists;
 	ULONG FileNameLength;
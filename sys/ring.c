@@ -0,0 +1,423 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2008 Hiroki Asakawa info@dokan-dev.net
+
+  http://dokan-dev.net/en
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+
+IOCTL_RING_REGISTER:
+DokanRingRegister
+  # lock the ring memory by METHOD_OUT_DIRECT and keep the IRP pending
+  # reference RequestEvent and ReplyEvent
+
+NotificationThread
+  # waits for ReplyEvent too
+  DokanRingNotify
+    # copy REPLY slots to pool and free the slots
+    # copy events queued in the EventQueue shards to FREE slots
+    # and set RequestEvent
+    CompleteIrpMain
+  DokanDispatchEvents
+    # events which do not fit into the ring go to IOCTL_EVENT_WAIT
+
+IOCTL_EVENT_RELEASE / cancel of IOCTL_RING_REGISTER:
+  # detach the ring and complete the IRP,
+  # events in REQUEST or BUSY slots are released by the timeout
+
+The ring is writable by user-mode, so a reply is copied before it is
+checked and used.
+
+*/
+
+
+#include "dokan.h"
+
+
+typedef struct _RING_REPLY {
+	LIST_ENTRY			ListEntry;
+	EVENT_INFORMATION	EventInfo;
+} RING_REPLY, *PRING_REPLY;
+
+
+// Ring->Lock must be held
+static PIRP
+DetachRing(
+	__in PDOKAN_RING	Ring,
+	__out PKEVENT*		RequestEvent,
+	__out PKEVENT*		ReplyEvent)
+{
+	PIRP irp = Ring->Irp;
+
+	*RequestEvent = Ring->RequestEvent;
+	*ReplyEvent = Ring->ReplyEvent;
+
+	Ring->Irp = NULL;
+	Ring->Base = NULL;
+	Ring->RequestEvent = NULL;
+	Ring->ReplyEvent = NULL;
+
+	return irp;
+}
+
+
+static VOID
+DereferenceRingEvents(
+	__in PKEVENT	RequestEvent,
+	__in PKEVENT	ReplyEvent)
+{
+	if (RequestEvent) {
+		ObDereferenceObject(RequestEvent);
+	}
+	if (ReplyEvent) {
+		ObDereferenceObject(ReplyEvent);
+	}
+}
+
+
+VOID
+DokanRingCancelRoutine(
+	__in PDEVICE_OBJECT	DeviceObject,
+	__in PIRP			Irp)
+{
+	PDokanVCB	vcb = DeviceObject->DeviceExtension;
+	PDOKAN_RING	ring = &vcb->Dcb->Ring;
+	PKEVENT		requestEvent = NULL;
+	PKEVENT		replyEvent = NULL;
+	KIRQL		oldIrql;
+
+	DDbgPrint("==> DokanRingCancelRoutine\n");
+
+	IoReleaseCancelSpinLock(Irp->CancelIrql);
+
+	KeAcquireSpinLock(&ring->Lock, &oldIrql);
+	if (ring->Irp == Irp) {
+		DetachRing(ring, &requestEvent, &replyEvent);
+	}
+	KeReleaseSpinLock(&ring->Lock, oldIrql);
+
+	DereferenceRingEvents(requestEvent, replyEvent);
+
+	Irp->IoStatus.Status = STATUS_CANCELLED;
+	Irp->IoStatus.Information = 0;
+	IoCompleteRequest(Irp, IO_NO_INCREMENT);
+
+	DDbgPrint("<== DokanRingCancelRoutine\n");
+}
+
+
+NTSTATUS
+DokanRingRegister(
+	__in PDEVICE_OBJECT DeviceObject,
+	__in PIRP Irp)
+{
+	PDokanVCB			vcb = DeviceObject->DeviceExtension;
+	PDokanDCB			dcb;
+	PDOKAN_RING			ring;
+	PIO_STACK_LOCATION	irpSp;
+	DOKAN_RING_REGISTER	ringRegister;
+	PDOKAN_RING_HEADER	header;
+	PKEVENT				requestEvent = NULL;
+	PKEVENT				replyEvent = NULL;
+	SIZE_T				length;
+	KIRQL				oldIrql;
+	NTSTATUS			status;
+
+	DDbgPrint("==> DokanRingRegister\n");
+
+	if (GetIdentifierType(vcb) != VCB) {
+		return STATUS_INVALID_PARAMETER;
+	}
+	dcb = vcb->Dcb;
+	ring = &dcb->Ring;
+
+	irpSp = IoGetCurrentIrpStackLocation(Irp);
+
+	if (irpSp->Parameters.DeviceIoControl.InputBufferLength < sizeof(DOKAN_RING_REGISTER)) {
+		return STATUS_INVALID_PARAMETER;
+	}
+	RtlCopyMemory(&ringRegister, Irp->AssociatedIrp.SystemBuffer, sizeof(DOKAN_RING_REGISTER));
+
+	// a slot holds any event which IOCTL_EVENT_WAIT would pass
+	if (ringRegister.SlotCount == 0 ||
+		ringRegister.SlotCount > DOKAN_RING_MAX_SLOT_COUNT ||
+		ringRegister.SlotSize != FIELD_OFFSET(DOKAN_RING_SLOT, Data) + dcb->EventBufferSize ||
+		DOKAN_RING_LENGTH(ringRegister.SlotSize, ringRegister.SlotCount) > DOKAN_RING_MAX_LENGTH) {
+		DDbgPrint("  invalid ring %d x %d\n", ringRegister.SlotCount, ringRegister.SlotSize);
+		return STATUS_INVALID_PARAMETER;
+	}
+
+	length = DOKAN_RING_LENGTH(ringRegister.SlotSize, ringRegister.SlotCount);
+	if (Irp->MdlAddress == NULL ||
+		irpSp->Parameters.DeviceIoControl.OutputBufferLength < length) {
+		return STATUS_BUFFER_TOO_SMALL;
+	}
+
+	header = MmGetSystemAddressForMdlSafe(Irp->MdlAddress, NormalPagePriority);
+	if (header == NULL) {
+		return STATUS_INSUFFICIENT_RESOURCES;
+	}
+
+	status = ObReferenceObjectByHandle(ringRegister.RequestEvent, EVENT_MODIFY_STATE,
+				*ExEventObjectType, UserMode, (PVOID*)&requestEvent, NULL);
+	if (!NT_SUCCESS(status)) {
+		return status;
+	}
+	status = ObReferenceObjectByHandle(ringRegister.ReplyEvent, SYNCHRONIZE,
+				*ExEventObjectType, UserMode, (PVOID*)&replyEvent, NULL);
+	if (!NT_SUCCESS(status)) {
+		ObDereferenceObject(requestEvent);
+		return status;
+	}
+
+	RtlZeroMemory(header, length);
+	header->SlotCount = ringRegister.SlotCount;
+	header->SlotSize = ringRegister.SlotSize;
+
+	KeAcquireSpinLock(&ring->Lock, &oldIrql);
+
+	if (ring->Irp != NULL || !dcb->Mounted) {
+		KeReleaseSpinLock(&ring->Lock, oldIrql);
+		DereferenceRingEvents(requestEvent, replyEvent);
+		DDbgPrint("  ring is already registered\n");
+		return STATUS_DEVICE_BUSY;
+	}
+
+	ring->Irp = Irp;
+	ring->Base = header;
+	ring->SlotCount = ringRegister.SlotCount;
+	ring->SlotSize = ringRegister.SlotSize;
+	ring->NextSlot = 0;
+	ring->RequestEvent = requestEvent;
+	ring->ReplyEvent = replyEvent;
+
+	IoMarkIrpPending(Irp);
+	IoSetCancelRoutine(Irp, DokanRingCancelRoutine);
+
+	if (Irp->Cancel && IoSetCancelRoutine(Irp, NULL) != NULL) {
+		DetachRing(ring, &requestEvent, &replyEvent);
+		KeReleaseSpinLock(&ring->Lock, oldIrql);
+		DereferenceRingEvents(requestEvent, replyEvent);
+
+		Irp->IoStatus.Status = STATUS_CANCELLED;
+		Irp->IoStatus.Information = 0;
+		IoCompleteRequest(Irp, IO_NO_INCREMENT);
+		return STATUS_PENDING;
+	}
+
+	KeReleaseSpinLock(&ring->Lock, oldIrql);
+
+	// NotificationThread starts to wait for ReplyEvent
+	KeSetEvent(&dcb->EventQueue.EventQueued, IO_NO_INCREMENT, FALSE);
+
+	DDbgPrint("<== DokanRingRegister %d x %d\n", ring->SlotCount, ring->SlotSize);
+	return STATUS_PENDING;
+}
+
+
+VOID
+DokanRingRelease(
+	__in PDokanDCB	Dcb)
+{
+	PDOKAN_RING	ring = &Dcb->Ring;
+	PKEVENT		requestEvent = NULL;
+	PKEVENT		replyEvent = NULL;
+	PIRP		irp;
+	KIRQL		oldIrql;
+
+	KeAcquireSpinLock(&ring->Lock, &oldIrql);
+
+	irp = ring->Irp;
+	if (irp != NULL && IoSetCancelRoutine(irp, NULL) == NULL) {
+		// the cancel routine detaches it
+		irp = NULL;
+	}
+	if (irp != NULL) {
+		DetachRing(ring, &requestEvent, &replyEvent);
+	}
+
+	KeReleaseSpinLock(&ring->Lock, oldIrql);
+
+	DereferenceRingEvents(requestEvent, replyEvent);
+
+	if (irp != NULL) {
+		DDbgPrint("  DokanRingRelease\n");
+		irp->IoStatus.Status = STATUS_SUCCESS;
+		irp->IoStatus.Information = 0;
+		IoCompleteRequest(irp, IO_NO_INCREMENT);
+	}
+}
+
+
+// returns referenced ReplyEvent or NULL when no ring is registered
+PKEVENT
+DokanRingReferenceReplyEvent(
+	__in PDokanDCB	Dcb)
+{
+	PDOKAN_RING	ring = &Dcb->Ring;
+	PKEVENT		replyEvent;
+	KIRQL		oldIrql;
+
+	KeAcquireSpinLock(&ring->Lock, &oldIrql);
+	replyEvent = ring->ReplyEvent;
+	if (replyEvent) {
+		ObReferenceObject(replyEvent);
+	}
+	KeReleaseSpinLock(&ring->Lock, oldIrql);
+
+	return replyEvent;
+}
+
+
+// Ring->Lock must be held
+static VOID
+TakeReplies(
+	__in PDOKAN_RING	Ring,
+	__in PLIST_ENTRY	ReplyList)
+{
+	PDOKAN_RING_SLOT	slot;
+	PRING_REPLY			reply;
+	ULONG				length;
+	ULONG				i;
+
+	for (i = 0; i < Ring->SlotCount; ++i) {
+		slot = DOKAN_RING_SLOT_AT(Ring->Base, Ring->SlotSize, i);
+		if (slot->State != DOKAN_RING_SLOT_REPLY) {
+			continue;
+		}
+
+		length = slot->Length;
+		if (length < FIELD_OFFSET(EVENT_INFORMATION, Buffer) ||
+			length > DOKAN_RING_SLOT_DATA_SIZE(Ring->SlotSize)) {
+			DDbgPrint("  invalid reply length %d\n", length);
+			InterlockedExchange(&slot->State, DOKAN_RING_SLOT_FREE);
+			continue;
+		}
+
+		reply = ExAllocatePool(FIELD_OFFSET(RING_REPLY, EventInfo) +
+					max(length, sizeof(EVENT_INFORMATION)));
+		if (reply == NULL) {
+			// try again on the next ReplyEvent
+			break;
+		}
+		RtlZeroMemory(&reply->EventInfo, sizeof(EVENT_INFORMATION));
+		RtlCopyMemory(&reply->EventInfo, slot->Data, length);
+		InterlockedExchange(&slot->State, DOKAN_RING_SLOT_FREE);
+
+		if (reply->EventInfo.BufferLength >
+			length - FIELD_OFFSET(EVENT_INFORMATION, Buffer)) {
+			DDbgPrint("  invalid reply BufferLength %d\n", reply->EventInfo.BufferLength);
+			ExFreePool(reply);
+			continue;
+		}
+		InsertTailList(ReplyList, &reply->ListEntry);
+	}
+}
+
+
+// Ring->Lock must be held, returns the number of slots filled
+static ULONG
+PutEvents(
+	__in PDOKAN_RING		Ring,
+	__in PDOKAN_EVENT_SHARD	Shard)
+{
+	PDRIVER_EVENT_CONTEXT	driverEventContext;
+	PDOKAN_RING_SLOT		slot;
+	PLIST_ENTRY				listHead;
+	ULONG					eventLen;
+	ULONG					filled = 0;
+	ULONG					i;
+
+	KeAcquireSpinLockAtDpcLevel(&Shard->PendingEvent.ListLock);
+
+	for (i = 0; i < Ring->SlotCount && !IsListEmpty(&Shard->NotifyEvent); ++i) {
+
+		slot = DOKAN_RING_SLOT_AT(Ring->Base, Ring->SlotSize, Ring->NextSlot);
+		if (slot->State != DOKAN_RING_SLOT_FREE) {
+			Ring->NextSlot = (Ring->NextSlot + 1) % Ring->SlotCount;
+			continue;
+		}
+
+		listHead = Shard->NotifyEvent.Flink;
+		driverEventContext = CONTAINING_RECORD(listHead, DRIVER_EVENT_CONTEXT, ListEntry);
+		eventLen = driverEventContext->EventContext.Length;
+
+		if (eventLen > DOKAN_RING_SLOT_DATA_SIZE(Ring->SlotSize)) {
+			// left to IOCTL_EVENT_WAIT
+			break;
+		}
+		RemoveEntryList(listHead);
+
+		RtlCopyMemory(slot->Data, &driverEventContext->EventContext, eventLen);
+		slot->Length = eventLen;
+		InterlockedExchange(&slot->State, DOKAN_RING_SLOT_REQUEST);
+		filled++;
+
+		if (driverEventContext->Completed) {
+			KeSetEvent(driverEventContext->Completed, IO_NO_INCREMENT, FALSE);
+		}
+		ExFreePool(driverEventContext);
+
+		Ring->NextSlot = (Ring->NextSlot + 1) % Ring->SlotCount;
+	}
+
+	KeReleaseSpinLockFromDpcLevel(&Shard->PendingEvent.ListLock);
+
+	return filled;
+}
+
+
+VOID
+DokanRingNotify(
+	__in PDokanDCB	Dcb)
+{
+	PDOKAN_RING	ring = &Dcb->Ring;
+	LIST_ENTRY	replyList;
+	PLIST_ENTRY	listHead;
+	PRING_REPLY	reply;
+	KIRQL		oldIrql;
+	ULONG		filled = 0;
+	ULONG		i;
+
+	InitializeListHead(&replyList);
+
+	KeAcquireSpinLock(&ring->Lock, &oldIrql);
+
+	if (ring->Irp == NULL) {
+		KeReleaseSpinLock(&ring->Lock, oldIrql);
+		return;
+	}
+
+	TakeReplies(ring, &replyList);
+
+	for (i = 0; i < DOKAN_EVENT_SHARDS; ++i) {
+		filled += PutEvents(ring, &Dcb->EventQueue.Shards[i]);
+	}
+	if (filled > 0) {
+		InterlockedExchangeAdd(&Dcb->EventQueue.QueuedEventCount, -(LONG)filled);
+		KeSetEvent(ring->RequestEvent, IO_NO_INCREMENT, FALSE);
+	}
+
+	KeReleaseSpinLock(&ring->Lock, oldIrql);
+
+	while (!IsListEmpty(&replyList)) {
+		listHead = RemoveHeadList(&replyList);
+		reply = CONTAINING_RECORD(listHead, RING_REPLY, ListEntry);
+		CompleteIrpMain(Dcb->Vcb, &reply->EventInfo);
+		ExFreePool(reply);
+	}
+}
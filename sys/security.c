@@ -289,10 +289,10 @@ DokanDispatchSetSecurity(
 
 		eventLength = sizeof(EVENT_CONTEXT) + securityDescLength + fcb->FileName.Length;
 
-		if (EVENT_CONTEXT_MAX_SIZE < eventLength) {
+		if (vcb->Dcb->EventBufferSize < eventLength) {
 			// TODO: Handle this case like DispatchWrite.
 			DDbgPrint("    SecurityDescriptor is too big: %d (limit %d)\n",
-					eventLength, EVENT_CONTEXT_MAX_SIZE);
+					eventLength, vcb->Dcb->EventBufferSize);
 			status = STATUS_INSUFFICIENT_RESOURCES;
 			__leave;
 		}
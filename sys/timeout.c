@@ -123,74 +123,18 @@ ReleaseTimeoutPendingIrp(
    __in PDokanDCB	Dcb
    )
 {
-	KIRQL				oldIrql;
-    PLIST_ENTRY			thisEntry, nextEntry, listHead;
+	PLIST_ENTRY			listHead;
 	PIRP_ENTRY			irpEntry;
-	LARGE_INTEGER		tickCount;
 	LIST_ENTRY			completeList;
 	PIRP				irp;
+	ULONG				i;
 
 	DDbgPrint("==> ReleaseTimeoutPendingIRP\n");
 	InitializeListHead(&completeList);
 
-	ASSERT(KeGetCurrentIrql() <= DISPATCH_LEVEL);
-	KeAcquireSpinLock(&Dcb->PendingIrp.ListLock, &oldIrql);
-
-	// when IRP queue is empty, there is nothing to do
-	if (IsListEmpty(&Dcb->PendingIrp.ListHead)) {
-		KeReleaseSpinLock(&Dcb->PendingIrp.ListLock, oldIrql);
-		DDbgPrint("  IrpQueue is Empty\n");
-		return STATUS_SUCCESS;
-	}
-
-	KeQueryTickCount(&tickCount);
-
-	// search timeout IRP through pending IRP list
-	listHead = &Dcb->PendingIrp.ListHead;
-
-    for (thisEntry = listHead->Flink;
-		thisEntry != listHead;
-		thisEntry = nextEntry) {
-
-        nextEntry = thisEntry->Flink;
-
-        irpEntry = CONTAINING_RECORD(thisEntry, IRP_ENTRY, ListEntry);
-
-		// this IRP is NOT timeout yet
-		if (tickCount.QuadPart < irpEntry->TickCount.QuadPart) {
-			break;
-		}
-
-		RemoveEntryList(thisEntry);
-
-		DDbgPrint(" timeout Irp #%X\n", irpEntry->SerialNumber);
-
-		irp = irpEntry->Irp;
-
-		if (irp == NULL) {
-			// this IRP has already been canceled
-			ASSERT(irpEntry->CancelRoutineFreeMemory == FALSE);
-			DokanFreeIrpEntry(irpEntry);
-			continue;
-		}
-
-		// this IRP is not canceled yet
-		if (IoSetCancelRoutine(irp, NULL) == NULL) {
-			// Cancel routine will run as soon as we release the lock
-			InitializeListHead(&irpEntry->ListEntry);
-			irpEntry->CancelRoutineFreeMemory = TRUE;
-			continue;
-		}
-		// IrpEntry is saved here for CancelRoutine
-		// Clear it to prevent to be completed by CancelRoutine twice
-		irp->Tail.Overlay.DriverContext[DRIVER_CONTEXT_IRP_ENTRY] = NULL;
-		InsertTailList(&completeList, &irpEntry->ListEntry);
-	}
-
-	if (IsListEmpty(&Dcb->PendingIrp.ListHead)) {
-		KeClearEvent(&Dcb->PendingIrp.NotEmpty);
+	for (i = 0; i < DOKAN_PENDING_IRP_SHARDS; ++i) {
+		DokanCollectTimeoutIrps(&Dcb->PendingIrp[i], &completeList);
 	}
-	KeReleaseSpinLock(&Dcb->PendingIrp.ListLock, oldIrql);
 	
 	while (!IsListEmpty(&completeList)) {
 		listHead = RemoveHeadList(&completeList);
@@ -214,11 +158,11 @@ DokanResetPendingIrpTimeout(
    )
 {
 	KIRQL				oldIrql;
-    PLIST_ENTRY			thisEntry, nextEntry, listHead;
 	PIRP_ENTRY			irpEntry;
 	PDokanVCB			vcb;
 	PEVENT_INFORMATION	eventInfo;
 	ULONG				timeout; // in milisecond
+	PIRP_LIST			pendingIrp;
 
 
 	DDbgPrint("==> ResetPendingIrpTimeout\n");
@@ -235,29 +179,18 @@ DokanResetPendingIrpTimeout(
 	if (GetIdentifierType(vcb) != VCB) {
 		return STATUS_INVALID_PARAMETER;
 	}
+	pendingIrp = DokanPendingIrpList(vcb->Dcb, eventInfo->SerialNumber);
+
 	ASSERT(KeGetCurrentIrql() <= DISPATCH_LEVEL);
-	KeAcquireSpinLock(&vcb->Dcb->PendingIrp.ListLock, &oldIrql);
+	KeAcquireSpinLock(&pendingIrp->ListLock, &oldIrql);
 
 	// search corresponding IRP through pending IRP list
-	listHead = &vcb->Dcb->PendingIrp.ListHead;
-
-    for (thisEntry = listHead->Flink; thisEntry != listHead; thisEntry = nextEntry) {
-
-		PIRP				irp;
-		PIO_STACK_LOCATION	irpSp;
-
-        nextEntry = thisEntry->Flink;
-
-        irpEntry = CONTAINING_RECORD(thisEntry, IRP_ENTRY, ListEntry);
-
-		if (irpEntry->SerialNumber != eventInfo->SerialNumber)  {
-			continue;
-		}
-
+	irpEntry = DokanFindPendingIrp(pendingIrp, eventInfo->SerialNumber);
+	if (irpEntry != NULL) {
 		DokanUpdateTimeout(&irpEntry->TickCount, timeout);
-		break;
+		DokanScheduleTimeout(pendingIrp, irpEntry);
 	}
-	KeReleaseSpinLock(&vcb->Dcb->PendingIrp.ListLock, oldIrql);
+	KeReleaseSpinLock(&pendingIrp->ListLock, oldIrql);
 	DDbgPrint("<== ResetPendingIrpTimeout\n");
 	return STATUS_SUCCESS;
 }
@@ -165,7 +165,7 @@ DokanDispatchWrite(
 		
 		// When eventlength is less than event notification buffer,
 		// returns it to user-mode using pending event.
-		if (eventLength <= EVENT_CONTEXT_MAX_SIZE) {
+		if (eventLength <= vcb->Dcb->EventBufferSize) {
 
 			DDbgPrint("   Offset %d:%d, Length %d\n",
 				irpSp->Parameters.Write.ByteOffset.HighPart,
@@ -277,6 +277,11 @@ DokanCompleteWrite(
 			fileObject->CurrentByteOffset.QuadPart);
 	}
 
+	if (NT_SUCCESS(status) && EventInfo->BufferLength != 0) {
+		// the directory listing of the parent is invalidated at cleanup
+		fileObject->Flags |= FO_FILE_MODIFIED;
+	}
+
 	IoCompleteRequest(irp, IO_NO_INCREMENT);
 
 	DokanPrintNTStatus(status);